@@ -84,6 +84,9 @@ void bfd_session_free(bfd_session *bs);
 bfd_session *bfd_session_new(int sd);
 bfd_session *bfd_find_disc(struct sockaddr_any *sa, uint32_t ldisc);
 int bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc);
+int bfd_peer_socket(struct bfd_peer_cfg *bpc);
+void bfd_session_install(bfd_session *bfd, struct bfd_peer_cfg *bpc);
+int bfd_bulk_validate(struct bfd_peer_cfg *bpc);
 
 
 /*
@@ -108,6 +111,136 @@ bfd_session *bs_session_find(uint32_t discr)
 	return bs;
 }
 
+/* Returns the position of the first index entry not below `discr`. */
+static size_t bs_index_find(uint32_t discr)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = bglobal.bg_bsindexlen;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (bglobal.bg_bsindex[mid].bie_discr < discr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Makes room for `count` more sessions so inserting them into the index
+ * can't fail later.
+ */
+static int bs_index_reserve(size_t count)
+{
+	struct bs_index_entry *bsindex;
+	size_t size;
+
+	if (bglobal.bg_bsindexlen + count <= bglobal.bg_bsindexsize)
+		return 0;
+
+	size = bglobal.bg_bsindexsize ? bglobal.bg_bsindexsize : 64;
+	while (size < bglobal.bg_bsindexlen + count)
+		size *= 2;
+
+	bsindex = realloc(bglobal.bg_bsindex, size * sizeof(*bsindex));
+	if (bsindex == NULL) {
+		log_warning("%s: realloc: %s\n", __FUNCTION__,
+			    strerror(errno));
+		return -1;
+	}
+
+	bglobal.bg_bsindex = bsindex;
+	bglobal.bg_bsindexsize = size;
+
+	return 0;
+}
+
+/*
+ * Inserts the session in its position. Discriminators are mostly
+ * allocated in ascending order, so this is usually an append.
+ */
+static void bs_index_add(bfd_session *bs)
+{
+	struct bs_index_entry *bie;
+	size_t pos;
+
+	pos = bs_index_find(bs->discrs.my_discr);
+	bie = &bglobal.bg_bsindex[pos];
+
+	/* Reuse the hole left by a removed session. */
+	if (pos < bglobal.bg_bsindexlen
+	    && bie->bie_discr == bs->discrs.my_discr) {
+		bie->bie_bs = bs;
+		bglobal.bg_bsindexholes--;
+		return;
+	}
+
+	memmove(bie + 1, bie, (bglobal.bg_bsindexlen - pos) * sizeof(*bie));
+	bie->bie_discr = bs->discrs.my_discr;
+	bie->bie_bs = bs;
+	bglobal.bg_bsindexlen++;
+}
+
+static void bs_index_del(bfd_session *bs)
+{
+	struct bs_index_entry *bsindex = bglobal.bg_bsindex;
+	size_t pos, idx;
+
+	pos = bs_index_find(bs->discrs.my_discr);
+	if (pos == bglobal.bg_bsindexlen || bsindex[pos].bie_bs != bs)
+		return;
+
+	bsindex[pos].bie_bs = NULL;
+	bglobal.bg_bsindexholes++;
+	if (bglobal.bg_bsindexholes * 2 <= bglobal.bg_bsindexlen)
+		return;
+
+	/* Compact the index: the order is kept, no sorting needed. */
+	for (pos = 0, idx = 0; idx < bglobal.bg_bsindexlen; idx++) {
+		if (bsindex[idx].bie_bs != NULL)
+			bsindex[pos++] = bsindex[idx];
+	}
+	bglobal.bg_bsindexlen = pos;
+	bglobal.bg_bsindexholes = 0;
+}
+
+/*
+ * Calls `h` for the sessions with local discriminator greater than
+ * `discr` in ascending order until it returns non-zero. The handler must
+ * not add or remove sessions.
+ */
+int bs_foreach_discr(uint32_t discr, bs_handle h, void *arg)
+{
+	size_t pos;
+
+	if (discr == UINT32_MAX)
+		return 0;
+
+	for (pos = bs_index_find(discr + 1); pos < bglobal.bg_bsindexlen;
+	     pos++) {
+		if (bglobal.bg_bsindex[pos].bie_bs == NULL)
+			continue;
+		if (h(bglobal.bg_bsindex[pos].bie_bs, arg) != 0)
+			break;
+	}
+
+	return 0;
+}
+
+/* Changes the session state keeping the daemon totals up to date. */
+void bs_state_set(bfd_session *bs, uint8_t state)
+{
+	if (bs->ses_state <= PTM_BFD_UP)
+		bglobal.bg_msessions[bs->ses_state]--;
+	if (state <= PTM_BFD_UP)
+		bglobal.bg_msessions[state]++;
+
+	bs->ses_state = state;
+}
+
 int ptm_bfd_fetch_ifindex(const char *ifname)
 {
 	struct ifreq ifr;
@@ -166,6 +299,12 @@ void fetch_portname_from_ifindex(int ifindex, char *ifname, size_t ifnamelen)
 uint32_t ptm_bfd_gen_ID(void)
 {
 	static uint32_t sessionID = 1;
+
+	/* Skip the discriminators in use or waiting for a warm restart. */
+	while (sessionID == 0 || bs_session_find(sessionID) != NULL
+	       || bfd_state_reserved(sessionID))
+		sessionID++;
+
 	return (sessionID++);
 }
 
@@ -183,7 +322,7 @@ void ptm_bfd_start_xmt_timer(bfd_session *bfd, bool is_echo)
 	 * be
 	 * between 75% and 90%.
 	 */
-	maxpercent = (bfd->detect_mult == 1) ? 16 : 26;
+	maxpercent = (bfd->profile->bp_detectmultiplier == 1) ? 16 : 26;
 	jitter = (xmt_TO * (75 + (random() % maxpercent))) / 100;
 	/* XXX remove that division above */
 
@@ -198,7 +337,6 @@ void ptm_bfd_echo_xmt_TO(bfd_session *bfd)
 	/* Send the scheduled echo  packet */
 	ptm_bfd_echo_snd(bfd);
 
-        gettimeofday(&bfd->xmit_tv, NULL);
 	/* Restart the timer for next time */
 	ptm_bfd_start_xmt_timer(bfd, true);
 }
@@ -208,7 +346,6 @@ void ptm_bfd_xmt_TO(bfd_session *bfd, int fbit)
 	/* Send the scheduled control packet */
 	ptm_bfd_snd(bfd, fbit);
 
-        gettimeofday(&bfd->xmit_tv, NULL);
 	/* Restart the timer for next time */
 	ptm_bfd_start_xmt_timer(bfd, false);
 }
@@ -224,7 +361,8 @@ void ptm_bfd_echo_stop(bfd_session *bfd, int polling)
 
 	if (polling) {
 		bfd->polling = polling;
-		bfd->new_timers.desired_min_tx = bfd->up_min_tx;
+		bfd->new_timers.desired_min_tx =
+			bfd->profile->bp_txinterval * 1000;
 		bfd->new_timers.required_min_rx = bfd->timers.required_min_rx;
 		ptm_bfd_snd(bfd, 0);
 	}
@@ -232,11 +370,15 @@ void ptm_bfd_echo_stop(bfd_session *bfd, int polling)
 
 void ptm_bfd_echo_start(bfd_session *bfd)
 {
+	/* Started with the socket (see bfd_socket_setup()). */
+	if (bfd->sock_pending)
+		return;
+
 	bfd->echo_detect_TO = (bfd->remote_detect_mult * bfd->echo_xmt_TO);
 	ptm_bfd_echo_xmt_TO(bfd);
 
 	bfd->polling = 1;
-	bfd->new_timers.desired_min_tx = bfd->up_min_tx;
+	bfd->new_timers.desired_min_tx = bfd->profile->bp_txinterval * 1000;
 	bfd->new_timers.required_min_rx = bfd->timers.required_min_rx;
 	ptm_bfd_snd(bfd, 0);
 }
@@ -244,7 +386,7 @@ void ptm_bfd_echo_start(bfd_session *bfd)
 void ptm_bfd_ses_up(bfd_session *bfd)
 {
 	bfd->local_diag = 0;
-	bfd->ses_state = PTM_BFD_UP;
+	bs_state_set(bfd, PTM_BFD_UP);
 	bfd->polling = 1;
 	get_monotime(&bfd->uptime);
 
@@ -252,11 +394,14 @@ void ptm_bfd_ses_up(bfd_session *bfd)
 	if (bfd->echo_xmt_TO && !BFD_CHECK_FLAG(bfd->flags, BFD_SESS_FLAG_MH)) {
 		ptm_bfd_echo_start(bfd);
 	} else {
-		bfd->new_timers.desired_min_tx = bfd->up_min_tx;
+		bfd->new_timers.desired_min_tx =
+			bfd->profile->bp_txinterval * 1000;
 		bfd->new_timers.required_min_rx = bfd->timers.required_min_rx;
 		ptm_bfd_snd(bfd, 0);
 	}
 
+	bfd_shm_update(bfd);
+	bfd_state_update(bfd);
 	control_notify(bfd);
 
 	INFOLOG("Session 0x%x up peer %s", bfd->discrs.my_discr,
@@ -269,12 +414,17 @@ void ptm_bfd_ses_dn(bfd_session *bfd, uint8_t diag)
 
 	bfd->local_diag = diag;
 	bfd->discrs.remote_discr = 0;
-	bfd->ses_state = PTM_BFD_DOWN;
+	bs_state_set(bfd, PTM_BFD_DOWN);
+	/* Keep the receive interval of an unfinished poll sequence. */
+	if (bfd->polling && bfd->new_timers.required_min_rx)
+		bfd->timers.required_min_rx = bfd->new_timers.required_min_rx;
 	bfd->polling = 0;
 	bfd->demand_mode = 0;
 	get_monotime(&bfd->downtime);
 
 	ptm_bfd_snd(bfd, 0);
+	bfd_shm_update(bfd);
+	bfd_state_update(bfd);
 
 	/* only signal clients when going from up->down state */
 	if (old_state == PTM_BFD_UP)
@@ -605,65 +755,136 @@ void bfd_echo_recvtimer_cb(evutil_socket_t sd __attribute__((unused)),
 	}
 }
 
+static uint16_t bs_source_port(int sd)
+{
+	struct sockaddr_any sa;
+	socklen_t salen = sizeof(sa);
+
+	memset(&sa, 0, sizeof(sa));
+	if (getsockname(sd, (struct sockaddr *)&sa, &salen) == -1)
+		return 0;
+
+	return ntohs(sa.sa_sin.sin_family == AF_INET6 ? sa.sa_sin6.sin6_port
+						      : sa.sa_sin.sin_port);
+}
+
 bfd_session *bfd_session_new(int sd)
 {
+	struct bfd_profile bpt;
 	bfd_session *bs;
 
 	bs = calloc(1, sizeof(*bs));
 	if (bs == NULL)
 		return NULL;
 
-	bs->up_min_tx = BFD_DEFDESIREDMINTX;
+	profile_set_defaults(&bpt);
+	bs->profile = profile_unnamed(&bpt);
+	if (bs->profile == NULL) {
+		free(bs);
+		return NULL;
+	}
+	bs->profile->bp_refcount++;
+
 	bs->timers.required_min_rx = BFD_DEFREQUIREDMINRX;
 	bs->timers.required_min_echo = BFD_DEF_REQ_MIN_ECHO;
-	bs->detect_mult = BFD_DEFDETECTMULT;
 	bs->mh_ttl = BFD_DEF_MHOP_TTL;
 
-	bfd_recvtimer_assign(bs, bfd_recvtimer_cb, sd);
-	bfd_echo_recvtimer_assign(bs, bfd_echo_recvtimer_cb, sd);
+	bfd_recvtimer_assign(bs, bfd_recvtimer_cb);
+	bfd_echo_recvtimer_assign(bs, bfd_echo_recvtimer_cb);
 	bfd_xmttimer_assign(bs, bfd_xmt_cb);
 	bfd_echo_xmttimer_assign(bs, bfd_echo_xmt_cb);
 
+	TAILQ_INIT(&bs->notify_list);
+
 	bs->sock = sd;
+	bs->src_port = bs_source_port(sd);
 	get_monotime(&bs->uptime);
 	bs->downtime = bs->uptime;
 
 	return bs;
 }
 
-static void _bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc)
+/*
+ * Returns the profile holding the `bpc` parameters: the named one or
+ * the unnamed one with the session parameters `bpc` doesn't change.
+ */
+static struct bfd_profile *bfd_session_profile(bfd_session *bs,
+					       struct bfd_peer_cfg *bpc)
+{
+	struct bfd_profile bpt;
+
+	/* The profile parameters were copied by profile_to_bpc(). */
+	if (bpc->bpc_has_profile)
+		return profile_find(bpc->bpc_profile);
+
+	memset(&bpt, 0, sizeof(bpt));
+	profile_set(&bpt, bs->profile);
+	if (bpc->bpc_has_detectmultiplier)
+		bpt.bp_detectmultiplier = bpc->bpc_detectmultiplier;
+	if (bpc->bpc_has_recvinterval)
+		bpt.bp_recvinterval = bpc->bpc_recvinterval;
+	if (bpc->bpc_has_txinterval)
+		bpt.bp_txinterval = bpc->bpc_txinterval;
+	if (bpc->bpc_has_echointerval)
+		bpt.bp_echointerval = bpc->bpc_echointerval;
+	bpt.bp_echo = bpc->bpc_echo;
+	bpt.bp_track_sla = bpc->bpc_track_sla;
+
+	return profile_unnamed(&bpt);
+}
+
+static int _bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc)
 {
-	if (bpc->bpc_echo) {
-		BFD_SET_FLAG(bs->flags, BFD_SESS_FLAG_ECHO);
+	struct bfd_profile *bp, *obp = bs->profile;
+	uint32_t desired_min_tx, required_min_rx;
+
+	bp = bfd_session_profile(bs, bpc);
+	if (bp == NULL)
+		return -1;
+
+	bp->bp_refcount++;
+	bs->profile = bp;
+
+	if (bp->bp_echo) {
 		ptm_bfd_echo_start(bs);
 
 		/* Activate/update echo receive timeout timer. */
 		bfd_echo_recvtimer_update(bs);
 	} else {
-		BFD_UNSET_FLAG(bs->flags, BFD_SESS_FLAG_ECHO);
 		ptm_bfd_echo_stop(bs, 0);
 	}
 
-        if (bpc->bpc_track_sla){
-		BFD_SET_FLAG(bs->flags, BFD_SESS_FLAG_TRACK_SLA);
-        } else {
-		BFD_UNSET_FLAG(bs->flags, BFD_SESS_FLAG_TRACK_SLA);
-        }
-
-	if (bpc->bpc_has_txinterval) {
-		bs->up_min_tx = bpc->bpc_txinterval * 1000;
-	}
+	if (bp->bp_track_sla && !obp->bp_track_sla)
+		bfd_sla_start(bs);
+	else if (!bp->bp_track_sla && obp->bp_track_sla)
+		bfd_sla_stop(bs);
 
-	if (bpc->bpc_has_recvinterval) {
-		bs->timers.required_min_rx = bpc->bpc_recvinterval * 1000;
+	/*
+	 * Up sessions negotiate the new intervals with a poll sequence:
+	 * they take effect when the peer answers with the final bit. The
+	 * intervals are compared with the ones being advertised, because a
+	 * replaced profile doesn't keep the old ones.
+	 */
+	desired_min_tx = bs->timers.desired_min_tx;
+	required_min_rx = bs->timers.required_min_rx;
+	if (bs->polling && bs->new_timers.required_min_rx) {
+		desired_min_tx = bs->new_timers.desired_min_tx;
+		required_min_rx = bs->new_timers.required_min_rx;
 	}
 
-	if (bpc->bpc_has_detectmultiplier) {
-		bs->detect_mult = bpc->bpc_detectmultiplier;
+	if (bs->ses_state == PTM_BFD_UP
+	    && (desired_min_tx != bp->bp_txinterval * 1000
+		|| required_min_rx != bp->bp_recvinterval * 1000)) {
+		bs->polling = 1;
+		bs->new_timers.desired_min_tx = bp->bp_txinterval * 1000;
+		bs->new_timers.required_min_rx = bp->bp_recvinterval * 1000;
+		ptm_bfd_snd(bs, 0);
+	} else if (bs->ses_state != PTM_BFD_UP) {
+		bs->timers.required_min_rx = bp->bp_recvinterval * 1000;
 	}
 
-	if (bpc->bpc_has_echointerval)
-		bs->timers.required_min_echo = bpc->bpc_echointerval * 1000;
+	bs->timers.required_min_echo = bp->bp_echointerval * 1000;
+	profile_unref(obp);
 
 	if (bpc->bpc_has_label) {
 		do {
@@ -689,8 +910,7 @@ static void _bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc)
 			if (pl_find(bpc->bpc_label) != NULL)
 				break;
 
-			strxcpy(bs->pl->pl_label, bpc->bpc_label,
-				sizeof(bs->pl->pl_label));
+			pl_rename(bs->pl, bpc->bpc_label);
 		} while (0);
 	}
 
@@ -704,15 +924,17 @@ static void _bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc)
 		bfd_echo_xmttimer_delete(bs);
 
 		/* Change and notify state change. */
-		bs->ses_state = PTM_BFD_ADM_DOWN;
+		bs_state_set(bs, PTM_BFD_ADM_DOWN);
 		control_notify(bs);
 
 		ptm_bfd_snd(bs, 0);
-	} else {
+	} else if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN)
+		   || bs->ses_state == PTM_BFD_DOWN) {
+		/* Don't restart sessions that are already running. */
 		BFD_UNSET_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN);
 
 		/* Change and notify state change. */
-		bs->ses_state = PTM_BFD_DOWN;
+		bs_state_set(bs, PTM_BFD_DOWN);
 		control_notify(bs);
 
 		/* Enable all timers. */
@@ -720,9 +942,14 @@ static void _bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc)
 		bfd_echo_recvtimer_update(bs);
 
 		bfd_xmttimer_update(bs, bs->xmt_TO);
-		if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_ECHO))
+		if (bs->profile->bp_echo)
 			bfd_echo_xmttimer_update(bs, bs->echo_xmt_TO);
 	}
+
+	bfd_shm_update(bs);
+	bfd_state_update(bs);
+
+	return 0;
 }
 
 int bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc)
@@ -731,7 +958,8 @@ int bfd_session_update(bfd_session *bs, struct bfd_peer_cfg *bpc)
 	if (bpc->bpc_createonly)
 		return -1;
 
-	_bfd_session_update(bs, bpc);
+	if (_bfd_session_update(bs, bpc) != 0)
+		return -1;
 
 	/* TODO add VxLAN support. */
 
@@ -750,31 +978,41 @@ void bfd_session_free(bfd_session *bs)
 	bfd_xmttimer_delete(bs);
 	bfd_echo_xmttimer_delete(bs);
 
+	if (bs->pl)
+		pl_free(bs->pl);
+	if (bs->range)
+		range_session_unlink(bs);
+	if (bs->sock_pending) {
+		TAILQ_REMOVE(&bglobal.bg_sockq, bs->sock_pending, bsp_entry);
+		free(bs->sock_pending);
+	}
+
 	HASH_DELETE(sh, session_hash, bs);
+	bs_index_del(bs);
 	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
 		HASH_DELETE(mh, local_peer_hash, bs);
 	} else {
 		HASH_DELETE(ph, peer_hash, bs);
 	}
 
+	bfd_shm_del(bs);
+	bfd_state_del(bs);
+	bfd_metrics_del(bs);
+	profile_unref(bs->profile);
 	free(bs);
 }
 
-bfd_session *ptm_bfd_sess_new(struct bfd_peer_cfg *bpc)
+bfd_session *bs_peer_find(struct bfd_peer_cfg *bpc)
 {
 	struct peer_label *pl;
-	bfd_session *bfd, *l_bfd;
 	bfd_mhop_key mhop;
 	bfd_shop_key shop;
-	int psock;
 
-	/* check to see if this needs a new session */
+	/* Try to find label first. */
 	if (bpc->bpc_has_label) {
 		pl = pl_find(bpc->bpc_label);
-		if (pl) {
-			l_bfd = pl->pl_bs;
-			goto skip_address_lookup;
-		}
+		if (pl)
+			return pl->pl_bs;
 	}
 
 	if (bpc->bpc_mhop) {
@@ -785,25 +1023,26 @@ bfd_session *ptm_bfd_sess_new(struct bfd_peer_cfg *bpc)
 			strxcpy(mhop.vrf_name, bpc->bpc_vrfname,
 				sizeof(mhop.vrf_name));
 
-		l_bfd = bfd_find_mhop(&mhop);
-	} else {
-		memset(&shop, 0, sizeof(shop));
-		shop.peer = bpc->bpc_peer;
-		if (!bpc->bpc_has_vxlan && bpc->bpc_has_localif)
-			strxcpy(shop.port_name, bpc->bpc_localif,
-				sizeof(shop.port_name));
-
-		l_bfd = bfd_find_shop(&shop);
+		return bfd_find_mhop(&mhop);
 	}
 
-skip_address_lookup:
-	if (l_bfd) {
-		/* Requesting a duplicated peer means update configuration. */
-		if (bfd_session_update(l_bfd, bpc) == 0)
-			return l_bfd;
-		else
-			return NULL;
-	}
+	memset(&shop, 0, sizeof(shop));
+	shop.peer = bpc->bpc_peer;
+	if (!bpc->bpc_has_vxlan && bpc->bpc_has_localif)
+		strxcpy(shop.port_name, bpc->bpc_localif,
+			sizeof(shop.port_name));
+
+	return bfd_find_shop(&shop);
+}
+
+int bfd_peer_socket(struct bfd_peer_cfg *bpc)
+{
+	int psock;
+
+	/* Use the socket handed over by the previous daemon. */
+	psock = bfd_state_socket(bpc);
+	if (psock != -1)
+		return psock;
 
 	/*
 	 * Get socket for transmitting control packets.  Note that if we
@@ -811,26 +1050,30 @@ skip_address_lookup:
 	 * port we wouldn't need a socket per session.
 	 */
 	if (bpc->bpc_ipv4) {
-		if ((psock = bp_peer_socket(bpc)) == -1) {
+		if ((psock = bp_peer_socket(bpc, bfd_state_port(bpc))) == -1) {
 			ERRLOG("Can't get socket for new session: %s",
 			       strerror(errno));
-			return NULL;
+			return -1;
 		}
 	} else {
-		if ((psock = bp_peer_socketv6(bpc)) == -1) {
+		if ((psock = bp_peer_socketv6(bpc, bfd_state_port(bpc)))
+		    == -1) {
 			ERRLOG("Can't get IPv6 socket for new session: %s",
 			       strerror(errno));
-			return NULL;
+			return -1;
 		}
 	}
 
-	/* Get memory */
-	if ((bfd = bfd_session_new(psock)) == NULL) {
-		ERRLOG("Can't malloc memory for new session: %s",
-		       strerror(errno));
-		return NULL;
-	}
+	return psock;
+}
 
+/*
+ * Initializes a freshly allocated session and inserts it in the session
+ * databases. The caller is responsible for starting the transmission
+ * and notifying the control sockets.
+ */
+void bfd_session_install(bfd_session *bfd, struct bfd_peer_cfg *bpc)
+{
 	if (bpc->bpc_has_localif && !bpc->bpc_mhop) {
 		bfd->ifindex = ptm_bfd_fetch_ifindex(bpc->bpc_localif);
 		ptm_bfd_fetch_local_mac(bpc->bpc_localif, bfd->local_mac);
@@ -844,23 +1087,31 @@ skip_address_lookup:
 		BFD_SET_FLAG(bfd->flags, BFD_SESS_FLAG_IPV6);
 	}
 
-        if (bpc->bpc_has_discr) {
-            bfd->discrs.my_discr = bpc->bpc_discr;
-        } else {
-            bfd->discrs.my_discr = ptm_bfd_gen_ID();
-        }
-
-	/* Initialize the session */
-	bfd->ses_state = PTM_BFD_DOWN;
-	bfd->discrs.remote_discr = 0;
+	/* Initialize the session or resume it after a warm restart. */
 	bfd->local_ip = bpc->bpc_local;
-	bfd->timers.desired_min_tx = bfd->up_min_tx;
-	bfd->detect_TO = (bfd->detect_mult * BFD_DEF_SLOWTX);
+	bfd->timers.desired_min_tx = bfd->profile->bp_txinterval * 1000;
+	if (!bfd_state_restore(bfd, bpc)) {
+		if (bpc->bpc_has_discr) {
+			bfd->discrs.my_discr = bpc->bpc_discr;
+		} else {
+			bfd->discrs.my_discr = ptm_bfd_gen_ID();
+		}
+
+		bfd->ses_state = PTM_BFD_DOWN;
+		bfd->discrs.remote_discr = 0;
+		bfd->detect_TO =
+			bfd->profile->bp_detectmultiplier * BFD_DEF_SLOWTX;
+
+		/* Start transmitting with slow interval until peer responds */
+		bfd->xmt_TO = BFD_DEF_SLOWTX;
+	}
 
 	/* Use detect_TO first for slow detection, then use recvtimer_update. */
 	bfd_recvtimer_update(bfd);
 
 	HASH_ADD(sh, session_hash, discrs.my_discr, sizeof(uint32_t), bfd);
+	bs_index_add(bfd);
+	bfd_metrics_add(bfd);
 
 	if (bpc->bpc_mhop) {
 		BFD_SET_FLAG(bfd->flags, BFD_SESS_FLAG_MH);
@@ -900,13 +1151,10 @@ skip_address_lookup:
 	 * XXX: session update triggers echo start, so we must have our
 	 * discriminator ID set first.
 	 */
+	bfd_shm_add(bfd);
+	bfd_state_add(bfd);
 	_bfd_session_update(bfd, bpc);
 
-	/* Start transmitting with slow interval until peer responds */
-	bfd->xmt_TO = BFD_DEF_SLOWTX;
-
-	ptm_bfd_xmt_TO(bfd, 0);
-
 	if (bpc->bpc_mhop) {
 		INFOLOG("Created new session 0x%x with vrf %s peer %s local %s",
 			bfd->discrs.my_discr,
@@ -917,93 +1165,663 @@ skip_address_lookup:
 			bfd->discrs.my_discr, satostr(&bfd->shop.peer),
 			bpc->bpc_localif);
 	}
+}
+
+bfd_session *ptm_bfd_sess_new(struct bfd_peer_cfg *bpc)
+{
+	bfd_session *bfd, *l_bfd;
+	int psock;
+
+	if (profile_to_bpc(bpc) != 0)
+		return NULL;
+
+	/* check to see if this needs a new session */
+	l_bfd = bs_peer_find(bpc);
+	if (l_bfd) {
+		/* Requesting a duplicated peer means update configuration. */
+		if (bfd_session_update(l_bfd, bpc) == 0)
+			return l_bfd;
+		else
+			return NULL;
+	}
+
+	if (bs_index_reserve(1) != 0)
+		return NULL;
+
+	psock = bfd_peer_socket(bpc);
+	if (psock == -1)
+		return NULL;
+
+	/* Get memory */
+	if ((bfd = bfd_session_new(psock)) == NULL) {
+		ERRLOG("Can't malloc memory for new session: %s",
+		       strerror(errno));
+		close(psock);
+		return NULL;
+	}
+
+	bfd_session_install(bfd, bpc);
+
+	ptm_bfd_xmt_TO(bfd, 0);
 
 	control_notify_config(BCM_NOTIFY_CONFIG_ADD, bfd);
 
 	return bfd;
 }
 
+static void bfd_session_log_delete(bfd_session *bs)
+{
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
+		INFOLOG("Deleting session 0x%x with vrf %s peer %s local %s",
+			bs->discrs.my_discr,
+			bs->mhop.vrf_name[0] ? bs->mhop.vrf_name : "N/A",
+			satostr(&bs->mhop.peer), satostr(&bs->mhop.local));
+	} else {
+		INFOLOG("Deleting session 0x%x with peer %s port %s\n",
+			bs->discrs.my_discr, satostr(&bs->shop.peer),
+			bs->shop.port_name);
+	}
+}
+
 int ptm_bfd_ses_del(struct bfd_peer_cfg *bpc)
 {
 	bfd_session *bs;
-	bfd_mhop_key mhop;
-	bfd_shop_key shop;
 
-	/* check to see if this needs a new session */
+	bs = bs_peer_find(bpc);
+	if (bs == NULL)
+		return -1;
+
+	return bfd_session_delete(bs);
+}
+
+int bfd_session_delete(bfd_session *bs)
+{
+	/*
+	 * This pointer is being referenced somewhere, don't let it be deleted.
+	 */
+	if (bs->refcount > 0)
+		return -1;
+
+	bfd_session_log_delete(bs);
+
+	control_notify_config(BCM_NOTIFY_CONFIG_DELETE, bs);
+
+	bfd_session_free(bs);
+
+	return 0;
+}
+
+/*
+ * Tells if applying `bpc` would change the session: only the parameters
+ * present in `bpc` are compared.
+ */
+static bool bfd_session_changed(bfd_session *bs, struct bfd_peer_cfg *bpc)
+{
+	const struct bfd_profile *bp = bs->profile;
+
+	if (bpc->bpc_echo != bp->bp_echo
+	    || bpc->bpc_shutdown
+		       != !!BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN)
+	    || bpc->bpc_track_sla != bp->bp_track_sla)
+		return true;
+	if (bpc->bpc_has_txinterval
+	    && bp->bp_txinterval != bpc->bpc_txinterval)
+		return true;
+	if (bpc->bpc_has_recvinterval
+	    && bp->bp_recvinterval != bpc->bpc_recvinterval)
+		return true;
+	if (bpc->bpc_has_detectmultiplier
+	    && bp->bp_detectmultiplier != bpc->bpc_detectmultiplier)
+		return true;
+	if (bpc->bpc_has_echointerval
+	    && bp->bp_echointerval != bpc->bpc_echointerval)
+		return true;
+	if (bpc->bpc_has_label
+	    && (bs->pl == NULL || strcmp(bs->pl->pl_label, bpc->bpc_label) != 0))
+		return true;
+	if (bpc->bpc_has_profile != (bp->bp_name[0] != 0)
+	    || (bpc->bpc_has_profile
+		&& strcmp(bp->bp_name, bpc->bpc_profile) != 0))
+		return true;
+
+	return false;
+}
+
+/*
+ * Moves the sessions of the replaced profiles (`bp_newer`) to the new
+ * ones in a single pass and sends one aggregated configuration
+ * notification.
+ */
+static uint32_t bfd_profile_apply(void)
+{
+	struct bfd_peer_cfg bpc;
+	bfd_session *bs, *tmp, **bsv;
+	uint32_t bscnt = 0;
+
+	bsv = calloc(HASH_CNT(sh, session_hash) + 1, sizeof(*bsv));
+	if (bsv == NULL)
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+
+	HASH_ITER (sh, session_hash, bs, tmp) {
+		if (bs->profile->bp_newer == NULL)
+			continue;
+
+		/* Keep everything that doesn't come from the profile. */
+		memset(&bpc, 0, sizeof(bpc));
+		bpc.bpc_has_profile = true;
+		strxcpy(bpc.bpc_profile, bs->profile->bp_name,
+			sizeof(bpc.bpc_profile));
+		bpc.bpc_shutdown =
+			BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN);
+		profile_to_bpc(&bpc);
+
+		if (bsv == NULL) {
+			bfd_session_update(bs, &bpc);
+		} else {
+			_bfd_session_update(bs, &bpc);
+			bsv[bscnt] = bs;
+		}
+		bscnt++;
+	}
+
+	if (bsv != NULL)
+		control_notify_config_bulk(BCM_NOTIFY_CONFIG_UPDATE, bsv,
+					   bscnt);
+	free(bsv);
+
+	return bscnt;
+}
+
+/*
+ * Configuration reload: applies the configuration file peers to the
+ * running sessions. New peers are added, peers with different
+ * parameters are updated and the sessions created by the configuration
+ * file that are no longer in it are deleted. Every other session is
+ * left untouched, so it doesn't flap.
+ */
+void ptm_bfd_sess_reload(struct bfd_peer_cfg *bpcv, size_t bpccnt,
+			 struct bfd_profile *bpv, size_t bpcnt,
+			 struct bfd_reload_stats *brs)
+{
+	struct bfd_profile *bp, *bptmp;
+	struct bfd_peer_cfg *bpc, rbpc;
+	struct bfd_peer_range *bpr;
+	bfd_session *bs, *tmp;
+	size_t idx;
+
+	/* Profiles first: a changed profile updates all its sessions. */
+	for (idx = 0; idx < bpcnt; idx++) {
+		bp = profile_find(bpv[idx].bp_name);
+		if (bp == NULL) {
+			bp = profile_new(&bpv[idx]);
+			if (bp == NULL) {
+				brs->brs_errors++;
+				continue;
+			}
+			brs->brs_profiles++;
+		} else if (!profile_cmp(bp, &bpv[idx])) {
+			bp = profile_replace(bp, &bpv[idx]);
+			if (bp == NULL) {
+				brs->brs_errors++;
+				continue;
+			}
+			brs->brs_profiles++;
+		}
+
+		bp->bp_reload = true;
+	}
+	if (brs->brs_profiles)
+		brs->brs_profiled = bfd_profile_apply();
+
+	for (idx = 0; idx < bpccnt; idx++) {
+		bpc = &bpcv[idx];
+		bs = bs_peer_find(bpc);
+		if (profile_to_bpc(bpc) != 0) {
+			/* Don't delete the session because of a bad entry. */
+			if (bs != NULL)
+				BFD_SET_FLAG(bs->flags, BFD_SESS_FLAG_RELOAD);
+			brs->brs_errors++;
+			continue;
+		}
+
+		if (bs == NULL) {
+			bs = ptm_bfd_sess_new(bpc);
+			if (bs == NULL) {
+				brs->brs_errors++;
+				continue;
+			}
+			brs->brs_added++;
+		} else if (bpc->bpc_createonly
+			   || !bfd_session_changed(bs, bpc)) {
+			brs->brs_unchanged++;
+		} else {
+			bfd_session_update(bs, bpc);
+			brs->brs_updated++;
+		}
+
+		BFD_SET_FLAG(bs->flags,
+			     BFD_SESS_FLAG_CONFIG | BFD_SESS_FLAG_RELOAD);
+		bfd_state_update(bs);
+	}
+
+	/* Sessions created from ranges follow the (new) range definitions. */
+	HASH_ITER (sh, session_hash, bs, tmp) {
+		if (!BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_RANGE)
+		    || BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_RELOAD))
+			continue;
+		bpr = range_session_bpc(bs, &rbpc);
+		if (bpr == NULL)
+			continue;
+
+		range_session_link(bpr, bs);
+
+		if (profile_to_bpc(&rbpc) != 0) {
+			brs->brs_errors++;
+		} else if (!bfd_session_changed(bs, &rbpc)) {
+			brs->brs_unchanged++;
+		} else {
+			bfd_session_update(bs, &rbpc);
+			brs->brs_updated++;
+		}
+
+		BFD_SET_FLAG(bs->flags, BFD_SESS_FLAG_RELOAD);
+	}
+
+	HASH_ITER (sh, session_hash, bs, tmp) {
+		if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_RELOAD)) {
+			BFD_UNSET_FLAG(bs->flags, BFD_SESS_FLAG_RELOAD);
+			continue;
+		}
+
+		/* Keep the control socket peers and the referenced ones. */
+		if ((!BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_CONFIG)
+		     && !BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_RANGE))
+		    || bs->refcount > 0)
+			continue;
+
+		bfd_session_log_delete(bs);
+		control_notify_config(BCM_NOTIFY_CONFIG_DELETE, bs);
+		bfd_session_free(bs);
+		brs->brs_deleted++;
+	}
+
+	/* Profiles removed from the file are kept while sessions use them. */
+	HASH_ITER (bp_hh, bglobal.bg_profiles, bp, bptmp) {
+		if (!bp->bp_reload && bp->bp_refcount == 0) {
+			profile_free(bp);
+			continue;
+		}
+
+		bp->bp_reload = false;
+	}
+}
+
+
+/*
+ * Bulk session handling.
+ *
+ * Bulk requests are transactional: every peer is validated (and every
+ * new session gets its socket and memory) before any change is applied.
+ * If one peer is rejected nothing changes and the remaining peers are
+ * reported as skipped.
+ */
+struct bfd_bulk_entry {
+	/* Request duplicates detection: use session or new peer key. */
+	UT_hash_handle bbe_hh;
+	bfd_session *bbe_bs;
+	/* New sessions socket setup. */
+	struct bfd_socket_pending *bbe_bsp;
+	struct {
+		bfd_shop_key shop;
+		bfd_mhop_key mhop;
+	} bbe_key;
+	bool bbe_new;
+};
+
+int bfd_bulk_validate(struct bfd_peer_cfg *bpc)
+{
+	int family = bpc->bpc_ipv4 ? AF_INET : AF_INET6;
+
+	if (profile_to_bpc(bpc) != 0)
+		return BBR_INVALID;
+	if (bpc->bpc_peer.sa_sin.sin_family != family)
+		return BBR_INVALID;
+	if (bpc->bpc_local.sa_sin.sin_family != AF_UNSPEC
+	    && bpc->bpc_local.sa_sin.sin_family != family)
+		return BBR_INVALID;
+	if (bpc->bpc_has_detectmultiplier && bpc->bpc_detectmultiplier == 0)
+		return BBR_INVALID;
+	if (bpc->bpc_has_recvinterval && bpc->bpc_recvinterval == 0)
+		return BBR_INVALID;
+	if (bpc->bpc_has_txinterval && bpc->bpc_txinterval == 0)
+		return BBR_INVALID;
+
+	return BBR_OK;
+}
+
+static void bfd_bulk_key(struct bfd_peer_cfg *bpc, struct bfd_bulk_entry *bbe)
+{
+	memset(&bbe->bbe_key, 0, sizeof(bbe->bbe_key));
 	if (bpc->bpc_mhop) {
-		memset(&mhop, 0, sizeof(mhop));
-		mhop.peer = bpc->bpc_peer;
-		mhop.local = bpc->bpc_local;
+		bbe->bbe_key.mhop.peer = bpc->bpc_peer;
+		bbe->bbe_key.mhop.local = bpc->bpc_local;
 		if (bpc->bpc_has_vrfname)
-			strxcpy(mhop.vrf_name, bpc->bpc_vrfname,
-				sizeof(mhop.vrf_name));
-
-		bs = bfd_find_mhop(&mhop);
+			strxcpy(bbe->bbe_key.mhop.vrf_name, bpc->bpc_vrfname,
+				sizeof(bbe->bbe_key.mhop.vrf_name));
 	} else {
-		memset(&shop, 0, sizeof(shop));
-		shop.peer = bpc->bpc_peer;
+		bbe->bbe_key.shop.peer = bpc->bpc_peer;
 		if (!bpc->bpc_has_vxlan && bpc->bpc_has_localif)
-			strxcpy(shop.port_name, bpc->bpc_localif,
-				sizeof(shop.port_name));
+			strxcpy(bbe->bbe_key.shop.port_name, bpc->bpc_localif,
+				sizeof(bbe->bbe_key.shop.port_name));
+	}
+}
 
-		bs = bfd_find_shop(&shop);
+static void bfd_bulk_abort(uint8_t *results, size_t bpccnt)
+{
+	size_t idx;
+
+	for (idx = 0; idx < bpccnt; idx++) {
+		if (results[idx] == BBR_OK)
+			results[idx] = BBR_SKIPPED;
 	}
-	if (bs == NULL)
+}
+
+static void bfd_socket_queue(bfd_session *bs, struct bfd_socket_pending *bsp,
+			     struct bfd_peer_cfg *bpc, uint64_t delay)
+{
+	bsp->bsp_bs = bs;
+	bsp->bsp_bpc = *bpc;
+	bsp->bsp_delay = delay;
+	bs->sock_pending = bsp;
+
+	/* Activating an active event does nothing. */
+	TAILQ_INSERT_TAIL(&bglobal.bg_sockq, bsp, bsp_entry);
+	event_active(&bglobal.bg_sockev, EV_TIMEOUT, 0);
+}
+
+/*
+ * Gives the session its socket and starts transmitting. Sessions that
+ * can't get one are deleted: the bulk request already succeeded, so the
+ * clients learn it from the delete notification (see bfdctl.h).
+ */
+static void bfd_socket_setup(struct bfd_socket_pending *bsp)
+{
+	bfd_session *bs = bsp->bsp_bs;
+	uint64_t bsp_delay = bsp->bsp_delay;
+	int psock;
+
+	TAILQ_REMOVE(&bglobal.bg_sockq, bsp, bsp_entry);
+	bs->sock_pending = NULL;
+
+	psock = bfd_peer_socket(&bsp->bsp_bpc);
+	free(bsp);
+	if (psock == -1) {
+		/*
+		 * Even if subscribed to: the notification drops the
+		 * subscriptions (see control_notify_config()).
+		 */
+		log_warning("%s: session 0x%x has no socket: deleting it\n",
+			    __FUNCTION__, bs->discrs.my_discr);
+		bfd_session_log_delete(bs);
+		control_notify_config(BCM_NOTIFY_CONFIG_DELETE, bs);
+		bfd_session_free(bs);
+		return;
+	}
+
+	bs->sock = psock;
+	bs->src_port = bs_source_port(psock);
+	if (bs->profile->bp_track_sla)
+		bfd_sla_start(bs);
+	bfd_state_update(bs);
+	bfd_repl_update(bs);
+
+	/* What _bfd_session_update() skipped without a socket. */
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN))
+		ptm_bfd_snd(bs, 0);
+	if (bs->profile->bp_echo)
+		ptm_bfd_echo_start(bs);
+	bfd_xmttimer_update(bs, bsp_delay);
+}
+
+/* Creates the bulk created sessions sockets, a batch per loop pass. */
+void bfd_socket_cb(evutil_socket_t sd __attribute__((unused)),
+		   short ev __attribute__((unused)),
+		   void *arg __attribute__((unused)))
+{
+	struct bfd_socket_pending *bsp;
+	size_t cnt;
+
+	for (cnt = 0; cnt < BFD_SOCKET_BATCH; cnt++) {
+		bsp = TAILQ_FIRST(&bglobal.bg_sockq);
+		if (bsp == NULL)
+			return;
+
+		bfd_socket_setup(bsp);
+	}
+
+	if (!TAILQ_EMPTY(&bglobal.bg_sockq))
+		event_active(&bglobal.bg_sockev, EV_TIMEOUT, 0);
+}
+
+/* Creates all the pending sockets now (e.g. before a handover). */
+void bfd_socket_flush(void)
+{
+	struct bfd_socket_pending *bsp;
+
+	while ((bsp = TAILQ_FIRST(&bglobal.bg_sockq)) != NULL)
+		bfd_socket_setup(bsp);
+}
+
+int ptm_bfd_sess_bulk_new(struct bfd_peer_cfg *bpcv, size_t bpccnt,
+			  uint8_t *results)
+{
+	struct bfd_bulk_entry *bbev, *bbe, *bbehash = NULL;
+	bfd_session **bsv;
+	size_t idx, newcnt = 0, newidx = 0, updidx;
+	int error = 0;
+
+	if (bpccnt == 0)
+		return 0;
+
+	bbev = calloc(bpccnt, sizeof(*bbev));
+	bsv = calloc(bpccnt, sizeof(*bsv));
+	if (bbev == NULL || bsv == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		free(bbev);
+		free(bsv);
+		memset(results, BBR_FAILED, bpccnt);
+		return -1;
+	}
+
+	/* Validate all peers and find the ones that already exist. */
+	for (idx = 0; idx < bpccnt; idx++) {
+		results[idx] = bfd_bulk_validate(&bpcv[idx]);
+		if (results[idx] != BBR_OK) {
+			error++;
+			continue;
+		}
+
+		bbev[idx].bbe_bs = bs_peer_find(&bpcv[idx]);
+		if (bbev[idx].bbe_bs == NULL) {
+			bbev[idx].bbe_new = true;
+			continue;
+		}
+
+		/* The same peer can't be configured twice. */
+		HASH_FIND(bbe_hh, bbehash, &bbev[idx].bbe_bs,
+			  sizeof(bbev[idx].bbe_bs), bbe);
+		if (bbe != NULL || bpcv[idx].bpc_createonly) {
+			results[idx] = BBR_EXISTS;
+			error++;
+			continue;
+		}
+
+		HASH_ADD(bbe_hh, bbehash, bbe_bs, sizeof(bbev[idx].bbe_bs),
+			 &bbev[idx]);
+	}
+	HASH_CLEAR(bbe_hh, bbehash);
+
+	/* New peers duplicates can only be detected by their keys. */
+	for (idx = 0; idx < bpccnt && error == 0; idx++) {
+		if (!bbev[idx].bbe_new)
+			continue;
+
+		bfd_bulk_key(&bpcv[idx], &bbev[idx]);
+		HASH_FIND(bbe_hh, bbehash, &bbev[idx].bbe_key,
+			  sizeof(bbev[idx].bbe_key), bbe);
+		if (bbe != NULL) {
+			results[idx] = BBR_EXISTS;
+			error++;
+			continue;
+		}
+
+		HASH_ADD(bbe_hh, bbehash, bbe_key, sizeof(bbev[idx].bbe_key),
+			 &bbev[idx]);
+	}
+	HASH_CLEAR(bbe_hh, bbehash);
+
+	/* Allocate all resources before touching the session databases. */
+	if (error == 0 && bs_index_reserve(bpccnt) != 0) {
+		memset(results, BBR_FAILED, bpccnt);
+		error++;
+	}
+
+	/* The sockets are only created after the batch (see bfd_socket_cb()). */
+	for (idx = 0; idx < bpccnt && error == 0; idx++) {
+		if (!bbev[idx].bbe_new)
+			continue;
+
+		bbev[idx].bbe_bsp = calloc(1, sizeof(*bbev[idx].bbe_bsp));
+		bbev[idx].bbe_bs = bfd_session_new(-1);
+		if (bbev[idx].bbe_bsp == NULL || bbev[idx].bbe_bs == NULL) {
+			log_warning("%s: bfd_session_new: %s\n", __FUNCTION__,
+				    strerror(errno));
+			results[idx] = BBR_FAILED;
+			error++;
+			break;
+		}
+
+		newcnt++;
+	}
+
+	if (error) {
+		/* New sessions are not installed yet: just release them. */
+		for (idx = 0; idx < bpccnt; idx++) {
+			if (!bbev[idx].bbe_new)
+				continue;
+
+			free(bbev[idx].bbe_bsp);
+			if (bbev[idx].bbe_bs == NULL)
+				continue;
+
+			profile_unref(bbev[idx].bbe_bs->profile);
+			free(bbev[idx].bbe_bs);
+		}
+
+		bfd_bulk_abort(results, bpccnt);
+		free(bbev);
+		free(bsv);
 		return -1;
+	}
 
 	/*
-	 * This pointer is being referenced somewhere, don't let it be deleted.
+	 * Apply the changes: new sessions are kept in the beginning of
+	 * `bsv` and the updated ones after them. The first transmission of
+	 * the new sessions is staggered over the slow transmission interval
+	 * to avoid sending all packets at once.
 	 */
-	if (bs->refcount > 0)
-		return -1;
+	updidx = newcnt;
+	for (idx = 0; idx < bpccnt; idx++) {
+		if (bbev[idx].bbe_new) {
+			/* Queued first: nothing is sent without a socket. */
+			bfd_socket_queue(bbev[idx].bbe_bs, bbev[idx].bbe_bsp,
+					 &bpcv[idx],
+					 (BFD_DEF_SLOWTX * newidx) / newcnt);
+			bfd_session_install(bbev[idx].bbe_bs, &bpcv[idx]);
+			bsv[newidx++] = bbev[idx].bbe_bs;
+			continue;
+		}
 
-	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
-		INFOLOG("Deleting session 0x%x with vrf %s peer %s local %s",
-			bs->discrs.my_discr,
-			bpc->bpc_has_vrfname ? bpc->bpc_vrfname : "N/A",
-			satostr(&bs->mhop.peer), satostr(&bs->mhop.local));
-	} else {
-		INFOLOG("Deleting session 0x%x with peer %s port %s\n",
-			bs->discrs.my_discr, satostr(&bs->shop.peer),
-			bs->shop.port_name);
+		_bfd_session_update(bbev[idx].bbe_bs, &bpcv[idx]);
+		bsv[updidx++] = bbev[idx].bbe_bs;
 	}
 
-	control_notify_config(BCM_NOTIFY_CONFIG_DELETE, bs);
+	control_notify_config_bulk(BCM_NOTIFY_CONFIG_ADD, bsv, newcnt);
+	control_notify_config_bulk(BCM_NOTIFY_CONFIG_UPDATE, &bsv[newcnt],
+				   bpccnt - newcnt);
 
-	bfd_session_free(bs);
+	free(bbev);
+	free(bsv);
 
 	return 0;
 }
 
-void ptm_bfd_send_sla_update(bfd_session *bfd, struct timeval *recv_tv)
-{
-    uint32_t time_elapsed = ((recv_tv->tv_sec*1000 + recv_tv->tv_usec/1000)
-            - (bfd->xmit_tv.tv_sec*1000 + bfd->xmit_tv.tv_usec/1000));
-    bfd->sla.lattency += time_elapsed;
-    if(bfd->sla.old_lat)
-        bfd->sla.jitter += abs(bfd->sla.old_lat - time_elapsed);
-    bfd->sla.old_lat = time_elapsed;
-    uint32_t total_pkts = bfd->stats.rx_ctrl_pkt + bfd->stats.rx_echo_pkt;
-    if(!(total_pkts % bfd->detect_mult)){
-        if(total_pkts % PKTS_TO_CONSIDER_FOR_PKT_LOSS < bfd->detect_mult){
-            uint32_t total_pkts_lost = ((bfd->stats.tx_ctrl_pkt + bfd->stats.tx_echo_pkt)
-                    - (bfd->stats.rx_ctrl_pkt + bfd->stats.rx_echo_pkt));
-            bfd->sla.pkt_loss = ((total_pkts_lost - bfd->sla.pkts_lost)/(float)PKTS_TO_CONSIDER_FOR_PKT_LOSS) * 100;
-            bfd->sla.pkts_lost = total_pkts_lost;
-        }
-
-        bfd->sla.lattency /= bfd->detect_mult;
-        bfd->sla.jitter /= (bfd->detect_mult - 1);
-
-#ifdef BFD_EVENT_DEBUG
-        log_debug("sla clac:\n\tlattency: %d\n\tjitter:%d\n\tpkt_loss:%f\n",
-                bfd->sla.lattency, bfd->sla.jitter, bfd->sla.pkt_loss);
-#endif /* BFD_EVENT_DEBUG */
-
-        control_notify_sla(bfd);
-
-        bfd->sla.lattency = 0;
-        bfd->sla.jitter = 0;
-        bfd->sla.old_lat = 0;
-    }
+int ptm_bfd_ses_bulk_del(struct bfd_peer_cfg *bpcv, size_t bpccnt,
+			 uint8_t *results)
+{
+	struct bfd_bulk_entry *bbev, *bbe, *bbehash = NULL;
+	bfd_session **bsv;
+	size_t idx;
+	int error = 0;
+
+	if (bpccnt == 0)
+		return 0;
+
+	bbev = calloc(bpccnt, sizeof(*bbev));
+	bsv = calloc(bpccnt, sizeof(*bsv));
+	if (bbev == NULL || bsv == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		free(bbev);
+		free(bsv);
+		memset(results, BBR_FAILED, bpccnt);
+		return -1;
+	}
+
+	for (idx = 0; idx < bpccnt; idx++) {
+		results[idx] = BBR_OK;
+		bsv[idx] = bs_peer_find(&bpcv[idx]);
+		if (bsv[idx] == NULL) {
+			results[idx] = BBR_NOT_FOUND;
+			error++;
+			continue;
+		}
+
+		/* Referenced sessions can't be deleted. */
+		if (bsv[idx]->refcount > 0) {
+			results[idx] = BBR_BUSY;
+			error++;
+			continue;
+		}
+
+		bbev[idx].bbe_bs = bsv[idx];
+		HASH_FIND(bbe_hh, bbehash, &bbev[idx].bbe_bs,
+			  sizeof(bbev[idx].bbe_bs), bbe);
+		if (bbe != NULL) {
+			results[idx] = BBR_EXISTS;
+			error++;
+			continue;
+		}
+
+		HASH_ADD(bbe_hh, bbehash, bbe_bs, sizeof(bbev[idx].bbe_bs),
+			 &bbev[idx]);
+	}
+	HASH_CLEAR(bbe_hh, bbehash);
+	free(bbev);
+
+	if (error) {
+		bfd_bulk_abort(results, bpccnt);
+		free(bsv);
+		return -1;
+	}
+
+	/* Notify while the sessions still exist, then remove them. */
+	control_notify_config_bulk(BCM_NOTIFY_CONFIG_DELETE, bsv, bpccnt);
+	for (idx = 0; idx < bpccnt; idx++) {
+		bfd_session_log_delete(bsv[idx]);
+		bfd_session_free(bsv[idx]);
+	}
+
+	free(bsv);
+
+	return 0;
 }
@@ -23,6 +23,7 @@
 
 #include <netinet/in.h>
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -83,7 +84,10 @@ typedef struct bfd_echo_pkt_s {
 		};
 	};
 	uint32_t my_discr;
-	uint8_t pad[16];
+	/* Round trip measurement: transmit timestamp key and time. */
+	uint8_t sla_key[4];
+	uint8_t sla_tx[8];
+	uint8_t pad[4];
 } bfd_echo_pkt_t;
 
 
@@ -142,7 +146,8 @@ typedef struct bfd_echo_pkt_s {
 /* BFD session flags */
 typedef enum ptm_bfd_session_flags {
 	BFD_SESS_FLAG_NONE = 0,
-	BFD_SESS_FLAG_ECHO = 1 << 0,	/* BFD Echo functionality */
+	BFD_SESS_FLAG_ECHO = 1 << 0,	/* BFD Echo functionality (only in
+					 * saved state, see bs->profile) */
 	BFD_SESS_FLAG_ECHO_ACTIVE = 1 << 1, /* BFD Echo Packets are being sent
 					     * actively */
 	BFD_SESS_FLAG_MH = 1 << 2,	  /* BFD Multi-hop session */
@@ -153,7 +158,13 @@ typedef enum ptm_bfd_session_flags {
 	BFD_SESS_FLAG_SEND_EVT_IGNORE = 1 << 6, /* ignore send event when timer
 						 * expires */
 	BFD_SESS_FLAG_SHUTDOWN = 1 << 7,	/* disable BGP peer function */
-        BFD_SESS_FLAG_TRACK_SLA = 1 << 8,   /* Calculate SLA parameters */
+        BFD_SESS_FLAG_TRACK_SLA = 1 << 8,   /* Calculate SLA parameters
+					     * (only in saved state) */
+	BFD_SESS_FLAG_CONFIG = 1 << 9,  /* created by the configuration file */
+	BFD_SESS_FLAG_RELOAD = 1 << 10, /* found by the configuration reload */
+	BFD_SESS_FLAG_RANGE = 1 << 11,  /* created from a peer range */
+	BFD_SESS_FLAG_RESUMED = 1 << 12, /* resumed, not in the configuration
+					  * file yet */
 } bfd_session_flags;
 
 #define BFD_SET_FLAG(field, flag) (field |= flag)
@@ -179,12 +190,39 @@ typedef struct ptm_bfd_session_stats {
 	uint64_t tx_echo_pkt;
 } bfd_session_stats_t;
 
+/* Kernel transmit timestamp (see bfd_sla.c). */
+struct bfd_sla_txstamp {
+	uint32_t bsx_key;
+	uint64_t bsx_time;
+};
+#define BFD_SLA_TXSTAMPS 8
+
 typedef struct ptm_bfd_session_sla {
-    uint32_t lattency;
-    uint32_t jitter;
-    uint32_t old_lat;
-    uint32_t pkts_lost;
-    float pkt_loss;
+	/* Last measured values: microseconds and percent. */
+	uint32_t lattency;
+	uint32_t jitter;
+	float pkt_loss;
+
+	/* Measurement window: round trip times in nanoseconds. */
+	uint32_t window_pkts;
+	uint32_t rtt_samples;
+	uint32_t jitter_samples;
+	uint64_t rtt_sum;
+	uint64_t jitter_sum;
+	uint64_t rtt_last;
+
+	/* Packet counters at the beginning of the loss window. */
+	uint64_t loss_tx;
+	uint64_t loss_rx;
+
+	/* Last Poll packet sent: timestamp key and transmit time. */
+	uint32_t poll_key;
+	uint64_t poll_tx;
+
+	/* Packets sent on the session socket: the timestamps key. */
+	uint32_t tx_seq;
+	bool tx_stamping;
+	struct bfd_sla_txstamp txstamps[BFD_SLA_TXSTAMPS];
 } bfd_session_sla_t;
 #define PKTS_TO_CONSIDER_FOR_PKT_LOSS 100
 
@@ -210,6 +248,23 @@ typedef struct ptm_bfd_session_vxlan_info {
 /* bfd_session shortcut label forwarding. */
 struct peer_label;
 
+/* bfd_session notification subscribers forwarding. */
+struct bfd_notify_peer;
+TAILQ_HEAD(bnplist, bfd_notify_peer);
+
+/*
+ * Session parameters reported by configuration notifications: used to
+ * suppress updates that don't change anything.
+ */
+struct bfd_notify_cfg {
+	bfd_timers_t timers;
+	bfd_timers_t remote_timers;
+	uint32_t up_min_tx;
+	uint32_t flags; /* BFD_SESS_FLAG_ECHO, BFD_SESS_FLAG_SHUTDOWN */
+	uint8_t detect_mult;
+	uint8_t remote_detect_mult;
+};
+
 /*
  * Session state information
  */
@@ -220,14 +275,12 @@ typedef struct ptm_bfd_session {
 	bfd_discrs_t discrs;
 	uint8_t local_diag;
 	uint8_t demand_mode;
-	uint8_t detect_mult;
 	uint8_t remote_detect_mult;
 	uint8_t mh_ttl;
 
-	/* Timers */
+	/* Timers: advertised values, see `profile` for the configured ones. */
 	bfd_timers_t timers;
 	bfd_timers_t new_timers;
-	uint32_t up_min_tx;
 	uint64_t detect_TO;
 	struct event echo_recvtimer_ev;
 	struct event recvtimer_ev;
@@ -242,11 +295,15 @@ typedef struct ptm_bfd_session {
 
 	/* This and the localDiscr are the keys to state info */
 	struct peer_label *pl;
+	/* Configured parameters, shared with other sessions (never NULL). */
+	struct bfd_profile *profile;
 	union {
 		bfd_shop_key shop;
 		bfd_mhop_key mhop;
 	};
 	int sock;
+	/* Source port of `sock`: it doesn't change (see bfd_state_fill()). */
+	uint16_t src_port;
 
 	/* fields needed for uthash integration */
 	UT_hash_handle sh; /* use session as key */
@@ -278,18 +335,114 @@ typedef struct ptm_bfd_session {
 
 	uint64_t refcount; /* number of pointers referencing this. */
 
-        /* SLA parameters */
-        bfd_session_sla_t sla;
-        struct timeval xmit_tv; /* The time at which the last packet was sent. */
+	/* Control sockets subscribed to this session notifications. */
+	struct bnplist notify_list;
+	/* Last notified configuration parameters. */
+	struct bfd_notify_cfg notify_cfg;
+
+	/* SLA parameters */
+	bfd_session_sla_t sla;
+
+	/* Shared memory status table entry (if published). */
+	struct bfd_status_entry *shm_entry;
+	/* Warm restart state file entry (if checkpointed). */
+	struct bfd_state_entry *state_entry;
+
+	/* Range the session was created from (see bfd_range.c). */
+	struct bfd_peer_range *range;
+	TAILQ_ENTRY(ptm_bfd_session) range_entry;
+
+	/* Socket setup of a bulk created session (see bfd_socket_cb()). */
+	struct bfd_socket_pending *sock_pending;
 } bfd_session;
+TAILQ_HEAD(bsrangelist, ptm_bfd_session);
 
 struct peer_label {
-	TAILQ_ENTRY(peer_label) pl_entry;
+	UT_hash_handle pl_hh; /* use label as key */
 
 	bfd_session *pl_bs;
 	char pl_label[MAXNAMELEN];
 };
-TAILQ_HEAD(pllist, peer_label);
+
+/*
+ * Session profile: configured parameters shared by every session
+ * referencing it. Named profiles are defined in the configuration file,
+ * sessions without one share an unnamed profile with the sessions that
+ * have the same parameters. Profiles are immutable: a configuration
+ * reload replaces a changed profile (see `bp_newer`).
+ */
+struct bfd_profile {
+	UT_hash_handle bp_hh; /* use name as key */
+	UT_hash_handle bp_ph; /* use parameters as key (unnamed profiles) */
+
+	/* Empty for unnamed profiles. */
+	char bp_name[MAXNAMELEN];
+	/* Sessions using this profile. */
+	uint64_t bp_refcount;
+
+	/* Parameters: keep them together without padding, see below. */
+	uint64_t bp_recvinterval; /* milliseconds */
+	uint64_t bp_txinterval;
+	uint64_t bp_echointerval;
+	uint8_t bp_detectmultiplier;
+	bool bp_echo;
+	bool bp_track_sla;
+
+	/* Configuration reload marks. */
+	bool bp_reload;
+	/* The replacement of a changed profile its sessions move to. */
+	struct bfd_profile *bp_newer;
+};
+
+/* Unnamed profiles key: all the parameters. */
+#define BFD_PROFILE_KEYLEN                                                     \
+	(offsetof(struct bfd_profile, bp_track_sla) + sizeof(bool)             \
+	 - offsetof(struct bfd_profile, bp_recvinterval))
+
+/*
+ * Peer range: a configuration file entry covering many peers (a prefix
+ * or a first-last address range, optionally crossed with a list of
+ * interfaces). Sessions are only created when a peer of the range sends
+ * its first packet, so the range peers take the passive role.
+ */
+struct bfd_peer_range {
+	TAILQ_ENTRY(bfd_peer_range) bpr_entry;
+
+	/* Session template: everything but the peer address. */
+	struct bfd_peer_cfg bpr_bpc;
+	struct sockaddr_any bpr_first;
+	struct sockaddr_any bpr_last;
+	/* Single hop interfaces (any interface when empty). */
+	char (*bpr_ifnames)[MAXNAMELEN + 1];
+	size_t bpr_ifcnt;
+
+	/*
+	 * Sessions created from the range: at most `bpr_maxsessions`, the
+	 * ones down for `bpr_downtimeout` seconds are deleted.
+	 */
+	struct bsrangelist bpr_sessions;
+	uint32_t bpr_sessioncnt;
+	uint32_t bpr_maxsessions;
+	uint32_t bpr_downtimeout;
+	/* The limit was reported. */
+	bool bpr_full;
+};
+TAILQ_HEAD(bprlist, bfd_peer_range);
+
+/*
+ * Bulk created session waiting for its socket: the sockets are created
+ * after the batch, `BFD_SOCKET_BATCH` per event loop pass.
+ */
+struct bfd_socket_pending {
+	TAILQ_ENTRY(bfd_socket_pending) bsp_entry;
+	bfd_session *bsp_bs;
+	struct bfd_peer_cfg bsp_bpc;
+	/* First transmission delay (microseconds). */
+	uint64_t bsp_delay;
+};
+TAILQ_HEAD(bsplist, bfd_socket_pending);
+
+#define BFD_SOCKET_BATCH 256
 
 /**
  * List of IP address family supported by BFD session.
@@ -377,51 +530,281 @@ struct bfd_control_buffer {
 	};
 };
 
+/*
+ * Immutable serialized message: it is built once and shared by every
+ * control socket output queue that needs it. The last queue entry to
+ * release it frees the memory.
+ */
+struct bfd_control_msgref {
+	uint64_t bcmr_refcount;
+	/* Total message length (header included). */
+	size_t bcmr_len;
+	struct bfd_control_msg *bcmr_bcm;
+};
+
+/*
+ * Lock-free list used to pass work between the protocol and the control
+ * threads: any thread may post entries, but only the thread running
+ * `bmb_ev` takes them (see `control_mbox_post`).
+ */
+struct bfd_mbox_entry {
+	struct bfd_mbox_entry *bme_next;
+};
+
+struct bfd_mbox {
+	struct bfd_mbox_entry *bmb_head;
+	/* eventfd signaled when the list stops being empty. */
+	int bmb_fd;
+	struct event bmb_ev;
+};
+
+/* Protocol to control thread output entries. */
+enum bfd_control_queue_type {
+	BCQT_MESSAGE = 0,
+	/* Close the connection. */
+	BCQT_CLOSE,
+	/* The protocol thread is done with the socket: free it. */
+	BCQT_RELEASE,
+	/* Hand the sockets and sessions over on the connection. */
+	BCQT_HANDOVER,
+	/* Stop the control thread. */
+	BCQT_STOP,
+};
+
+struct bfd_handover;
+
 struct bfd_control_queue {
+	/* Output list entry (must be the first field). */
+	struct bfd_mbox_entry bcq_mbe;
 	TAILQ_ENTRY(bfd_control_queue) bcq_entry;
 
+	enum bfd_control_queue_type bcq_type;
+	struct bfd_control_socket *bcq_bcs;
+	struct bfd_control_msgref *bcq_bcmr;
 	struct bfd_control_buffer bcq_bcb;
+	/* BCQT_HANDOVER snapshot. */
+	struct bfd_handover *bcq_bho;
 };
 TAILQ_HEAD(bcqueue, bfd_control_queue);
 
+/* What to do when a control socket output queue is full. */
+enum bfd_queue_policy {
+	/* Drop notifications and ask the client to resync. */
+	BQP_DROP = 0,
+	/* Close the connection. */
+	BQP_DISCONNECT,
+	/* Hold the latest peer state/SLA/update, otherwise like BQP_DROP. */
+	BQP_COLLAPSE,
+};
+
+/* Default output queue limits. */
+#define BFD_CONTROL_QUEUE_BYTES (64 * 1024 * 1024)
+#define BFD_CONTROL_QUEUE_MSGS 0 /* unlimited */
+
+/* Default number of notification events kept for resuming clients. */
+#define BFD_NOTIFY_JOURNAL 4096
+
+struct bfd_journal_entry;
+
+struct bfd_control_socket;
+
 struct bfd_notify_peer {
-	TAILQ_ENTRY(bfd_notify_peer) bnp_entry;
+	/* Control socket subscription hash: use session pointer as key. */
+	UT_hash_handle bnp_hh;
+	/* Session subscribers list. */
+	TAILQ_ENTRY(bfd_notify_peer) bnp_sentry;
 
+	struct bfd_control_socket *bnp_bcs;
 	bfd_session *bnp_bs;
 };
-TAILQ_HEAD(bnplist, bfd_notify_peer);
 
+/* Notification held by a control socket coalescing window. */
+struct bfd_notify_pending {
+	/* Control socket pending hash: use session pointer as key. */
+	UT_hash_handle bnpe_hh;
+	/* Control socket pending list (delivery order). */
+	TAILQ_ENTRY(bfd_notify_pending) bnpe_entry;
+
+	bfd_session *bnpe_bs;
+	/* Pending notifications (BCM_NOTIFY_* flags). */
+	uint64_t bnpe_notify;
+	/* Sequence number of the oldest held notification. */
+	uint64_t bnpe_seq;
+	/* Configuration parameters before the first held update. */
+	struct bfd_notify_cfg bnpe_cfg;
+};
+TAILQ_HEAD(bnpelist, bfd_notify_pending);
+
+/* Session query: see BMT_QUERY. */
+struct bfd_query {
+	uint32_t bq_flags; /* BCQ_F_* */
+	uint32_t bq_cursor;
+	uint32_t bq_limit;
+	uint8_t bq_state; /* PTM_BFD_* */
+	char bq_label[MAXNAMELEN + 1];
+	char bq_localif[MAXNAMELEN + 1];
+	char bq_vrfname[MAXNAMELEN + 1];
+};
+
+/* Request peers vector. */
+struct bfd_peer_vec {
+	struct bfd_peer_cfg *bpv_bpcv;
+	size_t bpv_cnt;
+	size_t bpv_size;
+};
+
+/* Control to protocol thread commands. */
+enum bfd_control_cmd_type {
+	/* New connection. */
+	BCCT_OPEN = 0,
+	/* Parsed request. */
+	BCCT_MESSAGE,
+	/* The output queue drained (see `bcs_drain`). */
+	BCCT_DRAINED,
+	/* The connection is closed: it is the last command of the socket. */
+	BCCT_CLOSE,
+};
+
+struct bfd_control_cmd {
+	/* Command list entry (must be the first field). */
+	struct bfd_mbox_entry bcc_mbe;
+
+	enum bfd_control_cmd_type bcc_type;
+	struct bfd_control_socket *bcc_bcs;
+
+	/* Request header. */
+	enum bc_msg_version bcc_version;
+	enum bc_msg_type bcc_msgtype;
+	uint16_t bcc_id;
+	/* The request is answered with this error. */
+	const char *bcc_error;
+
+	/*
+	 * Request peers and the number of entries that failed to parse.
+	 * Requests referencing peers by label are parsed by the protocol
+	 * thread: the control thread only passes the message (`bcc_buf`).
+	 */
+	struct bfd_peer_vec bcc_bpv;
+	int bcc_errors;
+	uint8_t *bcc_buf;
+
+	/* BMT_NOTIFY flags and sequence number to resume from. */
+	uint64_t bcc_notify;
+	uint64_t bcc_seq;
+	/* BMT_NOTIFY_COALESCE window. */
+	uint32_t bcc_window;
+	/* BMT_QUERY parameters. */
+	struct bfd_query bcc_bq;
+};
+
+/*
+ * Control sockets are shared by two threads: the control thread owns the
+ * connection (reads, request parsing, output queue and writes) and the
+ * protocol thread owns the notification state and answers the requests.
+ */
 struct bfd_control_socket {
 	TAILQ_ENTRY(bfd_control_socket) bcs_entry;
 
 	int bcs_sd;
-	struct event bcs_ev;
-	struct event bcs_outev;
-	struct bcqueue bcs_bcqueue;
+	/*
+	 * Queued messages and bytes (and their high-water marks): the
+	 * protocol thread adds and the control thread removes (atomics).
+	 */
+	uint32_t bcs_queue_msgs;
+	uint32_t bcs_queue_msgs_hwm;
+	size_t bcs_queue_bytes;
+	size_t bcs_queue_bytes_hwm;
+	/* The protocol thread wants BCCT_DRAINED (atomic). */
+	bool bcs_drain;
+	/* Notifications dropped since the last resync. */
+	uint64_t bcs_resync;
+	/* The socket will be closed as soon as possible. */
+	bool bcs_closing;
 
 	/* Notification data */
 	uint64_t bcs_notify;
-	struct bnplist bcs_bnplist;
+	struct bfd_notify_peer *bcs_bnphash;
+
+	/* Notification coalescing: window in milliseconds (0 disables). */
+	uint32_t bcs_coalesce;
+	struct event bcs_coalesce_ev;
+	struct bfd_notify_pending *bcs_bnpehash;
+	struct bnpelist bcs_bnpelist;
+
+	/* Statistics */
+	uint64_t bcs_notify_merged;
+	uint64_t bcs_notify_suppressed;
+	uint64_t bcs_queue_drops;
 
 	enum bc_msg_version bcs_version;
-	enum bc_msg_type bcs_type;
+
+	/* Control thread data. */
+	struct event bcs_ev;
+	struct event bcs_outev;
+	struct bcqueue bcs_bcqueue;
+	enum bc_msg_version bcs_rversion;
+	/* Reads and writes stopped (BCCT_CLOSE was sent). */
+	bool bcs_ioclosed;
+
+	/*
+	 * Input buffer: the data not parsed yet is between `bcs_inpos` and
+	 * `bcs_inlen`. There is always one spare byte after `bcs_insize`.
+	 */
+	uint8_t *bcs_inbuf;
+	size_t bcs_insize;
+	size_t bcs_inpos;
+	size_t bcs_inlen;
 
 	/* Message buffering */
-	struct bfd_control_buffer bcs_bin;
 	struct bfd_control_buffer *bcs_bout;
+
+	/* Messages sent only once per socket (so they can't fail). */
+	struct bfd_control_cmd bcs_closecmd;
+	struct bfd_control_queue bcs_closeq;
+	struct bfd_control_queue bcs_releaseq;
 };
 TAILQ_HEAD(bcslist, bfd_control_socket);
 
 int control_init(const char *path);
+void control_shutdown(void);
+struct bfd_control_msgref *control_msgref_new(enum bc_msg_version bmv,
+					      enum bc_msg_type bmt, uint16_t id,
+					      size_t datalen);
+void control_msgref_unref(struct bfd_control_msgref *bcmr);
 int control_notify_sla(bfd_session *bs);
 int control_notify(bfd_session *bs);
 int control_notify_config(const char *op, bfd_session *bs);
+int bulk_collect_cb(struct bfd_peer_cfg *bpc, void *arg);
+int control_notify_config_bulk(const char *op, bfd_session **bsv,
+			       size_t bscnt);
+
+/* Streaming JSON writer: see bfd_json.c. */
+struct json_writer {
+	char *jw_buf;
+	size_t jw_len;
+	size_t jw_size;
+	/* Nesting level and the levels that already have members. */
+	unsigned int jw_level;
+	uint64_t jw_members;
+	/* Memory allocation failed: the document is incomplete. */
+	bool jw_error;
+};
 
 /*
  * bfdd.c
  *
  * Daemon specific code.
  */
+struct bfd_repl_conn;
+TAILQ_HEAD(brclist, bfd_repl_conn);
+struct bfd_repl_standby;
+
+/* Session discriminator index entry: `bie_bs` is NULL for holes. */
+struct bs_index_entry {
+	uint32_t bie_discr;
+	bfd_session *bie_bs;
+};
+
 struct bfd_global {
 	int bg_shop;
 	int bg_mhop;
@@ -431,11 +814,105 @@ struct bfd_global {
 	int bg_vxlan;
 	struct event bg_ev[6];
 
+	/* Control thread: owns the control sockets (see control.c). */
+	pthread_t bg_cthread;
+	struct event_base *bg_ceb;
 	int bg_csock;
 	struct event bg_csockev;
-	struct bcslist bg_bcslist;
+	/* Commands to the protocol thread and output to the control thread. */
+	struct bfd_mbox bg_cmdq;
+	struct bfd_mbox bg_outq;
 
-	struct pllist bg_pllist;
+	struct bcslist bg_bcslist;
+	/* Control sockets output queue limits (0 is unlimited). */
+	size_t bg_cqbytes;
+	uint32_t bg_cqmsgs;
+	enum bfd_queue_policy bg_cqpolicy;
+
+	/* Last notification sequence number and the events journal. */
+	uint64_t bg_nseq;
+	struct bfd_journal_entry *bg_journal;
+	size_t bg_journal_size;
+
+	/* Shared memory status table (disabled when NULL). */
+	struct bfd_status_header *bg_shm;
+	size_t bg_shmlen;
+	uint32_t bg_shmentries;
+	uint32_t bg_shmnext;
+	struct event bg_shmev;
+
+	/* Warm restart state file (disabled when NULL). */
+	struct bfd_state_header *bg_state;
+	size_t bg_statelen;
+	uint32_t bg_stateentries;
+	uint32_t bg_statenext;
+	const char *bg_statepath;
+	/* Previous run checkpoints waiting for their sessions. */
+	struct bfd_state_saved *bg_stkeys;
+	struct bfd_state_saved *bg_stdiscrs;
+	/* Sockets and sessions were handed over by the previous daemon. */
+	bool bg_handover;
+
+	/* Replication to the standby daemons (see bfd_repl.c). */
+	int bg_rsock;
+	struct event bg_rsockev;
+	struct brclist bg_rconns;
+	/* Connection to the active daemon while in standby. */
+	struct bfd_repl_standby *bg_rstandby;
+	/* The sessions were replicated by the active daemon. */
+	bool bg_standby;
+
+	/* OpenMetrics exporter (see bfd_metrics.c). */
+	int bg_msock;
+	struct event bg_msockev;
+	uint32_t bg_mconns;
+	/* Only export the daemon totals instead of every session. */
+	bool bg_maggregate;
+	/*
+	 * Daemon totals kept up to date as they change: sessions per state
+	 * and the packet counters of all sessions, including removed ones.
+	 */
+	uint64_t bg_msessions[PTM_BFD_UP + 1];
+	bfd_session_stats_t bg_mstats;
+
+	/* Peer labels indexed by name. */
+	struct peer_label *bg_plhash;
+	/* Session profiles indexed by name. */
+	struct bfd_profile *bg_profiles;
+	/* Unnamed session profiles indexed by their parameters. */
+	struct bfd_profile *bg_uprofiles;
+	/* Peer ranges in configuration file order and their sessions reaper. */
+	struct bprlist bg_ranges;
+	struct event bg_rangeev;
+	/* Bulk created sessions waiting for their sockets. */
+	struct bsplist bg_sockq;
+	struct event bg_sockev;
+	/*
+	 * Sorted label index used for prefix lookups. It is only built on
+	 * demand and it is invalidated on every label insertion/removal.
+	 */
+	struct peer_label **bg_plindex;
+	size_t bg_plindexlen;
+	bool bg_plindex_valid;
+
+	/*
+	 * Sessions sorted by local discriminator used for paginated
+	 * queries and metrics scrapes. It is kept sorted on every session
+	 * insertion/removal: removed sessions leave a hole (NULL session)
+	 * until there are more holes than sessions and the index is
+	 * compacted.
+	 */
+	struct bs_index_entry *bg_bsindex;
+	size_t bg_bsindexlen;
+	size_t bg_bsindexsize;
+	size_t bg_bsindexholes;
+
+	/* JSON messages serialization buffer (protocol thread). */
+	struct json_writer bg_jw;
+
+	/* Configuration file path and its reload signal (SIGHUP). */
+	const char *bg_config;
+	struct event bg_sighupev;
 
 	struct event_base *bg_eb;
 };
@@ -448,19 +925,398 @@ extern struct bfd_global bglobal;
  * Contains the code related with loading/reloading configuration.
  */
 int parse_config(const char *);
-int config_request_add(const char *jsonstr);
-int config_request_del(const char *jsonstr);
-char *config_response(const char *status, const char *error);
-char *config_notify_sla(bfd_session *bs);
-char *config_notify(bfd_session *bs);
-char *config_notify_config(const char *op, bfd_session *bs);
+int parse_config_reload(const char *fname);
+struct bfd_control_msgref *config_response(uint16_t id, const char *status,
+					   const char *error,
+					   const uint8_t *results,
+					   size_t rescnt);
+struct bfd_control_msgref *config_notify_response(uint16_t id, uint64_t seq,
+						  bool resumed);
+struct bfd_control_msgref *config_notify_sla(bfd_session *bs, uint64_t seq);
+struct bfd_control_msgref *config_notify(bfd_session *bs, uint64_t seq);
+struct bfd_control_msgref *config_notify_config(const char *op,
+						bfd_session *bs, uint64_t seq);
+struct bfd_control_msgref *config_notify_config_bulk(const char *op,
+						     bfd_session **bsv,
+						     size_t bscnt,
+						     uint64_t seq);
 
 typedef int (*bpc_handle)(struct bfd_peer_cfg *, void *arg);
-int config_notify_request(struct bfd_control_socket *bcs, const char *jsonstr,
-			  bpc_handle bh);
+int config_notify_coalesce(const char *jsonstr, uint32_t *window);
+char *config_control_stats(void);
+struct bfd_control_msgref *config_notify_resync(uint64_t dropped);
+int config_query(const char *jsonstr, struct bfd_query *bq);
+char *config_query_response(bfd_session **bsv, size_t bscnt,
+			    uint32_t cursor);
+int config_request(const char *jsonstr, bpc_handle bh, void *arg);
+int config_request_nolabel(const char *jsonstr, bpc_handle bh, void *arg,
+			   bool *labels);
+int config_add(struct bfd_peer_cfg *bpc, void *arg);
+int config_del(struct bfd_peer_cfg *bpc, void *arg);
+void bpc_set_defaults(struct bfd_peer_cfg *bpc);
+
+typedef int (*pl_handle)(struct peer_label *pl, void *arg);
 
 struct peer_label *pl_new(const char *label, bfd_session *bs);
 struct peer_label *pl_find(const char *label);
+int pl_rename(struct peer_label *pl, const char *label);
+int pl_foreach_prefix(const char *prefix, pl_handle h, void *arg);
+void pl_free(struct peer_label *pl);
+void pl_to_bpc(struct peer_label *pl, struct bfd_peer_cfg *bpc);
+
+typedef int (*bp_handle)(struct bfd_profile *bp, void *arg);
+
+void profile_set_defaults(struct bfd_profile *bp);
+struct bfd_profile *profile_new(const struct bfd_profile *bpt);
+struct bfd_profile *profile_find(const char *name);
+struct bfd_profile *profile_unnamed(const struct bfd_profile *bpt);
+struct bfd_profile *profile_replace(struct bfd_profile *bp,
+				    const struct bfd_profile *bpt);
+bool profile_cmp(const struct bfd_profile *bp, const struct bfd_profile *bpt);
+void profile_set(struct bfd_profile *bp, const struct bfd_profile *bpt);
+void profile_unref(struct bfd_profile *bp);
+void profile_free(struct bfd_profile *bp);
+int profile_to_bpc(struct bfd_peer_cfg *bpc);
+
+typedef int (*bpr_handle)(struct bfd_peer_range *bpr, void *arg);
+
+int parse_peer_range(const char *str, int family, struct sockaddr_any *first,
+		     struct sockaddr_any *last);
+void bpc_fill_defaults(struct bfd_peer_cfg *bpc);
+
+
+/*
+ * bfd_range.c
+ *
+ * Peer ranges: sessions created on demand.
+ */
+/* Default sessions limit of a range. */
+#define BFD_RANGE_SESSIONS 1024
+/* Default time (seconds) before a down range session is deleted. */
+#define BFD_RANGE_DOWN_TIMEOUT 300
+/* Down range sessions check interval (seconds). */
+#define BFD_RANGE_REAP_INTERVAL 10
+
+void range_init(void);
+int range_addrcmp(const struct sockaddr_any *sa,
+		  const struct sockaddr_any *sb);
+bfd_session *range_session_new(char *port_name, struct sockaddr_any *peer,
+			       struct sockaddr_any *local, char *vrf_name,
+			       bool is_mhop);
+struct bfd_peer_range *range_session_bpc(bfd_session *bs,
+					 struct bfd_peer_cfg *bpc);
+void range_session_link(struct bfd_peer_range *bpr, bfd_session *bs);
+void range_session_unlink(bfd_session *bs);
+void range_free(struct bfd_peer_range *bpr);
+
+
+/*
+ * bfd_binconfig.c
+ *
+ * Control socket binary protocol (BMV_VERSION_2) handling.
+ */
+int binconfig_request(const uint8_t *data, size_t datalen, bpc_handle h,
+		      void *arg);
+int binconfig_request_nolabel(const uint8_t *data, size_t datalen,
+			      bpc_handle h, void *arg, bool *labels);
+void sa_to_bct(struct sockaddr_any *sa, uint8_t *addr);
+int binconfig_notify_flags(const uint8_t *data, size_t datalen,
+			   uint64_t *flags, uint64_t *seq);
+int binconfig_notify_coalesce(const uint8_t *data, size_t datalen,
+			      uint32_t *window);
+struct bfd_control_msgref *binconfig_control_stats(uint16_t id);
+struct bfd_control_msgref *binconfig_notify_resync(uint64_t dropped);
+int binconfig_query(const uint8_t *data, size_t datalen, struct bfd_query *bq);
+struct bfd_control_msgref *binconfig_query_response(uint16_t id,
+						    bfd_session **bsv,
+						    size_t bscnt,
+						    uint32_t cursor);
+struct bfd_control_msgref *binconfig_response(uint16_t id, const char *status,
+					      const char *error,
+					      const uint8_t *results,
+					      size_t rescnt);
+struct bfd_control_msgref *binconfig_notify_response(uint16_t id,
+						     uint64_t seq,
+						     bool resumed);
+struct bfd_control_msgref *binconfig_notify(bfd_session *bs, uint64_t seq);
+struct bfd_control_msgref *binconfig_notify_config(const char *op,
+						   bfd_session *bs,
+						   uint64_t seq);
+struct bfd_control_msgref *binconfig_notify_config_bulk(const char *op,
+							bfd_session **bsv,
+							size_t bscnt,
+							uint64_t seq);
+struct bfd_control_msgref *binconfig_notify_sla(bfd_session *bs,
+						uint64_t seq);
+
+
+/*
+ * bfd_shm.c
+ *
+ * Shared memory sessions status table.
+ */
+#define BFD_STATUS_ENTRIES 8192
+
+int bfd_shm_init(const char *path);
+void bfd_shm_add(bfd_session *bs);
+void bfd_shm_del(bfd_session *bs);
+void bfd_shm_update(bfd_session *bs);
+void bfd_shm_refresh(bfd_session *bs);
+
+
+/*
+ * bfd_state.c
+ *
+ * Warm restart: the sessions protocol state is checkpointed in a memory
+ * mapped file, so a restarted daemon resumes its sessions with the same
+ * discriminators, state and timers instead of bringing them down.
+ */
+#define BFD_STATE_MAGIC 0x42464453 /* "BFDS" */
+#define BFD_STATE_VERSION 1
+#define BFD_STATE_ENTRIES 8192
+
+struct bfd_state_header {
+	uint32_t bsf_magic;
+	uint32_t bsf_version;
+	uint32_t bsf_entry_size;
+	uint32_t bsf_entries;
+};
+
+/* Session hash key: same layout for every session type. */
+struct bfd_state_key {
+	bool bsk_multihop;
+	union {
+		bfd_shop_key bsk_shop;
+		bfd_mhop_key bsk_mhop;
+	};
+};
+
+struct bfd_state_entry {
+	/* Odd while the entry is written: torn entries are not restored. */
+	uint32_t bst_seq;
+	/* Local discriminator, zero on free entries. */
+	uint32_t bst_discr;
+	uint32_t bst_remote_discr;
+	/* BFD_SESS_FLAG_* */
+	uint32_t bst_flags;
+	uint8_t bst_state;
+	uint8_t bst_diag;
+	uint8_t bst_detect_mult;
+	uint8_t bst_remote_detect_mult;
+	/* Control packets source port. */
+	uint16_t bst_port;
+	uint32_t bst_up_min_tx;
+	bfd_timers_t bst_timers;
+	bfd_timers_t bst_remote_timers;
+	uint64_t bst_xmt_TO;
+	uint64_t bst_detect_TO;
+	struct timeval bst_uptime;
+	struct timeval bst_downtime;
+	struct bfd_state_key bst_key;
+	struct sockaddr_any bst_local;
+	char bst_label[MAXNAMELEN];
+	char bst_profile[MAXNAMELEN];
+};
+
+struct bfd_state_saved {
+	UT_hash_handle bss_kh; /* use session key as key */
+	UT_hash_handle bss_dh; /* use discriminator as key */
+	struct bfd_state_entry bss_entry;
+	/* Handed over session socket (or -1). */
+	int bss_sock;
+	bool bss_restored;
+	/* Resumed before the configuration was loaded. */
+	bool bss_resumed;
+};
+
+int bfd_state_init(const char *path);
+int bfd_state_saved_add(struct bfd_state_entry *bst, int sd);
+void bfd_state_saved_del(struct bfd_state_entry *bst);
+void bfd_state_saved_clear(void);
+void bfd_state_resume(void);
+void bfd_state_finish(void);
+uint16_t bfd_state_port(struct bfd_peer_cfg *bpc);
+int bfd_state_socket(struct bfd_peer_cfg *bpc);
+bool bfd_state_reserved(uint32_t discr);
+bool bfd_state_restore(bfd_session *bs, struct bfd_peer_cfg *bpc);
+void bfd_state_fill(bfd_session *bs, struct bfd_state_entry *bst);
+void bfd_state_add(bfd_session *bs);
+void bfd_state_del(bfd_session *bs);
+void bfd_state_update(bfd_session *bs);
+
+
+/*
+ * bfd_handover.c
+ *
+ * Sockets and sessions handover to a new daemon (zero downtime upgrades).
+ */
+#define BFD_HANDOVER_MAGIC 0x42464448 /* "BFDH" */
+/* Listening sockets slots (see handover_listener()). */
+#define BFD_HANDOVER_LISTENERS 9
+/* Sockets per message (SCM_RIGHTS is limited to 253). */
+#define BFD_HANDOVER_FDS 64
+/* Transfer timeout in seconds: the sessions are frozen meanwhile. */
+#define BFD_HANDOVER_TIMEOUT 5
+
+enum bfd_handover_type {
+	BHT_LISTENERS = 1,
+	BHT_SESSIONS = 2,
+	BHT_END = 3,
+};
+
+struct bfd_handover_hdr {
+	uint32_t bhh_magic;
+	uint16_t bhh_type;
+	/* Number of entries and sockets of the message. */
+	uint16_t bhh_count;
+};
+
+/*
+ * Sockets and sessions snapshot: taken by the protocol thread and sent by
+ * the control thread, which owns the connection.
+ */
+struct bfd_handover {
+	uint32_t bho_slots[BFD_HANDOVER_LISTENERS];
+	int bho_lfds[BFD_HANDOVER_LISTENERS];
+	size_t bho_lcnt;
+	struct bfd_state_entry *bho_bstv;
+	int *bho_fds;
+	size_t bho_cnt;
+
+	/* Transfer result (atomic), signaled on the `bho_efd` eventfd. */
+	int bho_result;
+	int bho_efd;
+};
+
+struct bfd_handover *bfd_handover_prepare(void);
+int bfd_handover_send(struct bfd_handover *bho, int sd);
+void bfd_handover_done(struct bfd_handover *bho, int result);
+int bfd_handover_wait(struct bfd_handover *bho);
+void bfd_handover_free(struct bfd_handover *bho);
+int bfd_handover_recv(const char *path);
+
+
+/*
+ * bfd_repl.c
+ *
+ * Active/standby replication: a standby daemon keeps a copy of the active
+ * daemon sessions and resumes them when the active daemon is gone.
+ */
+#define BFD_REPL_MAGIC 0x42464452 /* "BFDR" */
+/*
+ * Pending output of a standby connection: past it, the updates are
+ * collapsed per session until the output is written.
+ */
+#define BFD_REPL_QUEUE (16 * 1024 * 1024)
+/* Snapshot or collapsed updates messages queued per write. */
+#define BFD_REPL_CHUNK 256
+/* Standby statistics log interval (seconds). */
+#define BFD_REPL_STATS_INTERVAL 10
+/* Maximum wait for the active daemon to release its ports (ms). */
+#define BFD_REPL_RELEASE_WAIT 1000
+
+enum bfd_repl_type {
+	BRT_UPDATE = 1,
+	BRT_DELETE = 2,
+	/* End of the sessions snapshot sent to a new standby. */
+	BRT_SYNCED = 3,
+};
+
+struct bfd_repl_msg {
+	uint32_t brm_magic;
+	uint32_t brm_type;
+	/* Active daemon monotonic time in microseconds (lag measurement). */
+	uint64_t brm_time;
+	struct bfd_state_entry brm_entry;
+};
+
+/* Active side: session updated while the standby output was full. */
+struct bfd_repl_pending {
+	UT_hash_handle brp_hh; /* use discriminator as key */
+	uint32_t brp_discr;
+};
+
+/* Active side: a connected standby. */
+struct bfd_repl_conn {
+	TAILQ_ENTRY(bfd_repl_conn) brc_entry;
+
+	int brc_sd;
+	struct event brc_rev;
+	struct event brc_wev;
+
+	/* Pending output. */
+	uint8_t *brc_buf;
+	size_t brc_size;
+	size_t brc_len;
+	size_t brc_pos;
+
+	/* Snapshot in progress: last discriminator sent. */
+	bool brc_snapshot;
+	uint32_t brc_cursor;
+	/* Sessions to send once the output is written. */
+	struct bfd_repl_pending *brc_pending;
+
+	uint64_t brc_msgs;
+	uint64_t brc_bytes;
+};
+
+struct bfd_repl_stats {
+	uint64_t brs_msgs;
+	uint64_t brs_bytes;
+	/* Sum and maximum of the messages lag in microseconds. */
+	uint64_t brs_lag;
+	uint64_t brs_lagmax;
+};
+
+/* Standby side: the active daemon connection. */
+struct bfd_repl_standby {
+	const char *brs_path;
+	int brs_sd;
+	struct event brs_ev;
+	struct event brs_statsev;
+
+	/* Partially read message. */
+	struct bfd_repl_msg brs_msg;
+	size_t brs_msglen;
+	/* Reconnected: the saved sessions are replaced by the snapshot. */
+	bool brs_resync;
+
+	/* Statistics of the current interval and since the start. */
+	struct bfd_repl_stats brs_interval;
+	struct bfd_repl_stats brs_total;
+	struct timeval brs_start;
+};
+
+int bfd_repl_init(const char *path);
+int bfd_repl_standby(const char *path);
+void bfd_repl_update(bfd_session *bs);
+void bfd_repl_delete(bfd_session *bs);
+
+
+/*
+ * bfd_metrics.c
+ *
+ * OpenMetrics exporter.
+ */
+int bfd_metrics_init(const char *address);
+void bfd_metrics_add(bfd_session *bs);
+void bfd_metrics_del(bfd_session *bs);
+
+
+/*
+ * bfd_json.c
+ *
+ * Streaming JSON writer.
+ */
+void jw_reset(struct json_writer *jw);
+void jw_object_start(struct json_writer *jw, const char *key);
+void jw_object_end(struct json_writer *jw);
+void jw_array_start(struct json_writer *jw, const char *key);
+void jw_array_end(struct json_writer *jw);
+void jw_string(struct json_writer *jw, const char *key, const char *str);
+void jw_int(struct json_writer *jw, const char *key, int64_t value);
+void jw_bool(struct json_writer *jw, const char *key, bool value);
+void jw_double(struct json_writer *jw, const char *key, double value);
 
 
 /*
@@ -509,8 +1365,8 @@ int bp_udp6_shop(void);
 int bp_udp6_mhop(void);
 int ptm_bfd_echo_sock_init(void);
 int ptm_bfd_vxlan_sock_init(void);
-int bp_peer_socket(struct bfd_peer_cfg *bpc);
-int bp_peer_socketv6(struct bfd_peer_cfg *bpc);
+int bp_peer_socket(struct bfd_peer_cfg *bpc, uint16_t port);
+int bp_peer_socketv6(struct bfd_peer_cfg *bpc, uint16_t port);
 
 void ptm_bfd_snd(bfd_session *bfd, int fbit);
 void ptm_bfd_echo_snd(bfd_session *bfd);
@@ -535,8 +1391,8 @@ void bfd_echo_xmttimer_delete(bfd_session *bs);
 void bfd_recvtimer_delete(bfd_session *bs);
 void bfd_echo_recvtimer_delete(bfd_session *bs);
 
-void bfd_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb, int sd);
-void bfd_echo_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb, int sd);
+void bfd_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb);
+void bfd_echo_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb);
 void bfd_xmttimer_assign(bfd_session *bs, bfd_ev_cb cb);
 void bfd_echo_xmttimer_assign(bfd_session *bs, bfd_ev_cb cb);
 
@@ -550,6 +1406,7 @@ size_t strxcpy(char *dst, const char *src, size_t len);
 const char *satostr(struct sockaddr_any *sa);
 int strtosa(const char *addr, struct sockaddr_any *sa);
 time_t get_monotime(struct timeval *tv);
+uint64_t get_monotime_ns(void);
 
 
 /*
@@ -558,10 +1415,37 @@ time_t get_monotime(struct timeval *tv);
  * BFD protocol specific code.
  */
 extern bfd_state_str_list state_list[];
+extern bfd_session *session_hash;
+
+typedef int (*bs_handle)(bfd_session *bs, void *arg);
+
+/* Configuration reload churn. */
+struct bfd_reload_stats {
+	uint32_t brs_added;
+	uint32_t brs_updated;
+	uint32_t brs_deleted;
+	uint32_t brs_unchanged;
+	uint32_t brs_profiles;
+	uint32_t brs_profiled;
+	uint32_t brs_errors;
+};
 
 bfd_session *bs_session_find(uint32_t discr);
+int bs_foreach_discr(uint32_t discr, bs_handle h, void *arg);
+void bs_state_set(bfd_session *bs, uint8_t state);
+bfd_session *bs_peer_find(struct bfd_peer_cfg *bpc);
 bfd_session *ptm_bfd_sess_new(struct bfd_peer_cfg *bpc);
 int ptm_bfd_ses_del(struct bfd_peer_cfg *bpc);
+int bfd_session_delete(bfd_session *bs);
+void bfd_socket_cb(evutil_socket_t sd, short ev, void *arg);
+void bfd_socket_flush(void);
+int ptm_bfd_sess_bulk_new(struct bfd_peer_cfg *bpcv, size_t bpccnt,
+			  uint8_t *results);
+int ptm_bfd_ses_bulk_del(struct bfd_peer_cfg *bpcv, size_t bpccnt,
+			 uint8_t *results);
+void ptm_bfd_sess_reload(struct bfd_peer_cfg *bpcv, size_t bpccnt,
+			 struct bfd_profile *bpv, size_t bpcnt,
+			 struct bfd_reload_stats *brs);
 void ptm_bfd_ses_dn(bfd_session *bfd, uint8_t diag);
 void ptm_bfd_ses_up(bfd_session *bfd);
 void fetch_portname_from_ifindex(int ifindex, char *ifname, size_t ifnamelen);
@@ -578,8 +1462,23 @@ bfd_session *ptm_bfd_sess_find(bfd_pkt_t *cp, char *port_name,
 bfd_session *bfd_find_shop(bfd_shop_key *k);
 bfd_session *bfd_find_mhop(bfd_mhop_key *k);
 
+
 /*
- * sla calculations.
+ * bfd_sla.c
+ *
+ * SLA measurement: round trip times of the echo packets and of the poll
+ * sequences, on CLOCK_MONOTONIC nanosecond timestamps.
  */
-void ptm_bfd_send_sla_update(bfd_session *bfd, struct timeval *recv_tv);
+/* Samples above it are discarded (nanoseconds). */
+#define BFD_SLA_RTT_MAX 10000000000ULL
+/* Maximum distance of a kernel timestamp to its packet send call. */
+#define BFD_SLA_TXSTAMP_SKEW 10000000ULL
+
+void bfd_sla_start(bfd_session *bs);
+void bfd_sla_stop(bfd_session *bs);
+void bfd_sla_echo_stamp(bfd_session *bs, bfd_echo_pkt_t *ep);
+void bfd_sla_sent(bfd_session *bs, uint64_t polltx);
+uint64_t bfd_sla_rxtime(int sd, uint64_t rxtime);
+void ptm_bfd_send_sla_update(bfd_session *bfd, uint64_t rxtime,
+			     const bfd_echo_pkt_t *ep, bool final);
 #endif /* _BFD_H_ */
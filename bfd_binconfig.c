@@ -0,0 +1,784 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_binconfig.c: implements the control socket binary protocol
+ * (BMV_VERSION_2) encoding and decoding. It is the binary counterpart of
+ * the JSON handling in 'bfd_config.c'.
+ */
+
+#include <endian.h>
+#include <string.h>
+
+#include "bfd.h"
+
+/*
+ * Definitions
+ */
+typedef int (*bct_handle)(uint16_t type, const uint8_t *value, uint16_t len,
+			  void *arg);
+
+struct binconfig_arg {
+	bpc_handle ba_h;
+	void *ba_arg;
+};
+
+
+/*
+ * Prototypes
+ */
+int bct_foreach(const uint8_t *data, size_t datalen, bct_handle h, void *arg);
+uint8_t *bct_put(uint8_t *buf, uint16_t type, const void *value, size_t len);
+void bct_strcpy(char *dst, size_t dstlen, const char *src);
+void bct_to_sa(const uint8_t *addr, bool ipv4, struct sockaddr_any *sa);
+
+int binconfig_parse_peer(const uint8_t *value, uint16_t len,
+			 struct bfd_peer_cfg *bpc);
+void binconfig_peer(bfd_session *bs, struct bfd_control_peer *bcp);
+void binconfig_peer_state(bfd_session *bs,
+			  struct bfd_control_peer_state *bcps);
+void binconfig_peer_sla(bfd_session *bs, struct bfd_control_peer_sla *bcpl);
+uint8_t *binconfig_put_config(uint8_t *buf, const char *op, bfd_session *bs);
+
+
+/*
+ * TLV helpers
+ */
+
+/*
+ * Calls `h` for every TLV found in `data`. Returns -1 if the TLV list is
+ * malformed, otherwise the sum of the handler return values.
+ */
+int bct_foreach(const uint8_t *data, size_t datalen, bct_handle h, void *arg)
+{
+	struct bfd_control_tlv bct;
+	size_t pos = 0, tlvlen;
+	int error = 0;
+
+	while (pos < datalen) {
+		if (datalen - pos < sizeof(bct)) {
+			log_debug("%s: truncated TLV header\n", __FUNCTION__);
+			return -1;
+		}
+
+		memcpy(&bct, &data[pos], sizeof(bct));
+		bct.bct_type = ntohs(bct.bct_type);
+		bct.bct_length = ntohs(bct.bct_length);
+		tlvlen = BCT_TOTLEN(bct.bct_length);
+		if (tlvlen > datalen - pos) {
+			log_debug("%s: truncated TLV (type %d, length %d)\n",
+				  __FUNCTION__, bct.bct_type, bct.bct_length);
+			return -1;
+		}
+
+		error += h(bct.bct_type, &data[pos + sizeof(bct)],
+			   bct.bct_length, arg);
+		pos += tlvlen;
+	}
+
+	return error;
+}
+
+/* Writes a TLV (and its padding) to `buf` and returns the next position. */
+uint8_t *bct_put(uint8_t *buf, uint16_t type, const void *value, size_t len)
+{
+	struct bfd_control_tlv bct = {
+		.bct_type = htons(type), .bct_length = htons(len),
+	};
+
+	memcpy(buf, &bct, sizeof(bct));
+	memcpy(&buf[sizeof(bct)], value, len);
+	memset(&buf[sizeof(bct) + len], 0, BCT_ALIGN(len) - len);
+
+	return &buf[BCT_TOTLEN(len)];
+}
+
+/* Copies a fixed size (not NULL terminated) TLV string. */
+void bct_strcpy(char *dst, size_t dstlen, const char *src)
+{
+	size_t len;
+
+	len = strnlen(src, MAXNAMELEN);
+	if (len >= dstlen)
+		len = dstlen - 1;
+
+	memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+void bct_to_sa(const uint8_t *addr, bool ipv4, struct sockaddr_any *sa)
+{
+	memset(sa, 0, sizeof(*sa));
+	if (ipv4) {
+		sa->sa_sin.sin_family = AF_INET;
+		memcpy(&sa->sa_sin.sin_addr, addr,
+		       sizeof(sa->sa_sin.sin_addr));
+	} else {
+		sa->sa_sin6.sin6_family = AF_INET6;
+		memcpy(&sa->sa_sin6.sin6_addr, addr,
+		       sizeof(sa->sa_sin6.sin6_addr));
+	}
+}
+
+void sa_to_bct(struct sockaddr_any *sa, uint8_t *addr)
+{
+	if (sa->sa_sin.sin_family == AF_INET)
+		memcpy(addr, &sa->sa_sin.sin_addr, sizeof(sa->sa_sin.sin_addr));
+	else if (sa->sa_sin6.sin6_family == AF_INET6)
+		memcpy(addr, &sa->sa_sin6.sin6_addr,
+		       sizeof(sa->sa_sin6.sin6_addr));
+}
+
+
+/*
+ * Control socket binary parsing.
+ */
+int binconfig_parse_peer(const uint8_t *value, uint16_t len,
+			 struct bfd_peer_cfg *bpc)
+{
+	struct bfd_control_peer bcp;
+	struct peer_label *pl;
+	char label[MAXNAMELEN];
+	uint32_t flags;
+
+	/* Accept bigger TLVs so the structure can grow in the future. */
+	if (len < sizeof(bcp)) {
+		log_debug("%s: invalid peer TLV length: %d\n", __FUNCTION__,
+			  len);
+		return -1;
+	}
+
+	memcpy(&bcp, value, sizeof(bcp));
+	flags = ntohl(bcp.bcp_flags);
+
+	bpc_set_defaults(bpc);
+
+	if (flags & BCP_F_HAS_PEER) {
+		bpc->bpc_ipv4 = (flags & BCP_F_IPV6) == 0;
+		bpc->bpc_mhop = (flags & BCP_F_MHOP) != 0;
+		bct_to_sa(bcp.bcp_peer, bpc->bpc_ipv4, &bpc->bpc_peer);
+		if (flags & BCP_F_HAS_LOCAL)
+			bct_to_sa(bcp.bcp_local, bpc->bpc_ipv4,
+				  &bpc->bpc_local);
+		if (flags & BCP_F_HAS_LOCALIF) {
+			bpc->bpc_has_localif = true;
+			bct_strcpy(bpc->bpc_localif, sizeof(bpc->bpc_localif),
+				   bcp.bcp_localif);
+		}
+		if (flags & BCP_F_HAS_VRFNAME) {
+			bpc->bpc_has_vrfname = true;
+			bct_strcpy(bpc->bpc_vrfname, sizeof(bpc->bpc_vrfname),
+				   bcp.bcp_vrfname);
+		}
+	} else if (flags & BCP_F_HAS_LABEL) {
+		/* Translate the label into the BFD daemon key. */
+		bct_strcpy(label, sizeof(label), bcp.bcp_label);
+		pl = pl_find(label);
+		if (pl == NULL) {
+			log_debug("%s: unknown peer label: %s\n", __FUNCTION__,
+				  label);
+			return -1;
+		}
+
+		pl_to_bpc(pl, bpc);
+	} else {
+		log_debug("%s: no peer address provided\n", __FUNCTION__);
+		return -1;
+	}
+
+	if (flags & BCP_F_HAS_LABEL) {
+		bpc->bpc_has_label = true;
+		bct_strcpy(bpc->bpc_label, sizeof(bpc->bpc_label),
+			   bcp.bcp_label);
+	}
+	if (flags & BCP_F_HAS_DISCR) {
+		bpc->bpc_has_discr = true;
+		bpc->bpc_discr = ntohl(bcp.bcp_discr);
+	}
+	if (flags & BCP_F_HAS_DETECTMULTIPLIER) {
+		bpc->bpc_has_detectmultiplier = true;
+		bpc->bpc_detectmultiplier = bcp.bcp_detectmultiplier;
+	}
+	if (flags & BCP_F_HAS_RECVINTERVAL) {
+		bpc->bpc_has_recvinterval = true;
+		bpc->bpc_recvinterval = ntohl(bcp.bcp_recvinterval);
+	}
+	if (flags & BCP_F_HAS_TXINTERVAL) {
+		bpc->bpc_has_txinterval = true;
+		bpc->bpc_txinterval = ntohl(bcp.bcp_txinterval);
+	}
+	if (flags & BCP_F_HAS_ECHOINTERVAL) {
+		bpc->bpc_has_echointerval = true;
+		bpc->bpc_echointerval = ntohl(bcp.bcp_echointerval);
+	}
+
+	bpc->bpc_echo = (flags & BCP_F_ECHO) != 0;
+	bpc->bpc_shutdown = (flags & BCP_F_SHUTDOWN) != 0;
+	bpc->bpc_createonly = (flags & BCP_F_CREATEONLY) != 0;
+	bpc->bpc_track_sla = (flags & BCP_F_TRACK_SLA) != 0;
+
+	return 0;
+}
+
+static int _binconfig_request(uint16_t type, const uint8_t *value,
+			      uint16_t len, void *arg)
+{
+	struct binconfig_arg *ba = arg;
+	struct bfd_peer_cfg bpc;
+
+	if (type != BCT_PEER) {
+		log_debug("%s: unexpected TLV type: %d\n", __FUNCTION__, type);
+		return 1;
+	}
+
+	if (binconfig_parse_peer(value, len, &bpc) != 0)
+		return 1;
+
+	return ba->ba_h(&bpc, ba->ba_arg) != 0;
+}
+
+int binconfig_request(const uint8_t *data, size_t datalen, bpc_handle h,
+		      void *arg)
+{
+	struct binconfig_arg ba = {
+		.ba_h = h, .ba_arg = arg,
+	};
+
+	return bct_foreach(data, datalen, _binconfig_request, &ba);
+}
+
+static int _binconfig_label_peers(uint16_t type, const uint8_t *value,
+				  uint16_t len, void *arg __attribute__((unused)))
+{
+	struct bfd_control_peer bcp;
+	uint32_t flags;
+
+	if (type != BCT_PEER || len < sizeof(bcp))
+		return 0;
+
+	memcpy(&bcp, value, sizeof(bcp));
+	flags = ntohl(bcp.bcp_flags);
+
+	return (flags & BCP_F_HAS_PEER) == 0 && (flags & BCP_F_HAS_LABEL);
+}
+
+/*
+ * Like `binconfig_request`, but doesn't look up peer labels so it is safe
+ * to use outside the protocol thread: requests with peers only known by
+ * their labels are not parsed and `labels` is set instead.
+ */
+int binconfig_request_nolabel(const uint8_t *data, size_t datalen,
+			      bpc_handle h, void *arg, bool *labels)
+{
+	*labels = bct_foreach(data, datalen, _binconfig_label_peers, NULL) > 0;
+	if (*labels)
+		return 0;
+
+	return binconfig_request(data, datalen, h, arg);
+}
+
+static int _binconfig_notify_flags(uint16_t type, const uint8_t *value,
+				   uint16_t len, void *arg)
+{
+	uint64_t *flags = arg, *dst;
+
+	/* Flags followed by the optional sequence number to resume from. */
+	if (type == BCT_NOTIFY_FLAGS)
+		dst = &flags[0];
+	else if (type == BCT_SEQ)
+		dst = &flags[1];
+	else
+		dst = NULL;
+
+	if (dst == NULL || len != sizeof(*dst)) {
+		log_debug("%s: unexpected TLV (type %d, length %d)\n",
+			  __FUNCTION__, type, len);
+		return 1;
+	}
+
+	memcpy(dst, value, sizeof(*dst));
+	*dst = be64toh(*dst);
+
+	return 0;
+}
+
+int binconfig_notify_flags(const uint8_t *data, size_t datalen,
+			   uint64_t *flags, uint64_t *seq)
+{
+	uint64_t values[2] = {0, 0};
+
+	if (bct_foreach(data, datalen, _binconfig_notify_flags, values) != 0)
+		return -1;
+
+	*flags = values[0];
+	*seq = values[1];
+
+	return 0;
+}
+
+
+static int _binconfig_notify_coalesce(uint16_t type, const uint8_t *value,
+				      uint16_t len, void *arg)
+{
+	uint32_t *window = arg;
+
+	if (type != BCT_COALESCE || len != sizeof(*window)) {
+		log_debug("%s: unexpected TLV (type %d, length %d)\n",
+			  __FUNCTION__, type, len);
+		return 1;
+	}
+
+	memcpy(window, value, sizeof(*window));
+	*window = ntohl(*window);
+
+	return 0;
+}
+
+int binconfig_notify_coalesce(const uint8_t *data, size_t datalen,
+			      uint32_t *window)
+{
+	/* Use an invalid value to detect a missing TLV. */
+	*window = UINT32_MAX;
+	if (bct_foreach(data, datalen, _binconfig_notify_coalesce, window)
+	    != 0)
+		return -1;
+
+	return (*window <= BCM_COALESCE_MAX) ? 0 : -1;
+}
+
+static int _binconfig_query(uint16_t type, const uint8_t *value, uint16_t len,
+			    void *arg)
+{
+	struct bfd_query *bq = arg;
+	struct bfd_control_query bcq;
+
+	if (type != BCT_QUERY || len < sizeof(bcq)) {
+		log_debug("%s: unexpected TLV (type %d, length %d)\n",
+			  __FUNCTION__, type, len);
+		return 1;
+	}
+
+	memcpy(&bcq, value, sizeof(bcq));
+	bq->bq_flags = ntohl(bcq.bcq_flags);
+	bq->bq_cursor = ntohl(bcq.bcq_cursor);
+	bq->bq_limit = ntohl(bcq.bcq_limit);
+	if (bq->bq_limit == 0)
+		bq->bq_limit = BCM_QUERY_LIMIT;
+	if (bq->bq_limit > BCM_QUERY_LIMIT_MAX)
+		return 1;
+
+	/* enum bfd_peer_status maps to the session states. */
+	bq->bq_state = bcq.bcq_state;
+	bct_strcpy(bq->bq_label, sizeof(bq->bq_label), bcq.bcq_label);
+	bct_strcpy(bq->bq_localif, sizeof(bq->bq_localif), bcq.bcq_localif);
+	bct_strcpy(bq->bq_vrfname, sizeof(bq->bq_vrfname), bcq.bcq_vrfname);
+
+	return 0;
+}
+
+int binconfig_query(const uint8_t *data, size_t datalen, struct bfd_query *bq)
+{
+	memset(bq, 0, sizeof(*bq));
+	bq->bq_limit = BCM_QUERY_LIMIT;
+
+	return bct_foreach(data, datalen, _binconfig_query, bq);
+}
+
+
+/*
+ * Control socket binary messages.
+ */
+void binconfig_peer(bfd_session *bs, struct bfd_control_peer *bcp)
+{
+	uint32_t flags = BCP_F_HAS_PEER;
+
+	memset(bcp, 0, sizeof(*bcp));
+
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_IPV6))
+		flags |= BCP_F_IPV6;
+
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
+		flags |= BCP_F_MHOP | BCP_F_HAS_LOCAL;
+		sa_to_bct(&bs->mhop.peer, bcp->bcp_peer);
+		sa_to_bct(&bs->mhop.local, bcp->bcp_local);
+		if (bs->mhop.vrf_name[0]) {
+			flags |= BCP_F_HAS_VRFNAME;
+			strncpy(bcp->bcp_vrfname, bs->mhop.vrf_name,
+				sizeof(bcp->bcp_vrfname));
+		}
+	} else {
+		sa_to_bct(&bs->shop.peer, bcp->bcp_peer);
+		if (bs->local_ip.sa_sin.sin_family != AF_UNSPEC) {
+			flags |= BCP_F_HAS_LOCAL;
+			sa_to_bct(&bs->local_ip, bcp->bcp_local);
+		}
+		if (bs->shop.port_name[0]) {
+			flags |= BCP_F_HAS_LOCALIF;
+			strncpy(bcp->bcp_localif, bs->shop.port_name,
+				sizeof(bcp->bcp_localif));
+		}
+	}
+
+	if (bs->pl) {
+		flags |= BCP_F_HAS_LABEL;
+		strncpy(bcp->bcp_label, bs->pl->pl_label,
+			sizeof(bcp->bcp_label));
+	}
+
+	bcp->bcp_flags = htonl(flags);
+}
+
+struct bfd_control_msgref *binconfig_response(uint16_t id, const char *status,
+					      const char *error,
+					      const uint8_t *results,
+					      size_t rescnt)
+{
+	struct bfd_control_msgref *bcmr;
+	uint32_t bstatus;
+	size_t datalen, errorlen = 0;
+	uint8_t *buf;
+
+	/* The results vector must fit in a single TLV. */
+	if (rescnt > UINT16_MAX) {
+		log_warning("%s: too many results: %zu\n", __FUNCTION__,
+			    rescnt);
+		return NULL;
+	}
+
+	bstatus = (strcmp(status, BCM_RESPONSE_OK) == 0) ? BCS_STATUS_OK
+							 : BCS_STATUS_ERROR;
+	bstatus = htonl(bstatus);
+
+	datalen = BCT_TOTLEN(sizeof(bstatus));
+	if (error) {
+		errorlen = strlen(error);
+		datalen += BCT_TOTLEN(errorlen);
+	}
+	if (results)
+		datalen += BCT_TOTLEN(rescnt);
+
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_RESPONSE, id, datalen);
+	if (bcmr == NULL)
+		return NULL;
+
+	buf = bct_put(bcmr->bcmr_bcm->bcm_data, BCT_STATUS, &bstatus,
+		      sizeof(bstatus));
+	if (error)
+		buf = bct_put(buf, BCT_ERROR, error, errorlen);
+	if (results)
+		bct_put(buf, BCT_RESULTS, results, rescnt);
+
+	return bcmr;
+}
+
+void binconfig_peer_state(bfd_session *bs,
+			  struct bfd_control_peer_state *bcps)
+{
+	memset(bcps, 0, sizeof(*bcps));
+	bcps->bcps_id = htonl(bs->discrs.my_discr);
+	bcps->bcps_remoteid = htonl(bs->discrs.remote_discr);
+	bcps->bcps_state = bs->ses_state;
+	bcps->bcps_diag = bs->local_diag;
+	bcps->bcps_remotediag = bs->remote_diag;
+	if (bs->ses_state == PTM_BFD_UP)
+		bcps->bcps_time =
+			htonl(get_monotime(NULL) - bs->uptime.tv_sec);
+	else if (bs->ses_state == PTM_BFD_DOWN)
+		bcps->bcps_time =
+			htonl(get_monotime(NULL) - bs->downtime.tv_sec);
+}
+
+struct bfd_control_msgref *binconfig_notify_response(uint16_t id,
+						     uint64_t seq,
+						     bool resumed)
+{
+	struct bfd_control_msgref *bcmr;
+	uint32_t bstatus = htonl(BCS_STATUS_OK);
+	uint32_t bresumed = htonl(resumed);
+	uint64_t bseq = htobe64(seq);
+	uint8_t *buf;
+
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_RESPONSE, id,
+				  BCT_TOTLEN(sizeof(bstatus))
+					  + BCT_TOTLEN(sizeof(bseq))
+					  + BCT_TOTLEN(sizeof(bresumed)));
+	if (bcmr == NULL)
+		return NULL;
+
+	buf = bct_put(bcmr->bcmr_bcm->bcm_data, BCT_STATUS, &bstatus,
+		      sizeof(bstatus));
+	buf = bct_put(buf, BCT_SEQ, &bseq, sizeof(bseq));
+	bct_put(buf, BCT_RESUMED, &bresumed, sizeof(bresumed));
+
+	return bcmr;
+}
+
+struct bfd_control_msgref *binconfig_notify(bfd_session *bs, uint64_t seq)
+{
+	struct bfd_control_msgref *bcmr;
+	struct bfd_control_peer bcp;
+	struct bfd_control_peer_state bcps;
+	uint64_t bseq = htobe64(seq);
+	uint8_t *buf;
+
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_NOTIFY,
+				  htons(BCM_NOTIFY_ID),
+				  BCT_TOTLEN(sizeof(bseq))
+					  + BCT_TOTLEN(sizeof(bcp))
+					  + BCT_TOTLEN(sizeof(bcps)));
+	if (bcmr == NULL)
+		return NULL;
+
+	binconfig_peer(bs, &bcp);
+	binconfig_peer_state(bs, &bcps);
+
+	buf = bct_put(bcmr->bcmr_bcm->bcm_data, BCT_SEQ, &bseq, sizeof(bseq));
+	buf = bct_put(buf, BCT_PEER, &bcp, sizeof(bcp));
+	bct_put(buf, BCT_PEER_STATE, &bcps, sizeof(bcps));
+
+	return bcmr;
+}
+
+/* Writes the peer BCT_PEER and BCT_PEER_CONFIG pair. */
+uint8_t *binconfig_put_config(uint8_t *buf, const char *op, bfd_session *bs)
+{
+	struct bfd_control_peer bcp;
+	struct bfd_control_peer_config bcpc;
+	uint32_t flags = 0;
+
+	binconfig_peer(bs, &bcp);
+
+	/* Queries don't have operation. */
+	memset(&bcpc, 0, sizeof(bcpc));
+	if (op == NULL)
+		bcpc.bcpc_op = 0;
+	else if (strcmp(op, BCM_NOTIFY_CONFIG_ADD) == 0)
+		bcpc.bcpc_op = BCO_ADD;
+	else if (strcmp(op, BCM_NOTIFY_CONFIG_DELETE) == 0)
+		bcpc.bcpc_op = BCO_DELETE;
+	else
+		bcpc.bcpc_op = BCO_UPDATE;
+
+	/* On peer deletion we don't need to add any additional information. */
+	if (bcpc.bcpc_op == BCO_DELETE)
+		goto skip_config;
+
+	bcpc.bcpc_detectmultiplier = bs->profile->bp_detectmultiplier;
+	bcpc.bcpc_recvinterval = htonl(bs->profile->bp_recvinterval);
+	bcpc.bcpc_txinterval = htonl(bs->profile->bp_txinterval);
+	bcpc.bcpc_echointerval = htonl(bs->profile->bp_echointerval);
+
+	bcpc.bcpc_remote_detectmultiplier = bs->remote_detect_mult;
+	bcpc.bcpc_remote_recvinterval =
+		htonl(bs->remote_timers.required_min_rx / 1000);
+	bcpc.bcpc_remote_txinterval =
+		htonl(bs->remote_timers.desired_min_tx / 1000);
+	bcpc.bcpc_remote_echointerval =
+		htonl(bs->remote_timers.required_min_echo / 1000);
+
+	if (bs->profile->bp_echo)
+		flags |= BCP_F_ECHO;
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN))
+		flags |= BCP_F_SHUTDOWN;
+	if (bs->profile->bp_track_sla)
+		flags |= BCP_F_TRACK_SLA;
+	bcpc.bcpc_flags = htonl(flags);
+
+skip_config:
+	buf = bct_put(buf, BCT_PEER, &bcp, sizeof(bcp));
+	return bct_put(buf, BCT_PEER_CONFIG, &bcpc, sizeof(bcpc));
+}
+
+struct bfd_control_msgref *binconfig_notify_config(const char *op,
+						   bfd_session *bs,
+						   uint64_t seq)
+{
+	return binconfig_notify_config_bulk(op, &bs, 1, seq);
+}
+
+struct bfd_control_msgref *binconfig_notify_config_bulk(const char *op,
+							bfd_session **bsv,
+							size_t bscnt,
+							uint64_t seq)
+{
+	struct bfd_control_msgref *bcmr;
+	uint64_t bseq = htobe64(seq);
+	uint8_t *buf;
+	size_t idx, datalen;
+
+	datalen = bscnt * (BCT_TOTLEN(sizeof(struct bfd_control_peer))
+			   + BCT_TOTLEN(sizeof(struct bfd_control_peer_config)));
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_NOTIFY,
+				  htons(BCM_NOTIFY_ID),
+				  BCT_TOTLEN(sizeof(bseq)) + datalen);
+	if (bcmr == NULL)
+		return NULL;
+
+	buf = bct_put(bcmr->bcmr_bcm->bcm_data, BCT_SEQ, &bseq, sizeof(bseq));
+	for (idx = 0; idx < bscnt; idx++)
+		buf = binconfig_put_config(buf, op, bsv[idx]);
+
+	return bcmr;
+}
+
+void binconfig_peer_sla(bfd_session *bs, struct bfd_control_peer_sla *bcpl)
+{
+	memset(bcpl, 0, sizeof(*bcpl));
+	bcpl->bcpl_id = htonl(bs->discrs.my_discr);
+	bcpl->bcpl_remoteid = htonl(bs->discrs.remote_discr);
+	/* Latency and jitter are kept in microseconds, loss in percentage. */
+	bcpl->bcpl_latency = htonl(bs->sla.lattency);
+	bcpl->bcpl_jitter = htonl(bs->sla.jitter);
+	bcpl->bcpl_pkt_loss = htonl(bs->sla.pkt_loss * 10000); /* ppm */
+}
+
+struct bfd_control_msgref *binconfig_notify_sla(bfd_session *bs,
+						uint64_t seq)
+{
+	struct bfd_control_msgref *bcmr;
+	struct bfd_control_peer bcp;
+	struct bfd_control_peer_sla bcpl;
+	uint64_t bseq = htobe64(seq);
+	uint8_t *buf;
+
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_NOTIFY_SLA,
+				  htons(BCM_NOTIFY_ID),
+				  BCT_TOTLEN(sizeof(bseq))
+					  + BCT_TOTLEN(sizeof(bcp))
+					  + BCT_TOTLEN(sizeof(bcpl)));
+	if (bcmr == NULL)
+		return NULL;
+
+	binconfig_peer(bs, &bcp);
+	binconfig_peer_sla(bs, &bcpl);
+
+	buf = bct_put(bcmr->bcmr_bcm->bcm_data, BCT_SEQ, &bseq, sizeof(bseq));
+	buf = bct_put(buf, BCT_PEER, &bcp, sizeof(bcp));
+	bct_put(buf, BCT_PEER_SLA, &bcpl, sizeof(bcpl));
+
+	return bcmr;
+}
+
+struct bfd_control_msgref *binconfig_notify_resync(uint64_t dropped)
+{
+	struct bfd_control_msgref *bcmr;
+	uint64_t bdropped = htobe64(dropped);
+
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_NOTIFY,
+				  htons(BCM_NOTIFY_ID),
+				  BCT_TOTLEN(sizeof(bdropped)));
+	if (bcmr == NULL)
+		return NULL;
+
+	bct_put(bcmr->bcmr_bcm->bcm_data, BCT_RESYNC, &bdropped,
+		sizeof(bdropped));
+
+	return bcmr;
+}
+
+struct bfd_control_msgref *binconfig_control_stats(uint16_t id)
+{
+	struct bfd_control_msgref *bcmr;
+	struct bfd_control_socket *bcs;
+	struct bfd_control_stats bcst;
+	uint32_t bstatus = htonl(BCS_STATUS_OK);
+	size_t datalen, bcscnt = 0;
+	uint8_t *buf;
+
+	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry)
+		bcscnt++;
+
+	datalen = BCT_TOTLEN(sizeof(bstatus))
+		  + bcscnt * BCT_TOTLEN(sizeof(bcst));
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_RESPONSE, id, datalen);
+	if (bcmr == NULL)
+		return NULL;
+
+	buf = bct_put(bcmr->bcmr_bcm->bcm_data, BCT_STATUS, &bstatus,
+		      sizeof(bstatus));
+	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
+		memset(&bcst, 0, sizeof(bcst));
+		bcst.bcst_sd = htonl(bcs->bcs_sd);
+		bcst.bcst_coalesce = htonl(bcs->bcs_coalesce);
+		bcst.bcst_notify_merged = htobe64(bcs->bcs_notify_merged);
+		bcst.bcst_notify_suppressed =
+			htobe64(bcs->bcs_notify_suppressed);
+		bcst.bcst_queue_msgs = htonl(
+			__atomic_load_n(&bcs->bcs_queue_msgs, __ATOMIC_RELAXED));
+		bcst.bcst_queue_msgs_hwm = htonl(bcs->bcs_queue_msgs_hwm);
+		bcst.bcst_queue_bytes = htobe64(
+			__atomic_load_n(&bcs->bcs_queue_bytes, __ATOMIC_RELAXED));
+		bcst.bcst_queue_bytes_hwm = htobe64(bcs->bcs_queue_bytes_hwm);
+		bcst.bcst_queue_drops = htobe64(bcs->bcs_queue_drops);
+		buf = bct_put(buf, BCT_CONTROL_STATS, &bcst, sizeof(bcst));
+	}
+
+	return bcmr;
+}
+
+struct bfd_control_msgref *binconfig_query_response(uint16_t id,
+						    bfd_session **bsv,
+						    size_t bscnt,
+						    uint32_t cursor)
+{
+	struct bfd_control_msgref *bcmr;
+	struct bfd_control_peer_state bcps;
+	struct bfd_control_peer_counters bcpn;
+	struct bfd_control_peer_sla bcpl;
+	uint32_t bstatus = htonl(BCS_STATUS_OK), bcursor = htonl(cursor);
+	size_t datalen, idx;
+	uint8_t *buf;
+
+	datalen = BCT_TOTLEN(sizeof(bstatus));
+	for (idx = 0; idx < bscnt; idx++) {
+		datalen += BCT_TOTLEN(sizeof(struct bfd_control_peer))
+			   + BCT_TOTLEN(sizeof(struct bfd_control_peer_config))
+			   + BCT_TOTLEN(sizeof(bcps))
+			   + BCT_TOTLEN(sizeof(bcpn));
+		if (bsv[idx]->profile->bp_track_sla)
+			datalen += BCT_TOTLEN(sizeof(bcpl));
+	}
+	if (cursor)
+		datalen += BCT_TOTLEN(sizeof(bcursor));
+
+	bcmr = control_msgref_new(BMV_VERSION_2, BMT_RESPONSE, id, datalen);
+	if (bcmr == NULL)
+		return NULL;
+
+	buf = bct_put(bcmr->bcmr_bcm->bcm_data, BCT_STATUS, &bstatus,
+		      sizeof(bstatus));
+	for (idx = 0; idx < bscnt; idx++) {
+		buf = binconfig_put_config(buf, NULL, bsv[idx]);
+
+		binconfig_peer_state(bsv[idx], &bcps);
+		buf = bct_put(buf, BCT_PEER_STATE, &bcps, sizeof(bcps));
+
+		bcpn.bcpn_rx_ctrl = htobe64(bsv[idx]->stats.rx_ctrl_pkt);
+		bcpn.bcpn_tx_ctrl = htobe64(bsv[idx]->stats.tx_ctrl_pkt);
+		bcpn.bcpn_rx_echo = htobe64(bsv[idx]->stats.rx_echo_pkt);
+		bcpn.bcpn_tx_echo = htobe64(bsv[idx]->stats.tx_echo_pkt);
+		buf = bct_put(buf, BCT_PEER_COUNTERS, &bcpn, sizeof(bcpn));
+
+		if (bsv[idx]->profile->bp_track_sla) {
+			binconfig_peer_sla(bsv[idx], &bcpl);
+			buf = bct_put(buf, BCT_PEER_SLA, &bcpl, sizeof(bcpl));
+		}
+	}
+	if (cursor)
+		bct_put(buf, BCT_CURSOR, &bcursor, sizeof(bcursor));
+
+	return bcmr;
+}
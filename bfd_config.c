@@ -24,7 +24,16 @@
 
 #include <json-c/json.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "bfd.h"
 
@@ -44,19 +53,70 @@ enum peer_list_type {
 	PLT_IPV4,
 	PLT_IPV6,
 	PLT_LABEL,
+	PLT_PROFILE,
+};
+
+/* Peers read between progress checks while loading the configuration. */
+#define CONFIG_PROGRESS_PEERS 1024
+
+/*
+ * Configuration file reader: walks the top level object and lists by
+ * hand and only lets json-c parse one peer object at a time.
+ */
+struct config_reader {
+	const char *cr_buf;
+	size_t cr_len;
+	size_t cr_pos;
+	struct json_tokener *cr_tok;
+	/* Profile and peer range definitions handlers. */
+	bp_handle cr_bph;
+	bpr_handle cr_brh;
+
+	/* Progress report. */
+	uint64_t cr_peers;
+	time_t cr_report;
+};
+
+/* Configuration reload: everything read from the file. */
+struct config_reload {
+	struct bfd_peer_vec crl_peers;
+	struct bfd_profile *crl_profiles;
+	size_t crl_profilecnt;
+	size_t crl_profilesize;
+	struct bprlist crl_ranges;
 };
 
 
 /*
  * Prototypes
  */
+int config_file_add(struct bfd_peer_cfg *bpc, void *arg);
+int config_profile_add(struct bfd_profile *bp, void *arg);
+int config_range_add(struct bfd_peer_range *bpr, void *arg);
+bool config_reload_has_profile(struct config_reload *crl, const char *name);
+int config_reload_collect(struct bfd_peer_cfg *bpc, void *arg);
+int config_reload_range(struct bfd_peer_range *bpr, void *arg);
+int config_reload_profile(struct bfd_profile *bp, void *arg);
+int config_file_parse(const char *fname, bpc_handle h, bp_handle bph,
+		      bpr_handle brh, void *arg);
 int parse_config_json(struct json_object *jo, bpc_handle h, void *arg);
 int parse_list(struct json_object *jo, enum peer_list_type plt, bpc_handle h, void *arg);
+int parse_list_item(struct json_object *jo, enum peer_list_type plt,
+		    bpc_handle h, void *arg);
+int parse_profile_item(struct json_object *jo, bp_handle h, void *arg);
+int parse_range_item(struct json_object *jo, enum peer_list_type plt,
+		     bpr_handle h, void *arg);
+int parse_range_interfaces(struct json_object *jo,
+			   struct bfd_peer_range *bpr);
+int config_reader_next(struct config_reader *cr);
+int config_reader_key(struct config_reader *cr, char *key, size_t keylen);
+struct json_object *config_reader_value(struct config_reader *cr);
+int config_reader_list(struct config_reader *cr, enum peer_list_type plt,
+		       bpc_handle h, void *arg);
+int config_reader_parse(struct config_reader *cr, bpc_handle h, void *arg);
 int parse_peer_config(struct json_object *jo, struct bfd_peer_cfg *bpc);
 int parse_peer_label_config(struct json_object *jo, struct bfd_peer_cfg *bpc);
-
-int config_add(struct bfd_peer_cfg *bpc, void *arg);
-int config_del(struct bfd_peer_cfg *bpc, void *arg);
+int parse_profile_config(struct json_object *jo, struct bfd_profile *bp);
 
 int json_object_add_string(struct json_object *jo, const char *key,
 			   const char *str);
@@ -64,8 +124,13 @@ int json_object_add_bool(struct json_object *jo, const char *key, bool boolean);
 int json_object_add_int(struct json_object *jo, const char *key, int64_t value);
 int json_object_add_float(struct json_object *jo, const char *key, float value);
 int json_object_add_peer(struct json_object *jo, bfd_session *bs);
+int json_object_add_peer_config(struct json_object *jo, bfd_session *bs);
+int json_object_add_peer_query(struct json_object *jo, bfd_session *bs);
+void jw_add_peer(struct json_writer *jw, bfd_session *bs);
+void jw_add_peer_config(struct json_writer *jw, bfd_session *bs);
 
-void pl_free(struct peer_label *pl);
+int parse_peer_label_prefix(struct json_object *jo, const char *prefix,
+			    bpc_handle h, void *arg);
 
 
 /*
@@ -81,6 +146,129 @@ int config_del(struct bfd_peer_cfg *bpc, void *arg __attribute__((unused)))
 	return ptm_bfd_ses_del(bpc) != 0;
 }
 
+int config_file_add(struct bfd_peer_cfg *bpc,
+		    void *arg __attribute__((unused)))
+{
+	bfd_session *bs;
+
+	bs = ptm_bfd_sess_new(bpc);
+	if (bs == NULL)
+		return 1;
+
+	/* Reloads only delete the sessions of the configuration file. */
+	BFD_SET_FLAG(bs->flags, BFD_SESS_FLAG_CONFIG);
+	BFD_UNSET_FLAG(bs->flags, BFD_SESS_FLAG_RESUMED);
+	bfd_state_update(bs);
+	bfd_repl_update(bs);
+
+	return 0;
+}
+
+int config_profile_add(struct bfd_profile *bp,
+		       void *arg __attribute__((unused)))
+{
+	if (profile_find(bp->bp_name) != NULL) {
+		log_warning("%s: duplicated profile '%s'\n", __FUNCTION__,
+			    bp->bp_name);
+		return 1;
+	}
+
+	return profile_new(bp) == NULL;
+}
+
+int config_range_add(struct bfd_peer_range *bpr,
+		     void *arg __attribute__((unused)))
+{
+	if (bpr->bpr_bpc.bpc_has_profile
+	    && profile_find(bpr->bpr_bpc.bpc_profile) == NULL) {
+		log_warning("%s: unknown profile '%s'\n", __FUNCTION__,
+			    bpr->bpr_bpc.bpc_profile);
+		return 1;
+	}
+
+	TAILQ_INSERT_TAIL(&bglobal.bg_ranges, bpr, bpr_entry);
+
+	return 0;
+}
+
+/* Tells if the file being reloaded defines the profile (so far). */
+bool config_reload_has_profile(struct config_reload *crl, const char *name)
+{
+	size_t idx;
+
+	for (idx = 0; idx < crl->crl_profilecnt; idx++) {
+		if (strcmp(crl->crl_profiles[idx].bp_name, name) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+int config_reload_collect(struct bfd_peer_cfg *bpc, void *arg)
+{
+	struct config_reload *crl = arg;
+
+	/* Profiles must be defined in the file before their peers. */
+	if (bpc->bpc_has_profile
+	    && !config_reload_has_profile(crl, bpc->bpc_profile)) {
+		log_warning("%s: unknown profile '%s'\n", __FUNCTION__,
+			    bpc->bpc_profile);
+		return 1;
+	}
+
+	/* Parameters removed from the file go back to their defaults. */
+	bpc_fill_defaults(bpc);
+
+	return bulk_collect_cb(bpc, &crl->crl_peers);
+}
+
+int config_reload_range(struct bfd_peer_range *bpr, void *arg)
+{
+	struct config_reload *crl = arg;
+
+	if (bpr->bpr_bpc.bpc_has_profile
+	    && !config_reload_has_profile(crl, bpr->bpr_bpc.bpc_profile)) {
+		log_warning("%s: unknown profile '%s'\n", __FUNCTION__,
+			    bpr->bpr_bpc.bpc_profile);
+		return 1;
+	}
+
+	bpc_fill_defaults(&bpr->bpr_bpc);
+	TAILQ_INSERT_TAIL(&crl->crl_ranges, bpr, bpr_entry);
+
+	return 0;
+}
+
+int config_reload_profile(struct bfd_profile *bp, void *arg)
+{
+	struct config_reload *crl = arg;
+	struct bfd_profile *bpv;
+	size_t size;
+
+	if (config_reload_has_profile(crl, bp->bp_name)) {
+		log_warning("%s: duplicated profile '%s'\n", __FUNCTION__,
+			    bp->bp_name);
+		return 1;
+	}
+
+	if (crl->crl_profilecnt == crl->crl_profilesize) {
+		size = crl->crl_profilesize ? crl->crl_profilesize * 2 : 8;
+		bpv = realloc(crl->crl_profiles, size * sizeof(*bpv));
+		if (bpv == NULL) {
+			log_warning("%s: realloc: %s\n", __FUNCTION__,
+				    strerror(errno));
+			return -1;
+		}
+
+		crl->crl_profiles = bpv;
+		crl->crl_profilesize = size;
+	}
+
+	crl->crl_profiles[crl->crl_profilecnt++] = *bp;
+
+	return 0;
+}
+
 int parse_config_json(struct json_object *jo, bpc_handle h, void *arg)
 {
 	const char *key, *sval;
@@ -109,66 +297,398 @@ int parse_config_json(struct json_object *jo, bpc_handle h, void *arg)
 	return error;
 }
 
+/*
+ * Loads the configuration file. The file is mapped and read sequentially:
+ * peers are created as they are read, so the memory used does not depend
+ * on the file size.
+ */
 int parse_config(const char *fname)
 {
-	struct json_object *jo;
+	struct bfd_peer_range *bpr;
+	struct timeval start, end;
+	unsigned int ranges = 0;
+	int error;
+
+	get_monotime(&start);
+	error = config_file_parse(fname, config_file_add, config_profile_add,
+				  config_range_add, NULL);
+	get_monotime(&end);
+
+	TAILQ_FOREACH (bpr, &bglobal.bg_ranges, bpr_entry)
+		ranges++;
+
+	log_info("%s: loaded %u peers (%u labels, %u ranges) in %ld ms (%d "
+		 "errors)\n",
+		 __FUNCTION__, HASH_CNT(sh, session_hash),
+		 HASH_CNT(pl_hh, bglobal.bg_plhash), ranges,
+		 (end.tv_sec - start.tv_sec) * 1000
+			 + (end.tv_usec - start.tv_usec) / 1000,
+		 error);
+
+	return error;
+}
 
-	jo = json_object_from_file(fname);
-	if (jo == NULL) {
+/*
+ * Reloads the configuration file: the whole file is read first and the
+ * sessions are only changed if it has no errors (see
+ * ptm_bfd_sess_reload()).
+ */
+int parse_config_reload(const char *fname)
+{
+	struct bfd_reload_stats brs = {};
+	struct config_reload crl = {};
+	struct bfd_peer_range *bpr;
+	struct timeval start, end;
+	int error;
+
+	TAILQ_INIT(&crl.crl_ranges);
+
+	get_monotime(&start);
+	error = config_file_parse(fname, config_reload_collect,
+				  config_reload_profile, config_reload_range,
+				  &crl);
+	if (error != 0) {
+		log_error("%s: %s has errors: nothing was changed\n",
+			  __FUNCTION__, fname);
+		while ((bpr = TAILQ_FIRST(&crl.crl_ranges)) != NULL) {
+			TAILQ_REMOVE(&crl.crl_ranges, bpr, bpr_entry);
+			range_free(bpr);
+		}
+		free(crl.crl_peers.bpv_bpcv);
+		free(crl.crl_profiles);
 		return -1;
 	}
 
-	return parse_config_json(jo, config_add, NULL);
+	/* Replace the ranges: their sessions are checked by the reload. */
+	while ((bpr = TAILQ_FIRST(&bglobal.bg_ranges)) != NULL) {
+		TAILQ_REMOVE(&bglobal.bg_ranges, bpr, bpr_entry);
+		range_free(bpr);
+	}
+	while ((bpr = TAILQ_FIRST(&crl.crl_ranges)) != NULL) {
+		TAILQ_REMOVE(&crl.crl_ranges, bpr, bpr_entry);
+		TAILQ_INSERT_TAIL(&bglobal.bg_ranges, bpr, bpr_entry);
+	}
+
+	ptm_bfd_sess_reload(crl.crl_peers.bpv_bpcv, crl.crl_peers.bpv_cnt,
+			    crl.crl_profiles, crl.crl_profilecnt, &brs);
+	free(crl.crl_peers.bpv_bpcv);
+	free(crl.crl_profiles);
+	get_monotime(&end);
+
+	log_info("%s: reloaded %zu peers in %ld ms: %u added, %u updated, "
+		 "%u deleted, %u unchanged, %u profiles changed (%u sessions) "
+		 "(%u errors)\n",
+		 __FUNCTION__, crl.crl_peers.bpv_cnt,
+		 (end.tv_sec - start.tv_sec) * 1000
+			 + (end.tv_usec - start.tv_usec) / 1000,
+		 brs.brs_added, brs.brs_updated, brs.brs_deleted,
+		 brs.brs_unchanged, brs.brs_profiles, brs.brs_profiled,
+		 brs.brs_errors);
+
+	return brs.brs_errors ? -1 : 0;
 }
 
-int parse_list(struct json_object *jo, enum peer_list_type plt, bpc_handle h, void *arg)
+/* Reads the configuration file peers: returns -1 on syntax errors. */
+int config_file_parse(const char *fname, bpc_handle h, bp_handle bph,
+		      bpr_handle brh, void *arg)
 {
-	struct json_object *jo_val;
-	struct bfd_peer_cfg bpc;
-	int allen, idx;
-	int error = 0, result;
+	struct config_reader cr = {};
+	struct stat st;
+	void *buf;
+	int fd, error;
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		log_error("%s: open(%s): %s\n", __FUNCTION__, fname,
+			  strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		log_error("%s: %s: empty or unreadable file\n", __FUNCTION__,
+			  fname);
+		close(fd);
+		return -1;
+	}
 
-	allen = json_object_array_length(jo);
-	for (idx = 0; idx < allen; idx++) {
-		jo_val = json_object_array_get_idx(jo, idx);
-
-		/* Set defaults. */
-		memset(&bpc, 0, sizeof(bpc));
-		bpc.bpc_detectmultiplier = BFD_DEFDETECTMULT;
-		bpc.bpc_recvinterval = BFD_DEFREQUIREDMINRX;
-		bpc.bpc_txinterval = BFD_DEFDESIREDMINTX;
-		bpc.bpc_echointerval = BFD_DEF_REQ_MIN_ECHO;
-
-		switch (plt) {
-		case PLT_IPV4:
-			log_debug("ipv4 peers %d:\n", allen);
-			bpc.bpc_ipv4 = true;
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		log_error("%s: mmap(%s): %s\n", __FUNCTION__, fname,
+			  strerror(errno));
+		return -1;
+	}
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+	cr.cr_buf = buf;
+	cr.cr_len = st.st_size;
+	cr.cr_report = get_monotime(NULL);
+	cr.cr_bph = bph;
+	cr.cr_brh = brh;
+	cr.cr_tok = json_tokener_new();
+	if (cr.cr_tok == NULL) {
+		munmap(buf, st.st_size);
+		return -1;
+	}
+
+	error = config_reader_parse(&cr, h, arg);
+	json_tokener_free(cr.cr_tok);
+	munmap(buf, st.st_size);
+
+	return error;
+}
+
+/*
+ * Configuration file reader
+ */
+
+/* Skips white spaces and returns the next character or -1 at the end. */
+int config_reader_next(struct config_reader *cr)
+{
+	while (cr->cr_pos < cr->cr_len) {
+		switch (cr->cr_buf[cr->cr_pos]) {
+		case ' ':
+		case '\t':
+		case '\n':
+		case '\r':
+			cr->cr_pos++;
 			break;
-		case PLT_IPV6:
-			log_debug("ipv6 peers %d:\n", allen);
-			bpc.bpc_ipv4 = false;
+
+		default:
+			return (unsigned char)cr->cr_buf[cr->cr_pos];
+		}
+	}
+
+	return -1;
+}
+
+/* Reads an object key and the following colon. */
+int config_reader_key(struct config_reader *cr, char *key, size_t keylen)
+{
+	size_t len = 0;
+
+	if (config_reader_next(cr) != '"')
+		return -1;
+
+	for (cr->cr_pos++; cr->cr_pos < cr->cr_len; cr->cr_pos++) {
+		if (cr->cr_buf[cr->cr_pos] == '"')
 			break;
-		case PLT_LABEL:
-			log_debug("label peers %d:\n", allen);
-			if (parse_peer_label_config(jo_val, &bpc) != 0) {
-				error++;
-				continue;
-			}
+		if (cr->cr_buf[cr->cr_pos] == '\\')
+			cr->cr_pos++;
+		if (len < keylen - 1)
+			key[len++] = cr->cr_buf[cr->cr_pos];
+	}
+	key[len] = 0;
+
+	if (cr->cr_pos >= cr->cr_len)
+		return -1;
+
+	cr->cr_pos++;
+	if (config_reader_next(cr) != ':')
+		return -1;
+
+	cr->cr_pos++;
+
+	return 0;
+}
+
+/* Parses the next value with json-c. */
+struct json_object *config_reader_value(struct config_reader *cr)
+{
+	struct json_object *jo;
+	size_t len;
+
+	if (config_reader_next(cr) == -1)
+		return NULL;
+
+	len = cr->cr_len - cr->cr_pos;
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	json_tokener_reset(cr->cr_tok);
+	jo = json_tokener_parse_ex(cr->cr_tok, &cr->cr_buf[cr->cr_pos], len);
+	if (jo == NULL)
+		return NULL;
+
+	cr->cr_pos += json_tokener_get_parse_end(cr->cr_tok);
+
+	return jo;
+}
+
+int config_reader_list(struct config_reader *cr, enum peer_list_type plt,
+		       bpc_handle h, void *arg)
+{
+	struct json_object *jo;
+	struct timeval now;
+	int error = 0;
+
+	if (config_reader_next(cr) != '[')
+		return -1;
+
+	cr->cr_pos++;
+	if (config_reader_next(cr) == ']') {
+		cr->cr_pos++;
+		return 0;
+	}
+
+	for (;;) {
+		jo = config_reader_value(cr);
+		if (jo == NULL)
+			return -1;
+
+		if (plt == PLT_PROFILE)
+			error += parse_profile_item(jo, cr->cr_bph, arg);
+		else if (plt != PLT_LABEL
+			 && json_object_object_get_ex(jo, "peer-range", NULL))
+			error += parse_range_item(jo, plt, cr->cr_brh, arg);
+		else
+			error += parse_list_item(jo, plt, h, arg);
+		json_object_put(jo);
+
+		if (plt != PLT_PROFILE
+		    && (++cr->cr_peers % CONFIG_PROGRESS_PEERS) == 0
+		    && get_monotime(&now) != cr->cr_report) {
+			cr->cr_report = now.tv_sec;
+			log_info("%s: read %" PRIu64 " peers (%zu%%)\n",
+				 __FUNCTION__, cr->cr_peers,
+				 cr->cr_pos * 100 / cr->cr_len);
+		}
+
+		switch (config_reader_next(cr)) {
+		case ',':
+			cr->cr_pos++;
 			break;
+		case ']':
+			cr->cr_pos++;
+			return error;
 
 		default:
-			error++;
-			log_error("%s:%d: unsupported peer type\n",
-				__FUNCTION__, __LINE__);
-			break;
+			return -1;
+		}
+	}
+}
+
+/* Same as parse_config_json(), but reading from the file. */
+int config_reader_parse(struct config_reader *cr, bpc_handle h, void *arg)
+{
+	struct json_object *jo;
+	char key[32];
+	int error = 0, result;
+
+	if (config_reader_next(cr) != '{')
+		goto syntax_error;
+
+	cr->cr_pos++;
+	if (config_reader_next(cr) == '}')
+		return 0;
+
+	for (;;) {
+		if (config_reader_key(cr, key, sizeof(key)) != 0)
+			goto syntax_error;
+
+		if (strcmp(key, "ipv4") == 0)
+			result = config_reader_list(cr, PLT_IPV4, h, arg);
+		else if (strcmp(key, "ipv6") == 0)
+			result = config_reader_list(cr, PLT_IPV6, h, arg);
+		else if (strcmp(key, "label") == 0)
+			result = config_reader_list(cr, PLT_LABEL, h, arg);
+		else if (strcmp(key, "profiles") == 0)
+			result = config_reader_list(cr, PLT_PROFILE, h, arg);
+		else {
+			jo = config_reader_value(cr);
+			if (jo == NULL)
+				goto syntax_error;
+
+			log_warning("%s:%d invalid configuration: %s\n",
+				    __FUNCTION__, __LINE__, key);
+			json_object_put(jo);
+			result = 1;
 		}
+		if (result == -1)
+			goto syntax_error;
 
-		result = parse_peer_config(jo_val, &bpc);
 		error += result;
-		if (result == 0)
-			error += (h(&bpc, arg) != 0);
+
+		switch (config_reader_next(cr)) {
+		case ',':
+			cr->cr_pos++;
+			break;
+		case '}':
+			return error;
+
+		default:
+			goto syntax_error;
+		}
+	}
+
+syntax_error:
+	log_error("%s: syntax error at offset %zu (%" PRIu64
+		  " peers were read)\n",
+		  __FUNCTION__, cr->cr_pos, cr->cr_peers);
+	return -1;
+}
+
+int parse_list(struct json_object *jo, enum peer_list_type plt, bpc_handle h, void *arg)
+{
+	int allen, idx;
+	int error = 0;
+
+	allen = json_object_array_length(jo);
+	log_debug("%s peers %d:\n",
+		  plt == PLT_IPV4 ? "ipv4" : plt == PLT_IPV6 ? "ipv6" : "label",
+		  allen);
+	for (idx = 0; idx < allen; idx++)
+		error += parse_list_item(json_object_array_get_idx(jo, idx),
+					 plt, h, arg);
+
+	return error;
+}
+
+int parse_list_item(struct json_object *jo, enum peer_list_type plt,
+		    bpc_handle h, void *arg)
+{
+	struct json_object *jo_prefix;
+	struct bfd_peer_cfg bpc;
+	int error = 0, result;
+
+	/* Set defaults. */
+	bpc_set_defaults(&bpc);
+
+	/* Ranges are only supported by the configuration file reader. */
+	if (json_object_object_get_ex(jo, "peer-range", NULL)) {
+		log_warning("%s:%d: peer ranges are only supported in the "
+			    "configuration file\n",
+			    __FUNCTION__, __LINE__);
+		return 1;
+	}
+
+	switch (plt) {
+	case PLT_IPV4:
+		bpc.bpc_ipv4 = true;
+		break;
+	case PLT_IPV6:
+		bpc.bpc_ipv4 = false;
+		break;
+	case PLT_LABEL:
+		/* Label prefix addresses a group of peers. */
+		if (json_object_object_get_ex(jo, "label-prefix", &jo_prefix))
+			return parse_peer_label_prefix(
+				jo, json_object_get_string(jo_prefix), h, arg);
+
+		if (parse_peer_label_config(jo, &bpc) != 0)
+			return 1;
+		break;
+
+	default:
+		log_error("%s:%d: unsupported peer type\n", __FUNCTION__,
+			  __LINE__);
+		return 1;
 	}
 
+	result = parse_peer_config(jo, &bpc);
+	error += result;
+	if (result == 0)
+		error += (h(&bpc, arg) != 0);
+
 	return error;
 }
 
@@ -285,6 +805,28 @@ int parse_peer_config(struct json_object *jo, struct bfd_peer_cfg *bpc)
 			} else {
 				log_debug("\tlabel: %s\n", sval);
 			}
+		} else if (strcmp(key, "profile") == 0) {
+			bpc->bpc_has_profile = true;
+			sval = json_object_get_string(jo_val);
+			if (strxcpy(bpc->bpc_profile, sval,
+				    sizeof(bpc->bpc_profile))
+			    > sizeof(bpc->bpc_profile)) {
+				log_debug("\tprofile: %s (truncated)\n", sval);
+				error++;
+			} else {
+				log_debug("\tprofile: %s\n", sval);
+			}
+		} else if (strcmp(key, "peer-range") == 0
+			   || strcmp(key, "interfaces") == 0
+			   || strcmp(key, "max-sessions") == 0
+			   || strcmp(key, "down-timeout") == 0) {
+			/* Handled by the peer range parser. */
+			log_debug("\t%s: %s\n", key,
+				  json_object_get_string(jo_val));
+		} else if (strcmp(key, "label-prefix") == 0) {
+			/* Handled by the label list parser. */
+			log_debug("\tlabel-prefix: %s\n",
+				  json_object_get_string(jo_val));
 		} else if (strcmp(key, "track-sla") == 0) {
 			bpc->bpc_track_sla = json_object_get_boolean(jo_val);
 			log_debug("\ttrack-sla: %s\n",
@@ -303,187 +845,644 @@ int parse_peer_config(struct json_object *jo, struct bfd_peer_cfg *bpc)
 		error++;
 	}
 
+	/* Profile parameters can't be overridden per peer. */
+	if (bpc->bpc_has_profile
+	    && (bpc->bpc_has_detectmultiplier || bpc->bpc_has_recvinterval
+		|| bpc->bpc_has_txinterval || bpc->bpc_has_echointerval
+		|| bpc->bpc_echo || bpc->bpc_track_sla)) {
+		log_warning("%s:%d peer parameters conflict with profile "
+			    "'%s'\n",
+			    __FUNCTION__, __LINE__, bpc->bpc_profile);
+		error++;
+	}
+
 	return error;
 }
 
-int parse_peer_label_config(struct json_object *jo, struct bfd_peer_cfg *bpc)
+/*
+ * Parses a peer range entry: the other keys are the same as the peers
+ * ones and apply to every peer of the range.
+ */
+int parse_range_item(struct json_object *jo, enum peer_list_type plt,
+		     bpr_handle h, void *arg)
 {
-	struct peer_label *pl;
-	struct json_object *label;
+	struct bfd_peer_range *bpr;
+	struct bfd_peer_cfg *bpc;
+	struct json_object *jo_val;
 	const char *sval;
+	int error = 0;
 
-	/* Get label and translate it to BFD daemon key. */
-	if (!json_object_object_get_ex(jo, "label", &label)) {
+	bpr = calloc(1, sizeof(*bpr));
+	if (bpr == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
 		return 1;
 	}
 
-	sval = json_object_get_string(label);
+	TAILQ_INIT(&bpr->bpr_sessions);
+	bpr->bpr_maxsessions = BFD_RANGE_SESSIONS;
+	bpr->bpr_downtimeout = BFD_RANGE_DOWN_TIMEOUT;
+
+	bpc = &bpr->bpr_bpc;
+	bpc_set_defaults(bpc);
+	bpc->bpc_ipv4 = (plt == PLT_IPV4);
+
+	json_object_object_get_ex(jo, "peer-range", &jo_val);
+	sval = json_object_get_string(jo_val);
+	if (parse_peer_range(sval, bpc->bpc_ipv4 ? AF_INET : AF_INET6,
+			     &bpr->bpr_first, &bpr->bpr_last)
+	    != 0) {
+		log_warning("%s:%d failed to parse peer-range '%s'\n",
+			    __FUNCTION__, __LINE__, sval);
+		error++;
+	}
 
-	pl = pl_find(sval);
-	if (pl == NULL)
+	if (json_object_object_get_ex(jo, "interfaces", &jo_val))
+		error += parse_range_interfaces(jo_val, bpr);
+	if (json_object_object_get_ex(jo, "max-sessions", &jo_val))
+		bpr->bpr_maxsessions = json_object_get_int64(jo_val);
+	if (json_object_object_get_ex(jo, "down-timeout", &jo_val))
+		bpr->bpr_downtimeout = json_object_get_int64(jo_val);
+
+	/* The peer address comes from the range. */
+	if (json_object_object_get_ex(jo, "peer-address", NULL)) {
+		log_warning("%s:%d peer-range and peer-address are exclusive\n",
+			    __FUNCTION__, __LINE__);
+		error++;
+	}
+	bpc->bpc_peer = bpr->bpr_first;
+
+	error += parse_peer_config(jo, bpc);
+	if (bpc->bpc_has_label || bpc->bpc_has_discr) {
+		log_warning("%s:%d peer ranges can't have label or "
+			    "discriminator\n",
+			    __FUNCTION__, __LINE__);
+		error++;
+	}
+	if (bpc->bpc_mhop
+	    && (bpr->bpr_ifcnt > 0
+		|| bpc->bpc_local.sa_sin.sin_family == AF_UNSPEC)) {
+		log_warning("%s:%d multihop ranges need a local-address and "
+			    "no interfaces\n",
+			    __FUNCTION__, __LINE__);
+		error++;
+	}
+
+	if (error == 0 && h(bpr, arg) != 0)
+		error++;
+	if (error)
+		range_free(bpr);
+
+	return error;
+}
+
+int parse_range_interfaces(struct json_object *jo, struct bfd_peer_range *bpr)
+{
+	const char *sval;
+	size_t idx;
+
+	if (!json_object_is_type(jo, json_type_array)) {
+		log_warning("%s:%d interfaces must be a list\n", __FUNCTION__,
+			    __LINE__);
 		return 1;
+	}
 
-	log_debug("\tpeer-label: %s\n", sval);
+	bpr->bpr_ifcnt = json_object_array_length(jo);
+	bpr->bpr_ifnames =
+		calloc(bpr->bpr_ifcnt ? bpr->bpr_ifcnt : 1,
+		       sizeof(*bpr->bpr_ifnames));
+	if (bpr->bpr_ifnames == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		bpr->bpr_ifcnt = 0;
+		return 1;
+	}
 
-	/* Translate the label into BFD address keys. */
-	bpc->bpc_ipv4 = !BFD_CHECK_FLAG(pl->pl_bs->flags, BFD_SESS_FLAG_IPV6);
-	bpc->bpc_mhop = BFD_CHECK_FLAG(pl->pl_bs->flags, BFD_SESS_FLAG_MH);
-	if (bpc->bpc_mhop) {
-		bpc->bpc_peer = pl->pl_bs->mhop.peer;
-		bpc->bpc_local = pl->pl_bs->mhop.local;
-		if (pl->pl_bs->mhop.vrf_name[0]) {
-			bpc->bpc_has_vrfname = true;
-			strxcpy(bpc->bpc_vrfname, pl->pl_bs->mhop.vrf_name,
-				sizeof(bpc->bpc_vrfname));
-		}
-	} else {
-		bpc->bpc_peer = pl->pl_bs->shop.peer;
-		if (pl->pl_bs->shop.port_name[0]) {
-			bpc->bpc_has_localif = true;
-			strxcpy(bpc->bpc_localif, pl->pl_bs->shop.port_name,
-				sizeof(bpc->bpc_localif));
+	for (idx = 0; idx < bpr->bpr_ifcnt; idx++) {
+		sval = json_object_get_string(json_object_array_get_idx(jo, idx));
+		if (sval == NULL
+		    || strxcpy(bpr->bpr_ifnames[idx], sval,
+			       sizeof(bpr->bpr_ifnames[idx]))
+			       > sizeof(bpr->bpr_ifnames[idx])) {
+			log_warning("%s:%d invalid interface name\n",
+				    __FUNCTION__, __LINE__);
+			return 1;
 		}
 	}
 
 	return 0;
 }
 
+/* Parses a peer range: a prefix ("192.168.0.0/24") or "first-last". */
+int parse_peer_range(const char *str, int family, struct sockaddr_any *first,
+		     struct sockaddr_any *last)
+{
+	char buf[2 * INET6_ADDRSTRLEN + 2], *sep, *ep;
+	uint8_t *fb, *lb, mask;
+	size_t alen, idx;
+	long plen, bits;
 
-/*
- * Control socket JSON parsing.
- */
-int config_request_add(const char *jsonstr)
-{
-	struct json_object *jo;
+	if (str == NULL || strlen(str) >= sizeof(buf))
+		return -1;
+	strcpy(buf, str);
 
-	jo = json_tokener_parse(jsonstr);
-	if (jo == NULL)
+	if ((sep = strchr(buf, '/')) == NULL
+	    && (sep = strchr(buf, '-')) == NULL)
+		return -1;
+	*sep = 0;
+
+	if (strtosa(buf, first) != 0 || first->sa_sin.sin_family != family)
 		return -1;
 
-	return parse_config_json(jo, config_add, NULL);
+	if (str[sep - buf] == '-') {
+		if (strtosa(sep + 1, last) != 0
+		    || last->sa_sin.sin_family != family)
+			return -1;
+
+		return range_addrcmp(first, last) > 0 ? -1 : 0;
+	}
+
+	alen = (family == AF_INET) ? sizeof(first->sa_sin.sin_addr)
+				   : sizeof(first->sa_sin6.sin6_addr);
+	plen = strtol(sep + 1, &ep, 10);
+	if (sep[1] == 0 || *ep != 0 || plen < 0 || plen > (long)alen * 8)
+		return -1;
+
+	/* Mask the host bits: zeroed in the first address, set in the last. */
+	*last = *first;
+	if (family == AF_INET) {
+		fb = (uint8_t *)&first->sa_sin.sin_addr;
+		lb = (uint8_t *)&last->sa_sin.sin_addr;
+	} else {
+		fb = (uint8_t *)&first->sa_sin6.sin6_addr;
+		lb = (uint8_t *)&last->sa_sin6.sin6_addr;
+	}
+	for (idx = 0; idx < alen; idx++) {
+		bits = plen - (long)idx * 8;
+		if (bits >= 8)
+			continue;
+
+		mask = (bits <= 0) ? 0 : (uint8_t)(0xff << (8 - bits));
+		fb[idx] &= mask;
+		lb[idx] |= (uint8_t)~mask;
+	}
+
+	return 0;
 }
 
-int config_request_del(const char *jsonstr)
+int parse_profile_item(struct json_object *jo, bp_handle h, void *arg)
 {
-	struct json_object *jo;
+	struct bfd_profile bp;
+	int error;
 
-	jo = json_tokener_parse(jsonstr);
-	if (jo == NULL)
-		return -1;
+	error = parse_profile_config(jo, &bp);
+	if (error == 0)
+		error += (h(&bp, arg) != 0);
 
-	return parse_config_json(jo, config_del, NULL);
+	return error;
 }
 
-char *config_response(const char *status, const char *error)
+int parse_profile_config(struct json_object *jo, struct bfd_profile *bp)
 {
-	struct json_object *resp, *jo;
-	char *jsonstr;
+	const char *key, *sval;
+	struct json_object *jo_val;
+	struct json_object_iterator joi, join;
+	int error = 0;
 
-	resp = json_object_new_object();
-	if (resp == NULL)
-		return NULL;
+	profile_set_defaults(bp);
 
-	/* Add 'status' response key. */
-	jo = json_object_new_string(status);
-	if (jo == NULL) {
-		json_object_put(resp);
-		return NULL;
+	log_debug("\tprofile:\n");
+
+	JSON_FOREACH (jo, joi, join) {
+		key = json_object_iter_peek_name(&joi);
+		jo_val = json_object_iter_peek_value(&joi);
+
+		if (strcmp(key, "name") == 0) {
+			sval = json_object_get_string(jo_val);
+			if (strxcpy(bp->bp_name, sval, sizeof(bp->bp_name))
+			    > sizeof(bp->bp_name)) {
+				log_debug("\tname: %s (truncated)\n", sval);
+				error++;
+			} else {
+				log_debug("\tname: %s\n", sval);
+			}
+		} else if (strcmp(key, "detect-multiplier") == 0) {
+			bp->bp_detectmultiplier = json_object_get_int64(jo_val);
+			log_debug("\tdetect-multiplier: %u\n",
+				  bp->bp_detectmultiplier);
+		} else if (strcmp(key, "receive-interval") == 0) {
+			bp->bp_recvinterval = json_object_get_int64(jo_val);
+			log_debug("\treceive-interval: %llu\n",
+				  bp->bp_recvinterval);
+		} else if (strcmp(key, "transmit-interval") == 0) {
+			bp->bp_txinterval = json_object_get_int64(jo_val);
+			log_debug("\ttransmit-interval: %llu\n",
+				  bp->bp_txinterval);
+		} else if (strcmp(key, "echo-interval") == 0) {
+			bp->bp_echointerval = json_object_get_int64(jo_val);
+			log_debug("\techo-interval: %llu\n",
+				  bp->bp_echointerval);
+		} else if (strcmp(key, "echo-mode") == 0) {
+			bp->bp_echo = json_object_get_boolean(jo_val);
+			log_debug("\techo-mode: %s\n",
+				  bp->bp_echo ? "true" : "false");
+		} else if (strcmp(key, "track-sla") == 0) {
+			bp->bp_track_sla = json_object_get_boolean(jo_val);
+			log_debug("\ttrack-sla: %s\n",
+				  bp->bp_track_sla ? "true" : "false");
+		} else {
+			sval = json_object_get_string(jo_val);
+			log_warning("%s:%d invalid configuration: '%s: %s'\n",
+				    __FUNCTION__, __LINE__, key, sval);
+			error++;
+		}
 	}
 
-	json_object_object_add(resp, "status", jo);
+	if (bp->bp_name[0] == 0) {
+		log_warning("%s:%d profile without name\n", __FUNCTION__,
+			    __LINE__);
+		error++;
+	}
+	if (bp->bp_detectmultiplier == 0 || bp->bp_recvinterval == 0
+	    || bp->bp_txinterval == 0) {
+		log_warning("%s:%d profile '%s' has invalid timers\n",
+			    __FUNCTION__, __LINE__, bp->bp_name);
+		error++;
+	}
 
-	/* Add 'error' response key. */
-	if (error != NULL) {
-		jo = json_object_new_string(error);
-		if (jo == NULL) {
-			json_object_put(resp);
-			return NULL;
+	return error;
+}
+
+void bpc_set_defaults(struct bfd_peer_cfg *bpc)
+{
+	memset(bpc, 0, sizeof(*bpc));
+	bpc->bpc_detectmultiplier = BFD_DEFDETECTMULT;
+	bpc->bpc_recvinterval = BFD_DEFREQUIREDMINRX;
+	bpc->bpc_txinterval = BFD_DEFDESIREDMINTX;
+	bpc->bpc_echointerval = BFD_DEF_REQ_MIN_ECHO;
+}
+
+/*
+ * Sets the default value of every session parameter missing in `bpc`,
+ * so applying it resets the parameters it doesn't mention. Peers with a
+ * profile get the parameters from it instead.
+ */
+void bpc_fill_defaults(struct bfd_peer_cfg *bpc)
+{
+	if (bpc->bpc_has_profile)
+		return;
+
+	if (!bpc->bpc_has_detectmultiplier) {
+		bpc->bpc_detectmultiplier = BFD_DEFDETECTMULT;
+		bpc->bpc_has_detectmultiplier = true;
+	}
+	if (!bpc->bpc_has_recvinterval) {
+		bpc->bpc_recvinterval = BFD_DEFREQUIREDMINRX / 1000;
+		bpc->bpc_has_recvinterval = true;
+	}
+	if (!bpc->bpc_has_txinterval) {
+		bpc->bpc_txinterval = BFD_DEFDESIREDMINTX / 1000;
+		bpc->bpc_has_txinterval = true;
+	}
+	if (!bpc->bpc_has_echointerval) {
+		bpc->bpc_echointerval = BFD_DEF_REQ_MIN_ECHO / 1000;
+		bpc->bpc_has_echointerval = true;
+	}
+}
+
+void pl_to_bpc(struct peer_label *pl, struct bfd_peer_cfg *bpc)
+{
+	/* Translate the label into BFD address keys. */
+	bpc->bpc_ipv4 = !BFD_CHECK_FLAG(pl->pl_bs->flags, BFD_SESS_FLAG_IPV6);
+	bpc->bpc_mhop = BFD_CHECK_FLAG(pl->pl_bs->flags, BFD_SESS_FLAG_MH);
+	if (bpc->bpc_mhop) {
+		bpc->bpc_peer = pl->pl_bs->mhop.peer;
+		bpc->bpc_local = pl->pl_bs->mhop.local;
+		if (pl->pl_bs->mhop.vrf_name[0]) {
+			bpc->bpc_has_vrfname = true;
+			strxcpy(bpc->bpc_vrfname, pl->pl_bs->mhop.vrf_name,
+				sizeof(bpc->bpc_vrfname));
 		}
+	} else {
+		bpc->bpc_peer = pl->pl_bs->shop.peer;
+		if (pl->pl_bs->shop.port_name[0]) {
+			bpc->bpc_has_localif = true;
+			strxcpy(bpc->bpc_localif, pl->pl_bs->shop.port_name,
+				sizeof(bpc->bpc_localif));
+		}
+	}
+}
+
+int parse_peer_label_config(struct json_object *jo, struct bfd_peer_cfg *bpc)
+{
+	struct peer_label *pl;
+	struct json_object *label;
+	const char *sval;
 
-		json_object_object_add(resp, "error", jo);
+	/* Get label and translate it to BFD daemon key. */
+	if (!json_object_object_get_ex(jo, "label", &label)) {
+		return 1;
 	}
 
-	/* Generate JSON response. */
-	jsonstr = strdup(
-		json_object_to_json_string_ext(resp, BFDD_JSON_CONV_OPTIONS));
-	json_object_put(resp);
+	sval = json_object_get_string(label);
 
-	return jsonstr;
+	pl = pl_find(sval);
+	if (pl == NULL)
+		return 1;
+
+	log_debug("\tpeer-label: %s\n", sval);
+
+	pl_to_bpc(pl, bpc);
+
+	return 0;
 }
 
-char *config_notify_sla(bfd_session *bs)
+struct label_prefix_arg {
+	struct json_object *lpa_jo;
+	bpc_handle lpa_h;
+	void *lpa_arg;
+};
+
+static int _parse_peer_label_prefix(struct peer_label *pl, void *arg)
 {
-	struct json_object *resp;
-	char *jsonstr;
+	struct label_prefix_arg *lpa = arg;
+	struct bfd_peer_cfg bpc;
 
-	resp = json_object_new_object();
-	if (resp == NULL)
-		return NULL;
+	log_debug("\tpeer-label: %s\n", pl->pl_label);
 
-	json_object_add_string(resp, "op", BCM_NOTIFY_PEER_SLA_UPDATE);
+	bpc_set_defaults(&bpc);
+	pl_to_bpc(pl, &bpc);
+	if (parse_peer_config(lpa->lpa_jo, &bpc) != 0)
+		return -1;
 
-	/* Add status information */
-	json_object_add_int(resp, "id", bs->discrs.my_discr);
-	json_object_add_int(resp, "remote-id", bs->discrs.my_discr);
+	return lpa->lpa_h(&bpc, lpa->lpa_arg);
+}
 
-        json_object_add_int(resp, "latency", bs->sla.lattency);
-        json_object_add_int(resp, "jitter", bs->sla.jitter);
-        json_object_add_float(resp, "pkt_loss", bs->sla.pkt_loss);
+int parse_peer_label_prefix(struct json_object *jo, const char *prefix,
+			    bpc_handle h, void *arg)
+{
+	struct label_prefix_arg lpa = {
+		.lpa_jo = jo, .lpa_h = h, .lpa_arg = arg,
+	};
 
-	/* Generate JSON response. */
-	jsonstr = strdup(
-		json_object_to_json_string_ext(resp, BFDD_JSON_CONV_OPTIONS));
-	json_object_put(resp);
+	if (prefix == NULL || prefix[0] == 0)
+		return 1;
 
-	return jsonstr;
+	log_debug("\tpeer-label-prefix: %s\n", prefix);
+
+	return pl_foreach_prefix(prefix, _parse_peer_label_prefix, &lpa);
 }
 
-char *config_notify(bfd_session *bs)
+
+/*
+ * Control socket JSON parsing.
+ */
+static const char *bulk_result_str(uint8_t result)
 {
-	struct json_object *resp;
-	char *jsonstr;
-	time_t now;
+	switch (result) {
+	case BBR_OK:
+		return "ok";
+	case BBR_SKIPPED:
+		return "skipped";
+	case BBR_INVALID:
+		return "invalid";
+	case BBR_EXISTS:
+		return "exists";
+	case BBR_NOT_FOUND:
+		return "not-found";
+	case BBR_BUSY:
+		return "busy";
+	case BBR_FAILED:
+		return "failed";
 
-	resp = json_object_new_object();
-	if (resp == NULL)
+	default:
+		return "unknown";
+	}
+}
+
+/* Copies the serialized document to a new control message. */
+static struct bfd_control_msgref *config_msgref(enum bc_msg_type bmt,
+						uint16_t id)
+{
+	struct json_writer *jw = &bglobal.bg_jw;
+	struct bfd_control_msgref *bcmr;
+
+	if (jw->jw_error)
 		return NULL;
 
-	json_object_add_string(resp, "op", BCM_NOTIFY_PEER_STATUS);
+	bcmr = control_msgref_new(BMV_VERSION_1, bmt, id, jw->jw_len);
+	if (bcmr == NULL)
+		return NULL;
+
+	memcpy(bcmr->bcmr_bcm->bcm_data, jw->jw_buf, jw->jw_len);
+
+	return bcmr;
+}
+
+struct bfd_control_msgref *config_response(uint16_t id, const char *status,
+					   const char *error,
+					   const uint8_t *results,
+					   size_t rescnt)
+{
+	struct json_writer *jw = &bglobal.bg_jw;
+	size_t idx;
+
+	jw_reset(jw);
+	jw_object_start(jw, NULL);
+	jw_string(jw, "status", status);
+	if (error != NULL)
+		jw_string(jw, "error", error);
+
+	/* Add bulk request per-peer 'results' vector. */
+	if (results != NULL) {
+		jw_array_start(jw, "results");
+		for (idx = 0; idx < rescnt; idx++)
+			jw_string(jw, NULL, bulk_result_str(results[idx]));
+		jw_array_end(jw);
+	}
+	jw_object_end(jw);
+
+	return config_msgref(BMT_RESPONSE, id);
+}
+
+struct bfd_control_msgref *config_notify_response(uint16_t id, uint64_t seq,
+						  bool resumed)
+{
+	struct json_writer *jw = &bglobal.bg_jw;
+
+	jw_reset(jw);
+	jw_object_start(jw, NULL);
+	jw_string(jw, "status", BCM_RESPONSE_OK);
+	jw_int(jw, "seq", seq);
+	jw_bool(jw, "resumed", resumed);
+	jw_object_end(jw);
+
+	return config_msgref(BMT_RESPONSE, id);
+}
+
+struct bfd_control_msgref *config_notify_sla(bfd_session *bs, uint64_t seq)
+{
+	struct json_writer *jw = &bglobal.bg_jw;
 
-	json_object_add_peer(resp, bs);
+	jw_reset(jw);
+	jw_object_start(jw, NULL);
+	jw_string(jw, "op", BCM_NOTIFY_PEER_SLA_UPDATE);
+	jw_int(jw, "seq", seq);
 
 	/* Add status information */
-	json_object_add_int(resp, "id", bs->discrs.my_discr);
-	json_object_add_int(resp, "remote-id", bs->discrs.my_discr);
+	jw_int(jw, "id", bs->discrs.my_discr);
+	jw_int(jw, "remote-id", bs->discrs.my_discr);
+
+	/* Milliseconds for compatibility, then with microsecond precision. */
+	jw_int(jw, "latency", bs->sla.lattency / 1000);
+	jw_int(jw, "jitter", bs->sla.jitter / 1000);
+	jw_int(jw, "latency-us", bs->sla.lattency);
+	jw_int(jw, "jitter-us", bs->sla.jitter);
+	jw_double(jw, "pkt_loss", bs->sla.pkt_loss);
+	jw_object_end(jw);
+
+	return config_msgref(BMT_NOTIFY_SLA, htons(BCM_NOTIFY_ID));
+}
+
+struct bfd_control_msgref *config_notify(bfd_session *bs, uint64_t seq)
+{
+	struct json_writer *jw = &bglobal.bg_jw;
+	time_t now;
+
+	jw_reset(jw);
+	jw_object_start(jw, NULL);
+	jw_string(jw, "op", BCM_NOTIFY_PEER_STATUS);
+	jw_int(jw, "seq", seq);
+
+	jw_add_peer(jw, bs);
+
+	/* Add status information */
+	jw_int(jw, "id", bs->discrs.my_discr);
+	jw_int(jw, "remote-id", bs->discrs.my_discr);
 
 	switch (bs->ses_state) {
 	case PTM_BFD_UP:
-		json_object_add_string(resp, "state", "up");
+		jw_string(jw, "state", "up");
 
 		now = get_monotime(NULL);
-		json_object_add_int(resp, "uptime", now - bs->uptime.tv_sec);
+		jw_int(jw, "uptime", now - bs->uptime.tv_sec);
 		break;
 	case PTM_BFD_ADM_DOWN:
-		json_object_add_string(resp, "state", "adm-down");
+		jw_string(jw, "state", "adm-down");
 		break;
 	case PTM_BFD_DOWN:
-		json_object_add_string(resp, "state", "down");
+		jw_string(jw, "state", "down");
 
 		now = get_monotime(NULL);
-		json_object_add_int(resp, "downtime",
-				    now - bs->downtime.tv_sec);
+		jw_int(jw, "downtime", now - bs->downtime.tv_sec);
 		break;
 	case PTM_BFD_INIT:
-		json_object_add_string(resp, "state", "init");
+		jw_string(jw, "state", "init");
 		break;
 
 	default:
-		json_object_add_string(resp, "state", "unknown");
+		jw_string(jw, "state", "unknown");
 		break;
 	}
 
-	json_object_add_int(resp, "diagnostics", bs->local_diag);
-	json_object_add_int(resp, "remote-diagnostics", bs->remote_diag);
+	jw_int(jw, "diagnostics", bs->local_diag);
+	jw_int(jw, "remote-diagnostics", bs->remote_diag);
+	jw_object_end(jw);
+
+	return config_msgref(BMT_NOTIFY, htons(BCM_NOTIFY_ID));
+}
+
+struct bfd_control_msgref *config_notify_config(const char *op,
+						bfd_session *bs, uint64_t seq)
+{
+	struct json_writer *jw = &bglobal.bg_jw;
+
+	jw_reset(jw);
+	jw_object_start(jw, NULL);
+	jw_string(jw, "op", op);
+	jw_int(jw, "seq", seq);
+
+	jw_add_peer(jw, bs);
+
+	/* On peer deletion we don't need to add any additional information. */
+	if (strcmp(op, BCM_NOTIFY_CONFIG_DELETE) != 0)
+		jw_add_peer_config(jw, bs);
+	jw_object_end(jw);
+
+	return config_msgref(BMT_NOTIFY, htons(BCM_NOTIFY_ID));
+}
+
+struct bfd_control_msgref *config_notify_config_bulk(const char *op,
+						     bfd_session **bsv,
+						     size_t bscnt,
+						     uint64_t seq)
+{
+	struct json_writer *jw = &bglobal.bg_jw;
+	size_t idx;
+	bool delete = (strcmp(op, BCM_NOTIFY_CONFIG_DELETE) == 0);
+
+	jw_reset(jw);
+	jw_object_start(jw, NULL);
+	jw_string(jw, "op", op);
+	jw_int(jw, "seq", seq);
+
+	jw_array_start(jw, "peers");
+	for (idx = 0; idx < bscnt; idx++) {
+		jw_object_start(jw, NULL);
+		jw_add_peer(jw, bsv[idx]);
+		if (!delete)
+			jw_add_peer_config(jw, bsv[idx]);
+		jw_object_end(jw);
+	}
+	jw_array_end(jw);
+	jw_object_end(jw);
+
+	return config_msgref(BMT_NOTIFY, htons(BCM_NOTIFY_ID));
+}
+
+char *config_control_stats(void)
+{
+	struct json_object *resp, *sockets, *jo;
+	struct bfd_control_socket *bcs;
+	char *jsonstr;
+
+	resp = json_object_new_object();
+	if (resp == NULL)
+		return NULL;
+
+	json_object_add_string(resp, "status", BCM_RESPONSE_OK);
+
+	sockets = json_object_new_array();
+	if (sockets == NULL) {
+		json_object_put(resp);
+		return NULL;
+	}
+
+	json_object_object_add(resp, "sockets", sockets);
+	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
+		jo = json_object_new_object();
+		if (jo == NULL) {
+			json_object_put(resp);
+			return NULL;
+		}
+
+		json_object_add_int(jo, "sd", bcs->bcs_sd);
+		json_object_add_int(jo, "coalesce-window", bcs->bcs_coalesce);
+		json_object_add_int(jo, "notify-merged",
+				    bcs->bcs_notify_merged);
+		json_object_add_int(jo, "notify-suppressed",
+				    bcs->bcs_notify_suppressed);
+		json_object_add_int(jo, "queue-messages",
+				    __atomic_load_n(&bcs->bcs_queue_msgs,
+						    __ATOMIC_RELAXED));
+		json_object_add_int(jo, "queue-messages-high",
+				    bcs->bcs_queue_msgs_hwm);
+		json_object_add_int(jo, "queue-bytes",
+				    __atomic_load_n(&bcs->bcs_queue_bytes,
+						    __ATOMIC_RELAXED));
+		json_object_add_int(jo, "queue-bytes-high",
+				    bcs->bcs_queue_bytes_hwm);
+		json_object_add_int(jo, "queue-drops", bcs->bcs_queue_drops);
+		json_object_array_add(sockets, jo);
+	}
 
 	/* Generate JSON response. */
 	jsonstr = strdup(
@@ -493,47 +1492,151 @@ char *config_notify(bfd_session *bs)
 	return jsonstr;
 }
 
-char *config_notify_config(const char *op, bfd_session *bs)
+struct bfd_control_msgref *config_notify_resync(uint64_t dropped)
 {
-	struct json_object *resp;
+	struct json_writer *jw = &bglobal.bg_jw;
+
+	jw_reset(jw);
+	jw_object_start(jw, NULL);
+	jw_string(jw, "op", BCM_NOTIFY_RESYNC);
+	jw_int(jw, "dropped", dropped);
+	jw_object_end(jw);
+
+	return config_msgref(BMT_NOTIFY, htons(BCM_NOTIFY_ID));
+}
+
+int config_notify_coalesce(const char *jsonstr, uint32_t *window)
+{
+	struct json_object *jo, *jo_val;
+	int64_t value;
+	int error = -1;
+
+	jo = json_tokener_parse(jsonstr);
+	if (jo == NULL)
+		return -1;
+
+	if (json_object_object_get_ex(jo, "window", &jo_val)) {
+		value = json_object_get_int64(jo_val);
+		if (value >= 0 && value <= BCM_COALESCE_MAX) {
+			*window = value;
+			error = 0;
+		}
+	}
+
+	json_object_put(jo);
+
+	return error;
+}
+
+int config_query(const char *jsonstr, struct bfd_query *bq)
+{
+	struct json_object *jo, *jo_val;
+	struct json_object_iterator joi, join;
+	const char *key, *sval;
+	int64_t limit;
+	int error = 0;
+
+	jo = json_tokener_parse(jsonstr);
+	if (jo == NULL)
+		return -1;
+
+	memset(bq, 0, sizeof(*bq));
+	bq->bq_limit = BCM_QUERY_LIMIT;
+
+	JSON_FOREACH (jo, joi, join) {
+		key = json_object_iter_peek_name(&joi);
+		jo_val = json_object_iter_peek_value(&joi);
+
+		if (strcmp(key, "state") == 0) {
+			sval = json_object_get_string(jo_val);
+			bq->bq_flags |= BCQ_F_STATE;
+			if (strcmp(sval, "up") == 0)
+				bq->bq_state = PTM_BFD_UP;
+			else if (strcmp(sval, "down") == 0)
+				bq->bq_state = PTM_BFD_DOWN;
+			else if (strcmp(sval, "init") == 0)
+				bq->bq_state = PTM_BFD_INIT;
+			else if (strcmp(sval, "adm-down") == 0)
+				bq->bq_state = PTM_BFD_ADM_DOWN;
+			else
+				error++;
+		} else if (strcmp(key, "label-prefix") == 0) {
+			bq->bq_flags |= BCQ_F_LABEL;
+			strxcpy(bq->bq_label, json_object_get_string(jo_val),
+				sizeof(bq->bq_label));
+		} else if (strcmp(key, "local-interface") == 0) {
+			bq->bq_flags |= BCQ_F_LOCALIF;
+			strxcpy(bq->bq_localif,
+				json_object_get_string(jo_val),
+				sizeof(bq->bq_localif));
+		} else if (strcmp(key, "vrf-name") == 0) {
+			bq->bq_flags |= BCQ_F_VRFNAME;
+			strxcpy(bq->bq_vrfname,
+				json_object_get_string(jo_val),
+				sizeof(bq->bq_vrfname));
+		} else if (strcmp(key, "multihop") == 0) {
+			bq->bq_flags |= json_object_get_boolean(jo_val)
+						? BCQ_F_MHOP
+						: BCQ_F_SHOP;
+		} else if (strcmp(key, "ipv6") == 0) {
+			bq->bq_flags |= json_object_get_boolean(jo_val)
+						? BCQ_F_IPV6
+						: BCQ_F_IPV4;
+		} else if (strcmp(key, "limit") == 0) {
+			limit = json_object_get_int64(jo_val);
+			if (limit <= 0 || limit > BCM_QUERY_LIMIT_MAX)
+				error++;
+			else
+				bq->bq_limit = limit;
+		} else if (strcmp(key, "cursor") == 0) {
+			bq->bq_cursor = json_object_get_int64(jo_val);
+		} else {
+			log_debug("%s: unknown query key: %s\n", __FUNCTION__,
+				  key);
+			error++;
+		}
+	}
+
+	json_object_put(jo);
+
+	return error;
+}
+
+char *config_query_response(bfd_session **bsv, size_t bscnt,
+			    uint32_t cursor)
+{
+	struct json_object *resp, *peers, *jo;
 	char *jsonstr;
+	size_t idx;
 
 	resp = json_object_new_object();
 	if (resp == NULL)
 		return NULL;
 
-	json_object_add_string(resp, "op", op);
+	json_object_add_string(resp, "status", BCM_RESPONSE_OK);
 
-	json_object_add_peer(resp, bs);
-
-	/* On peer deletion we don't need to add any additional information. */
-	if (strcmp(op, BCM_NOTIFY_CONFIG_DELETE) == 0) {
-		goto skip_config;
+	peers = json_object_new_array();
+	if (peers == NULL) {
+		json_object_put(resp);
+		return NULL;
 	}
 
-	json_object_add_int(resp, "detect-multiplier", bs->detect_mult);
-	json_object_add_int(resp, "receive-interval",
-			    bs->timers.required_min_rx / 1000);
-	json_object_add_int(resp, "transmit-interval",
-			    bs->up_min_tx / 1000);
-	json_object_add_int(resp, "echo-interval",
-			    bs->timers.required_min_echo / 1000);
+	json_object_object_add(resp, "peers", peers);
+	for (idx = 0; idx < bscnt; idx++) {
+		jo = json_object_new_object();
+		if (jo == NULL) {
+			json_object_put(resp);
+			return NULL;
+		}
 
-	json_object_add_int(resp, "remote-detect-multiplier",
-			    bs->remote_detect_mult);
-	json_object_add_int(resp, "remote-receive-interval",
-			    bs->remote_timers.required_min_rx / 1000);
-	json_object_add_int(resp, "remote-transmit-interval",
-			    bs->remote_timers.desired_min_tx / 1000);
-	json_object_add_int(resp, "remote-echo-interval",
-			    bs->remote_timers.required_min_echo / 1000);
+		json_object_add_peer_query(jo, bsv[idx]);
+		json_object_array_add(peers, jo);
+	}
 
-	json_object_add_bool(resp, "echo-mode",
-			     BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_ECHO));
-	json_object_add_bool(resp, "shutdown",
-			     BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN));
+	/* Tell the client where to continue. */
+	if (cursor)
+		json_object_add_int(resp, "cursor", cursor);
 
-skip_config:
 	/* Generate JSON response. */
 	jsonstr = strdup(
 		json_object_to_json_string_ext(resp, BFDD_JSON_CONV_OPTIONS));
@@ -542,22 +1645,130 @@ skip_config:
 	return jsonstr;
 }
 
-int config_notify_request(struct bfd_control_socket *bcs, const char *jsonstr,
-			  bpc_handle bh)
+int config_request(const char *jsonstr, bpc_handle bh, void *arg)
+{
+	struct json_object *jo;
+	int error;
+
+	jo = json_tokener_parse(jsonstr);
+	if (jo == NULL)
+		return -1;
+
+	error = parse_config_json(jo, bh, arg);
+	json_object_put(jo);
+
+	return error;
+}
+
+/*
+ * Like `config_request`, but doesn't look up peer labels so it is safe to
+ * use outside the protocol thread: requests with a "label" list are not
+ * parsed and `labels` is set instead.
+ */
+int config_request_nolabel(const char *jsonstr, bpc_handle bh, void *arg,
+			   bool *labels)
 {
 	struct json_object *jo;
+	int error = 0;
 
 	jo = json_tokener_parse(jsonstr);
 	if (jo == NULL)
 		return -1;
 
-	return parse_config_json(jo, bh, bcs);
+	*labels = json_object_object_get_ex(jo, "label", NULL);
+	if (!*labels)
+		error = parse_config_json(jo, bh, arg);
+
+	json_object_put(jo);
+
+	return error;
 }
 
 
 /*
  * JSON helper functions
  */
+int json_object_add_peer_config(struct json_object *jo, bfd_session *bs)
+{
+	json_object_add_int(jo, "detect-multiplier",
+			    bs->profile->bp_detectmultiplier);
+	json_object_add_int(jo, "receive-interval",
+			    bs->profile->bp_recvinterval);
+	json_object_add_int(jo, "transmit-interval",
+			    bs->profile->bp_txinterval);
+	json_object_add_int(jo, "echo-interval",
+			    bs->profile->bp_echointerval);
+
+	json_object_add_int(jo, "remote-detect-multiplier",
+			    bs->remote_detect_mult);
+	json_object_add_int(jo, "remote-receive-interval",
+			    bs->remote_timers.required_min_rx / 1000);
+	json_object_add_int(jo, "remote-transmit-interval",
+			    bs->remote_timers.desired_min_tx / 1000);
+	json_object_add_int(jo, "remote-echo-interval",
+			    bs->remote_timers.required_min_echo / 1000);
+
+	json_object_add_bool(jo, "echo-mode",
+			     bs->profile->bp_echo);
+	json_object_add_bool(jo, "shutdown",
+			     BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN));
+
+	return 0;
+}
+
+int json_object_add_peer_query(struct json_object *jo, bfd_session *bs)
+{
+	time_t now = get_monotime(NULL);
+
+	json_object_add_peer(jo, bs);
+
+	/* Status */
+	json_object_add_int(jo, "id", bs->discrs.my_discr);
+	json_object_add_int(jo, "remote-id", bs->discrs.remote_discr);
+	switch (bs->ses_state) {
+	case PTM_BFD_UP:
+		json_object_add_string(jo, "state", "up");
+		json_object_add_int(jo, "uptime", now - bs->uptime.tv_sec);
+		break;
+	case PTM_BFD_ADM_DOWN:
+		json_object_add_string(jo, "state", "adm-down");
+		break;
+	case PTM_BFD_DOWN:
+		json_object_add_string(jo, "state", "down");
+		json_object_add_int(jo, "downtime", now - bs->downtime.tv_sec);
+		break;
+	case PTM_BFD_INIT:
+		json_object_add_string(jo, "state", "init");
+		break;
+
+	default:
+		json_object_add_string(jo, "state", "unknown");
+		break;
+	}
+	json_object_add_int(jo, "diagnostics", bs->local_diag);
+	json_object_add_int(jo, "remote-diagnostics", bs->remote_diag);
+
+	/* Timers */
+	json_object_add_peer_config(jo, bs);
+
+	/* Counters */
+	json_object_add_int(jo, "rx-control-packets", bs->stats.rx_ctrl_pkt);
+	json_object_add_int(jo, "tx-control-packets", bs->stats.tx_ctrl_pkt);
+	json_object_add_int(jo, "rx-echo-packets", bs->stats.rx_echo_pkt);
+	json_object_add_int(jo, "tx-echo-packets", bs->stats.tx_echo_pkt);
+
+	/* SLA */
+	if (bs->profile->bp_track_sla) {
+		json_object_add_int(jo, "latency", bs->sla.lattency / 1000);
+		json_object_add_int(jo, "jitter", bs->sla.jitter / 1000);
+		json_object_add_int(jo, "latency-us", bs->sla.lattency);
+		json_object_add_int(jo, "jitter-us", bs->sla.jitter);
+		json_object_add_float(jo, "pkt_loss", bs->sla.pkt_loss);
+	}
+
+	return 0;
+}
+
 int json_object_add_string(struct json_object *jo, const char *key,
 			   const char *str)
 {
@@ -643,10 +1854,57 @@ int json_object_add_peer(struct json_object *jo, bfd_session *bs)
 
 	if (bs->pl)
 		json_object_add_string(jo, "label", bs->pl->pl_label);
+	if (bs->profile->bp_name[0] != 0)
+		json_object_add_string(jo, "profile", bs->profile->bp_name);
 
 	return 0;
 }
 
+/* Same as `json_object_add_peer`, for the streaming writer. */
+void jw_add_peer(struct json_writer *jw, bfd_session *bs)
+{
+	jw_bool(jw, "ipv6", BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_IPV6));
+	jw_bool(jw, "multihop", BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH));
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
+		jw_string(jw, "peer-address", satostr(&bs->mhop.peer));
+		jw_string(jw, "local-address", satostr(&bs->mhop.local));
+		if (strlen(bs->mhop.vrf_name) > 0)
+			jw_string(jw, "vrf-name", bs->mhop.vrf_name);
+	} else {
+		jw_string(jw, "peer-address", satostr(&bs->shop.peer));
+		if (bs->local_ip.sa_sin.sin_family != AF_UNSPEC)
+			jw_string(jw, "local-address", satostr(&bs->local_ip));
+		if (strlen(bs->shop.port_name) > 0)
+			jw_string(jw, "local-interface", bs->shop.port_name);
+	}
+
+	if (bs->pl)
+		jw_string(jw, "label", bs->pl->pl_label);
+	if (bs->profile->bp_name[0] != 0)
+		jw_string(jw, "profile", bs->profile->bp_name);
+}
+
+/* Same as `json_object_add_peer_config`, for the streaming writer. */
+void jw_add_peer_config(struct json_writer *jw, bfd_session *bs)
+{
+	jw_int(jw, "detect-multiplier", bs->profile->bp_detectmultiplier);
+	jw_int(jw, "receive-interval", bs->profile->bp_recvinterval);
+	jw_int(jw, "transmit-interval", bs->profile->bp_txinterval);
+	jw_int(jw, "echo-interval", bs->profile->bp_echointerval);
+
+	jw_int(jw, "remote-detect-multiplier", bs->remote_detect_mult);
+	jw_int(jw, "remote-receive-interval",
+	       bs->remote_timers.required_min_rx / 1000);
+	jw_int(jw, "remote-transmit-interval",
+	       bs->remote_timers.desired_min_tx / 1000);
+	jw_int(jw, "remote-echo-interval",
+	       bs->remote_timers.required_min_echo / 1000);
+
+	jw_bool(jw, "echo-mode", bs->profile->bp_echo);
+	jw_bool(jw, "shutdown",
+		BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN));
+}
+
 
 /*
  * Label handling
@@ -655,14 +1913,9 @@ struct peer_label *pl_find(const char *label)
 {
 	struct peer_label *pl;
 
-	TAILQ_FOREACH (pl, &bglobal.bg_pllist, pl_entry) {
-		if (strcmp(pl->pl_label, label) != 0)
-			continue;
-
-		return pl;
-	}
+	HASH_FIND(pl_hh, bglobal.bg_plhash, label, strlen(label), pl);
 
-	return NULL;
+	return pl;
 }
 
 struct peer_label *pl_new(const char *label, bfd_session *bs)
@@ -681,16 +1934,308 @@ struct peer_label *pl_new(const char *label, bfd_session *bs)
 	pl->pl_bs = bs;
 	bs->pl = pl;
 
-	TAILQ_INSERT_HEAD(&bglobal.bg_pllist, pl, pl_entry);
+	HASH_ADD_KEYPTR(pl_hh, bglobal.bg_plhash, pl->pl_label,
+			strlen(pl->pl_label), pl);
+	bglobal.bg_plindex_valid = false;
 
 	return pl;
 }
 
+int pl_rename(struct peer_label *pl, const char *label)
+{
+	/* The hash key is the label itself: remove, rename and re-add. */
+	HASH_DELETE(pl_hh, bglobal.bg_plhash, pl);
+
+	if (strxcpy(pl->pl_label, label, sizeof(pl->pl_label))
+	    > sizeof(pl->pl_label)) {
+		log_warning("%s:%d: label was truncated\n", __FUNCTION__,
+			    __LINE__);
+	}
+
+	HASH_ADD_KEYPTR(pl_hh, bglobal.bg_plhash, pl->pl_label,
+			strlen(pl->pl_label), pl);
+	bglobal.bg_plindex_valid = false;
+
+	return 0;
+}
+
 void pl_free(struct peer_label *pl)
 {
 	/* Remove the pointer back. */
 	pl->pl_bs->pl = NULL;
 
-	TAILQ_REMOVE(&bglobal.bg_pllist, pl, pl_entry);
+	HASH_DELETE(pl_hh, bglobal.bg_plhash, pl);
+	bglobal.bg_plindex_valid = false;
 	free(pl);
 }
+
+static int pl_cmp(const void *a, const void *b)
+{
+	const struct peer_label *pla = *(struct peer_label *const *)a;
+	const struct peer_label *plb = *(struct peer_label *const *)b;
+
+	return strcmp(pla->pl_label, plb->pl_label);
+}
+
+static int pl_index_build(void)
+{
+	struct peer_label *pl, *tmp, **plindex;
+	size_t plcount;
+
+	if (bglobal.bg_plindex_valid)
+		return 0;
+
+	plcount = HASH_CNT(pl_hh, bglobal.bg_plhash);
+	plindex = realloc(bglobal.bg_plindex,
+			  (plcount ? plcount : 1) * sizeof(*plindex));
+	if (plindex == NULL) {
+		log_warning("%s: realloc: %s\n", __FUNCTION__,
+			    strerror(errno));
+		return -1;
+	}
+
+	bglobal.bg_plindex = plindex;
+	bglobal.bg_plindexlen = 0;
+	HASH_ITER (pl_hh, bglobal.bg_plhash, pl, tmp) {
+		plindex[bglobal.bg_plindexlen++] = pl;
+	}
+
+	qsort(plindex, bglobal.bg_plindexlen, sizeof(*plindex), pl_cmp);
+	bglobal.bg_plindex_valid = true;
+
+	return 0;
+}
+
+int pl_foreach_prefix(const char *prefix, pl_handle h, void *arg)
+{
+	struct peer_label **plmatch;
+	size_t prefixlen = strlen(prefix);
+	size_t lo, hi, mid, first, matches, idx;
+	int error = 0;
+
+	if (pl_index_build() != 0)
+		return -1;
+
+	/* Binary search the first label that is not less than prefix. */
+	lo = 0;
+	hi = bglobal.bg_plindexlen;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(bglobal.bg_plindex[mid]->pl_label, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	first = lo;
+	for (matches = 0; first + matches < bglobal.bg_plindexlen; matches++) {
+		if (strncmp(bglobal.bg_plindex[first + matches]->pl_label,
+			    prefix, prefixlen)
+		    != 0)
+			break;
+	}
+	if (matches == 0)
+		return 0;
+
+	/*
+	 * Work on a copy: the handler might add/remove labels and invalidate
+	 * the index.
+	 */
+	plmatch = malloc(matches * sizeof(*plmatch));
+	if (plmatch == NULL) {
+		log_warning("%s: malloc: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+	memcpy(plmatch, &bglobal.bg_plindex[first],
+	       matches * sizeof(*plmatch));
+
+	for (idx = 0; idx < matches; idx++)
+		error += (h(plmatch[idx], arg) != 0);
+
+	free(plmatch);
+
+	return error;
+}
+
+
+/*
+ * Profile handling
+ */
+/* Unnamed profile with the default parameters. */
+void profile_set_defaults(struct bfd_profile *bp)
+{
+	memset(bp, 0, sizeof(*bp));
+	bp->bp_detectmultiplier = BFD_DEFDETECTMULT;
+	bp->bp_recvinterval = BFD_DEFREQUIREDMINRX / 1000;
+	bp->bp_txinterval = BFD_DEFDESIREDMINTX / 1000;
+	bp->bp_echointerval = BFD_DEF_REQ_MIN_ECHO / 1000;
+}
+
+static struct bfd_profile *profile_alloc(const struct bfd_profile *bpt)
+{
+	struct bfd_profile *bp;
+
+	bp = calloc(1, sizeof(*bp));
+	if (bp == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		return NULL;
+	}
+
+	strxcpy(bp->bp_name, bpt->bp_name, sizeof(bp->bp_name));
+	profile_set(bp, bpt);
+
+	return bp;
+}
+
+struct bfd_profile *profile_new(const struct bfd_profile *bpt)
+{
+	struct bfd_profile *bp;
+
+	bp = profile_alloc(bpt);
+	if (bp == NULL)
+		return NULL;
+
+	HASH_ADD_KEYPTR(bp_hh, bglobal.bg_profiles, bp->bp_name,
+			strlen(bp->bp_name), bp);
+
+	return bp;
+}
+
+struct bfd_profile *profile_find(const char *name)
+{
+	struct bfd_profile *bp;
+
+	HASH_FIND(bp_hh, bglobal.bg_profiles, name, strlen(name), bp);
+
+	return bp;
+}
+
+/*
+ * Returns the unnamed profile with the `bpt` parameters, it is created
+ * if no session uses one yet. The caller takes the reference.
+ */
+struct bfd_profile *profile_unnamed(const struct bfd_profile *bpt)
+{
+	struct bfd_profile *bp;
+
+	HASH_FIND(bp_ph, bglobal.bg_uprofiles, &bpt->bp_recvinterval,
+		  BFD_PROFILE_KEYLEN, bp);
+	if (bp != NULL)
+		return bp;
+
+	bp = calloc(1, sizeof(*bp));
+	if (bp == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		return NULL;
+	}
+
+	profile_set(bp, bpt);
+	HASH_ADD(bp_ph, bglobal.bg_uprofiles, bp_recvinterval,
+		 BFD_PROFILE_KEYLEN, bp);
+
+	return bp;
+}
+
+/*
+ * Replaces the named profile `bp` with a copy holding the `bpt`
+ * parameters. The sessions still using `bp` must be moved to the new
+ * profile (`bp_newer`): `bp` is released with the last of them.
+ */
+struct bfd_profile *profile_replace(struct bfd_profile *bp,
+				    const struct bfd_profile *bpt)
+{
+	struct bfd_profile *bpn;
+
+	bpn = profile_alloc(bpt);
+	if (bpn == NULL)
+		return NULL;
+
+	HASH_DELETE(bp_hh, bglobal.bg_profiles, bp);
+	HASH_ADD_KEYPTR(bp_hh, bglobal.bg_profiles, bpn->bp_name,
+			strlen(bpn->bp_name), bpn);
+
+	if (bp->bp_refcount == 0)
+		free(bp);
+	else
+		bp->bp_newer = bpn;
+
+	return bpn;
+}
+
+/* Tells if the profile parameters are the same. */
+bool profile_cmp(const struct bfd_profile *bp, const struct bfd_profile *bpt)
+{
+	return bp->bp_detectmultiplier == bpt->bp_detectmultiplier
+	       && bp->bp_recvinterval == bpt->bp_recvinterval
+	       && bp->bp_txinterval == bpt->bp_txinterval
+	       && bp->bp_echointerval == bpt->bp_echointerval
+	       && bp->bp_echo == bpt->bp_echo
+	       && bp->bp_track_sla == bpt->bp_track_sla;
+}
+
+/* Copies the `bpt` parameters to the profile. */
+void profile_set(struct bfd_profile *bp, const struct bfd_profile *bpt)
+{
+	bp->bp_detectmultiplier = bpt->bp_detectmultiplier;
+	bp->bp_recvinterval = bpt->bp_recvinterval;
+	bp->bp_txinterval = bpt->bp_txinterval;
+	bp->bp_echointerval = bpt->bp_echointerval;
+	bp->bp_echo = bpt->bp_echo;
+	bp->bp_track_sla = bpt->bp_track_sla;
+}
+
+/*
+ * Releases a session reference: unnamed and replaced profiles go away
+ * with their last session, named ones only when they leave the
+ * configuration file.
+ */
+void profile_unref(struct bfd_profile *bp)
+{
+	if (--bp->bp_refcount > 0)
+		return;
+
+	if (bp->bp_name[0] == 0) {
+		HASH_DELETE(bp_ph, bglobal.bg_uprofiles, bp);
+		free(bp);
+	} else if (bp->bp_newer != NULL) {
+		free(bp);
+	}
+}
+
+void profile_free(struct bfd_profile *bp)
+{
+	HASH_DELETE(bp_hh, bglobal.bg_profiles, bp);
+	free(bp);
+}
+
+/*
+ * Copies the peer profile parameters into `bpc`. Returns -1 if the
+ * profile doesn't exist.
+ */
+int profile_to_bpc(struct bfd_peer_cfg *bpc)
+{
+	struct bfd_profile *bp;
+
+	if (!bpc->bpc_has_profile)
+		return 0;
+
+	bp = profile_find(bpc->bpc_profile);
+	if (bp == NULL) {
+		log_warning("%s: unknown profile '%s'\n", __FUNCTION__,
+			    bpc->bpc_profile);
+		return -1;
+	}
+
+	bpc->bpc_has_detectmultiplier = true;
+	bpc->bpc_detectmultiplier = bp->bp_detectmultiplier;
+	bpc->bpc_has_recvinterval = true;
+	bpc->bpc_recvinterval = bp->bp_recvinterval;
+	bpc->bpc_has_txinterval = true;
+	bpc->bpc_txinterval = bp->bp_txinterval;
+	bpc->bpc_has_echointerval = true;
+	bpc->bpc_echointerval = bp->bp_echointerval;
+	bpc->bpc_echo = bp->bp_echo;
+	bpc->bpc_track_sla = bp->bp_track_sla;
+
+	return 0;
+}
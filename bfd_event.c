@@ -75,8 +75,12 @@ void bfd_xmttimer_update(bfd_session *bs, uint64_t jitter)
 {
 	struct timeval tv = {.tv_sec = 0, .tv_usec = jitter};
 
-	/* Don't add event if peer is deactivated. */
-	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN)) {
+	/*
+	 * Don't add event if peer is deactivated or has no socket yet (see
+	 * bfd_socket_setup()).
+	 */
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN)
+	    || bs->sock_pending) {
 		return;
 	}
 
@@ -93,8 +97,12 @@ void bfd_echo_xmttimer_update(bfd_session *bs, uint64_t jitter)
 {
 	struct timeval tv = {.tv_sec = 0, .tv_usec = jitter};
 
-	/* Don't add event if peer is deactivated. */
-	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN)) {
+	/*
+	 * Don't add event if peer is deactivated or has no socket yet (see
+	 * bfd_socket_setup()).
+	 */
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN)
+	    || bs->sock_pending) {
 		return;
 	}
 
@@ -127,16 +135,19 @@ void bfd_echo_xmttimer_delete(bfd_session *bs)
 	event_del(&bs->echo_xmttimer_ev);
 }
 
-void bfd_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb, int sd)
+/*
+ * The detection timers are plain timers: the session socket becomes
+ * readable when the transmit timestamps are queued (see bfd_sla.c).
+ */
+void bfd_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb)
 {
-	event_assign(&bs->recvtimer_ev, bglobal.bg_eb, sd, EV_PERSIST | EV_READ,
-		     cb, bs);
+	event_assign(&bs->recvtimer_ev, bglobal.bg_eb, -1, EV_PERSIST, cb, bs);
 }
 
-void bfd_echo_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb, int sd)
+void bfd_echo_recvtimer_assign(bfd_session *bs, bfd_ev_cb cb)
 {
-	event_assign(&bs->echo_recvtimer_ev, bglobal.bg_eb, sd,
-		     EV_PERSIST | EV_READ, cb, bs);
+	event_assign(&bs->echo_recvtimer_ev, bglobal.bg_eb, -1, EV_PERSIST, cb,
+		     bs);
 }
 
 void bfd_xmttimer_assign(bfd_session *bs, bfd_ev_cb cb)
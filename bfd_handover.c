@@ -0,0 +1,480 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_handover.c: hands the sockets and sessions over to a new daemon.
+ *
+ * The new daemon sends BMT_HANDOVER on the control socket of the running
+ * one, which answers on the same connection with:
+ *
+ *   - BHT_LISTENERS: the listening sockets (uint32_t slot per socket);
+ *   - BHT_SESSIONS: session checkpoints (struct bfd_state_entry), each
+ *     one with its socket, in chunks of at most BFD_HANDOVER_FDS;
+ *   - BHT_END.
+ *
+ * The sockets are passed with SCM_RIGHTS on the chunk header. The old
+ * daemon takes the snapshot on the protocol thread and freezes the
+ * sessions, the control thread (which owns the connection) writes the
+ * messages queued before the request and sends the snapshot. The old
+ * daemon then exits, without bringing any session down; the new one
+ * restores the sessions like a warm restart (see bfd_state.c) and
+ * transmits with the handed over sockets.
+ */
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+/*
+ * Prototypes
+ */
+int *handover_listener(uint32_t slot);
+int handover_write(int sd, uint16_t type, void *data, size_t len, int *fds,
+		   size_t fdcnt);
+int handover_read(int sd, struct bfd_handover_hdr *bhh, int *fds,
+		  size_t *fdcnt);
+int handover_read_data(int sd, void *data, size_t len);
+
+
+/*
+ * Functions
+ */
+
+/* Listening sockets in slot order. */
+int *handover_listener(uint32_t slot)
+{
+	switch (slot) {
+	case 0:
+		return &bglobal.bg_csock;
+	case 1:
+		return &bglobal.bg_shop;
+	case 2:
+		return &bglobal.bg_mhop;
+	case 3:
+		return &bglobal.bg_shop6;
+	case 4:
+		return &bglobal.bg_mhop6;
+	case 5:
+		return &bglobal.bg_echo;
+	case 6:
+		return &bglobal.bg_vxlan;
+	case 7:
+		return &bglobal.bg_msock;
+	case 8:
+		return &bglobal.bg_rsock;
+
+	default:
+		return NULL;
+	}
+}
+
+int handover_write(int sd, uint16_t type, void *data, size_t len, int *fds,
+		   size_t fdcnt)
+{
+	struct bfd_handover_hdr bhh = {
+		.bhh_magic = BFD_HANDOVER_MAGIC,
+		.bhh_type = type,
+		.bhh_count = fdcnt,
+	};
+	union {
+		struct cmsghdr cmsg;
+		uint8_t buf[CMSG_SPACE(sizeof(int) * BFD_HANDOVER_FDS)];
+	} cbuf;
+	struct iovec iov[2];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	size_t pos;
+	ssize_t bwrite;
+
+	iov[0].iov_base = &bhh;
+	iov[0].iov_len = sizeof(bhh);
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = len ? 2 : 1;
+	if (fdcnt > 0) {
+		memset(&cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdcnt);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdcnt);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdcnt);
+	}
+
+	do {
+		bwrite = sendmsg(sd, &msg, MSG_NOSIGNAL);
+	} while (bwrite == -1 && errno == EINTR);
+	if (bwrite == -1) {
+		log_warning("%s: sendmsg: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	/* The descriptors went with the first part: send the rest. */
+	if ((size_t)bwrite < sizeof(bhh)) {
+		log_warning("%s: short write\n", __FUNCTION__);
+		return -1;
+	}
+	for (pos = bwrite - sizeof(bhh); pos < len; pos += bwrite) {
+		bwrite = write(sd, (uint8_t *)data + pos, len - pos);
+		if (bwrite == -1) {
+			if (errno == EINTR) {
+				bwrite = 0;
+				continue;
+			}
+
+			log_warning("%s: write: %s\n", __FUNCTION__,
+				    strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Protocol thread: takes the snapshot of every socket and session. The
+ * sessions must not run from now on: the new daemon resumes them from it.
+ */
+struct bfd_handover *bfd_handover_prepare(void)
+{
+	struct bfd_handover *bho;
+	bfd_session *bs, *tmp;
+	uint32_t slot;
+	size_t cnt;
+	int *lsd;
+
+	bho = calloc(1, sizeof(*bho));
+	if (bho == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		return NULL;
+	}
+
+	/* Every session hands over its socket. */
+	bfd_socket_flush();
+
+	bho->bho_efd = -1;
+	cnt = HASH_CNT(sh, session_hash);
+	bho->bho_bstv = calloc(cnt ? cnt : 1, sizeof(*bho->bho_bstv));
+	bho->bho_fds = calloc(cnt ? cnt : 1, sizeof(*bho->bho_fds));
+	bho->bho_efd = eventfd(0, EFD_CLOEXEC);
+	if (bho->bho_bstv == NULL || bho->bho_fds == NULL
+	    || bho->bho_efd == -1) {
+		log_warning("%s: %s\n", __FUNCTION__, strerror(errno));
+		bfd_handover_free(bho);
+		return NULL;
+	}
+
+	for (slot = 0; (lsd = handover_listener(slot)) != NULL; slot++) {
+		if (*lsd == -1)
+			continue;
+
+		bho->bho_slots[bho->bho_lcnt] = slot;
+		bho->bho_lfds[bho->bho_lcnt++] = *lsd;
+	}
+
+	HASH_ITER (sh, session_hash, bs, tmp) {
+		bfd_state_fill(bs, &bho->bho_bstv[bho->bho_cnt]);
+		bho->bho_fds[bho->bho_cnt++] = bs->sock;
+	}
+
+	return bho;
+}
+
+void bfd_handover_free(struct bfd_handover *bho)
+{
+	if (bho == NULL)
+		return;
+
+	if (bho->bho_efd != -1)
+		close(bho->bho_efd);
+	free(bho->bho_bstv);
+	free(bho->bho_fds);
+	free(bho);
+}
+
+/*
+ * Control thread: sends the snapshot to the new daemon on the (blocking)
+ * connection `sd`.
+ */
+int bfd_handover_send(struct bfd_handover *bho, int sd)
+{
+	size_t pos, cnt;
+
+	if (handover_write(sd, BHT_LISTENERS, bho->bho_slots,
+			   sizeof(*bho->bho_slots) * bho->bho_lcnt,
+			   bho->bho_lfds, bho->bho_lcnt)
+	    != 0)
+		return -1;
+
+	for (pos = 0; pos < bho->bho_cnt; pos += cnt) {
+		cnt = bho->bho_cnt - pos;
+		if (cnt > BFD_HANDOVER_FDS)
+			cnt = BFD_HANDOVER_FDS;
+
+		if (handover_write(sd, BHT_SESSIONS, &bho->bho_bstv[pos],
+				   sizeof(*bho->bho_bstv) * cnt,
+				   &bho->bho_fds[pos], cnt)
+		    != 0)
+			return -1;
+	}
+
+	if (handover_write(sd, BHT_END, NULL, 0, NULL, 0) != 0)
+		return -1;
+
+	log_info("%s: handed %zu sessions over\n", __FUNCTION__,
+		 bho->bho_cnt);
+
+	return 0;
+}
+
+/* Control thread: gives the transfer result to the protocol thread. */
+void bfd_handover_done(struct bfd_handover *bho, int result)
+{
+	uint64_t one = 1;
+
+	__atomic_store_n(&bho->bho_result, result, __ATOMIC_RELEASE);
+	if (write(bho->bho_efd, &one, sizeof(one)) == -1)
+		log_warning("%s: write: %s\n", __FUNCTION__, strerror(errno));
+}
+
+/* Protocol thread: waits for the control thread to send the snapshot. */
+int bfd_handover_wait(struct bfd_handover *bho)
+{
+	uint64_t cnt;
+
+	while (read(bho->bho_efd, &cnt, sizeof(cnt)) == -1) {
+		if (errno != EINTR) {
+			log_error("%s: read: %s\n", __FUNCTION__,
+				  strerror(errno));
+			return -1;
+		}
+	}
+
+	return __atomic_load_n(&bho->bho_result, __ATOMIC_ACQUIRE);
+}
+
+int handover_read_data(int sd, void *data, size_t len)
+{
+	size_t pos = 0;
+	ssize_t bread;
+
+	while (pos < len) {
+		bread = read(sd, (uint8_t *)data + pos, len - pos);
+		if (bread == 0) {
+			log_error("%s: connection closed\n", __FUNCTION__);
+			return -1;
+		}
+		if (bread == -1) {
+			if (errno == EINTR)
+				continue;
+
+			log_error("%s: read: %s\n", __FUNCTION__,
+				  strerror(errno));
+			return -1;
+		}
+
+		pos += bread;
+	}
+
+	return 0;
+}
+
+/* Reads a chunk header with its descriptors. */
+int handover_read(int sd, struct bfd_handover_hdr *bhh, int *fds,
+		  size_t *fdcnt)
+{
+	union {
+		struct cmsghdr cmsg;
+		uint8_t buf[CMSG_SPACE(sizeof(int) * BFD_HANDOVER_FDS)];
+	} cbuf;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	ssize_t bread;
+
+	*fdcnt = 0;
+	iov.iov_base = bhh;
+	iov.iov_len = sizeof(*bhh);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	do {
+		bread = recvmsg(sd, &msg, MSG_CMSG_CLOEXEC);
+	} while (bread == -1 && errno == EINTR);
+	if (bread <= 0) {
+		log_error("%s: recvmsg: %s\n", __FUNCTION__,
+			  bread ? strerror(errno) : "connection closed");
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET
+		    || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		*fdcnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * *fdcnt);
+	}
+
+	if ((size_t)bread < sizeof(*bhh)
+	    && handover_read_data(sd, (uint8_t *)bhh + bread,
+				  sizeof(*bhh) - bread)
+		       != 0)
+		return -1;
+
+	if (bhh->bhh_magic != BFD_HANDOVER_MAGIC
+	    || bhh->bhh_count > BFD_HANDOVER_FDS || *fdcnt != bhh->bhh_count
+	    || (msg.msg_flags & MSG_CTRUNC)) {
+		log_error("%s: invalid handover message\n", __FUNCTION__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Takes the sockets and sessions over from the daemon running on the
+ * control socket `path`. Must be called before any socket is created.
+ */
+int bfd_handover_recv(const char *path)
+{
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+	};
+	struct bfd_control_msg bcm = {
+		.bcm_length = 0,
+		.bcm_id = htons(1),
+		.bcm_type = BMT_HANDOVER,
+		.bcm_ver = BMV_VERSION_2,
+	};
+	struct bfd_handover_hdr bhh;
+	struct bfd_state_entry *bstv;
+	uint32_t slots[BFD_HANDOVER_LISTENERS], slot;
+	int fds[BFD_HANDOVER_FDS], *lsd, sd;
+	size_t fdcnt, idx, total = 0;
+
+	strxcpy(sun.sun_path, path, sizeof(sun.sun_path));
+	sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sd == -1) {
+		log_error("%s: socket: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		log_error("%s: connect(%s): %s\n", __FUNCTION__, path,
+			  strerror(errno));
+		close(sd);
+		return -1;
+	}
+	if (write(sd, &bcm, sizeof(bcm)) != sizeof(bcm)) {
+		log_error("%s: write: %s\n", __FUNCTION__, strerror(errno));
+		close(sd);
+		return -1;
+	}
+
+	bstv = calloc(BFD_HANDOVER_FDS, sizeof(*bstv));
+	if (bstv == NULL) {
+		log_error("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		close(sd);
+		return -1;
+	}
+
+	/* The sockets that were not handed over are created as usual. */
+	for (slot = 0; (lsd = handover_listener(slot)) != NULL; slot++)
+		*lsd = -1;
+
+	do {
+		if (handover_read(sd, &bhh, fds, &fdcnt) != 0)
+			goto fail;
+
+		switch (bhh.bhh_type) {
+		case BHT_LISTENERS:
+			if (fdcnt > BFD_HANDOVER_LISTENERS) {
+				log_error("%s: too many listening sockets: "
+					  "%zu\n",
+					  __FUNCTION__, fdcnt);
+				goto fail_fds;
+			}
+			if (handover_read_data(sd, slots,
+					       sizeof(*slots) * fdcnt)
+			    != 0)
+				goto fail_fds;
+
+			for (idx = 0; idx < fdcnt; idx++) {
+				lsd = handover_listener(slots[idx]);
+				if (lsd == NULL || *lsd != -1) {
+					close(fds[idx]);
+					continue;
+				}
+
+				*lsd = fds[idx];
+			}
+			break;
+
+		case BHT_SESSIONS:
+			if (handover_read_data(sd, bstv, sizeof(*bstv) * fdcnt)
+			    != 0)
+				goto fail_fds;
+
+			for (idx = 0; idx < fdcnt; idx++) {
+				if (bfd_state_saved_add(&bstv[idx], fds[idx])
+				    != 0)
+					close(fds[idx]);
+			}
+			total += fdcnt;
+			break;
+
+		case BHT_END:
+			break;
+
+		default:
+			log_error("%s: unknown handover message type %d\n",
+				  __FUNCTION__, bhh.bhh_type);
+			goto fail_fds;
+		}
+	} while (bhh.bhh_type != BHT_END);
+
+	free(bstv);
+	close(sd);
+
+	bglobal.bg_handover = true;
+	log_info("%s: took %zu sessions over\n", __FUNCTION__, total);
+
+	return 0;
+
+fail_fds:
+	for (idx = 0; idx < fdcnt; idx++)
+		close(fds[idx]);
+fail:
+	free(bstv);
+	close(sd);
+
+	return -1;
+}
@@ -0,0 +1,294 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_json.c: streaming JSON writer. Documents are written straight into
+ * a reusable buffer with the same formatting as json-c
+ * (`BFDD_JSON_CONV_OPTIONS`), so the daemon messages don't need to build
+ * an object tree first.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include "bfd.h"
+
+/*
+ * Definitions
+ */
+#define JW_INITIAL_SIZE 1024
+#define JW_PRETTY (BFDD_JSON_CONV_OPTIONS & JSON_C_TO_STRING_PRETTY)
+
+/* Bit of the nesting level in `jw_members`. */
+#define JW_LEVEL_BIT(level) (1ULL << ((level) % 64))
+
+/*
+ * Prototypes
+ */
+bool jw_reserve(struct json_writer *jw, size_t len);
+void jw_append(struct json_writer *jw, const char *str, size_t len);
+void jw_indent(struct json_writer *jw, unsigned int level);
+void jw_escape(struct json_writer *jw, const char *str);
+void jw_member(struct json_writer *jw, const char *key);
+void jw_container_start(struct json_writer *jw, const char *key, char c);
+void jw_container_end(struct json_writer *jw, char c);
+
+
+/*
+ * Buffer handling
+ */
+bool jw_reserve(struct json_writer *jw, size_t len)
+{
+	size_t size;
+	char *buf;
+
+	if (jw->jw_error)
+		return false;
+	if (jw->jw_len + len <= jw->jw_size)
+		return true;
+
+	size = jw->jw_size ? jw->jw_size : JW_INITIAL_SIZE;
+	while (size < jw->jw_len + len)
+		size *= 2;
+
+	buf = realloc(jw->jw_buf, size);
+	if (buf == NULL) {
+		log_warning("%s: realloc: %s\n", __FUNCTION__, strerror(errno));
+		jw->jw_error = true;
+		return false;
+	}
+
+	jw->jw_buf = buf;
+	jw->jw_size = size;
+
+	return true;
+}
+
+void jw_append(struct json_writer *jw, const char *str, size_t len)
+{
+	if (!jw_reserve(jw, len))
+		return;
+
+	memcpy(&jw->jw_buf[jw->jw_len], str, len);
+	jw->jw_len += len;
+}
+
+void jw_indent(struct json_writer *jw, unsigned int level)
+{
+	while (level-- > 0)
+		jw_append(jw, "  ", 2);
+}
+
+/* Escapes like json-c: quotes, backslashes, slashes and control chars. */
+void jw_escape(struct json_writer *jw, const char *str)
+{
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *s = (const unsigned char *)str;
+	const char *esc;
+	char uesc[7];
+	size_t pos, start = 0;
+
+	for (pos = 0; s[pos] != 0; pos++) {
+		switch (s[pos]) {
+		case '\b':
+			esc = "\\b";
+			break;
+		case '\n':
+			esc = "\\n";
+			break;
+		case '\r':
+			esc = "\\r";
+			break;
+		case '\t':
+			esc = "\\t";
+			break;
+		case '\f':
+			esc = "\\f";
+			break;
+		case '"':
+			esc = "\\\"";
+			break;
+		case '\\':
+			esc = "\\\\";
+			break;
+		case '/':
+			esc = "\\/";
+			break;
+
+		default:
+			if (s[pos] >= ' ')
+				continue;
+
+			snprintf(uesc, sizeof(uesc), "\\u00%c%c",
+				 hex[s[pos] >> 4], hex[s[pos] & 0xf]);
+			esc = uesc;
+			break;
+		}
+
+		jw_append(jw, &str[start], pos - start);
+		jw_append(jw, esc, strlen(esc));
+		start = pos + 1;
+	}
+
+	jw_append(jw, &str[start], pos - start);
+}
+
+/*
+ * Starts a value in the current container: `key` is `NULL` for array
+ * items and for the document itself. Keys are not escaped.
+ */
+void jw_member(struct json_writer *jw, const char *key)
+{
+	if (jw->jw_level == 0)
+		return;
+
+	if (jw->jw_members & JW_LEVEL_BIT(jw->jw_level)) {
+		jw_append(jw, ",", 1);
+		if (JW_PRETTY)
+			jw_append(jw, "\n", 1);
+	}
+	jw->jw_members |= JW_LEVEL_BIT(jw->jw_level);
+
+	if (JW_PRETTY)
+		jw_indent(jw, jw->jw_level);
+
+	if (key == NULL)
+		return;
+
+	jw_append(jw, "\"", 1);
+	jw_append(jw, key, strlen(key));
+	jw_append(jw, "\":", 2);
+}
+
+void jw_container_start(struct json_writer *jw, const char *key, char c)
+{
+	jw_member(jw, key);
+	jw_append(jw, &c, 1);
+	if (JW_PRETTY)
+		jw_append(jw, "\n", 1);
+
+	jw->jw_level++;
+	jw->jw_members &= ~JW_LEVEL_BIT(jw->jw_level);
+}
+
+void jw_container_end(struct json_writer *jw, char c)
+{
+	if (JW_PRETTY) {
+		if (jw->jw_members & JW_LEVEL_BIT(jw->jw_level))
+			jw_append(jw, "\n", 1);
+		jw_indent(jw, jw->jw_level - 1);
+	}
+
+	jw->jw_level--;
+	jw_append(jw, &c, 1);
+}
+
+
+/*
+ * Document writing
+ */
+void jw_reset(struct json_writer *jw)
+{
+	jw->jw_len = 0;
+	jw->jw_level = 0;
+	jw->jw_members = 0;
+	jw->jw_error = false;
+}
+
+void jw_object_start(struct json_writer *jw, const char *key)
+{
+	jw_container_start(jw, key, '{');
+}
+
+void jw_object_end(struct json_writer *jw)
+{
+	jw_container_end(jw, '}');
+}
+
+void jw_array_start(struct json_writer *jw, const char *key)
+{
+	jw_container_start(jw, key, '[');
+}
+
+void jw_array_end(struct json_writer *jw)
+{
+	jw_container_end(jw, ']');
+}
+
+void jw_string(struct json_writer *jw, const char *key, const char *str)
+{
+	jw_member(jw, key);
+	jw_append(jw, "\"", 1);
+	jw_escape(jw, str);
+	jw_append(jw, "\"", 1);
+}
+
+void jw_int(struct json_writer *jw, const char *key, int64_t value)
+{
+	char buf[24];
+	int len;
+
+	jw_member(jw, key);
+	len = snprintf(buf, sizeof(buf), "%" PRId64, value);
+	jw_append(jw, buf, len);
+}
+
+void jw_bool(struct json_writer *jw, const char *key, bool value)
+{
+	jw_member(jw, key);
+	if (value)
+		jw_append(jw, "true", 4);
+	else
+		jw_append(jw, "false", 5);
+}
+
+/* Same as json-c: "%.17g" that always looks like a floating point. */
+void jw_double(struct json_writer *jw, const char *key, double value)
+{
+	char buf[128];
+	int len;
+
+	jw_member(jw, key);
+	if (isnan(value)) {
+		jw_append(jw, "NaN", 3);
+		return;
+	}
+	if (isinf(value)) {
+		if (value > 0)
+			jw_append(jw, "Infinity", 8);
+		else
+			jw_append(jw, "-Infinity", 9);
+		return;
+	}
+
+	len = snprintf(buf, sizeof(buf), "%.17g", value);
+	if (len < (int)sizeof(buf) - 2 && strchr(buf, '.') == NULL
+	    && strchr(buf, 'e') == NULL
+	    && (isdigit((unsigned char)buf[0])
+		|| (buf[0] == '-' && isdigit((unsigned char)buf[1])))) {
+		memcpy(&buf[len], ".0", 3);
+		len += 2;
+	}
+
+	jw_append(jw, buf, len);
+}
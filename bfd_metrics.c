@@ -0,0 +1,803 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_metrics.c: exports the daemon and sessions counters in the
+ * OpenMetrics text format over a minimal HTTP/1.0 server.
+ *
+ * The response is rendered in pieces: every connection owns a fixed
+ * buffer that is filled from a (metric family, session discriminator)
+ * cursor whenever the previous piece was written, so large scrapes are
+ * interleaved with the protocol events instead of blocking them.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+/*
+ * Definitions
+ */
+#define BFD_METRICS_BUFSIZE 32768
+#define BFD_METRICS_CONNS 8
+#define BFD_METRICS_TIMEOUT 10
+/* Longest line: the labels may double in size when escaped. */
+#define BFD_METRICS_LINE_MAX (512 + 8 * (MAXNAMELEN + 1))
+
+#define BFD_METRICS_CONTENT_TYPE                                               \
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+enum bfd_metrics_sample {
+	/* Daemon metrics. */
+	BMS_SESSIONS,
+	BMS_SOCKETS,
+	BMS_RX_CTRL,
+	BMS_TX_CTRL,
+	BMS_RX_ECHO,
+	BMS_TX_ECHO,
+
+	/* Per session metrics. */
+	BMS_SESSION_STATE,
+	BMS_SESSION_RX_CTRL,
+	BMS_SESSION_TX_CTRL,
+	BMS_SESSION_RX_ECHO,
+	BMS_SESSION_TX_ECHO,
+	BMS_SESSION_LATENCY,
+	BMS_SESSION_JITTER,
+	BMS_SESSION_LOSS,
+};
+
+struct bfd_metrics_family {
+	const char *bmf_name;
+	const char *bmf_type;
+	const char *bmf_unit;
+	const char *bmf_help;
+	enum bfd_metrics_sample bmf_sample;
+	bool bmf_session;
+};
+
+static const struct bfd_metrics_family metrics_families[] = {
+	{"bfdd_sessions", "gauge", NULL, "Number of sessions by state.",
+	 BMS_SESSIONS, false},
+	{"bfdd_control_sockets", "gauge", NULL,
+	 "Number of connected control sockets.", BMS_SOCKETS, false},
+	{"bfdd_rx_control_packets", "counter", NULL,
+	 "Control packets received by all sessions.", BMS_RX_CTRL, false},
+	{"bfdd_tx_control_packets", "counter", NULL,
+	 "Control packets sent by all sessions.", BMS_TX_CTRL, false},
+	{"bfdd_rx_echo_packets", "counter", NULL,
+	 "Echo packets received by all sessions.", BMS_RX_ECHO, false},
+	{"bfdd_tx_echo_packets", "counter", NULL,
+	 "Echo packets sent by all sessions.", BMS_TX_ECHO, false},
+
+	{"bfdd_session_state", "gauge", NULL,
+	 "Session state: 0 adm-down, 1 down, 2 init and 3 up.",
+	 BMS_SESSION_STATE, true},
+	{"bfdd_session_rx_control_packets", "counter", NULL,
+	 "Control packets received.", BMS_SESSION_RX_CTRL, true},
+	{"bfdd_session_tx_control_packets", "counter", NULL,
+	 "Control packets sent.", BMS_SESSION_TX_CTRL, true},
+	{"bfdd_session_rx_echo_packets", "counter", NULL,
+	 "Echo packets received.", BMS_SESSION_RX_ECHO, true},
+	{"bfdd_session_tx_echo_packets", "counter", NULL,
+	 "Echo packets sent.", BMS_SESSION_TX_ECHO, true},
+	{"bfdd_session_sla_latency_seconds", "gauge", "seconds",
+	 "Last measured latency.", BMS_SESSION_LATENCY, true},
+	{"bfdd_session_sla_jitter_seconds", "gauge", "seconds",
+	 "Last measured jitter.", BMS_SESSION_JITTER, true},
+	{"bfdd_session_sla_packet_loss_ratio", "gauge", "ratio",
+	 "Last measured packet loss.", BMS_SESSION_LOSS, true},
+};
+#define METRICS_FAMILIES                                                       \
+	(sizeof(metrics_families) / sizeof(metrics_families[0]))
+
+/* Daemon totals are taken once at the beginning of each scrape. */
+struct bfd_metrics_totals {
+	uint64_t bmt_sessions[PTM_BFD_UP + 1];
+	uint64_t bmt_sockets;
+	bfd_session_stats_t bmt_stats;
+};
+
+struct bfd_metrics_conn {
+	int bmc_sd;
+	struct event bmc_ev;
+
+	/* The last piece of the response was rendered. */
+	bool bmc_eof;
+
+	/* Rendering cursor: family index and last written session. */
+	unsigned int bmc_family;
+	uint32_t bmc_discr;
+	bool bmc_header;
+	struct bfd_metrics_totals bmc_totals;
+
+	/* Holds the request first and then the response pieces. */
+	size_t bmc_len;
+	size_t bmc_pos;
+	char bmc_buf[BFD_METRICS_BUFSIZE];
+};
+
+/*
+ * Prototypes
+ */
+int metrics_listen_unix(const char *path);
+int metrics_listen_tcp(const char *address);
+void metrics_accept(evutil_socket_t sd, short ev, void *arg);
+void metrics_conn_free(struct bfd_metrics_conn *bmc);
+void metrics_conn_event(struct bfd_metrics_conn *bmc, short ev);
+void metrics_conn_cb(evutil_socket_t sd, short ev, void *arg);
+int metrics_read(struct bfd_metrics_conn *bmc);
+int metrics_write(struct bfd_metrics_conn *bmc);
+void metrics_respond(struct bfd_metrics_conn *bmc, const char *status);
+
+bool metrics_room(struct bfd_metrics_conn *bmc);
+void metrics_append(struct bfd_metrics_conn *bmc, const char *str);
+void metrics_printf(struct bfd_metrics_conn *bmc, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void metrics_escape(struct bfd_metrics_conn *bmc, const char *str);
+void metrics_totals(struct bfd_metrics_totals *bmt);
+void metrics_header(struct bfd_metrics_conn *bmc,
+		    const struct bfd_metrics_family *bmf);
+void metrics_daemon(struct bfd_metrics_conn *bmc,
+		    const struct bfd_metrics_family *bmf);
+void metrics_labels(struct bfd_metrics_conn *bmc, bfd_session *bs);
+int metrics_session_cb(bfd_session *bs, void *arg);
+int metrics_render(struct bfd_metrics_conn *bmc);
+
+
+/*
+ * Listening socket
+ */
+int bfd_metrics_init(const char *address)
+{
+	int sd;
+
+	/* Keep the socket handed over by the previous daemon. */
+	if (bglobal.bg_msock != -1)
+		sd = bglobal.bg_msock;
+	else if (address[0] == '/')
+		sd = metrics_listen_unix(address);
+	else
+		sd = metrics_listen_tcp(address);
+
+	if (sd == -1)
+		return -1;
+
+	if (sd != bglobal.bg_msock && listen(sd, SOMAXCONN) == -1) {
+		log_error("%s: listen: %s\n", __FUNCTION__, strerror(errno));
+		close(sd);
+		return -1;
+	}
+
+	bglobal.bg_msock = sd;
+	event_assign(&bglobal.bg_msockev, bglobal.bg_eb, sd,
+		     EV_READ | EV_PERSIST, metrics_accept, NULL);
+	event_add(&bglobal.bg_msockev, NULL);
+
+	return 0;
+}
+
+int metrics_listen_unix(const char *path)
+{
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+	};
+	int sd;
+
+	if (strxcpy(sun.sun_path, path, sizeof(sun.sun_path))
+	    >= sizeof(sun.sun_path)) {
+		log_error("%s: path too long: %s\n", __FUNCTION__, path);
+		return -1;
+	}
+
+	/* Remove previously created sockets. */
+	unlink(sun.sun_path);
+
+	sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    PF_UNSPEC);
+	if (sd == -1) {
+		log_error("%s: socket: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	if (bind(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		log_error("%s: bind(%s): %s\n", __FUNCTION__, path,
+			  strerror(errno));
+		close(sd);
+		return -1;
+	}
+
+	return sd;
+}
+
+/*
+ * Accepts `port`, `address:port` or `[address]:port`. The exporter binds
+ * to the IPv4 loopback address when no address is given.
+ */
+int metrics_listen_tcp(const char *address)
+{
+	struct sockaddr_any sa;
+	char host[INET6_ADDRSTRLEN + 2];
+	const char *port;
+	char *ep;
+	unsigned long portnum;
+	socklen_t salen;
+	size_t hostlen;
+	int sd, on = 1;
+
+	port = strrchr(address, ':');
+	if (port == NULL) {
+		port = address;
+		strxcpy(host, "127.0.0.1", sizeof(host));
+	} else {
+		hostlen = port - address;
+		port++;
+		if (hostlen >= 2 && address[0] == '['
+		    && address[hostlen - 1] == ']') {
+			address++;
+			hostlen -= 2;
+		}
+		if (hostlen >= sizeof(host))
+			goto invalid;
+
+		memcpy(host, address, hostlen);
+		host[hostlen] = 0;
+	}
+
+	portnum = strtoul(port, &ep, 10);
+	if (*port == 0 || *ep != 0 || portnum == 0 || portnum > 65535)
+		goto invalid;
+	if (strtosa(host, &sa) != 0)
+		goto invalid;
+
+	if (sa.sa_sin.sin_family == AF_INET) {
+		sa.sa_sin.sin_port = htons(portnum);
+		salen = sizeof(sa.sa_sin);
+	} else {
+		sa.sa_sin6.sin6_port = htons(portnum);
+		salen = sizeof(sa.sa_sin6);
+	}
+
+	sd = socket(sa.sa_sin.sin_family,
+		    SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (sd == -1) {
+		log_error("%s: socket: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
+		log_warning("%s: setsockopt(SO_REUSEADDR): %s\n", __FUNCTION__,
+			    strerror(errno));
+
+	if (bind(sd, (struct sockaddr *)&sa, salen) == -1) {
+		log_error("%s: bind(%s): %s\n", __FUNCTION__, address,
+			  strerror(errno));
+		close(sd);
+		return -1;
+	}
+
+	return sd;
+
+invalid:
+	log_error("%s: invalid address: %s\n", __FUNCTION__, address);
+	return -1;
+}
+
+void metrics_accept(evutil_socket_t sd, short ev __attribute__((unused)),
+		    void *arg __attribute__((unused)))
+{
+	struct bfd_metrics_conn *bmc;
+	int csock;
+
+	csock = accept(sd, NULL, 0);
+	if (csock == -1) {
+		log_warning("%s: accept: %s\n", __FUNCTION__, strerror(errno));
+		return;
+	}
+
+	/* A slow scraper must never block the protocol thread. */
+	if (evutil_make_socket_nonblocking(csock) == -1) {
+		close(csock);
+		return;
+	}
+
+	if (bglobal.bg_mconns >= BFD_METRICS_CONNS) {
+		log_warning("%s: too many scrapes in progress\n", __FUNCTION__);
+		close(csock);
+		return;
+	}
+
+	/* The only allocation of the whole scrape. */
+	bmc = malloc(sizeof(*bmc));
+	if (bmc == NULL) {
+		log_warning("%s: malloc: %s\n", __FUNCTION__, strerror(errno));
+		close(csock);
+		return;
+	}
+
+	bmc->bmc_sd = csock;
+	bmc->bmc_eof = false;
+	bmc->bmc_len = 0;
+	bmc->bmc_pos = 0;
+	bglobal.bg_mconns++;
+
+	metrics_conn_event(bmc, EV_READ);
+}
+
+void metrics_conn_free(struct bfd_metrics_conn *bmc)
+{
+	event_del(&bmc->bmc_ev);
+	close(bmc->bmc_sd);
+	bglobal.bg_mconns--;
+	free(bmc);
+}
+
+/* Waits for `ev`: idle connections are closed after a while. */
+void metrics_conn_event(struct bfd_metrics_conn *bmc, short ev)
+{
+	struct timeval tv = {.tv_sec = BFD_METRICS_TIMEOUT};
+
+	event_assign(&bmc->bmc_ev, bglobal.bg_eb, bmc->bmc_sd,
+		     ev | EV_PERSIST, metrics_conn_cb, bmc);
+	event_add(&bmc->bmc_ev, &tv);
+}
+
+void metrics_conn_cb(evutil_socket_t sd __attribute__((unused)), short ev,
+		     void *arg)
+{
+	struct bfd_metrics_conn *bmc = arg;
+
+	if (ev & EV_TIMEOUT) {
+		metrics_conn_free(bmc);
+		return;
+	}
+
+	if (ev & EV_READ) {
+		if (metrics_read(bmc) != 0) {
+			metrics_conn_free(bmc);
+			return;
+		}
+	}
+
+	if (ev & EV_WRITE) {
+		if (metrics_write(bmc) != 0) {
+			metrics_conn_free(bmc);
+			return;
+		}
+	}
+}
+
+
+/*
+ * HTTP handling
+ */
+int metrics_read(struct bfd_metrics_conn *bmc)
+{
+	ssize_t bread;
+
+	/* Keep room for the string terminator. */
+	bread = read(bmc->bmc_sd, &bmc->bmc_buf[bmc->bmc_len],
+		     sizeof(bmc->bmc_buf) - bmc->bmc_len - 1);
+	if (bread == 0)
+		return -1;
+	if (bread < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+
+		log_warning("%s: read: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	bmc->bmc_len += bread;
+	bmc->bmc_buf[bmc->bmc_len] = 0;
+
+	/* Only the request line matters, but wait for the whole header. */
+	if (strstr(bmc->bmc_buf, "\r\n\r\n") == NULL
+	    && strstr(bmc->bmc_buf, "\n\n") == NULL) {
+		if (bmc->bmc_len == sizeof(bmc->bmc_buf) - 1)
+			metrics_respond(bmc, "431 Request Header Fields Too Large");
+		return 0;
+	}
+
+	if (strncmp(bmc->bmc_buf, "GET ", 4) != 0) {
+		metrics_respond(bmc, "405 Method Not Allowed");
+		return 0;
+	}
+
+	metrics_respond(bmc, "200 OK");
+	return 0;
+}
+
+/*
+ * Starts the response: anything other than "200 OK" has no body. The
+ * response size is not known beforehand, so the body ends when the
+ * connection is closed.
+ */
+void metrics_respond(struct bfd_metrics_conn *bmc, const char *status)
+{
+	bmc->bmc_len = 0;
+	bmc->bmc_pos = 0;
+
+	if (strcmp(status, "200 OK") != 0) {
+		metrics_printf(bmc,
+			       "HTTP/1.0 %s\r\nContent-Length: 0\r\n"
+			       "Connection: close\r\n\r\n",
+			       status);
+		bmc->bmc_eof = true;
+	} else {
+		metrics_printf(bmc,
+			       "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+			       "Connection: close\r\n\r\n",
+			       BFD_METRICS_CONTENT_TYPE);
+		bmc->bmc_family = 0;
+		bmc->bmc_discr = 0;
+		bmc->bmc_header = false;
+		metrics_totals(&bmc->bmc_totals);
+	}
+
+	/* Ignore the rest of the request from now on. */
+	event_del(&bmc->bmc_ev);
+	metrics_conn_event(bmc, EV_WRITE);
+}
+
+/* Writes one piece per call so other events get to run in between. */
+int metrics_write(struct bfd_metrics_conn *bmc)
+{
+	ssize_t bwrite;
+
+	if (bmc->bmc_pos == bmc->bmc_len) {
+		if (bmc->bmc_eof)
+			return -1;
+
+		bmc->bmc_len = 0;
+		bmc->bmc_pos = 0;
+		if (metrics_render(bmc) != 0)
+			return -1;
+	}
+
+	bwrite = write(bmc->bmc_sd, &bmc->bmc_buf[bmc->bmc_pos],
+		       bmc->bmc_len - bmc->bmc_pos);
+	if (bwrite < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+
+		log_warning("%s: write: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	bmc->bmc_pos += bwrite;
+
+	/* Close as soon as the last piece is out. */
+	if (bmc->bmc_pos == bmc->bmc_len && bmc->bmc_eof)
+		return -1;
+
+	return 0;
+}
+
+
+/*
+ * Rendering
+ */
+bool metrics_room(struct bfd_metrics_conn *bmc)
+{
+	return sizeof(bmc->bmc_buf) - bmc->bmc_len >= BFD_METRICS_LINE_MAX;
+}
+
+/*
+ * The output helpers never grow the buffer: callers check for
+ * `metrics_room()` before writing a line.
+ */
+void metrics_append(struct bfd_metrics_conn *bmc, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (len > sizeof(bmc->bmc_buf) - bmc->bmc_len)
+		len = sizeof(bmc->bmc_buf) - bmc->bmc_len;
+
+	memcpy(&bmc->bmc_buf[bmc->bmc_len], str, len);
+	bmc->bmc_len += len;
+}
+
+void metrics_printf(struct bfd_metrics_conn *bmc, const char *fmt, ...)
+{
+	size_t room = sizeof(bmc->bmc_buf) - bmc->bmc_len;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(&bmc->bmc_buf[bmc->bmc_len], room, fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+	/* Don't count the truncated part nor the terminator. */
+	if ((size_t)len >= room)
+		len = room ? room - 1 : 0;
+
+	bmc->bmc_len += len;
+}
+
+/* Escapes label values: backslashes, double quotes and line feeds. */
+void metrics_escape(struct bfd_metrics_conn *bmc, const char *str)
+{
+	for (; *str != 0 && bmc->bmc_len + 2 <= sizeof(bmc->bmc_buf);
+	     str++) {
+		switch (*str) {
+		case '\\':
+		case '"':
+			bmc->bmc_buf[bmc->bmc_len++] = '\\';
+			bmc->bmc_buf[bmc->bmc_len++] = *str;
+			break;
+		case '\n':
+			bmc->bmc_buf[bmc->bmc_len++] = '\\';
+			bmc->bmc_buf[bmc->bmc_len++] = 'n';
+			break;
+
+		default:
+			bmc->bmc_buf[bmc->bmc_len++] = *str;
+			break;
+		}
+	}
+}
+
+/* The session totals are kept up to date, they are just copied here. */
+void metrics_totals(struct bfd_metrics_totals *bmt)
+{
+	struct bfd_control_socket *bcs;
+
+	memset(bmt, 0, sizeof(*bmt));
+	memcpy(bmt->bmt_sessions, bglobal.bg_msessions,
+	       sizeof(bmt->bmt_sessions));
+	bmt->bmt_stats = bglobal.bg_mstats;
+
+	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
+		bmt->bmt_sockets++;
+	}
+}
+
+void metrics_header(struct bfd_metrics_conn *bmc,
+		    const struct bfd_metrics_family *bmf)
+{
+	metrics_printf(bmc, "# TYPE %s %s\n", bmf->bmf_name, bmf->bmf_type);
+	if (bmf->bmf_unit)
+		metrics_printf(bmc, "# UNIT %s %s\n", bmf->bmf_name,
+			       bmf->bmf_unit);
+	metrics_printf(bmc, "# HELP %s %s\n", bmf->bmf_name, bmf->bmf_help);
+}
+
+void metrics_daemon(struct bfd_metrics_conn *bmc,
+		    const struct bfd_metrics_family *bmf)
+{
+	static const char *const states[] = {
+		[PTM_BFD_ADM_DOWN] = "adm-down",
+		[PTM_BFD_DOWN] = "down",
+		[PTM_BFD_INIT] = "init",
+		[PTM_BFD_UP] = "up",
+	};
+	struct bfd_metrics_totals *bmt = &bmc->bmc_totals;
+	uint64_t value;
+	int state;
+
+	switch (bmf->bmf_sample) {
+	case BMS_SESSIONS:
+		for (state = PTM_BFD_ADM_DOWN; state <= PTM_BFD_UP; state++)
+			metrics_printf(bmc, "%s{state=\"%s\"} %" PRIu64 "\n",
+				       bmf->bmf_name, states[state],
+				       bmt->bmt_sessions[state]);
+		return;
+	case BMS_SOCKETS:
+		value = bmt->bmt_sockets;
+		break;
+	case BMS_RX_CTRL:
+		value = bmt->bmt_stats.rx_ctrl_pkt;
+		break;
+	case BMS_TX_CTRL:
+		value = bmt->bmt_stats.tx_ctrl_pkt;
+		break;
+	case BMS_RX_ECHO:
+		value = bmt->bmt_stats.rx_echo_pkt;
+		break;
+	case BMS_TX_ECHO:
+		value = bmt->bmt_stats.tx_echo_pkt;
+		break;
+
+	default:
+		return;
+	}
+
+	if (strcmp(bmf->bmf_type, "counter") == 0)
+		metrics_printf(bmc, "%s_total %" PRIu64 "\n", bmf->bmf_name,
+			       value);
+	else
+		metrics_printf(bmc, "%s %" PRIu64 "\n", bmf->bmf_name, value);
+}
+
+void metrics_labels(struct bfd_metrics_conn *bmc, bfd_session *bs)
+{
+	metrics_printf(bmc, "{id=\"%u\"", bs->discrs.my_discr);
+
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
+		metrics_printf(bmc, ",peer=\"%s\",local=\"%s\"",
+			       satostr(&bs->mhop.peer),
+			       satostr(&bs->mhop.local));
+		if (bs->mhop.vrf_name[0] != 0) {
+			metrics_append(bmc, ",vrf=\"");
+			metrics_escape(bmc, bs->mhop.vrf_name);
+			metrics_append(bmc, "\"");
+		}
+	} else {
+		metrics_printf(bmc, ",peer=\"%s\"", satostr(&bs->shop.peer));
+		if (bs->local_ip.sa_sin.sin_family != AF_UNSPEC)
+			metrics_printf(bmc, ",local=\"%s\"",
+				       satostr(&bs->local_ip));
+		if (bs->shop.port_name[0] != 0) {
+			metrics_append(bmc, ",interface=\"");
+			metrics_escape(bmc, bs->shop.port_name);
+			metrics_append(bmc, "\"");
+		}
+	}
+
+	if (bs->pl) {
+		metrics_append(bmc, ",label=\"");
+		metrics_escape(bmc, bs->pl->pl_label);
+		metrics_append(bmc, "\"");
+	}
+
+	metrics_append(bmc, "}");
+}
+
+int metrics_session_cb(bfd_session *bs, void *arg)
+{
+	struct bfd_metrics_conn *bmc = arg;
+	const struct bfd_metrics_family *bmf;
+	uint64_t value;
+
+	/* Stop here and continue on the next piece. */
+	if (!metrics_room(bmc))
+		return 1;
+
+	bmf = &metrics_families[bmc->bmc_family];
+	bmc->bmc_discr = bs->discrs.my_discr;
+
+	switch (bmf->bmf_sample) {
+	case BMS_SESSION_STATE:
+		metrics_append(bmc, bmf->bmf_name);
+		metrics_labels(bmc, bs);
+		metrics_printf(bmc, " %u\n", bs->ses_state);
+		return 0;
+
+	case BMS_SESSION_LATENCY:
+	case BMS_SESSION_JITTER:
+	case BMS_SESSION_LOSS:
+		if (!bs->profile->bp_track_sla)
+			return 0;
+
+		metrics_append(bmc, bmf->bmf_name);
+		metrics_labels(bmc, bs);
+		/* SLA latency and jitter are kept in microseconds. */
+		if (bmf->bmf_sample == BMS_SESSION_LATENCY)
+			metrics_printf(bmc, " %u.%06u\n",
+				       bs->sla.lattency / 1000000,
+				       bs->sla.lattency % 1000000);
+		else if (bmf->bmf_sample == BMS_SESSION_JITTER)
+			metrics_printf(bmc, " %u.%06u\n",
+				       bs->sla.jitter / 1000000,
+				       bs->sla.jitter % 1000000);
+		else
+			metrics_printf(bmc, " %g\n", bs->sla.pkt_loss / 100.0);
+		return 0;
+
+	case BMS_SESSION_RX_CTRL:
+		value = bs->stats.rx_ctrl_pkt;
+		break;
+	case BMS_SESSION_TX_CTRL:
+		value = bs->stats.tx_ctrl_pkt;
+		break;
+	case BMS_SESSION_RX_ECHO:
+		value = bs->stats.rx_echo_pkt;
+		break;
+	case BMS_SESSION_TX_ECHO:
+		value = bs->stats.tx_echo_pkt;
+		break;
+
+	default:
+		return 0;
+	}
+
+	metrics_printf(bmc, "%s_total", bmf->bmf_name);
+	metrics_labels(bmc, bs);
+	metrics_printf(bmc, " %" PRIu64 "\n", value);
+
+	return 0;
+}
+
+/*
+ * Fills the buffer from the cursor. OpenMetrics wants the samples of a
+ * family together, so per session families walk the sessions once each
+ * in discriminator order: sessions created or removed between pieces are
+ * simply found or skipped by the next walk. The discriminator index is
+ * kept sorted, so resuming a walk is a binary search and a piece never
+ * allocates memory.
+ */
+int metrics_render(struct bfd_metrics_conn *bmc)
+{
+	const struct bfd_metrics_family *bmf;
+
+	for (; bmc->bmc_family < METRICS_FAMILIES; bmc->bmc_family++) {
+		bmf = &metrics_families[bmc->bmc_family];
+		if (bmf->bmf_session && bglobal.bg_maggregate)
+			continue;
+
+		if (!metrics_room(bmc))
+			return 0;
+
+		if (!bmc->bmc_header) {
+			metrics_header(bmc, bmf);
+			bmc->bmc_header = true;
+		}
+
+		if (bmf->bmf_session) {
+			if (bs_foreach_discr(bmc->bmc_discr, metrics_session_cb,
+					     bmc)
+			    != 0)
+				return -1;
+			/* The walk stopped early when the buffer filled up. */
+			if (!metrics_room(bmc))
+				return 0;
+		} else {
+			metrics_daemon(bmc, bmf);
+		}
+
+		bmc->bmc_header = false;
+		bmc->bmc_discr = 0;
+	}
+
+	if (!metrics_room(bmc))
+		return 0;
+
+	metrics_append(bmc, "# EOF\n");
+	bmc->bmc_eof = true;
+
+	return 0;
+}
+
+/*
+ * Session state totals: state changes are accounted by bs_state_set().
+ * The packet counters are accumulated as packets are sent and received,
+ * so they stay monotonic when sessions are removed.
+ */
+void bfd_metrics_add(bfd_session *bs)
+{
+	if (bs->ses_state <= PTM_BFD_UP)
+		bglobal.bg_msessions[bs->ses_state]++;
+}
+
+void bfd_metrics_del(bfd_session *bs)
+{
+	if (bs->ses_state <= PTM_BFD_UP)
+		bglobal.bg_msessions[bs->ses_state]--;
+}
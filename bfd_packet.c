@@ -322,17 +322,23 @@ void ptm_bfd_echo_snd(bfd_session *bfd)
 	size_t pktlen;
 	uint16_t port = htons(BFD_DEF_ECHO_PORT);
 
+	/* Bulk created session without its socket yet. */
+	if (bfd->sock_pending)
+		return;
+
+	ep = (bfd_raw_echo_pkt_t *)(bfd->echo_pkt + ETH_HDR_LEN);
 	if (!BFD_CHECK_FLAG(bfd->flags, BFD_SESS_FLAG_ECHO_ACTIVE)) {
 		ptm_bfd_echo_pkt_create(bfd);
 		BFD_SET_FLAG(bfd->flags, BFD_SESS_FLAG_ECHO_ACTIVE);
 	} else {
 		/* just update the checksum and ip Id */
-		ep = (bfd_raw_echo_pkt_t *)(bfd->echo_pkt + ETH_HDR_LEN);
 		ep->ip.id = htons(ptm_bfd_gen_IP_ID(bfd));
 		ep->ip.check = 0;
 		ep->ip.check = checksum((uint16_t *)&ep->ip, IP_HDR_LEN);
 	}
 
+	bfd_sla_echo_stamp(bfd, &ep->data);
+
 	if (use_layer2) {
 		pkt = bfd->echo_pkt;
 		pktlen = BFD_ECHO_PKT_TOT_LEN;
@@ -348,6 +354,9 @@ void ptm_bfd_echo_snd(bfd_session *bfd)
 	}
 
 	bfd->stats.tx_echo_pkt++;
+	bglobal.bg_mstats.tx_echo_pkt++;
+	bfd_sla_sent(bfd, 0);
+	bfd_shm_refresh(bfd);
 }
 
 int ptm_bfd_echo_loopback(uint8_t *pkt, int pkt_len, struct sockaddr_ll *sll)
@@ -432,7 +441,7 @@ void ptm_bfd_vxlan_pkt_snd(bfd_session *bfd, int fbit)
 	BFD_SETDEMANDBIT(cp.data.flags, BFD_DEF_DEMAND);
 	BFD_SETPBIT(cp.data.flags, bfd->polling);
 	BFD_SETFBIT(cp.data.flags, fbit);
-	cp.data.detect_mult = bfd->detect_mult;
+	cp.data.detect_mult = bfd->profile->bp_detectmultiplier;
 	cp.data.len = BFD_PKT_LEN;
 	cp.data.discrs.my_discr = htonl(bfd->discrs.my_discr);
 	cp.data.discrs.remote_discr = htonl(bfd->discrs.remote_discr);
@@ -454,6 +463,9 @@ void ptm_bfd_vxlan_pkt_snd(bfd_session *bfd, int fbit)
 		ERRLOG("Error sending vxlan bfd pkt: %s", strerror(errno));
 	} else {
 		bfd->stats.tx_ctrl_pkt++;
+		bglobal.bg_mstats.tx_ctrl_pkt++;
+		bfd_sla_sent(bfd, 0);
+		bfd_shm_refresh(bfd);
 	}
 }
 
@@ -466,12 +478,12 @@ int ptm_bfd_process_echo_pkt(int s)
 	char rx_pkt[BFD_RX_BUF_LEN];
 	bfd_session *bfd;
 	uint32_t my_discr = 0;
-        struct timeval recv_tv;
+	uint64_t recv_time;
 
 	pkt_len = recvfrom(s, rx_pkt, BFD_RX_BUF_LEN, MSG_DONTWAIT,
 			   (struct sockaddr *)&sll, &from_len);
 
-        gettimeofday(&recv_tv, NULL);
+	recv_time = get_monotime_ns();
 	if (pkt_len <= 0) {
 		if (errno != EAGAIN)
 			ERRLOG("Error receiving from BFD Echo socket: %s",
@@ -518,9 +530,11 @@ int ptm_bfd_process_echo_pkt(int s)
 	}
 	
 	bfd->stats.rx_echo_pkt++;
-        if (BFD_CHECK_FLAG(bfd->flags, BFD_SESS_FLAG_TRACK_SLA)) {
-            ptm_bfd_send_sla_update(bfd, &recv_tv);
-        }
+	bglobal.bg_mstats.rx_echo_pkt++;
+	bfd_shm_refresh(bfd);
+	if (bfd->profile->bp_track_sla)
+		ptm_bfd_send_sla_update(bfd, bfd_sla_rxtime(s, recv_time),
+					&ep->data, false);
 
 	/* Compute detect time */
 	bfd->echo_detect_TO = bfd->remote_detect_mult * bfd->echo_xmt_TO;
@@ -534,6 +548,11 @@ int ptm_bfd_process_echo_pkt(int s)
 void ptm_bfd_snd(bfd_session *bfd, int fbit)
 {
 	bfd_pkt_t cp;
+	uint64_t txtime;
+
+	/* Bulk created session without its socket yet. */
+	if (bfd->sock_pending)
+		return;
 
 	/* if the BFD session is for VxLAN tunnel, then construct and
 	 * send bfd raw packet */
@@ -550,7 +569,7 @@ void ptm_bfd_snd(bfd_session *bfd, int fbit)
 	BFD_SETDEMANDBIT(cp.flags, BFD_DEF_DEMAND);
 	BFD_SETPBIT(cp.flags, bfd->polling);
 	BFD_SETFBIT(cp.flags, fbit);
-	cp.detect_mult = bfd->detect_mult;
+	cp.detect_mult = bfd->profile->bp_detectmultiplier;
 	cp.len = BFD_PKT_LEN;
 	cp.discrs.my_discr = htonl(bfd->discrs.my_discr);
 	cp.discrs.remote_discr = htonl(bfd->discrs.remote_discr);
@@ -565,12 +584,17 @@ void ptm_bfd_snd(bfd_session *bfd, int fbit)
 	}
 	cp.timers.required_min_echo = htonl(bfd->timers.required_min_echo);
 
+	/* The Final answer gives the round trip time of the Poll packets. */
+	txtime = bfd->polling ? get_monotime_ns() : 0;
 	if (_ptm_bfd_send(bfd, false, NULL, &cp, BFD_PKT_LEN) != 0) {
 		ERRLOG("Error sending control pkt: %s", strerror(errno));
 		return;
 	}
 
 	bfd->stats.tx_ctrl_pkt++;
+	bglobal.bg_mstats.tx_ctrl_pkt++;
+	bfd_sla_sent(bfd, txtime);
+	bfd_shm_refresh(bfd);
 }
 
 #if 0  /* TODO VxLAN Support */
@@ -802,7 +826,7 @@ void bfd_recv_cb(evutil_socket_t sd, short events __attribute__((unused)),
 {
 	bfd_session *bfd;
 	bfd_pkt_t *cp;
-        struct timeval recv_tv;
+	uint64_t recv_time;
 	bool is_mhop, is_vxlan;
 	ssize_t mlen = 0;
 	uint8_t old_state;
@@ -816,7 +840,7 @@ void bfd_recv_cb(evutil_socket_t sd, short events __attribute__((unused)),
 		return;
 	}
 
-        gettimeofday(&recv_tv, NULL);
+	recv_time = get_monotime_ns();
 	is_mhop = is_vxlan = false;
 	if (sd == bglobal.bg_shop || sd == bglobal.bg_mhop) {
 		is_mhop = sd == bglobal.bg_mhop;
@@ -870,8 +894,15 @@ strcpy(peer_addr, inet_ntoa(sin.sin_addr));
 		return;
 	}
 
-	if ((bfd = ptm_bfd_sess_find(cp, port, &peer, &local, vrfname, is_mhop))
-	    == NULL) {
+	bfd = ptm_bfd_sess_find(cp, port, &peer, &local, vrfname, is_mhop);
+	/*
+	 * Range peers only get a session when they start one, from within
+	 * the hop count the session will accept.
+	 */
+	if (bfd == NULL && cp->discrs.remote_discr == 0
+	    && (!is_mhop || (BFD_TTL_VAL - BFD_DEF_MHOP_TTL) <= ttlval))
+		bfd = range_session_new(port, &peer, &local, vrfname, is_mhop);
+	if (bfd == NULL) {
 		DLOG("Failed to generate session from remote packet");
 		return;
 	}
@@ -881,6 +912,7 @@ strcpy(peer_addr, inet_ntoa(sin.sin_addr));
 	}
 
 	bfd->stats.rx_ctrl_pkt++;
+	bglobal.bg_mstats.rx_ctrl_pkt++;
 	if (is_mhop) {
 		if ((BFD_TTL_VAL - bfd->mh_ttl) > ttlval) {
 			DLOG("Exceeded max hop count of %d, dropped pkt from"
@@ -938,7 +970,7 @@ strcpy(peer_addr, inet_ntoa(sin.sin_addr));
 			if (BFD_GETSTATE(cp->flags) == PTM_BFD_INIT) {
 				ptm_bfd_ses_up(bfd);
 			} else if (BFD_GETSTATE(cp->flags) == PTM_BFD_DOWN) {
-				bfd->ses_state = PTM_BFD_INIT;
+				bs_state_set(bfd, PTM_BFD_INIT);
 			} /* UP stays in DOWN state */
 			break;
 		case (PTM_BFD_INIT):
@@ -961,7 +993,7 @@ strcpy(peer_addr, inet_ntoa(sin.sin_addr));
 		     state_list[old_state].str, state_list[bfd->ses_state].str);
 	}
 
-	if (BFD_CHECK_FLAG(bfd->flags, BFD_SESS_FLAG_ECHO)) {
+	if (bfd->profile->bp_echo) {
 		if (BFD_CHECK_FLAG(bfd->flags, BFD_SESS_FLAG_ECHO_ACTIVE)) {
 			if (!ntohl(cp->timers.required_min_echo)) {
 				ptm_bfd_echo_stop(bfd, 1);
@@ -1033,10 +1065,17 @@ strcpy(peer_addr, inet_ntoa(sin.sin_addr));
 
 		control_notify_config(BCM_NOTIFY_CONFIG_UPDATE, bfd);
 	}
-	
-        if (BFD_CHECK_FLAG(bfd->flags, BFD_SESS_FLAG_TRACK_SLA)) {
-                ptm_bfd_send_sla_update(bfd, &recv_tv);
-        }
+
+	/* Only wake the status table readers on session changes. */
+	if (old_state != bfd->ses_state || BFD_GETFBIT(cp->flags))
+		bfd_shm_update(bfd);
+	else
+		bfd_shm_refresh(bfd);
+	bfd_state_update(bfd);
+
+	if (bfd->profile->bp_track_sla)
+		ptm_bfd_send_sla_update(bfd, bfd_sla_rxtime(sd, recv_time),
+					NULL, BFD_GETFBIT(cp->flags));
 }
 
 
@@ -1124,7 +1163,7 @@ int bp_udp_mhop(void)
 	return sd;
 }
 
-int bp_peer_socket(struct bfd_peer_cfg *bpc)
+int bp_peer_socket(struct bfd_peer_cfg *bpc, uint16_t port)
 {
 	int sd, pcount;
 	struct sockaddr_in sin;
@@ -1169,6 +1208,13 @@ int bp_peer_socket(struct bfd_peer_cfg *bpc)
 		sin.sin_addr.s_addr = INADDR_ANY;
 	}
 
+	/* Keep the source port of a warm restarted session. */
+	if (port != 0) {
+		sin.sin_port = htons(port);
+		if (bind(sd, (struct sockaddr *)&sin, sizeof(sin)) == 0)
+			return sd;
+	}
+
 	pcount = 0;
 	do {
 		if ((++pcount) > (BFD_SRCPORTMAX - BFD_SRCPORTINIT)) {
@@ -1191,7 +1237,7 @@ int bp_peer_socket(struct bfd_peer_cfg *bpc)
  * IPv6 sockets
  */
 
-int bp_peer_socketv6(struct bfd_peer_cfg *bpc)
+int bp_peer_socketv6(struct bfd_peer_cfg *bpc, uint16_t port)
 {
 	int sd, pcount, ifindex;
 	struct sockaddr_in6 sin6;
@@ -1241,6 +1287,12 @@ int bp_peer_socketv6(struct bfd_peer_cfg *bpc)
 		}
 	}
 
+	if (port != 0) {
+		sin6.sin6_port = htons(port);
+		if (bind(sd, (struct sockaddr *)&sin6, sizeof(sin6)) == 0)
+			return sd;
+	}
+
 	pcount = 0;
 	do {
 		if ((++pcount) > (BFD_SRCPORTMAX - BFD_SRCPORTINIT)) {
@@ -0,0 +1,272 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_range.c: implements the peer ranges. The configuration file ranges
+ * are kept as session templates and a session is only created when the
+ * first packet of a peer in the range arrives.
+ *
+ * Anybody in the range can make the daemon create a session (and its
+ * socket), so every range limits its sessions and the ones that stay
+ * down are deleted: a scan of the range doesn't leave them behind.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bfd.h"
+
+/*
+ * Prototypes
+ */
+struct bfd_peer_range *range_match(bool mhop, struct sockaddr_any *peer,
+				   struct sockaddr_any *local,
+				   const char *port_name,
+				   const char *vrf_name);
+void range_bpc(struct bfd_peer_range *bpr, struct sockaddr_any *peer,
+	       const char *port_name, struct bfd_peer_cfg *bpc);
+void range_reap_cb(evutil_socket_t sd, short ev, void *arg);
+
+
+/*
+ * Functions
+ */
+void range_init(void)
+{
+	struct timeval tv = {
+		.tv_sec = BFD_RANGE_REAP_INTERVAL,
+	};
+
+	event_assign(&bglobal.bg_rangeev, bglobal.bg_eb, -1, EV_PERSIST,
+		     range_reap_cb, NULL);
+	event_add(&bglobal.bg_rangeev, &tv);
+}
+
+/* Deletes the range sessions that are down for too long. */
+void range_reap_cb(evutil_socket_t sd __attribute__((unused)),
+		   short ev __attribute__((unused)),
+		   void *arg __attribute__((unused)))
+{
+	struct bfd_peer_range *bpr;
+	bfd_session *bs, *bstmp;
+	time_t now = get_monotime(NULL);
+	uint32_t deleted;
+
+	TAILQ_FOREACH (bpr, &bglobal.bg_ranges, bpr_entry) {
+		deleted = 0;
+		TAILQ_FOREACH_SAFE (bs, &bpr->bpr_sessions, range_entry,
+				    bstmp) {
+			if (bs->ses_state != PTM_BFD_DOWN
+			    || now - bs->downtime.tv_sec
+				       < bpr->bpr_downtimeout)
+				continue;
+
+			if (bfd_session_delete(bs) == 0)
+				deleted++;
+		}
+
+		if (deleted)
+			log_info("%s: deleted %u down sessions of range %s\n",
+				 __FUNCTION__, deleted,
+				 satostr(&bpr->bpr_first));
+	}
+}
+
+/* Compares the addresses (of the same family) in network byte order. */
+int range_addrcmp(const struct sockaddr_any *sa, const struct sockaddr_any *sb)
+{
+	if (sa->sa_sin.sin_family == AF_INET)
+		return memcmp(&sa->sa_sin.sin_addr, &sb->sa_sin.sin_addr,
+			      sizeof(sa->sa_sin.sin_addr));
+
+	return memcmp(&sa->sa_sin6.sin6_addr, &sb->sa_sin6.sin6_addr,
+		      sizeof(sa->sa_sin6.sin6_addr));
+}
+
+/* Returns the first range covering the peer. */
+struct bfd_peer_range *range_match(bool mhop, struct sockaddr_any *peer,
+				   struct sockaddr_any *local,
+				   const char *port_name,
+				   const char *vrf_name)
+{
+	struct bfd_peer_range *bpr;
+	struct bfd_peer_cfg *bpc;
+	size_t idx;
+
+	if (port_name == NULL)
+		port_name = "";
+	if (vrf_name == NULL)
+		vrf_name = "";
+
+	TAILQ_FOREACH (bpr, &bglobal.bg_ranges, bpr_entry) {
+		bpc = &bpr->bpr_bpc;
+		if (bpc->bpc_mhop != mhop
+		    || bpr->bpr_first.sa_sin.sin_family
+			       != peer->sa_sin.sin_family
+		    || range_addrcmp(peer, &bpr->bpr_first) < 0
+		    || range_addrcmp(peer, &bpr->bpr_last) > 0)
+			continue;
+
+		if (mhop) {
+			if (range_addrcmp(local, &bpc->bpc_local) != 0)
+				continue;
+			if (strcmp(vrf_name,
+				   bpc->bpc_has_vrfname ? bpc->bpc_vrfname : "")
+			    != 0)
+				continue;
+
+			return bpr;
+		}
+
+		if (bpr->bpr_ifcnt == 0) {
+			if (bpc->bpc_has_localif
+			    && strcmp(port_name, bpc->bpc_localif) != 0)
+				continue;
+
+			return bpr;
+		}
+
+		for (idx = 0; idx < bpr->bpr_ifcnt; idx++) {
+			if (strcmp(port_name, bpr->bpr_ifnames[idx]) == 0)
+				return bpr;
+		}
+	}
+
+	return NULL;
+}
+
+/* Builds the configuration of a range peer. */
+void range_bpc(struct bfd_peer_range *bpr, struct sockaddr_any *peer,
+	       const char *port_name, struct bfd_peer_cfg *bpc)
+{
+	*bpc = bpr->bpr_bpc;
+
+	bpc->bpc_peer = *peer;
+	if (bpc->bpc_peer.sa_sin.sin_family == AF_INET)
+		bpc->bpc_peer.sa_sin.sin_port = 0;
+	else
+		bpc->bpc_peer.sa_sin6.sin6_port = 0;
+
+	if (!bpc->bpc_mhop && bpr->bpr_ifcnt > 0) {
+		bpc->bpc_has_localif = true;
+		strxcpy(bpc->bpc_localif, port_name, sizeof(bpc->bpc_localif));
+	}
+}
+
+/*
+ * Creates the session of a peer that sent its first packet, if one of
+ * the ranges covers it.
+ */
+bfd_session *range_session_new(char *port_name, struct sockaddr_any *peer,
+			       struct sockaddr_any *local, char *vrf_name,
+			       bool is_mhop)
+{
+	struct bfd_peer_range *bpr;
+	struct bfd_peer_cfg bpc;
+	bfd_session *bs;
+
+	bpr = range_match(is_mhop, peer, local, port_name, vrf_name);
+	if (bpr == NULL)
+		return NULL;
+
+	if (bpr->bpr_sessioncnt >= bpr->bpr_maxsessions) {
+		if (!bpr->bpr_full)
+			log_warning("%s: range %s has %u sessions: ignoring "
+				    "the new peers\n",
+				    __FUNCTION__, satostr(&bpr->bpr_first),
+				    bpr->bpr_sessioncnt);
+		bpr->bpr_full = true;
+		return NULL;
+	}
+
+	range_bpc(bpr, peer, port_name, &bpc);
+	bs = ptm_bfd_sess_new(&bpc);
+	if (bs == NULL)
+		return NULL;
+
+	range_session_link(bpr, bs);
+	BFD_SET_FLAG(bs->flags, BFD_SESS_FLAG_RANGE);
+	bfd_state_update(bs);
+	bfd_repl_update(bs);
+
+	return bs;
+}
+
+/*
+ * Builds the configuration of a session created from a range with the
+ * current range definitions. Returns the range, or NULL if no range
+ * covers it anymore.
+ */
+struct bfd_peer_range *range_session_bpc(bfd_session *bs,
+					 struct bfd_peer_cfg *bpc)
+{
+	struct bfd_peer_range *bpr;
+
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
+		bpr = range_match(true, &bs->mhop.peer, &bs->mhop.local, NULL,
+				  bs->mhop.vrf_name);
+		if (bpr == NULL)
+			return NULL;
+
+		range_bpc(bpr, &bs->mhop.peer, NULL, bpc);
+		return bpr;
+	}
+
+	bpr = range_match(false, &bs->shop.peer, NULL, bs->shop.port_name,
+			  NULL);
+	if (bpr == NULL)
+		return NULL;
+
+	range_bpc(bpr, &bs->shop.peer, bs->shop.port_name, bpc);
+
+	return bpr;
+}
+
+/*
+ * Counts the session in its range. A reload may move sessions to a range
+ * with a lower limit: they are kept, new peers wait for room.
+ */
+void range_session_link(struct bfd_peer_range *bpr, bfd_session *bs)
+{
+	if (bs->range == bpr)
+		return;
+	if (bs->range)
+		range_session_unlink(bs);
+
+	bs->range = bpr;
+	TAILQ_INSERT_TAIL(&bpr->bpr_sessions, bs, range_entry);
+	bpr->bpr_sessioncnt++;
+}
+
+void range_session_unlink(bfd_session *bs)
+{
+	struct bfd_peer_range *bpr = bs->range;
+
+	TAILQ_REMOVE(&bpr->bpr_sessions, bs, range_entry);
+	bpr->bpr_sessioncnt--;
+	bpr->bpr_full = false;
+	bs->range = NULL;
+}
+
+/* The range sessions are kept (see ptm_bfd_sess_reload()). */
+void range_free(struct bfd_peer_range *bpr)
+{
+	while (!TAILQ_EMPTY(&bpr->bpr_sessions))
+		range_session_unlink(TAILQ_FIRST(&bpr->bpr_sessions));
+
+	free(bpr->bpr_ifnames);
+	free(bpr);
+}
@@ -0,0 +1,717 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_repl.c: active/standby sessions replication.
+ *
+ * The active daemon listens on a unix stream socket. A standby daemon
+ * connects to it before creating any socket or session and receives:
+ *
+ *   - BRT_UPDATE for every session (the snapshot) and BRT_SYNCED;
+ *   - BRT_UPDATE or BRT_DELETE on every state or configuration change,
+ *     along with the control socket notifications.
+ *
+ * The snapshot is sent in discriminator order, a chunk each time the
+ * output was written, so its size doesn't depend on the number of
+ * sessions. Changes are queued as they happen, until BFD_REPL_QUEUE
+ * bytes are pending: the changed sessions are then only remembered and
+ * their latest state is sent once the standby caught up.
+ *
+ * The messages carry the session checkpoint (struct bfd_state_entry), so
+ * the standby keeps them like a warm restart state file. When the active
+ * daemon connection is closed and no daemon accepts a new one, the
+ * standby starts as usual and resumes the sessions with the same
+ * discriminators, state and timers (see bfd_state.c).
+ *
+ * A handed over daemon (see bfd_handover.c) keeps the listening socket:
+ * the standby reconnects to it and gets a new snapshot.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+/*
+ * Prototypes
+ */
+uint64_t repl_time(void);
+void repl_accept(evutil_socket_t sd, short ev, void *arg);
+void repl_conn_free(struct bfd_repl_conn *brc);
+struct bfd_repl_msg *repl_append(struct bfd_repl_conn *brc, uint32_t type,
+				 bfd_session *bs);
+int repl_pending_add(struct bfd_repl_conn *brc, uint32_t discr);
+int repl_pending_send(struct bfd_repl_conn *brc);
+int repl_snapshot_cb(bfd_session *bs, void *arg);
+int repl_refill(struct bfd_repl_conn *brc);
+void repl_send(uint32_t type, bfd_session *bs);
+void repl_read_cb(evutil_socket_t sd, short ev, void *arg);
+void repl_write_cb(evutil_socket_t sd, short ev, void *arg);
+
+int repl_connect(const char *path);
+void repl_standby_cb(evutil_socket_t sd, short ev, void *arg);
+void repl_standby_apply(struct bfd_repl_standby *brs);
+void repl_standby_closed(struct bfd_repl_standby *brs);
+bool repl_port_free(uint16_t port);
+void repl_wait_ports(void);
+void repl_stats_cb(evutil_socket_t sd, short ev, void *arg);
+void repl_stats_fold(struct bfd_repl_standby *brs);
+void repl_stats_log(const char *what, struct bfd_repl_stats *stats,
+		    uint64_t usecs);
+
+
+/*
+ * Functions
+ */
+uint64_t repl_time(void)
+{
+	struct timeval tv;
+
+	get_monotime(&tv);
+
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/*
+ * Active daemon
+ */
+int bfd_repl_init(const char *path)
+{
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+	};
+	int sd;
+
+	/* Keep the socket handed over by the previous daemon. */
+	if (bglobal.bg_rsock != -1) {
+		sd = bglobal.bg_rsock;
+	} else {
+		if (strxcpy(sun.sun_path, path, sizeof(sun.sun_path))
+		    >= sizeof(sun.sun_path)) {
+			log_error("%s: path too long: %s\n", __FUNCTION__,
+				  path);
+			return -1;
+		}
+
+		/* Remove previously created sockets. */
+		unlink(sun.sun_path);
+
+		sd = socket(AF_UNIX,
+			    SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		if (sd == -1) {
+			log_error("%s: socket: %s\n", __FUNCTION__,
+				  strerror(errno));
+			return -1;
+		}
+
+		if (bind(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1
+		    || listen(sd, SOMAXCONN) == -1) {
+			log_error("%s: %s: %s\n", __FUNCTION__, path,
+				  strerror(errno));
+			close(sd);
+			return -1;
+		}
+	}
+
+	bglobal.bg_rsock = sd;
+	event_assign(&bglobal.bg_rsockev, bglobal.bg_eb, sd,
+		     EV_READ | EV_PERSIST, repl_accept, NULL);
+	event_add(&bglobal.bg_rsockev, NULL);
+
+	return 0;
+}
+
+void repl_accept(evutil_socket_t sd, short ev __attribute__((unused)),
+		 void *arg __attribute__((unused)))
+{
+	struct bfd_repl_conn *brc;
+	int csock;
+
+	csock = accept(sd, NULL, 0);
+	if (csock == -1) {
+		log_warning("%s: accept: %s\n", __FUNCTION__, strerror(errno));
+		return;
+	}
+
+	/* A slow standby must never block the protocol thread. */
+	if (evutil_make_socket_nonblocking(csock) == -1) {
+		close(csock);
+		return;
+	}
+
+	brc = calloc(1, sizeof(*brc));
+	if (brc == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		close(csock);
+		return;
+	}
+
+	brc->brc_sd = csock;
+	event_assign(&brc->brc_rev, bglobal.bg_eb, csock, EV_READ | EV_PERSIST,
+		     repl_read_cb, brc);
+	event_assign(&brc->brc_wev, bglobal.bg_eb, csock, EV_WRITE,
+		     repl_write_cb, brc);
+	event_add(&brc->brc_rev, NULL);
+	TAILQ_INSERT_TAIL(&bglobal.bg_rconns, brc, brc_entry);
+
+	/* The snapshot is sent as the output is written. */
+	brc->brc_snapshot = true;
+	brc->brc_cursor = 0;
+	if (repl_refill(brc) != 0) {
+		repl_conn_free(brc);
+		return;
+	}
+
+	log_info("%s: standby connected: sending %u sessions\n", __FUNCTION__,
+		 HASH_CNT(sh, session_hash));
+}
+
+void repl_conn_free(struct bfd_repl_conn *brc)
+{
+	struct bfd_repl_pending *brp, *brptmp;
+
+	log_info("%s: standby disconnected: %" PRIu64 " messages (%" PRIu64
+		 " bytes) sent\n",
+		 __FUNCTION__, brc->brc_msgs, brc->brc_bytes);
+
+	TAILQ_REMOVE(&bglobal.bg_rconns, brc, brc_entry);
+	event_del(&brc->brc_rev);
+	event_del(&brc->brc_wev);
+	close(brc->brc_sd);
+	HASH_ITER (brp_hh, brc->brc_pending, brp, brptmp) {
+		HASH_DELETE(brp_hh, brc->brc_pending, brp);
+		free(brp);
+	}
+	free(brc->brc_buf);
+	free(brc);
+}
+
+/* Queues a message: it is written once the event loop gets back. */
+struct bfd_repl_msg *repl_append(struct bfd_repl_conn *brc, uint32_t type,
+				 bfd_session *bs)
+{
+	struct bfd_repl_msg *brm;
+	uint8_t *buf;
+	size_t size;
+
+	/* Reuse the space of the written messages. */
+	if (brc->brc_pos > 0) {
+		memmove(brc->brc_buf, brc->brc_buf + brc->brc_pos,
+			brc->brc_len - brc->brc_pos);
+		brc->brc_len -= brc->brc_pos;
+		brc->brc_pos = 0;
+	}
+
+	if (brc->brc_len + sizeof(*brm) > brc->brc_size) {
+		size = brc->brc_size ? brc->brc_size * 2 : sizeof(*brm) * 64;
+		buf = realloc(brc->brc_buf, size);
+		if (buf == NULL) {
+			log_warning("%s: realloc: %s\n", __FUNCTION__,
+				    strerror(errno));
+			return NULL;
+		}
+
+		brc->brc_buf = buf;
+		brc->brc_size = size;
+	}
+
+	brm = (struct bfd_repl_msg *)(brc->brc_buf + brc->brc_len);
+	memset(brm, 0, sizeof(*brm));
+	brm->brm_magic = BFD_REPL_MAGIC;
+	brm->brm_type = type;
+	brm->brm_time = repl_time();
+	if (bs != NULL)
+		bfd_state_fill(bs, &brm->brm_entry);
+
+	brc->brc_len += sizeof(*brm);
+	brc->brc_msgs++;
+	event_add(&brc->brc_wev, NULL);
+
+	return brm;
+}
+
+/* Remembers a session changed while the output is full. */
+int repl_pending_add(struct bfd_repl_conn *brc, uint32_t discr)
+{
+	struct bfd_repl_pending *brp;
+
+	HASH_FIND(brp_hh, brc->brc_pending, &discr, sizeof(discr), brp);
+	if (brp != NULL)
+		return 0;
+
+	brp = calloc(1, sizeof(*brp));
+	if (brp == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	brp->brp_discr = discr;
+	HASH_ADD(brp_hh, brc->brc_pending, brp_discr, sizeof(brp->brp_discr),
+		 brp);
+
+	return 0;
+}
+
+/*
+ * Sends the latest state of a chunk of the remembered sessions: an update,
+ * or a deletion (by discriminator) for the ones that are gone.
+ */
+int repl_pending_send(struct bfd_repl_conn *brc)
+{
+	struct bfd_repl_pending *brp, *brptmp;
+	struct bfd_repl_msg *brm;
+	bfd_session *bs;
+	int cnt = 0;
+
+	HASH_ITER (brp_hh, brc->brc_pending, brp, brptmp) {
+		if (cnt++ == BFD_REPL_CHUNK)
+			break;
+
+		bs = bs_session_find(brp->brp_discr);
+		brm = repl_append(brc, bs ? BRT_UPDATE : BRT_DELETE, bs);
+		if (brm == NULL)
+			return -1;
+		if (bs == NULL)
+			brm->brm_entry.bst_discr = brp->brp_discr;
+
+		HASH_DELETE(brp_hh, brc->brc_pending, brp);
+		free(brp);
+	}
+
+	return 0;
+}
+
+struct repl_snapshot_arg {
+	struct bfd_repl_conn *rsa_brc;
+	int rsa_cnt;
+	int rsa_error;
+};
+
+int repl_snapshot_cb(bfd_session *bs, void *arg)
+{
+	struct repl_snapshot_arg *rsa = arg;
+
+	if (repl_append(rsa->rsa_brc, BRT_UPDATE, bs) == NULL) {
+		rsa->rsa_error = -1;
+		return 1;
+	}
+
+	rsa->rsa_brc->brc_cursor = bs->discrs.my_discr;
+
+	return ++rsa->rsa_cnt == BFD_REPL_CHUNK;
+}
+
+/*
+ * The output was written: queues the remembered sessions, then the next
+ * chunk of the snapshot. Sessions created meanwhile are sent as they
+ * change, the ones after the cursor once more by the snapshot.
+ */
+int repl_refill(struct bfd_repl_conn *brc)
+{
+	struct repl_snapshot_arg rsa = {
+		.rsa_brc = brc,
+	};
+
+	if (brc->brc_pending != NULL)
+		return repl_pending_send(brc);
+	if (!brc->brc_snapshot)
+		return 0;
+
+	bs_foreach_discr(brc->brc_cursor, repl_snapshot_cb, &rsa);
+	if (rsa.rsa_error != 0)
+		return -1;
+	if (rsa.rsa_cnt == BFD_REPL_CHUNK)
+		return 0;
+
+	brc->brc_snapshot = false;
+	if (repl_append(brc, BRT_SYNCED, NULL) == NULL)
+		return -1;
+
+	return 0;
+}
+
+void repl_send(uint32_t type, bfd_session *bs)
+{
+	struct bfd_repl_conn *brc, *brctmp;
+	int error;
+
+	TAILQ_FOREACH_SAFE (brc, &bglobal.bg_rconns, brc_entry, brctmp) {
+		/* A standby that can't keep up gets the latest state later. */
+		if (brc->brc_pending != NULL
+		    || brc->brc_len - brc->brc_pos >= BFD_REPL_QUEUE)
+			error = repl_pending_add(brc, bs->discrs.my_discr);
+		else
+			error = repl_append(brc, type, bs) == NULL;
+
+		if (error != 0)
+			repl_conn_free(brc);
+	}
+}
+
+void bfd_repl_update(bfd_session *bs)
+{
+	if (TAILQ_EMPTY(&bglobal.bg_rconns))
+		return;
+
+	repl_send(BRT_UPDATE, bs);
+}
+
+void bfd_repl_delete(bfd_session *bs)
+{
+	if (TAILQ_EMPTY(&bglobal.bg_rconns))
+		return;
+
+	repl_send(BRT_DELETE, bs);
+}
+
+/* The standby doesn't talk: only wait for the connection to close. */
+void repl_read_cb(evutil_socket_t sd, short ev __attribute__((unused)),
+		  void *arg)
+{
+	struct bfd_repl_conn *brc = arg;
+	uint8_t buf[256];
+	ssize_t bread;
+
+	bread = read(sd, buf, sizeof(buf));
+	if (bread > 0)
+		return;
+	if (bread == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	repl_conn_free(brc);
+}
+
+void repl_write_cb(evutil_socket_t sd, short ev __attribute__((unused)),
+		   void *arg)
+{
+	struct bfd_repl_conn *brc = arg;
+	ssize_t bwrite;
+
+	while (brc->brc_pos < brc->brc_len) {
+		bwrite = write(sd, brc->brc_buf + brc->brc_pos,
+			       brc->brc_len - brc->brc_pos);
+		if (bwrite == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				event_add(&brc->brc_wev, NULL);
+				return;
+			}
+
+			log_warning("%s: write: %s\n", __FUNCTION__,
+				    strerror(errno));
+			repl_conn_free(brc);
+			return;
+		}
+
+		brc->brc_pos += bwrite;
+		brc->brc_bytes += bwrite;
+	}
+
+	brc->brc_pos = brc->brc_len = 0;
+	if (repl_refill(brc) != 0)
+		repl_conn_free(brc);
+}
+
+
+/*
+ * Standby daemon
+ */
+int repl_connect(const char *path)
+{
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+	};
+	int sd;
+
+	strxcpy(sun.sun_path, path, sizeof(sun.sun_path));
+	sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sd == -1) {
+		log_error("%s: socket: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		log_debug("%s: connect(%s): %s\n", __FUNCTION__, path,
+			  strerror(errno));
+		close(sd);
+		return -1;
+	}
+
+	if (evutil_make_socket_nonblocking(sd) == -1) {
+		close(sd);
+		return -1;
+	}
+
+	return sd;
+}
+
+/*
+ * Keeps a copy of the sessions of the active daemon replicating on `path`
+ * and returns once it is gone. Must be called before any socket is
+ * created: the sessions are resumed by the configuration load.
+ */
+int bfd_repl_standby(const char *path)
+{
+	struct bfd_repl_standby *brs;
+	struct timeval tv = {
+		.tv_sec = BFD_REPL_STATS_INTERVAL,
+	};
+
+	brs = calloc(1, sizeof(*brs));
+	if (brs == NULL) {
+		log_error("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	brs->brs_path = path;
+	brs->brs_sd = repl_connect(path);
+	if (brs->brs_sd == -1) {
+		log_warning("%s: no active daemon on %s: starting as active\n",
+			    __FUNCTION__, path);
+		free(brs);
+		return 0;
+	}
+
+	bglobal.bg_rstandby = brs;
+	bglobal.bg_standby = true;
+	get_monotime(&brs->brs_start);
+
+	event_assign(&brs->brs_ev, bglobal.bg_eb, brs->brs_sd,
+		     EV_READ | EV_PERSIST, repl_standby_cb, brs);
+	event_add(&brs->brs_ev, NULL);
+	event_assign(&brs->brs_statsev, bglobal.bg_eb, -1, EV_PERSIST,
+		     repl_stats_cb, brs);
+	event_add(&brs->brs_statsev, &tv);
+
+	log_info("%s: standing by for the active daemon on %s\n", __FUNCTION__,
+		 path);
+
+	/* Stopped by repl_standby_closed(). */
+	event_base_dispatch(bglobal.bg_eb);
+
+	event_del(&brs->brs_statsev);
+	repl_stats_fold(brs);
+	repl_stats_log("replicated", &brs->brs_total,
+		       repl_time()
+			       - ((uint64_t)brs->brs_start.tv_sec * 1000000
+				  + brs->brs_start.tv_usec));
+	log_info("%s: active daemon is gone: resuming %u sessions\n",
+		 __FUNCTION__, HASH_CNT(bss_dh, bglobal.bg_stdiscrs));
+
+	bglobal.bg_rstandby = NULL;
+	free(brs);
+
+	repl_wait_ports();
+
+	return 0;
+}
+
+bool repl_port_free(uint16_t port)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+		.sin_port = htons(port),
+	};
+	int sd, rv;
+
+	sd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+	if (sd == -1)
+		return true;
+
+	rv = bind(sd, (struct sockaddr *)&sin, sizeof(sin));
+	close(sd);
+
+	return rv == 0 || errno != EADDRINUSE;
+}
+
+/*
+ * The exiting daemon connection might be closed before its listening
+ * sockets: wait for them to be released, otherwise bg_listen() fails.
+ */
+void repl_wait_ports(void)
+{
+	int wait;
+
+	for (wait = 0; wait < BFD_REPL_RELEASE_WAIT; wait += 10) {
+		if (repl_port_free(BFD_DEFDESTPORT)
+		    && repl_port_free(BFD_DEF_MHOP_DEST_PORT))
+			return;
+
+		usleep(10000);
+	}
+
+	log_warning("%s: the BFD ports are still in use\n", __FUNCTION__);
+}
+
+void repl_standby_cb(evutil_socket_t sd, short ev __attribute__((unused)),
+		     void *arg)
+{
+	struct bfd_repl_standby *brs = arg;
+	ssize_t bread;
+
+	for (;;) {
+		bread = read(sd, (uint8_t *)&brs->brs_msg + brs->brs_msglen,
+			     sizeof(brs->brs_msg) - brs->brs_msglen);
+		if (bread == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+
+			log_warning("%s: read: %s\n", __FUNCTION__,
+				    strerror(errno));
+			break;
+		}
+		if (bread == 0)
+			break;
+
+		brs->brs_interval.brs_bytes += bread;
+		brs->brs_msglen += bread;
+		if (brs->brs_msglen < sizeof(brs->brs_msg))
+			continue;
+
+		brs->brs_msglen = 0;
+		if (brs->brs_msg.brm_magic != BFD_REPL_MAGIC) {
+			log_warning("%s: invalid replication message\n",
+				    __FUNCTION__);
+			break;
+		}
+
+		repl_standby_apply(brs);
+	}
+
+	repl_standby_closed(brs);
+}
+
+void repl_standby_apply(struct bfd_repl_standby *brs)
+{
+	struct bfd_repl_msg *brm = &brs->brs_msg;
+	struct bfd_repl_stats *stats = &brs->brs_interval;
+	uint64_t now, lag = 0;
+
+	/* Same host clock: the lag includes the queueing on both sides. */
+	now = repl_time();
+	if (now > brm->brm_time)
+		lag = now - brm->brm_time;
+
+	stats->brs_msgs++;
+	stats->brs_lag += lag;
+	if (lag > stats->brs_lagmax)
+		stats->brs_lagmax = lag;
+
+	/* The old copy is kept until the new active daemon talks. */
+	if (brs->brs_resync) {
+		brs->brs_resync = false;
+		bfd_state_saved_clear();
+	}
+
+	switch (brm->brm_type) {
+	case BRT_UPDATE:
+		bfd_state_saved_del(&brm->brm_entry);
+		bfd_state_saved_add(&brm->brm_entry, -1);
+		break;
+
+	case BRT_DELETE:
+		bfd_state_saved_del(&brm->brm_entry);
+		break;
+
+	case BRT_SYNCED:
+		log_info("%s: in sync with the active daemon: %u sessions\n",
+			 __FUNCTION__, HASH_CNT(bss_dh, bglobal.bg_stdiscrs));
+		break;
+
+	default:
+		log_debug("%s: unknown message type %u\n", __FUNCTION__,
+			  brm->brm_type);
+		break;
+	}
+}
+
+/*
+ * The active daemon closed the connection: it might have dropped a slow
+ * standby or handed its sockets over, so reconnect first. Nobody listening
+ * means it is gone.
+ */
+void repl_standby_closed(struct bfd_repl_standby *brs)
+{
+	event_del(&brs->brs_ev);
+	close(brs->brs_sd);
+	brs->brs_msglen = 0;
+
+	brs->brs_sd = repl_connect(brs->brs_path);
+	if (brs->brs_sd == -1) {
+		event_base_loopbreak(bglobal.bg_eb);
+		return;
+	}
+
+	log_info("%s: reconnected to the active daemon\n", __FUNCTION__);
+	brs->brs_resync = true;
+	event_assign(&brs->brs_ev, bglobal.bg_eb, brs->brs_sd,
+		     EV_READ | EV_PERSIST, repl_standby_cb, brs);
+	event_add(&brs->brs_ev, NULL);
+}
+
+void repl_stats_log(const char *what, struct bfd_repl_stats *stats,
+		    uint64_t usecs)
+{
+	if (usecs == 0)
+		usecs = 1;
+
+	log_info("%s: %s %" PRIu64 " messages (%" PRIu64 "/s, %" PRIu64
+		 " bytes/s), lag avg %" PRIu64 "us max %" PRIu64 "us\n",
+		 __FUNCTION__, what, stats->brs_msgs,
+		 stats->brs_msgs * 1000000 / usecs,
+		 stats->brs_bytes * 1000000 / usecs,
+		 stats->brs_msgs ? stats->brs_lag / stats->brs_msgs : 0,
+		 stats->brs_lagmax);
+}
+
+void repl_stats_cb(evutil_socket_t sd __attribute__((unused)),
+		   short ev __attribute__((unused)), void *arg)
+{
+	struct bfd_repl_standby *brs = arg;
+
+	if (brs->brs_interval.brs_msgs > 0)
+		repl_stats_log("replicated", &brs->brs_interval,
+			       BFD_REPL_STATS_INTERVAL * 1000000);
+
+	repl_stats_fold(brs);
+}
+
+/* Adds the current interval to the totals. */
+void repl_stats_fold(struct bfd_repl_standby *brs)
+{
+	struct bfd_repl_stats *total = &brs->brs_total;
+	struct bfd_repl_stats *stats = &brs->brs_interval;
+
+	total->brs_msgs += stats->brs_msgs;
+	total->brs_bytes += stats->brs_bytes;
+	total->brs_lag += stats->brs_lag;
+	if (stats->brs_lagmax > total->brs_lagmax)
+		total->brs_lagmax = stats->brs_lagmax;
+	memset(stats, 0, sizeof(*stats));
+}
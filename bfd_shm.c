@@ -0,0 +1,329 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_shm.c: publishes the sessions status in a shared memory table. See
+ * 'bfdctl.h' for the table layout.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/futex.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+/*
+ * Prototypes
+ */
+uint32_t *bfd_shm_index(uint32_t offset);
+void bfd_shm_index_add(uint32_t *index, uint32_t hash, uint32_t slot);
+void bfd_shm_index_del(uint32_t *index, uint32_t hash, uint32_t slot);
+void bfd_shm_write(bfd_session *bs, struct bfd_status_entry *bse,
+		   bool label);
+void bfd_shm_changed(void);
+void bfd_shm_wake(evutil_socket_t sd, short ev, void *arg);
+
+
+/*
+ * Functions
+ */
+int bfd_shm_init(const char *path)
+{
+	struct bfd_status_header *bsh;
+	uint32_t isize;
+	size_t len, ilen;
+	int fd;
+
+	if (bglobal.bg_shmentries == 0 || bglobal.bg_shmentries > INT32_MAX) {
+		log_error("%s: invalid number of entries: %u\n", __FUNCTION__,
+			  bglobal.bg_shmentries);
+		return -1;
+	}
+
+	/* Keep the indexes at most half full. */
+	for (isize = 1; isize < bglobal.bg_shmentries * 2; isize <<= 1)
+		/* NOTHING */;
+
+	ilen = isize * sizeof(uint32_t);
+	len = sizeof(*bsh) + 2 * ilen
+	      + bglobal.bg_shmentries * sizeof(struct bfd_status_entry);
+
+	/* Replace the file instead of truncating it under old readers. */
+	unlink(path);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		log_error("%s: open(%s): %s\n", __FUNCTION__, path,
+			  strerror(errno));
+		return -1;
+	}
+
+	if (ftruncate(fd, len) == -1) {
+		log_error("%s: ftruncate: %s\n", __FUNCTION__, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	bsh = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bsh == MAP_FAILED) {
+		log_error("%s: mmap: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	/* The file is zeroed: all entries and index slots are empty. */
+	bsh->bsh_version = BSH_VERSION;
+	bsh->bsh_entry_size = sizeof(struct bfd_status_entry);
+	bsh->bsh_entries = bglobal.bg_shmentries;
+	bsh->bsh_index_size = isize;
+	bsh->bsh_discr_index = sizeof(*bsh);
+	bsh->bsh_label_index = sizeof(*bsh) + ilen;
+	bsh->bsh_entries_off = sizeof(*bsh) + 2 * ilen;
+	__atomic_store_n(&bsh->bsh_magic, BSH_MAGIC, __ATOMIC_RELEASE);
+
+	bglobal.bg_shm = bsh;
+	bglobal.bg_shmlen = len;
+	event_assign(&bglobal.bg_shmev, bglobal.bg_eb, -1, 0, bfd_shm_wake,
+		     NULL);
+
+	return 0;
+}
+
+uint32_t *bfd_shm_index(uint32_t offset)
+{
+	return (uint32_t *)((uint8_t *)bglobal.bg_shm + offset);
+}
+
+void bfd_shm_index_add(uint32_t *index, uint32_t hash, uint32_t slot)
+{
+	uint32_t mask = bglobal.bg_shm->bsh_index_size - 1, probe, cur;
+
+	for (probe = 0; probe <= mask; probe++, hash++) {
+		cur = index[hash & mask];
+		if (cur != BSH_INDEX_EMPTY && cur != BSH_INDEX_DELETED)
+			continue;
+
+		__atomic_store_n(&index[hash & mask], slot, __ATOMIC_RELEASE);
+		return;
+	}
+}
+
+void bfd_shm_index_del(uint32_t *index, uint32_t hash, uint32_t slot)
+{
+	uint32_t mask = bglobal.bg_shm->bsh_index_size - 1, probe, cur;
+
+	for (probe = 0; probe <= mask; probe++, hash++) {
+		cur = index[hash & mask];
+		if (cur == BSH_INDEX_EMPTY)
+			return;
+		if (cur != slot)
+			continue;
+
+		/* Keep the probe chain for the following entries. */
+		__atomic_store_n(&index[hash & mask], BSH_INDEX_DELETED,
+				 __ATOMIC_RELEASE);
+		return;
+	}
+}
+
+void bfd_shm_write(bfd_session *bs, struct bfd_status_entry *bse, bool label)
+{
+	uint32_t flags = 0;
+
+	/* Sequence lock: readers retry while it is odd. */
+	__atomic_store_n(&bse->bse_seq, bse->bse_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH))
+		flags |= BCP_F_MHOP;
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_IPV6))
+		flags |= BCP_F_IPV6;
+	if (bs->profile->bp_echo)
+		flags |= BCP_F_ECHO;
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_SHUTDOWN))
+		flags |= BCP_F_SHUTDOWN;
+	if (bs->profile->bp_track_sla)
+		flags |= BCP_F_TRACK_SLA;
+
+	bse->bse_discr = bs->discrs.my_discr;
+	bse->bse_remote_discr = bs->discrs.remote_discr;
+	bse->bse_flags = flags;
+	bse->bse_state = bs->ses_state;
+	bse->bse_diag = bs->local_diag;
+	bse->bse_remote_diag = bs->remote_diag;
+	bse->bse_detect_mult = bs->profile->bp_detectmultiplier;
+	bse->bse_remote_detect_mult = bs->remote_detect_mult;
+	bse->bse_rx_interval = bs->profile->bp_recvinterval * 1000;
+	bse->bse_tx_interval = bs->profile->bp_txinterval * 1000;
+	bse->bse_echo_interval = bs->profile->bp_echointerval * 1000;
+	bse->bse_remote_rx_interval = bs->remote_timers.required_min_rx;
+	bse->bse_remote_tx_interval = bs->remote_timers.desired_min_tx;
+	bse->bse_remote_echo_interval = bs->remote_timers.required_min_echo;
+	bse->bse_uptime = bs->uptime.tv_sec;
+	bse->bse_downtime = bs->downtime.tv_sec;
+	bse->bse_rx_ctrl = bs->stats.rx_ctrl_pkt;
+	bse->bse_tx_ctrl = bs->stats.tx_ctrl_pkt;
+	bse->bse_rx_echo = bs->stats.rx_echo_pkt;
+	bse->bse_tx_echo = bs->stats.tx_echo_pkt;
+
+	if (label) {
+		memset(bse->bse_peer, 0, sizeof(bse->bse_peer));
+		memset(bse->bse_local, 0, sizeof(bse->bse_local));
+		if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
+			sa_to_bct(&bs->mhop.peer, bse->bse_peer);
+			sa_to_bct(&bs->mhop.local, bse->bse_local);
+		} else {
+			sa_to_bct(&bs->shop.peer, bse->bse_peer);
+			sa_to_bct(&bs->local_ip, bse->bse_local);
+		}
+
+		memset(bse->bse_label, 0, sizeof(bse->bse_label));
+		if (bs->pl)
+			strncpy(bse->bse_label, bs->pl->pl_label,
+				sizeof(bse->bse_label));
+	}
+
+	__atomic_store_n(&bse->bse_seq, bse->bse_seq + 1, __ATOMIC_RELEASE);
+}
+
+void bfd_shm_changed(void)
+{
+	__atomic_add_fetch(&bglobal.bg_shm->bsh_generation, 1,
+			   __ATOMIC_RELEASE);
+
+	/* Wake the blocked readers once per event loop iteration. */
+	event_active(&bglobal.bg_shmev, 0, 0);
+}
+
+void bfd_shm_wake(evutil_socket_t sd __attribute__((unused)),
+		  short ev __attribute__((unused)),
+		  void *arg __attribute__((unused)))
+{
+	__atomic_add_fetch(&bglobal.bg_shm->bsh_wake, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &bglobal.bg_shm->bsh_wake, FUTEX_WAKE, INT_MAX,
+		NULL, NULL, 0);
+}
+
+void bfd_shm_add(bfd_session *bs)
+{
+	struct bfd_status_entry *entries, *bse;
+	uint32_t idx, slot = 0;
+
+	if (bglobal.bg_shm == NULL)
+		return;
+
+	/* Look for a free entry starting from the last allocated one. */
+	entries = (struct bfd_status_entry *)bfd_shm_index(
+		bglobal.bg_shm->bsh_entries_off);
+	for (idx = 0; idx < bglobal.bg_shmentries; idx++) {
+		slot = (bglobal.bg_shmnext + idx) % bglobal.bg_shmentries;
+		if (entries[slot].bse_discr == 0)
+			break;
+	}
+	if (idx == bglobal.bg_shmentries) {
+		log_warning("%s: status table is full, session 0x%x not "
+			    "published\n",
+			    __FUNCTION__, bs->discrs.my_discr);
+		return;
+	}
+
+	bglobal.bg_shmnext = slot + 1;
+	bse = &entries[slot];
+	bs->shm_entry = bse;
+
+	bfd_shm_write(bs, bse, true);
+	bfd_shm_index_add(bfd_shm_index(bglobal.bg_shm->bsh_discr_index),
+			  bfd_status_hash_discr(bse->bse_discr), slot + 1);
+	if (bse->bse_label[0])
+		bfd_shm_index_add(
+			bfd_shm_index(bglobal.bg_shm->bsh_label_index),
+			bfd_status_hash_label(bse->bse_label), slot + 1);
+
+	bfd_shm_changed();
+}
+
+void bfd_shm_del(bfd_session *bs)
+{
+	struct bfd_status_entry *bse = bs->shm_entry;
+	uint32_t slot;
+
+	if (bse == NULL)
+		return;
+
+	slot = bse - (struct bfd_status_entry *)bfd_shm_index(
+			     bglobal.bg_shm->bsh_entries_off)
+	       + 1;
+	bfd_shm_index_del(bfd_shm_index(bglobal.bg_shm->bsh_discr_index),
+			  bfd_status_hash_discr(bse->bse_discr), slot);
+	if (bse->bse_label[0])
+		bfd_shm_index_del(
+			bfd_shm_index(bglobal.bg_shm->bsh_label_index),
+			bfd_status_hash_label(bse->bse_label), slot);
+
+	__atomic_store_n(&bse->bse_seq, bse->bse_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	bse->bse_discr = 0;
+	__atomic_store_n(&bse->bse_seq, bse->bse_seq + 1, __ATOMIC_RELEASE);
+
+	bs->shm_entry = NULL;
+	bfd_shm_changed();
+}
+
+/* Publishes a session status change. */
+void bfd_shm_update(bfd_session *bs)
+{
+	struct bfd_status_entry *bse = bs->shm_entry;
+	char label[MAXNAMELEN];
+	uint32_t *index, slot;
+
+	if (bse == NULL)
+		return;
+
+	memcpy(label, bse->bse_label, sizeof(label));
+	bfd_shm_write(bs, bse, true);
+
+	/* Move the label index entry on renames. */
+	if (memcmp(label, bse->bse_label, sizeof(label)) != 0) {
+		index = bfd_shm_index(bglobal.bg_shm->bsh_label_index);
+		slot = bse - (struct bfd_status_entry *)bfd_shm_index(
+				     bglobal.bg_shm->bsh_entries_off)
+		       + 1;
+		if (label[0])
+			bfd_shm_index_del(index, bfd_status_hash_label(label),
+					  slot);
+		if (bse->bse_label[0])
+			bfd_shm_index_add(
+				index, bfd_status_hash_label(bse->bse_label),
+				slot);
+	}
+
+	bfd_shm_changed();
+}
+
+/* Updates the session counters in place (readers are not woken up). */
+void bfd_shm_refresh(bfd_session *bs)
+{
+	if (bs->shm_entry == NULL)
+		return;
+
+	bfd_shm_write(bs, bs->shm_entry, false);
+}
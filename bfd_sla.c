@@ -0,0 +1,345 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_sla.c: measures the sessions latency, jitter and packet loss.
+ *
+ * The latency is the round trip time of the packets that come back as an
+ * answer to ours:
+ *
+ *   - echo packets carry their transmit time, so every echo is paired
+ *     with its own transmission (lost ones don't skew the next);
+ *   - a Final packet answers the last Poll packet we sent.
+ *
+ * Times are CLOCK_MONOTONIC nanoseconds. When the kernel provides software
+ * timestamps (SO_TIMESTAMPING on transmission, SIOCGSTAMPNS on reception)
+ * they replace the times taken around the send and receive calls. The
+ * kernel timestamps use CLOCK_REALTIME: they are converted on arrival.
+ *
+ * The transmit timestamps are read from the session socket error queue
+ * and matched with the packets by their key (SOF_TIMESTAMPING_OPT_ID),
+ * which counts the packets sent on the socket.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "bfd.h"
+
+/*
+ * Prototypes
+ */
+uint64_t sla_monotime(const struct timespec *ts);
+int sla_timestamping(bfd_session *bs, int flags);
+void sla_txstamps_read(bfd_session *bs);
+uint64_t sla_txtime(bfd_session *bs, uint32_t key, uint64_t txtime,
+		    uint64_t rxtime);
+void sla_sample(bfd_session *bs, uint64_t txtime, uint64_t rxtime);
+uint32_t sla_usecs(uint64_t nsecs);
+void sla_report(bfd_session *bs);
+
+
+/*
+ * Functions
+ */
+
+/* Converts a kernel (CLOCK_REALTIME) timestamp, 0 if it is invalid. */
+uint64_t sla_monotime(const struct timespec *ts)
+{
+	struct timespec now;
+	uint64_t real, stamp, mono;
+
+	mono = get_monotime_ns();
+	if (clock_gettime(CLOCK_REALTIME, &now) != 0 || mono == 0)
+		return 0;
+
+	real = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	stamp = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+	if (stamp == 0)
+		return 0;
+
+	/* The clock was stepped back since then: use the current time. */
+	if (stamp > real)
+		return mono;
+	if (real - stamp > mono)
+		return 0;
+
+	return mono - (real - stamp);
+}
+
+int sla_timestamping(bfd_session *bs, int flags)
+{
+	return setsockopt(bs->sock, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+			  sizeof(flags));
+}
+
+/* Starts measuring: called when the SLA tracking is enabled. */
+void bfd_sla_start(bfd_session *bs)
+{
+	const int flags = SOF_TIMESTAMPING_TX_SOFTWARE
+			  | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID
+			  | SOF_TIMESTAMPING_OPT_TSONLY;
+
+	memset(&bs->sla, 0, sizeof(bs->sla));
+	bs->sla.loss_tx = bs->stats.tx_ctrl_pkt + bs->stats.tx_echo_pkt;
+	bs->sla.loss_rx = bs->stats.rx_ctrl_pkt + bs->stats.rx_echo_pkt;
+
+	/* Started again with the socket (see bfd_socket_setup()). */
+	if (bs->sock_pending)
+		return;
+
+	/*
+	 * Turning the timestamps off first resets the key counter of a
+	 * socket handed over by the previous daemon.
+	 */
+	sla_timestamping(bs, 0);
+	if (sla_timestamping(bs, flags) == -1) {
+		log_debug("%s: session 0x%x: no transmit timestamps: %s\n",
+			  __FUNCTION__, bs->discrs.my_discr, strerror(errno));
+		return;
+	}
+
+	bs->sla.tx_stamping = true;
+}
+
+void bfd_sla_stop(bfd_session *bs)
+{
+	if (!bs->sla.tx_stamping)
+		return;
+
+	sla_timestamping(bs, 0);
+	/* Release the timestamps still queued. */
+	sla_txstamps_read(bs);
+	bs->sla.tx_stamping = false;
+}
+
+/* Writes the transmit time in an echo packet about to be sent. */
+void bfd_sla_echo_stamp(bfd_session *bs, bfd_echo_pkt_t *ep)
+{
+	uint64_t txtime = 0;
+
+	if (bs->profile->bp_track_sla)
+		txtime = get_monotime_ns();
+
+	memcpy(ep->sla_key, &bs->sla.tx_seq, sizeof(ep->sla_key));
+	memcpy(ep->sla_tx, &txtime, sizeof(ep->sla_tx));
+}
+
+/*
+ * Counts a packet sent on the session socket. `polltx` is the transmit
+ * time of a Poll packet (zero for the others).
+ */
+void bfd_sla_sent(bfd_session *bs, uint64_t polltx)
+{
+	if (polltx != 0) {
+		bs->sla.poll_key = bs->sla.tx_seq;
+		bs->sla.poll_tx = polltx;
+	}
+
+	bs->sla.tx_seq++;
+}
+
+/* Returns the kernel receive time of the last packet read on `sd`. */
+uint64_t bfd_sla_rxtime(int sd, uint64_t rxtime)
+{
+	struct timespec ts;
+	uint64_t stamp;
+
+	if (ioctl(sd, SIOCGSTAMPNS, &ts) == -1)
+		return rxtime;
+
+	stamp = sla_monotime(&ts);
+	if (stamp == 0 || stamp > rxtime || rxtime - stamp > BFD_SLA_RTT_MAX)
+		return rxtime;
+
+	return stamp;
+}
+
+void sla_txstamps_read(bfd_session *bs)
+{
+	union {
+		struct cmsghdr cmsg;
+		uint8_t buf[CMSG_SPACE(sizeof(struct scm_timestamping))
+			    + CMSG_SPACE(sizeof(struct sock_extended_err)
+					 + sizeof(struct sockaddr_in6))];
+	} cbuf;
+	struct scm_timestamping tss;
+	struct sock_extended_err see;
+	struct bfd_sla_txstamp *bsx;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	bool has_tss, has_see;
+
+	if (!bs->sla.tx_stamping)
+		return;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof(cbuf.buf);
+		if (recvmsg(bs->sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return;
+
+		has_tss = has_see = false;
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		     cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level == SOL_SOCKET
+			    && cm->cmsg_type == SCM_TIMESTAMPING) {
+				memcpy(&tss, CMSG_DATA(cm), sizeof(tss));
+				has_tss = true;
+			} else if ((cm->cmsg_level == SOL_IP
+				    && cm->cmsg_type == IP_RECVERR)
+				   || (cm->cmsg_level == SOL_IPV6
+				       && cm->cmsg_type == IPV6_RECVERR)) {
+				memcpy(&see, CMSG_DATA(cm), sizeof(see));
+				has_see = true;
+			}
+		}
+
+		if (!has_tss || !has_see || see.ee_errno != ENOMSG
+		    || see.ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+			continue;
+
+		bsx = &bs->sla.txstamps[see.ee_data % BFD_SLA_TXSTAMPS];
+		bsx->bsx_key = see.ee_data;
+		bsx->bsx_time = sla_monotime(&tss.ts[0]);
+	}
+}
+
+/*
+ * Replaces the packet transmit time by its kernel timestamp if it is
+ * there. Timestamps that are too far from the send call belong to another
+ * packet: the key counter went out of sync.
+ */
+uint64_t sla_txtime(bfd_session *bs, uint32_t key, uint64_t txtime,
+		    uint64_t rxtime)
+{
+	struct bfd_sla_txstamp *bsx;
+
+	bsx = &bs->sla.txstamps[key % BFD_SLA_TXSTAMPS];
+	if (bsx->bsx_key != key || bsx->bsx_time == 0
+	    || bsx->bsx_time > rxtime
+	    || bsx->bsx_time + BFD_SLA_TXSTAMP_SKEW < txtime
+	    || bsx->bsx_time > txtime + BFD_SLA_TXSTAMP_SKEW)
+		return txtime;
+
+	return bsx->bsx_time;
+}
+
+void sla_sample(bfd_session *bs, uint64_t txtime, uint64_t rxtime)
+{
+	bfd_session_sla_t *sla = &bs->sla;
+	uint64_t rtt;
+
+	if (txtime == 0 || txtime > rxtime || rxtime - txtime > BFD_SLA_RTT_MAX)
+		return;
+
+	rtt = rxtime - txtime;
+	sla->rtt_sum += rtt;
+	sla->rtt_samples++;
+
+	/* Jitter: mean difference between consecutive round trips. */
+	if (sla->rtt_last != 0) {
+		sla->jitter_sum += (rtt > sla->rtt_last) ? rtt - sla->rtt_last
+							 : sla->rtt_last - rtt;
+		sla->jitter_samples++;
+	}
+	sla->rtt_last = rtt;
+}
+
+uint32_t sla_usecs(uint64_t nsecs)
+{
+	nsecs /= 1000;
+
+	return (nsecs > UINT32_MAX) ? UINT32_MAX : nsecs;
+}
+
+void sla_report(bfd_session *bs)
+{
+	bfd_session_sla_t *sla = &bs->sla;
+	uint64_t tx, rx, dtx, drx;
+
+	/* Keep the last values when no packet came back. */
+	if (sla->rtt_samples > 0)
+		sla->lattency = sla_usecs(sla->rtt_sum / sla->rtt_samples);
+	if (sla->jitter_samples > 0)
+		sla->jitter = sla_usecs(sla->jitter_sum / sla->jitter_samples);
+
+	tx = bs->stats.tx_ctrl_pkt + bs->stats.tx_echo_pkt;
+	rx = bs->stats.rx_ctrl_pkt + bs->stats.rx_echo_pkt;
+	drx = rx - sla->loss_rx;
+	if (drx >= PKTS_TO_CONSIDER_FOR_PKT_LOSS) {
+		dtx = tx - sla->loss_tx;
+		sla->pkt_loss =
+			(dtx > drx) ? (float)(dtx - drx) * 100 / dtx : 0;
+		sla->loss_tx = tx;
+		sla->loss_rx = rx;
+	}
+
+#ifdef BFD_EVENT_DEBUG
+	log_debug("%s: session 0x%x: latency %uus jitter %uus loss %f%%\n",
+		  __FUNCTION__, bs->discrs.my_discr, sla->lattency, sla->jitter,
+		  sla->pkt_loss);
+#endif /* BFD_EVENT_DEBUG */
+
+	control_notify_sla(bs);
+
+	sla->window_pkts = 0;
+	sla->rtt_samples = 0;
+	sla->jitter_samples = 0;
+	sla->rtt_sum = 0;
+	sla->jitter_sum = 0;
+}
+
+/*
+ * Accounts a received packet: an echo packet `ep` or a control packet
+ * with the Final bit `final`. The values are reported every detection
+ * multiplier packets.
+ */
+void ptm_bfd_send_sla_update(bfd_session *bfd, uint64_t rxtime,
+			     const bfd_echo_pkt_t *ep, bool final)
+{
+	bfd_session_sla_t *sla = &bfd->sla;
+	uint64_t txtime;
+	uint32_t key;
+
+	sla_txstamps_read(bfd);
+
+	if (ep != NULL) {
+		memcpy(&key, ep->sla_key, sizeof(key));
+		memcpy(&txtime, ep->sla_tx, sizeof(txtime));
+		if (txtime != 0)
+			sla_sample(bfd, sla_txtime(bfd, key, txtime, rxtime),
+				   rxtime);
+	} else if (final && sla->poll_tx != 0) {
+		sla_sample(bfd,
+			   sla_txtime(bfd, sla->poll_key, sla->poll_tx, rxtime),
+			   rxtime);
+		sla->poll_tx = 0;
+	}
+
+	if (++sla->window_pkts >= bfd->profile->bp_detectmultiplier)
+		sla_report(bfd);
+}
@@ -0,0 +1,684 @@
+/*********************************************************************
+ * Copyright 2017-2018 Network Device Education Foundation, Inc. ("NetDEF")
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; see the file COPYING; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ *
+ * bfd_state.c: checkpoints the sessions protocol state for warm restarts.
+ *
+ * Every session has an entry in a memory mapped file that is rewritten on
+ * each state or timers change, so it survives the daemon exit or crash.
+ * On startup the previous file is loaded and the sessions are resumed
+ * with their discriminators, state and timers before the configuration
+ * file is loaded, so they keep transmitting while it is parsed. The
+ * configuration then updates them, the peers it no longer has are deleted
+ * and the range sessions are recreated. The new file replaces the
+ * previous one once all sessions were restored.
+ *
+ * The checkpoints handed over by a running daemon (see bfd_handover.c)
+ * are restored the same way, along with the sessions sockets. So are the
+ * ones replicated to a standby daemon (see bfd_repl.c).
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+/*
+ * Prototypes
+ */
+int bfd_state_load(const char *path);
+int bfd_state_create(const char *path);
+void bfd_state_key_bpc(struct bfd_peer_cfg *bpc, struct bfd_state_key *key);
+struct bfd_state_saved *bfd_state_find(struct bfd_peer_cfg *bpc);
+void bfd_state_bpc(struct bfd_state_entry *bst, struct bfd_peer_cfg *bpc);
+int bfd_state_confirm(struct bfd_state_saved *bss);
+void bfd_state_write(bfd_session *bs, struct bfd_state_entry *bst);
+
+
+/*
+ * Functions
+ */
+int bfd_state_init(const char *path)
+{
+	char tmppath[PATH_MAX];
+
+	if (bglobal.bg_stateentries == 0
+	    || bglobal.bg_stateentries > INT32_MAX) {
+		log_error("%s: invalid number of entries: %u\n", __FUNCTION__,
+			  bglobal.bg_stateentries);
+		return -1;
+	}
+
+	if (snprintf(tmppath, sizeof(tmppath), "%s.new", path)
+	    >= (int)sizeof(tmppath)) {
+		log_error("%s: path too long: %s\n", __FUNCTION__, path);
+		return -1;
+	}
+
+	/*
+	 * A missing or invalid previous file is a cold start. Handed over
+	 * or replicated sessions are more recent than the file.
+	 */
+	if (!bglobal.bg_handover && !bglobal.bg_standby
+	    && bfd_state_load(path) != 0)
+		return -1;
+
+	/* The previous file is kept until all sessions are restored. */
+	if (bfd_state_create(tmppath) != 0)
+		return -1;
+
+	bglobal.bg_statepath = path;
+
+	return 0;
+}
+
+/* Loads the previous run checkpoints. */
+int bfd_state_load(const char *path)
+{
+	struct bfd_state_header *bsf;
+	struct bfd_state_entry *entries, *bst;
+	struct stat st;
+	uint32_t idx, seq, count = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+
+		log_error("%s: open(%s): %s\n", __FUNCTION__, path,
+			  strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(*bsf)) {
+		log_warning("%s: %s: invalid state file: cold start\n",
+			    __FUNCTION__, path);
+		close(fd);
+		return 0;
+	}
+
+	bsf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bsf == MAP_FAILED) {
+		log_error("%s: mmap: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	if (bsf->bsf_magic != BFD_STATE_MAGIC
+	    || bsf->bsf_version != BFD_STATE_VERSION
+	    || bsf->bsf_entry_size != sizeof(*bst)
+	    || (size_t)st.st_size
+		       < sizeof(*bsf) + (size_t)bsf->bsf_entries * sizeof(*bst)) {
+		log_warning("%s: %s: incompatible state file: cold start\n",
+			    __FUNCTION__, path);
+		munmap(bsf, st.st_size);
+		return 0;
+	}
+
+	entries = (struct bfd_state_entry *)(bsf + 1);
+	for (idx = 0; idx < bsf->bsf_entries; idx++) {
+		bst = &entries[idx];
+		seq = __atomic_load_n(&bst->bst_seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) || bst->bst_discr == 0)
+			continue;
+
+		if (bfd_state_saved_add(bst, -1) == 0)
+			count++;
+	}
+	munmap(bsf, st.st_size);
+
+	log_info("%s: %u sessions to restore from %s\n", __FUNCTION__, count,
+		 path);
+
+	return 0;
+}
+
+/*
+ * Adds a checkpoint to restore with its handed over socket (or -1).
+ * Duplicated sessions are refused: the first checkpoint wins.
+ */
+int bfd_state_saved_add(struct bfd_state_entry *bst, int sd)
+{
+	struct bfd_state_saved *bss;
+
+	HASH_FIND(bss_kh, bglobal.bg_stkeys, &bst->bst_key,
+		  sizeof(bst->bst_key), bss);
+	if (bss != NULL)
+		return -1;
+	HASH_FIND(bss_dh, bglobal.bg_stdiscrs, &bst->bst_discr,
+		  sizeof(uint32_t), bss);
+	if (bss != NULL)
+		return -1;
+
+	bss = calloc(1, sizeof(*bss));
+	if (bss == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	bss->bss_entry = *bst;
+	bss->bss_sock = sd;
+	HASH_ADD(bss_kh, bglobal.bg_stkeys, bss_entry.bst_key,
+		 sizeof(bss->bss_entry.bst_key), bss);
+	HASH_ADD(bss_dh, bglobal.bg_stdiscrs, bss_entry.bst_discr,
+		 sizeof(uint32_t), bss);
+
+	return 0;
+}
+
+/* Removes the checkpoints with the same discriminator or key. */
+void bfd_state_saved_del(struct bfd_state_entry *bst)
+{
+	struct bfd_state_saved *bss;
+
+	HASH_FIND(bss_dh, bglobal.bg_stdiscrs, &bst->bst_discr,
+		  sizeof(uint32_t), bss);
+	if (bss != NULL) {
+		HASH_DELETE(bss_kh, bglobal.bg_stkeys, bss);
+		HASH_DELETE(bss_dh, bglobal.bg_stdiscrs, bss);
+		free(bss);
+	}
+
+	HASH_FIND(bss_kh, bglobal.bg_stkeys, &bst->bst_key,
+		  sizeof(bst->bst_key), bss);
+	if (bss != NULL) {
+		HASH_DELETE(bss_kh, bglobal.bg_stkeys, bss);
+		HASH_DELETE(bss_dh, bglobal.bg_stdiscrs, bss);
+		free(bss);
+	}
+}
+
+/* Removes all checkpoints (none of them was restored yet). */
+void bfd_state_saved_clear(void)
+{
+	struct bfd_state_saved *bss, *bsstmp;
+
+	HASH_ITER (bss_dh, bglobal.bg_stdiscrs, bss, bsstmp) {
+		HASH_DELETE(bss_kh, bglobal.bg_stkeys, bss);
+		HASH_DELETE(bss_dh, bglobal.bg_stdiscrs, bss);
+		if (bss->bss_sock != -1)
+			close(bss->bss_sock);
+		free(bss);
+	}
+}
+
+int bfd_state_create(const char *path)
+{
+	struct bfd_state_header *bsf;
+	size_t len;
+	int fd;
+
+	len = sizeof(*bsf)
+	      + bglobal.bg_stateentries * sizeof(struct bfd_state_entry);
+
+	unlink(path);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		log_error("%s: open(%s): %s\n", __FUNCTION__, path,
+			  strerror(errno));
+		return -1;
+	}
+
+	if (ftruncate(fd, len) == -1) {
+		log_error("%s: ftruncate: %s\n", __FUNCTION__, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	bsf = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bsf == MAP_FAILED) {
+		log_error("%s: mmap: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	/* The file is zeroed: all entries are free. */
+	bsf->bsf_version = BFD_STATE_VERSION;
+	bsf->bsf_entry_size = sizeof(struct bfd_state_entry);
+	bsf->bsf_entries = bglobal.bg_stateentries;
+	__atomic_store_n(&bsf->bsf_magic, BFD_STATE_MAGIC, __ATOMIC_RELEASE);
+
+	bglobal.bg_state = bsf;
+	bglobal.bg_statelen = len;
+
+	return 0;
+}
+
+/*
+ * Resumes the checkpointed sessions, except the range ones, before the
+ * configuration file is loaded: handed over sessions must not wait for
+ * it to transmit. The configuration file sessions are confirmed by
+ * bfd_state_finish().
+ */
+void bfd_state_resume(void)
+{
+	struct bfd_state_saved *bss, *bsstmp;
+	struct bfd_state_entry *bst;
+	struct bfd_peer_cfg bpc;
+	bfd_session *bs;
+
+	HASH_ITER (bss_kh, bglobal.bg_stkeys, bss, bsstmp) {
+		bst = &bss->bss_entry;
+		if (BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_RANGE))
+			continue;
+
+		bfd_state_bpc(bst, &bpc);
+		bs = ptm_bfd_sess_new(&bpc);
+		if (bs == NULL)
+			continue;
+
+		bss->bss_resumed = true;
+		if (BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_CONFIG)) {
+			BFD_SET_FLAG(bs->flags, BFD_SESS_FLAG_CONFIG
+							| BFD_SESS_FLAG_RESUMED);
+			bfd_state_update(bs);
+		}
+	}
+}
+
+/*
+ * Deletes the resumed configuration file session that the file no longer
+ * has (see config_file_add()) or gives the other ones the profile that
+ * was not loaded yet when they were resumed.
+ */
+int bfd_state_confirm(struct bfd_state_saved *bss)
+{
+	struct bfd_state_entry *bst = &bss->bss_entry;
+	struct bfd_peer_cfg bpc;
+	bfd_session *bs;
+
+	bs = bs_session_find(bst->bst_discr);
+	if (bs == NULL)
+		return 0;
+
+	bfd_state_bpc(bst, &bpc);
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_RESUMED)) {
+		BFD_UNSET_FLAG(bs->flags, BFD_SESS_FLAG_RESUMED);
+		return ptm_bfd_ses_del(&bpc) == 0 ? -1 : 0;
+	}
+
+	/* Updates the existing session. */
+	if (!BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_CONFIG)
+	    && bpc.bpc_has_profile && bs->profile->bp_name[0] == 0)
+		ptm_bfd_sess_new(&bpc);
+
+	return 0;
+}
+
+/*
+ * Recreates the range sessions, finishes the resumed ones and replaces
+ * the previous state file. Called after the configuration file is loaded.
+ */
+void bfd_state_finish(void)
+{
+	struct bfd_state_saved *bss, *bsstmp;
+	struct bfd_state_entry *bst;
+	struct bfd_peer_cfg bpc;
+	char tmppath[PATH_MAX];
+	uint32_t restored = 0, dropped = 0;
+
+	HASH_ITER (bss_kh, bglobal.bg_stkeys, bss, bsstmp) {
+		bst = &bss->bss_entry;
+
+		/* Ranges are only known after the configuration is loaded. */
+		if (BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_RANGE)) {
+			if (bst->bst_key.bsk_multihop)
+				range_session_new(NULL,
+						  &bst->bst_key.bsk_mhop.peer,
+						  &bst->bst_key.bsk_mhop.local,
+						  bst->bst_key.bsk_mhop.vrf_name,
+						  true);
+			else
+				range_session_new(
+					bst->bst_key.bsk_shop.port_name,
+					&bst->bst_key.bsk_shop.peer,
+					&bst->bst_local, NULL, false);
+		} else if (!BFD_CHECK_FLAG(bst->bst_flags,
+					   BFD_SESS_FLAG_CONFIG)) {
+			bfd_state_bpc(bst, &bpc);
+			ptm_bfd_sess_new(&bpc);
+		}
+
+		/* Restored entries were removed by bfd_state_restore(). */
+		if (!bss->bss_restored) {
+			HASH_DELETE(bss_kh, bglobal.bg_stkeys, bss);
+			dropped++;
+		}
+	}
+
+	HASH_ITER (bss_dh, bglobal.bg_stdiscrs, bss, bsstmp) {
+		if (bss->bss_resumed && bfd_state_confirm(bss) != 0)
+			dropped++;
+		else if (bss->bss_restored)
+			restored++;
+		if (bss->bss_sock != -1)
+			close(bss->bss_sock);
+
+		HASH_DELETE(bss_dh, bglobal.bg_stdiscrs, bss);
+		free(bss);
+	}
+
+	if (restored || dropped)
+		log_info("%s: restored %u sessions (%u dropped)\n",
+			 __FUNCTION__, restored, dropped);
+
+	if (bglobal.bg_state == NULL)
+		return;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.new", bglobal.bg_statepath);
+	if (rename(tmppath, bglobal.bg_statepath) == -1)
+		log_error("%s: rename(%s): %s\n", __FUNCTION__,
+			  bglobal.bg_statepath, strerror(errno));
+}
+
+void bfd_state_key_bpc(struct bfd_peer_cfg *bpc, struct bfd_state_key *key)
+{
+	/* Same key as the session databases (see bfd_session_install()). */
+	memset(key, 0, sizeof(*key));
+	key->bsk_multihop = bpc->bpc_mhop;
+	if (bpc->bpc_mhop) {
+		key->bsk_mhop.peer = bpc->bpc_peer;
+		key->bsk_mhop.local = bpc->bpc_local;
+		if (bpc->bpc_has_vrfname)
+			strxcpy(key->bsk_mhop.vrf_name, bpc->bpc_vrfname,
+				sizeof(key->bsk_mhop.vrf_name));
+		return;
+	}
+
+	key->bsk_shop.peer = bpc->bpc_peer;
+	if (!bpc->bpc_has_vxlan && bpc->bpc_has_localif)
+		strxcpy(key->bsk_shop.port_name, bpc->bpc_localif,
+			sizeof(key->bsk_shop.port_name));
+}
+
+struct bfd_state_saved *bfd_state_find(struct bfd_peer_cfg *bpc)
+{
+	struct bfd_state_saved *bss;
+	struct bfd_state_key key;
+
+	if (bglobal.bg_stkeys == NULL)
+		return NULL;
+
+	bfd_state_key_bpc(bpc, &key);
+	HASH_FIND(bss_kh, bglobal.bg_stkeys, &key, sizeof(key), bss);
+
+	return bss;
+}
+
+/* Returns the source port used by the peer session before the restart. */
+uint16_t bfd_state_port(struct bfd_peer_cfg *bpc)
+{
+	struct bfd_state_saved *bss;
+
+	bss = bfd_state_find(bpc);
+	if (bss == NULL)
+		return 0;
+
+	return bss->bss_entry.bst_port;
+}
+
+/* Takes the socket handed over with the peer session (or returns -1). */
+int bfd_state_socket(struct bfd_peer_cfg *bpc)
+{
+	struct bfd_state_saved *bss;
+	int sd;
+
+	bss = bfd_state_find(bpc);
+	if (bss == NULL)
+		return -1;
+
+	sd = bss->bss_sock;
+	bss->bss_sock = -1;
+
+	return sd;
+}
+
+/* Tells if a discriminator belongs to a session not restored yet. */
+bool bfd_state_reserved(uint32_t discr)
+{
+	struct bfd_state_saved *bss;
+
+	if (bglobal.bg_stdiscrs == NULL)
+		return false;
+
+	HASH_FIND(bss_dh, bglobal.bg_stdiscrs, &discr, sizeof(discr), bss);
+
+	return bss != NULL && !bss->bss_restored;
+}
+
+/*
+ * Resumes a new session with its checkpoint. The configuration is applied
+ * afterwards: changed intervals are negotiated with a poll sequence.
+ */
+bool bfd_state_restore(bfd_session *bs, struct bfd_peer_cfg *bpc)
+{
+	struct bfd_state_saved *bss;
+	struct bfd_state_entry *bst;
+
+	bss = bfd_state_find(bpc);
+	if (bss == NULL)
+		return false;
+
+	/* The configuration asks for another discriminator. */
+	bst = &bss->bss_entry;
+	if (bpc->bpc_has_discr && bpc->bpc_discr != bst->bst_discr)
+		return false;
+	if (bs_session_find(bst->bst_discr) != NULL)
+		return false;
+
+	HASH_DELETE(bss_kh, bglobal.bg_stkeys, bss);
+	bss->bss_restored = true;
+
+	bs->discrs.my_discr = bst->bst_discr;
+	bs->discrs.remote_discr = bst->bst_remote_discr;
+	bs->ses_state = bst->bst_state;
+	bs->local_diag = bst->bst_diag;
+	bs->remote_detect_mult = bst->bst_remote_detect_mult;
+	bs->timers = bst->bst_timers;
+	bs->remote_timers = bst->bst_remote_timers;
+	bs->xmt_TO = bst->bst_xmt_TO;
+	bs->detect_TO = bst->bst_detect_TO;
+	bs->uptime = bst->bst_uptime;
+	bs->downtime = bst->bst_downtime;
+	if (!bpc->bpc_mhop && bst->bst_local.sa_sin.sin_family != AF_UNSPEC)
+		bs->local_ip = bst->bst_local;
+
+	log_debug("%s: session 0x%x resumed in state %d\n", __FUNCTION__,
+		  bs->discrs.my_discr, bs->ses_state);
+
+	return true;
+}
+
+/* Builds the configuration of a control socket session. */
+void bfd_state_bpc(struct bfd_state_entry *bst, struct bfd_peer_cfg *bpc)
+{
+	memset(bpc, 0, sizeof(*bpc));
+	bpc->bpc_mhop = bst->bst_key.bsk_multihop;
+	bpc->bpc_ipv4 = !BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_IPV6);
+	if (bpc->bpc_mhop) {
+		bpc->bpc_peer = bst->bst_key.bsk_mhop.peer;
+		bpc->bpc_local = bst->bst_key.bsk_mhop.local;
+		if (bst->bst_key.bsk_mhop.vrf_name[0]) {
+			bpc->bpc_has_vrfname = true;
+			strxcpy(bpc->bpc_vrfname, bst->bst_key.bsk_mhop.vrf_name,
+				sizeof(bpc->bpc_vrfname));
+		}
+	} else {
+		bpc->bpc_peer = bst->bst_key.bsk_shop.peer;
+		bpc->bpc_local = bst->bst_local;
+		if (bst->bst_key.bsk_shop.port_name[0]) {
+			bpc->bpc_has_localif = true;
+			strxcpy(bpc->bpc_localif,
+				bst->bst_key.bsk_shop.port_name,
+				sizeof(bpc->bpc_localif));
+		}
+	}
+
+	bpc->bpc_has_vxlan =
+		!!BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_VXLAN);
+	bpc->bpc_echo = !!BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_ECHO);
+	bpc->bpc_shutdown =
+		!!BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_SHUTDOWN);
+	bpc->bpc_track_sla =
+		!!BFD_CHECK_FLAG(bst->bst_flags, BFD_SESS_FLAG_TRACK_SLA);
+
+	if (bst->bst_label[0]) {
+		bpc->bpc_has_label = true;
+		strxcpy(bpc->bpc_label, bst->bst_label, sizeof(bpc->bpc_label));
+	}
+
+	/*
+	 * The profile parameters are copied by profile_to_bpc(). Profiles
+	 * are unknown until the configuration is loaded: the session starts
+	 * with the checkpointed parameters (see bfd_state_confirm()).
+	 */
+	if (bst->bst_profile[0] && profile_find(bst->bst_profile) != NULL) {
+		bpc->bpc_has_profile = true;
+		strxcpy(bpc->bpc_profile, bst->bst_profile,
+			sizeof(bpc->bpc_profile));
+		return;
+	}
+
+	bpc->bpc_has_detectmultiplier = true;
+	bpc->bpc_detectmultiplier = bst->bst_detect_mult;
+	bpc->bpc_has_txinterval = true;
+	bpc->bpc_txinterval = bst->bst_up_min_tx / 1000;
+	bpc->bpc_has_recvinterval = true;
+	bpc->bpc_recvinterval = bst->bst_timers.required_min_rx / 1000;
+	bpc->bpc_has_echointerval = true;
+	bpc->bpc_echointerval = bst->bst_timers.required_min_echo / 1000;
+}
+
+void bfd_state_write(bfd_session *bs, struct bfd_state_entry *bst)
+{
+	const uint32_t flags = BFD_SESS_FLAG_IPV6 | BFD_SESS_FLAG_VXLAN
+			       | BFD_SESS_FLAG_SHUTDOWN | BFD_SESS_FLAG_CONFIG
+			       | BFD_SESS_FLAG_RANGE;
+
+	/* Sequence lock: an odd value marks an interrupted write. */
+	__atomic_store_n(&bst->bst_seq, bst->bst_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	bst->bst_discr = bs->discrs.my_discr;
+	bst->bst_remote_discr = bs->discrs.remote_discr;
+	bst->bst_flags = bs->flags & flags;
+	if (bs->profile->bp_echo)
+		bst->bst_flags |= BFD_SESS_FLAG_ECHO;
+	if (bs->profile->bp_track_sla)
+		bst->bst_flags |= BFD_SESS_FLAG_TRACK_SLA;
+	bst->bst_state = bs->ses_state;
+	bst->bst_diag = bs->local_diag;
+	bst->bst_detect_mult = bs->profile->bp_detectmultiplier;
+	bst->bst_remote_detect_mult = bs->remote_detect_mult;
+	bst->bst_up_min_tx = bs->profile->bp_txinterval * 1000;
+	bst->bst_timers = bs->timers;
+	bst->bst_remote_timers = bs->remote_timers;
+	bst->bst_xmt_TO = bs->xmt_TO;
+	bst->bst_detect_TO = bs->detect_TO;
+	bst->bst_uptime = bs->uptime;
+	bst->bst_downtime = bs->downtime;
+	bst->bst_local = bs->local_ip;
+
+	memset(bst->bst_label, 0, sizeof(bst->bst_label));
+	if (bs->pl)
+		strxcpy(bst->bst_label, bs->pl->pl_label,
+			sizeof(bst->bst_label));
+	memset(bst->bst_profile, 0, sizeof(bst->bst_profile));
+	strxcpy(bst->bst_profile, bs->profile->bp_name,
+		sizeof(bst->bst_profile));
+
+	__atomic_store_n(&bst->bst_seq, bst->bst_seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Fills a new entry: the key and the source port don't change, later
+ * updates only need bfd_state_write().
+ */
+void bfd_state_fill(bfd_session *bs, struct bfd_state_entry *bst)
+{
+	memset(&bst->bst_key, 0, sizeof(bst->bst_key));
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH)) {
+		bst->bst_key.bsk_multihop = true;
+		bst->bst_key.bsk_mhop = bs->mhop;
+	} else
+		bst->bst_key.bsk_shop = bs->shop;
+
+	bst->bst_port = bs->src_port;
+
+	bfd_state_write(bs, bst);
+}
+
+void bfd_state_add(bfd_session *bs)
+{
+	struct bfd_state_entry *entries, *bst;
+	uint32_t idx, slot = 0;
+
+	if (bglobal.bg_state == NULL)
+		return;
+
+	/* Look for a free entry starting from the last allocated one. */
+	entries = (struct bfd_state_entry *)(bglobal.bg_state + 1);
+	for (idx = 0; idx < bglobal.bg_stateentries; idx++) {
+		slot = (bglobal.bg_statenext + idx) % bglobal.bg_stateentries;
+		if (entries[slot].bst_discr == 0)
+			break;
+	}
+	if (idx == bglobal.bg_stateentries) {
+		log_warning("%s: state file is full, session 0x%x not "
+			    "checkpointed\n",
+			    __FUNCTION__, bs->discrs.my_discr);
+		return;
+	}
+
+	bglobal.bg_statenext = slot + 1;
+	bst = &entries[slot];
+	bs->state_entry = bst;
+
+	bfd_state_fill(bs, bst);
+}
+
+void bfd_state_del(bfd_session *bs)
+{
+	struct bfd_state_entry *bst = bs->state_entry;
+
+	if (bst == NULL)
+		return;
+
+	__atomic_store_n(&bst->bst_seq, bst->bst_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	bst->bst_discr = 0;
+	__atomic_store_n(&bst->bst_seq, bst->bst_seq + 1, __ATOMIC_RELEASE);
+
+	bs->state_entry = NULL;
+}
+
+/* Checkpoints a session state, timers or configuration change. */
+void bfd_state_update(bfd_session *bs)
+{
+	if (bs->state_entry == NULL)
+		return;
+
+	bfd_state_write(bs, bs->state_entry);
+}
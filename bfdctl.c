@@ -24,13 +24,24 @@
 
 
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
 
+#include <linux/futex.h>
+
+#include <endian.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <json-c/json.h>
@@ -43,8 +54,8 @@
 void usage(void);
 
 int control_init(const char *path);
-uint16_t control_send(int sd, enum bc_msg_type bmt, const void *data,
-		      size_t datalen);
+uint16_t control_send(int sd, enum bc_msg_version bmv, enum bc_msg_type bmt,
+		      const void *data, size_t datalen);
 
 typedef int (*control_recv_cb)(struct bfd_control_msg *, void *arg);
 int control_recv(int sd, control_recv_cb cb, void *arg);
@@ -52,7 +63,149 @@ int control_recv(int sd, control_recv_cb cb, void *arg);
 struct json_object *ctrl_new_json(void);
 void ctrl_add_peer(struct json_object *msg, struct bfd_peer_cfg *bpc);
 
+size_t ctrl_bin_tlv(uint8_t *buf, uint16_t type, const void *value,
+		    size_t len);
+size_t ctrl_bin_peer(uint8_t *buf, struct bfd_peer_cfg *bpc);
+void ctrl_bin_print(uint16_t type, const uint8_t *value, uint16_t len);
+
+/* Query page being received. */
+struct ctrl_query {
+	uint16_t cq_id;
+	uint32_t cq_cursor;
+};
+
+int ctrl_show(int sd, enum bc_msg_version bmv, struct bfd_control_query *bcq);
+
+struct bfd_status_header *ctrl_status_open(const char *path, size_t *len,
+					   ino_t *ino);
+void ctrl_status_print(const struct bfd_status_header *bsh,
+		       const char *prefix);
+int ctrl_status(const char *path, bool monitor, const char *prefix);
+
+/* Default number of batch requests in flight. */
+#define CTRL_BATCH_WINDOW 64
+#define CTRL_BATCH_WINDOW_MAX 4096
+
+/* Batch request in flight. */
+struct ctrl_batch_req {
+	uint16_t cbr_id;
+	bool cbr_done;
+	size_t cbr_line;
+	char cbr_peer[INET6_ADDRSTRLEN];
+};
+
+/* Batch requests in flight: a ring in the order they were sent. */
+struct ctrl_batch {
+	struct ctrl_batch_req *cb_reqs;
+	size_t cb_window;
+	size_t cb_head;
+	size_t cb_count;
+	uint64_t cb_ok;
+	uint64_t cb_failed;
+};
+
+int ctrl_batch_parse_json(const char *line, struct bfd_peer_cfg *bpc);
+int ctrl_batch_parse_csv(char *line, struct bfd_peer_cfg *bpc);
+int ctrl_batch_send(int sd, enum bc_msg_version bmv, enum bc_msg_type bmt,
+		    struct ctrl_batch *cb, struct bfd_peer_cfg *bpc,
+		    size_t line);
+int bcm_recv_batch(struct bfd_control_msg *bcm, void *arg);
+int ctrl_batch(int sd, enum bc_msg_version bmv, enum bc_msg_type bmt,
+	       const char *path, size_t window,
+	       const struct bfd_peer_cfg *defaults);
+
+bool ctrl_response_ok(const struct bfd_control_msg *bcm, const uint8_t *data,
+		      char *error, size_t errorlen);
+
+/* Benchmark defaults. */
+#define CTRL_BENCH_CONNS 4
+#define CTRL_BENCH_CONNS_MAX 1024
+#define CTRL_BENCH_RATE 1000
+#define CTRL_BENCH_SECONDS 10
+/* Peers added and then deleted in turns by each connection. */
+#define CTRL_BENCH_PEERS 250
+#define CTRL_BENCH_READ_SIZE 65536
+/* Time to wait for the outstanding responses at the end. */
+#define CTRL_BENCH_DRAIN_SECONDS 10
+
+/* Latencies in microseconds. */
+struct ctrl_bench_samples {
+	uint32_t *cbs_values;
+	size_t cbs_count;
+	size_t cbs_size;
+};
+
+struct ctrl_bench_req {
+	uint16_t cbr_id;
+	bool cbr_done;
+	bool cbr_measured;
+	uint64_t cbr_sent;
+};
+
+struct ctrl_bench_conn {
+	int cbc_sd;
+	unsigned int cbc_idx;
+
+	/* Requests sent and the next send time (nanoseconds). */
+	uint64_t cbc_sent;
+	uint64_t cbc_next;
+
+	/* Requests in flight: a ring in the order they were sent. */
+	struct ctrl_bench_req *cbc_reqs;
+	size_t cbc_head;
+	size_t cbc_count;
+
+	/* Received data with room for a string terminator. */
+	uint8_t *cbc_buf;
+	size_t cbc_len;
+	size_t cbc_size;
+};
+
+struct ctrl_bench {
+	enum bc_msg_version cbn_bmv;
+	size_t cbn_window;
+	struct ctrl_bench_conn *cbn_conns;
+	size_t cbn_nconns;
+
+	/* Time each peer add was sent to measure the notifications lag. */
+	uint64_t *cbn_added;
+
+	/* Measurement period (nanoseconds). */
+	uint64_t cbn_start;
+	uint64_t cbn_end;
+	uint64_t cbn_last;
+
+	uint64_t cbn_ok;
+	uint64_t cbn_failed;
+	uint64_t cbn_notifications;
+	uint64_t cbn_resyncs;
+	struct ctrl_bench_samples cbn_latency;
+	struct ctrl_bench_samples cbn_lag;
+};
+
+uint64_t ctrl_bench_now(void);
+void ctrl_bench_sample(struct ctrl_bench_samples *cbs, uint64_t ns);
+int ctrl_bench_cmp(const void *a, const void *b);
+void ctrl_bench_report(const char *name, struct ctrl_bench_samples *cbs);
+void ctrl_bench_peer(struct ctrl_bench_conn *cbc, size_t peer,
+		     struct sockaddr_any *sa);
+int ctrl_bench_send(struct ctrl_bench *cbn, struct ctrl_bench_conn *cbc,
+		    uint64_t now);
+void ctrl_bench_added(struct ctrl_bench *cbn, const uint8_t *addr,
+		      uint64_t now);
+void ctrl_bench_notify(struct ctrl_bench *cbn,
+		       const struct bfd_control_msg *bcm, const uint8_t *data,
+		       uint64_t now);
+void ctrl_bench_msg(struct ctrl_bench *cbn, struct ctrl_bench_conn *cbc,
+		    const struct bfd_control_msg *bcm, const uint8_t *data,
+		    uint64_t now);
+int ctrl_bench_read(struct ctrl_bench *cbn, struct ctrl_bench_conn *cbc);
+int ctrl_bench(const char *path, enum bc_msg_version bmv, size_t conns,
+	       unsigned long rate, unsigned long seconds, size_t window);
+
 int bcm_recv(struct bfd_control_msg *bcm, void *arg);
+int bcm_recv_bin(struct bfd_control_msg *bcm);
+int bcm_recv_query(struct bfd_control_msg *bcm, void *arg);
 const char *satostr(struct sockaddr_any *sa);
 int strtosa(const char *addr, struct sockaddr_any *sa);
 
@@ -65,18 +218,43 @@ void usage(void)
 	extern const char *__progname;
 
 	fprintf(stderr,
-		"%s: [OPTIONS...]\n"
+		"%s: [OPTIONS...] [show [up|down|init|adm-down]]\n"
+		"%s: [-2] [-C path] [-W count] bench [connections [rate "
+		"[seconds]]]\n"
+		"%s: [-2] [-C path] reload\n"
+		"\t-2: use the binary control protocol (version 2)\n"
+		"\t-B: use bulk (transactional) add/delete requests\n"
 		"\t-C: control socket path\n"
+		"\t-L <prefix>: show only peers with label prefix\n"
 		"\t-M: monitor (show notifications for all peers or a specific)\n"
+		"\t-R <seq>: resume monitoring after notification <seq>\n"
+		"\t-S: show the control sockets statistics\n"
+		"\t-V <vrf>: show only peers of the VRF\n"
 		"\t-a: add peer\n"
+		"\t-b <path>: add/delete the peers read from a file ('-' for "
+		"stdin), one per line as a JSON object or as "
+		"'peer[,local[,ifname[,label]]]'\n"
 		"\t-d: delete peer\n"
+		"\t-f <ipv4|ipv6>: show only peers of the address family\n"
 		"\t-i <ifname>: interface\n"
 		"\t-l <address>: local address (e.g. 192.168.0.1 or 2001:db8::100)\n"
 		"\t-m: multihop\n"
+		"\t-n <count>: show peers in pages of <count>\n"
 		"\t-p <address>: peer address (e.g. 192.168.0.1 or 2001:db8::100)\n"
+		"\t-t <path>: show the daemon shared memory status table (watch "
+		"it with '-M')\n"
                 "\t-s: track sla and displays calculated sla parameters if monitoring\n"
-		"\t-v: verbose mode\n",
-		__progname);
+		"\t-v: verbose mode\n"
+		"\t-W <count>: batch (and bench, per connection) requests in "
+		"flight (default 64)\n"
+		"\t-w <ms>: coalesce notifications in windows of <ms> if monitoring\n"
+		"\n"
+		"bench: add and delete peers over <connections> (default %d) "
+		"subscribed control connections at <rate> requests per second "
+		"(default %d, 0 is unlimited) for <seconds> (default %d)\n"
+		"reload: apply the daemon configuration file changes\n",
+		__progname, __progname, __progname, CTRL_BENCH_CONNS,
+		CTRL_BENCH_RATE, CTRL_BENCH_SECONDS);
 
 	exit(1);
 }
@@ -87,20 +265,46 @@ int main(int argc, char *argv[])
 	const char *ifname = NULL;
 	const char *jsonstr = NULL;
 	const char *ctl_path = BFD_CONTROL_SOCK_PATH;
+	const char *status_path = NULL;
+	const char *batch_path = NULL;
+	unsigned long batch_window = CTRL_BATCH_WINDOW;
+	unsigned long bench_conns = CTRL_BENCH_CONNS;
+	unsigned long bench_rate = CTRL_BENCH_RATE;
+	unsigned long bench_seconds = CTRL_BENCH_SECONDS;
+	const void *msg = NULL;
+	size_t msglen = 0;
+	uint8_t binmsg[BCT_TOTLEN(sizeof(struct bfd_control_peer))];
+	enum bc_msg_version bmv = BMV_VERSION_1;
 	enum bc_msg_type bmt = 0;
 	int csock;
 	int opt;
 	uint16_t cur_id;
 	bool mhop = false, verbose = false, monitor = false, sla = false;
+	bool bulk = false, stats = false, show = false;
+	struct bfd_control_query bcq;
+	long window = -1;
+	uint32_t bwindow;
+	char *ep;
 	struct sockaddr_any local, peer;
 	struct bfd_peer_cfg bpc;
-	uint64_t notify_flags = BCM_NOTIFY_ALL;
+	uint64_t notify_flags = BCM_NOTIFY_ALL, resume = 0, bresume;
+	uint64_t notify_req[2];
 
 	memset(&local, 0, sizeof(local));
 	memset(&peer, 0, sizeof(peer));
+	memset(&bpc, 0, sizeof(bpc));
+	memset(&bcq, 0, sizeof(bcq));
 
-	while ((opt = getopt(argc, argv, "aC:di:l:Mmsp:v")) != -1) {
+	while ((opt = getopt(argc, argv, "2aBb:C:df:i:L:l:Mmn:R:Ssp:t:V:vW:w:")) != -1) {
 		switch (opt) {
+		case '2':
+			bmv = BMV_VERSION_2;
+			break;
+
+		case 'B':
+			bulk = true;
+			break;
+
 		case 'C':
 			ctl_path = optarg;
 			break;
@@ -115,6 +319,10 @@ int main(int argc, char *argv[])
 			bmt = BMT_REQUEST_ADD;
 			break;
 
+		case 'b':
+			batch_path = optarg;
+			break;
+
 		case 'd':
 			if (bmt != 0) {
 				fprintf(stderr,
@@ -125,6 +333,15 @@ int main(int argc, char *argv[])
 			bmt = BMT_REQUEST_DEL;
 			break;
 
+		case 'f':
+			if (strcmp(optarg, "ipv4") == 0)
+				bcq.bcq_flags |= BCQ_F_IPV4;
+			else if (strcmp(optarg, "ipv6") == 0)
+				bcq.bcq_flags |= BCQ_F_IPV6;
+			else
+				usage();
+			break;
+
 		case 'i':
 			ifname = optarg;
 			if (strlen(ifname) > MAXNAMELEN) {
@@ -135,6 +352,11 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'L':
+			bcq.bcq_flags |= BCQ_F_LABEL;
+			strncpy(bcq.bcq_label, optarg, sizeof(bcq.bcq_label));
+			break;
+
 		case 'l':
 			if (strtosa(optarg, &local) != 0) {
 				fprintf(stderr, "wrong address format: %s\n",
@@ -159,28 +381,197 @@ int main(int argc, char *argv[])
 			mhop = true;
 			break;
 
+		case 'n':
+			bcq.bcq_limit = strtoul(optarg, &ep, 10);
+			if (*ep != 0 || bcq.bcq_limit == 0
+			    || bcq.bcq_limit > BCM_QUERY_LIMIT_MAX) {
+				fprintf(stderr,
+					"invalid page size (expected 1-%d): %s\n",
+					BCM_QUERY_LIMIT_MAX, optarg);
+				exit(1);
+			}
+			break;
+
+		case 'R':
+			resume = strtoull(optarg, &ep, 10);
+			if (*ep != 0 || resume == 0) {
+				fprintf(stderr, "invalid sequence number: %s\n",
+					optarg);
+				exit(1);
+			}
+			break;
+
+		case 'S':
+			stats = true;
+			break;
+
+		case 'V':
+			bcq.bcq_flags |= BCQ_F_VRFNAME;
+			strncpy(bcq.bcq_vrfname, optarg,
+				sizeof(bcq.bcq_vrfname));
+			break;
+
                 case 's':
                         sla = true;
                         break;
 
+		case 't':
+			status_path = optarg;
+			break;
+
 		case 'v':
 			verbose = true;
 			break;
 
+		case 'W':
+			batch_window = strtoul(optarg, &ep, 10);
+			if (*ep != 0 || batch_window == 0
+			    || batch_window > CTRL_BATCH_WINDOW_MAX) {
+				fprintf(stderr,
+					"invalid batch window (expected 1-%d): %s\n",
+					CTRL_BATCH_WINDOW_MAX, optarg);
+				exit(1);
+			}
+			break;
+
+		case 'w':
+			window = strtol(optarg, &ep, 10);
+			if (*ep != 0 || window < 0 || window > BCM_COALESCE_MAX) {
+				fprintf(stderr,
+					"invalid coalescing window (expected 0-%d): %s\n",
+					BCM_COALESCE_MAX, optarg);
+				exit(1);
+			}
+			break;
+
 		default:
 			usage();
 			break;
 		}
 	}
 
-	if (bmt == 0 && !monitor) {
+	/* Commands */
+	if (optind < argc && strcmp(argv[optind], "bench") == 0) {
+		if (++optind < argc) {
+			bench_conns = strtoul(argv[optind], &ep, 10);
+			if (*ep != 0 || bench_conns == 0
+			    || bench_conns > CTRL_BENCH_CONNS_MAX)
+				usage();
+		}
+		if (++optind < argc) {
+			bench_rate = strtoul(argv[optind], &ep, 10);
+			if (*ep != 0)
+				usage();
+		}
+		if (++optind < argc) {
+			bench_seconds = strtoul(argv[optind], &ep, 10);
+			if (*ep != 0 || bench_seconds == 0)
+				usage();
+		}
+		if (++optind < argc)
+			usage();
+
+		if (ctrl_bench(ctl_path, bmv, bench_conns, bench_rate,
+			       bench_seconds, batch_window)
+		    != 0)
+			exit(1);
+
+		return 0;
+	}
+
+	if (optind < argc && strcmp(argv[optind], "reload") == 0) {
+		if (++optind < argc)
+			usage();
+
+		if ((csock = control_init(ctl_path)) == -1)
+			exit(1);
+
+		/* JSON messages must carry at least an empty object. */
+		if (bmv == BMV_VERSION_2)
+			cur_id = control_send(csock, bmv, BMT_RELOAD, NULL, 0);
+		else
+			cur_id = control_send(csock, bmv, BMT_RELOAD, "{}", 2);
+		if (cur_id == 0) {
+			fprintf(stderr, "failed to send message\n");
+			exit(1);
+		}
+
+		control_recv(csock, bcm_recv, &cur_id);
+
+		return 0;
+	}
+
+	if (optind < argc) {
+		if (strcmp(argv[optind], "show") != 0)
+			usage();
+
+		show = true;
+		if (++optind < argc) {
+			bcq.bcq_flags |= BCQ_F_STATE;
+			if (strcmp(argv[optind], "up") == 0)
+				bcq.bcq_state = BPS_UP;
+			else if (strcmp(argv[optind], "down") == 0)
+				bcq.bcq_state = BPS_DOWN;
+			else if (strcmp(argv[optind], "init") == 0)
+				bcq.bcq_state = BPS_INIT;
+			else if (strcmp(argv[optind], "adm-down") == 0)
+				bcq.bcq_state = BPS_SHUTDOWN;
+			else
+				usage();
+		}
+	}
+
+	/* The status table is read directly: no control socket needed. */
+	if (status_path) {
+		if (ctrl_status(status_path, monitor,
+				(bcq.bcq_flags & BCQ_F_LABEL) ? bcq.bcq_label
+							      : NULL)
+		    != 0)
+			exit(1);
+
+		return 0;
+	}
+
+	/* Batches pipeline one request per peer over a single connection. */
+	if (batch_path) {
+		if (bmt == 0 || bulk) {
+			fprintf(stderr,
+				"batch mode requires '-a' or '-d' (without "
+				"'-B')\n");
+			exit(1);
+		}
+
+		/* Defaults for the peers read from the batch. */
+		bpc.bpc_mhop = mhop;
+		bpc.bpc_track_sla = sla;
+		if (ifname) {
+			bpc.bpc_has_localif = true;
+			strcpy(bpc.bpc_localif, ifname);
+		}
+
+		if ((csock = control_init(ctl_path)) == -1)
+			exit(1);
+
+		if (ctrl_batch(csock, bmv, bmt, batch_path, batch_window, &bpc)
+		    != 0)
+			exit(1);
+
+		return 0;
+	}
+
+	if (bmt == 0 && !monitor && !stats && !show) {
 		fprintf(stderr, "you must specify an operation\n");
 		exit(1);
 	}
 
+	if (bulk && bmt == BMT_REQUEST_ADD)
+		bmt = BMT_REQUEST_BULK_ADD;
+	else if (bulk && bmt == BMT_REQUEST_DEL)
+		bmt = BMT_REQUEST_BULK_DEL;
+
 	if (peer.sa_sin.sin_family == 0) {
-		if (monitor) {
-			goto skip_json;
+		if (monitor || ((stats || show) && bmt == 0)) {
+			goto skip_msg;
 		}
 
 		fprintf(stderr, "you must specify a remote peer\n");
@@ -209,6 +600,12 @@ int main(int argc, char *argv[])
 	bpc.bpc_local = local;
         bpc.bpc_track_sla = sla;
 
+	if (bmv == BMV_VERSION_2) {
+		msglen = ctrl_bin_peer(binmsg, &bpc);
+		msg = binmsg;
+		goto skip_msg;
+	}
+
 	/* Create the JSON string. */
 	jo = ctrl_new_json();
 	ctrl_add_peer(jo, &bpc);
@@ -218,13 +615,34 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "%s\n", jsonstr);
 	}
 
-skip_json:
+	msg = jsonstr;
+	msglen = strlen(jsonstr);
+
+skip_msg:
 	if ((csock = control_init(ctl_path)) == -1) {
 		exit(1);
 	}
 
 	if (bmt != 0) {
-		cur_id = control_send(csock, bmt, jsonstr, strlen(jsonstr));
+		cur_id = control_send(csock, bmv, bmt, msg, msglen);
+		if (cur_id == 0) {
+			fprintf(stderr, "failed to send message\n");
+			exit(1);
+		}
+
+		control_recv(csock, bcm_recv, &cur_id);
+		if (bmt == BMT_REQUEST_BULK_ADD)
+			printf("Note: the new sessions get their sockets after "
+			       "the response, the ones that can't get one are "
+			       "deleted (monitor with '-M').\n");
+	}
+
+	if (stats) {
+		/* JSON messages must carry at least an empty object. */
+		if (bmv == BMV_VERSION_2)
+			cur_id = control_send(csock, bmv, BMT_STATS, NULL, 0);
+		else
+			cur_id = control_send(csock, bmv, BMT_STATS, "{}", 2);
 		if (cur_id == 0) {
 			fprintf(stderr, "failed to send message\n");
 			exit(1);
@@ -233,13 +651,44 @@ skip_json:
 		control_recv(csock, bcm_recv, &cur_id);
 	}
 
+	if (show) {
+		if (mhop)
+			bcq.bcq_flags |= BCQ_F_MHOP;
+		if (ifname) {
+			bcq.bcq_flags |= BCQ_F_LOCALIF;
+			strncpy(bcq.bcq_localif, ifname,
+				sizeof(bcq.bcq_localif));
+		}
+
+		if (ctrl_show(csock, bmv, &bcq) != 0)
+			exit(1);
+	}
+
 	if (monitor) {
-		if (jsonstr == NULL) {
-			cur_id = control_send(csock, BMT_NOTIFY, &notify_flags,
+		if (msg == NULL && bmv == BMV_VERSION_2) {
+			notify_flags = htobe64(notify_flags);
+			msglen = ctrl_bin_tlv(binmsg, BCT_NOTIFY_FLAGS,
+					      &notify_flags,
 					      sizeof(notify_flags));
+			if (resume) {
+				bresume = htobe64(resume);
+				msglen += ctrl_bin_tlv(&binmsg[msglen], BCT_SEQ,
+						       &bresume,
+						       sizeof(bresume));
+			}
+			cur_id = control_send(csock, bmv, BMT_NOTIFY, binmsg,
+					      msglen);
+		} else if (msg == NULL) {
+			/* The resume sequence number follows the flags. */
+			notify_req[0] = notify_flags;
+			notify_req[1] = resume;
+			cur_id = control_send(csock, bmv, BMT_NOTIFY,
+					      notify_req,
+					      resume ? sizeof(notify_req)
+						     : sizeof(notify_flags));
 		} else {
-			cur_id = control_send(csock, BMT_NOTIFY_ADD, jsonstr,
-					      strlen(jsonstr));
+			cur_id = control_send(csock, bmv, BMT_NOTIFY_ADD, msg,
+					      msglen);
 		}
 		if (cur_id == 0) {
 			fprintf(stderr, "failed to send message\n");
@@ -248,6 +697,28 @@ skip_json:
 
 		control_recv(csock, bcm_recv, &cur_id);
 
+		if (window >= 0) {
+			if (bmv == BMV_VERSION_2) {
+				bwindow = htonl(window);
+				msglen = ctrl_bin_tlv(binmsg, BCT_COALESCE,
+						      &bwindow,
+						      sizeof(bwindow));
+			} else {
+				msglen = snprintf((char *)binmsg,
+						  sizeof(binmsg),
+						  "{\"window\":%ld}", window);
+			}
+
+			cur_id = control_send(csock, bmv, BMT_NOTIFY_COALESCE,
+					      binmsg, msglen);
+			if (cur_id == 0) {
+				fprintf(stderr, "failed to send message\n");
+				exit(1);
+			}
+
+			control_recv(csock, bcm_recv, &cur_id);
+		}
+
 		printf("Listening for events\n");
 
 		/* Expect notifications only */
@@ -271,6 +742,9 @@ int bcm_recv(struct bfd_control_msg *bcm, void *arg)
 			__FUNCTION__, *id, ntohs(bcm->bcm_id));
 	}
 
+	if (bcm->bcm_ver == BMV_VERSION_2)
+		return bcm_recv_bin(bcm);
+
 	switch (bcm->bcm_type) {
 	case BMT_RESPONSE:
 		jo = json_tokener_parse((const char *)bcm->bcm_data);
@@ -389,6 +863,24 @@ void ctrl_add_peer(struct json_object *msg, struct bfd_peer_cfg *bpc)
 		json_object_object_add(peer_jo, "local-interface", jo);
 	}
 
+	if (bpc->bpc_has_vrfname) {
+		jo = json_object_new_string(bpc->bpc_vrfname);
+		if (jo == NULL) {
+			json_object_put(peer_jo);
+			return;
+		}
+		json_object_object_add(peer_jo, "vrf-name", jo);
+	}
+
+	if (bpc->bpc_has_label) {
+		jo = json_object_new_string(bpc->bpc_label);
+		if (jo == NULL) {
+			json_object_put(peer_jo);
+			return;
+		}
+		json_object_object_add(peer_jo, "label", jo);
+	}
+
 	/* Select the appropriated peer list and add the peer to it. */
 	if (bpc->bpc_ipv4)
 		json_object_object_get_ex(msg, "ipv4", &plist);
@@ -400,103 +892,1617 @@ void ctrl_add_peer(struct json_object *msg, struct bfd_peer_cfg *bpc)
 
 
 /*
- * Control socket
+ * Binary queries build and parsing
  */
-int control_init(const char *path)
+size_t ctrl_bin_tlv(uint8_t *buf, uint16_t type, const void *value,
+		    size_t len)
 {
-	struct sockaddr_un sun = {.sun_family = AF_UNIX,
-				  .sun_path = BFD_CONTROL_SOCK_PATH};
-	int sd;
+	struct bfd_control_tlv bct = {
+		.bct_type = htons(type), .bct_length = htons(len),
+	};
 
-	if (path) {
-		strncpy(sun.sun_path, path, sizeof(sun.sun_path));
-		sun.sun_path[sizeof(sun.sun_path) - 1] = 0;
+	memcpy(buf, &bct, sizeof(bct));
+	memcpy(&buf[sizeof(bct)], value, len);
+	memset(&buf[sizeof(bct) + len], 0, BCT_ALIGN(len) - len);
+
+	return BCT_TOTLEN(len);
+}
+
+size_t ctrl_bin_peer(uint8_t *buf, struct bfd_peer_cfg *bpc)
+{
+	struct bfd_control_peer bcp;
+	uint32_t flags = BCP_F_HAS_PEER;
+
+	memset(&bcp, 0, sizeof(bcp));
+
+	if (bpc->bpc_ipv4) {
+		memcpy(bcp.bcp_peer, &bpc->bpc_peer.sa_sin.sin_addr,
+		       sizeof(bpc->bpc_peer.sa_sin.sin_addr));
+		memcpy(bcp.bcp_local, &bpc->bpc_local.sa_sin.sin_addr,
+		       sizeof(bpc->bpc_local.sa_sin.sin_addr));
+	} else {
+		flags |= BCP_F_IPV6;
+		memcpy(bcp.bcp_peer, &bpc->bpc_peer.sa_sin6.sin6_addr,
+		       sizeof(bpc->bpc_peer.sa_sin6.sin6_addr));
+		memcpy(bcp.bcp_local, &bpc->bpc_local.sa_sin6.sin6_addr,
+		       sizeof(bpc->bpc_local.sa_sin6.sin6_addr));
 	}
 
-	sd = socket(AF_UNIX, SOCK_STREAM, PF_UNSPEC);
-	if (sd == -1) {
-		fprintf(stderr, "%s: socket: %s\n", __FUNCTION__,
-			strerror(errno));
-		return -1;
+	if (bpc->bpc_local.sa_sin.sin_family != 0)
+		flags |= BCP_F_HAS_LOCAL;
+	if (bpc->bpc_mhop)
+		flags |= BCP_F_MHOP;
+	if (bpc->bpc_track_sla)
+		flags |= BCP_F_TRACK_SLA;
+	if (bpc->bpc_has_localif) {
+		flags |= BCP_F_HAS_LOCALIF;
+		strncpy(bcp.bcp_localif, bpc->bpc_localif,
+			sizeof(bcp.bcp_localif));
+	}
+	if (bpc->bpc_has_vrfname) {
+		flags |= BCP_F_HAS_VRFNAME;
+		strncpy(bcp.bcp_vrfname, bpc->bpc_vrfname,
+			sizeof(bcp.bcp_vrfname));
+	}
+	if (bpc->bpc_has_label) {
+		flags |= BCP_F_HAS_LABEL;
+		strncpy(bcp.bcp_label, bpc->bpc_label, sizeof(bcp.bcp_label));
 	}
 
-	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
-		fprintf(stderr, "%s: connect: %s\n", __FUNCTION__,
-			strerror(errno));
-		return -1;
+	bcp.bcp_flags = htonl(flags);
+
+	return ctrl_bin_tlv(buf, BCT_PEER, &bcp, sizeof(bcp));
+}
+
+static void ctrl_bin_print_addr(const char *name, const uint8_t *addr,
+				bool ipv6)
+{
+	struct sockaddr_any sa;
+
+	memset(&sa, 0, sizeof(sa));
+	if (ipv6) {
+		sa.sa_sin6.sin6_family = AF_INET6;
+		memcpy(&sa.sa_sin6.sin6_addr, addr,
+		       sizeof(sa.sa_sin6.sin6_addr));
+	} else {
+		sa.sa_sin.sin_family = AF_INET;
+		memcpy(&sa.sa_sin.sin_addr, addr, sizeof(sa.sa_sin.sin_addr));
 	}
 
-	return sd;
+	printf("\t%s: %s\n", name, satostr(&sa));
 }
 
-uint16_t control_send(int sd, enum bc_msg_type bmt, const void *data,
-		      size_t datalen)
+void ctrl_bin_print(uint16_t type, const uint8_t *value, uint16_t len)
 {
-	static uint16_t id = 0;
-	const uint8_t *dataptr = data;
-	ssize_t sent;
-	size_t cur = 0;
-	struct bfd_control_msg bcm = {
-		.bcm_length = htonl(datalen),
-		.bcm_type = bmt,
-		.bcm_ver = BMV_VERSION_1,
-		.bcm_id = htons(++id),
+	static const char *state_str[] = {
+		[BPS_SHUTDOWN] = "adm-down", [BPS_DOWN] = "down",
+		[BPS_INIT] = "init", [BPS_UP] = "up",
 	};
+	static const char *op_str[] = {
+		[BCO_ADD] = BCM_NOTIFY_CONFIG_ADD,
+		[BCO_DELETE] = BCM_NOTIFY_CONFIG_DELETE,
+		[BCO_UPDATE] = BCM_NOTIFY_CONFIG_UPDATE,
+	};
+	struct bfd_control_peer bcp;
+	struct bfd_control_peer_state bcps;
+	struct bfd_control_peer_config bcpc;
+	struct bfd_control_peer_sla bcpl;
+	struct bfd_control_stats bcst;
+	struct bfd_control_peer_counters bcpn;
+	uint64_t dropped;
+	uint32_t flags, status;
+	uint16_t idx;
+
+	switch (type) {
+	case BCT_STATUS:
+		if (len < sizeof(status))
+			break;
 
-	sent = write(sd, &bcm, sizeof(bcm));
-	if (sent == 0) {
-		fprintf(stderr, "%s: bfdd closed connection\n", __FUNCTION__);
-		return 0;
-	}
-	if (sent < 0) {
-		fprintf(stderr, "%s: write: %s\n", __FUNCTION__,
-			strerror(errno));
-		return 0;
-	}
+		memcpy(&status, value, sizeof(status));
+		printf("\tstatus: %s\n", ntohl(status) == BCS_STATUS_OK
+						  ? BCM_RESPONSE_OK
+						  : BCM_RESPONSE_ERROR);
+		return;
 
-	while (datalen > 0) {
-		sent = write(sd, &dataptr[cur], datalen);
-		if (sent == 0) {
-			fprintf(stderr, "%s: bfdd closed connection\n",
-				__FUNCTION__);
-			return 0;
-		}
-		if (sent < 0) {
-			if (errno == EAGAIN || errno == EWOULDBLOCK
-			    || errno == EINTR)
-				continue;
+	case BCT_ERROR:
+		printf("\terror: %.*s\n", len, (const char *)value);
+		return;
 
-			fprintf(stderr, "%s: write: %s\n", __FUNCTION__,
-				strerror(errno));
-			return 0;
-		}
+	case BCT_RESULTS:
+		printf("\tresults:");
+		for (idx = 0; idx < len; idx++)
+			printf(" %u", value[idx]);
+		printf("\n");
+		return;
 
-		datalen -= sent;
-		cur += sent;
+	case BCT_PEER:
+		if (len < sizeof(bcp))
+			break;
+
+		memcpy(&bcp, value, sizeof(bcp));
+		flags = ntohl(bcp.bcp_flags);
+		printf("\tipv6: %s\n", (flags & BCP_F_IPV6) ? "true" : "false");
+		printf("\tmultihop: %s\n",
+		       (flags & BCP_F_MHOP) ? "true" : "false");
+		ctrl_bin_print_addr("peer-address", bcp.bcp_peer,
+				    flags & BCP_F_IPV6);
+		if (flags & BCP_F_HAS_LOCAL)
+			ctrl_bin_print_addr("local-address", bcp.bcp_local,
+					    flags & BCP_F_IPV6);
+		if (flags & BCP_F_HAS_LOCALIF)
+			printf("\tlocal-interface: %.*s\n", MAXNAMELEN,
+			       bcp.bcp_localif);
+		if (flags & BCP_F_HAS_VRFNAME)
+			printf("\tvrf-name: %.*s\n", MAXNAMELEN,
+			       bcp.bcp_vrfname);
+		if (flags & BCP_F_HAS_LABEL)
+			printf("\tlabel: %.*s\n", MAXNAMELEN, bcp.bcp_label);
+		return;
+
+	case BCT_PEER_STATE:
+		if (len < sizeof(bcps))
+			break;
+
+		memcpy(&bcps, value, sizeof(bcps));
+		printf("\top: %s\n", BCM_NOTIFY_PEER_STATUS);
+		printf("\tid: %u\n", ntohl(bcps.bcps_id));
+		printf("\tremote-id: %u\n", ntohl(bcps.bcps_remoteid));
+		printf("\tstate: %s\n", bcps.bcps_state <= BPS_UP
+						 ? state_str[bcps.bcps_state]
+						 : "unknown");
+		if (bcps.bcps_state == BPS_UP)
+			printf("\tuptime: %u\n", ntohl(bcps.bcps_time));
+		else if (bcps.bcps_state == BPS_DOWN)
+			printf("\tdowntime: %u\n", ntohl(bcps.bcps_time));
+		printf("\tdiagnostics: %u\n", bcps.bcps_diag);
+		printf("\tremote-diagnostics: %u\n", bcps.bcps_remotediag);
+		return;
+
+	case BCT_PEER_CONFIG:
+		if (len < sizeof(bcpc))
+			break;
+
+		memcpy(&bcpc, value, sizeof(bcpc));
+		/* Query responses don't have operation. */
+		if (bcpc.bcpc_op != 0)
+			printf("\top: %s\n",
+			       (bcpc.bcpc_op >= BCO_ADD
+				&& bcpc.bcpc_op <= BCO_UPDATE)
+				       ? op_str[bcpc.bcpc_op]
+				       : "unknown");
+		if (bcpc.bcpc_op == BCO_DELETE)
+			return;
+
+		flags = ntohl(bcpc.bcpc_flags);
+		printf("\tdetect-multiplier: %u\n", bcpc.bcpc_detectmultiplier);
+		printf("\treceive-interval: %u\n",
+		       ntohl(bcpc.bcpc_recvinterval));
+		printf("\ttransmit-interval: %u\n",
+		       ntohl(bcpc.bcpc_txinterval));
+		printf("\techo-interval: %u\n", ntohl(bcpc.bcpc_echointerval));
+		printf("\tremote-detect-multiplier: %u\n",
+		       bcpc.bcpc_remote_detectmultiplier);
+		printf("\tremote-receive-interval: %u\n",
+		       ntohl(bcpc.bcpc_remote_recvinterval));
+		printf("\tremote-transmit-interval: %u\n",
+		       ntohl(bcpc.bcpc_remote_txinterval));
+		printf("\tremote-echo-interval: %u\n",
+		       ntohl(bcpc.bcpc_remote_echointerval));
+		printf("\techo-mode: %s\n",
+		       (flags & BCP_F_ECHO) ? "true" : "false");
+		printf("\tshutdown: %s\n",
+		       (flags & BCP_F_SHUTDOWN) ? "true" : "false");
+		return;
+
+	case BCT_PEER_SLA:
+		if (len < sizeof(bcpl))
+			break;
+
+		memcpy(&bcpl, value, sizeof(bcpl));
+		printf("\top: %s\n", BCM_NOTIFY_PEER_SLA_UPDATE);
+		printf("\tid: %u\n", ntohl(bcpl.bcpl_id));
+		printf("\tremote-id: %u\n", ntohl(bcpl.bcpl_remoteid));
+		printf("\tlatency: %u us\n", ntohl(bcpl.bcpl_latency));
+		printf("\tjitter: %u us\n", ntohl(bcpl.bcpl_jitter));
+		printf("\tpkt_loss: %.4f%%\n",
+		       ntohl(bcpl.bcpl_pkt_loss) / 10000.0);
+		return;
+
+	case BCT_CONTROL_STATS:
+		if (len < sizeof(bcst))
+			break;
+
+		memcpy(&bcst, value, sizeof(bcst));
+		printf("\tsocket: %u\n", ntohl(bcst.bcst_sd));
+		printf("\t\tcoalesce-window: %u\n", ntohl(bcst.bcst_coalesce));
+		printf("\t\tnotify-merged: %" PRIu64 "\n",
+		       be64toh(bcst.bcst_notify_merged));
+		printf("\t\tnotify-suppressed: %" PRIu64 "\n",
+		       be64toh(bcst.bcst_notify_suppressed));
+		printf("\t\tqueue-messages: %u\n", ntohl(bcst.bcst_queue_msgs));
+		printf("\t\tqueue-messages-high: %u\n",
+		       ntohl(bcst.bcst_queue_msgs_hwm));
+		printf("\t\tqueue-bytes: %" PRIu64 "\n",
+		       be64toh(bcst.bcst_queue_bytes));
+		printf("\t\tqueue-bytes-high: %" PRIu64 "\n",
+		       be64toh(bcst.bcst_queue_bytes_hwm));
+		printf("\t\tqueue-drops: %" PRIu64 "\n",
+		       be64toh(bcst.bcst_queue_drops));
+		return;
+
+	case BCT_PEER_COUNTERS:
+		if (len < sizeof(bcpn))
+			break;
+
+		memcpy(&bcpn, value, sizeof(bcpn));
+		printf("\trx-control-packets: %" PRIu64 "\n",
+		       be64toh(bcpn.bcpn_rx_ctrl));
+		printf("\ttx-control-packets: %" PRIu64 "\n",
+		       be64toh(bcpn.bcpn_tx_ctrl));
+		printf("\trx-echo-packets: %" PRIu64 "\n",
+		       be64toh(bcpn.bcpn_rx_echo));
+		printf("\ttx-echo-packets: %" PRIu64 "\n",
+		       be64toh(bcpn.bcpn_tx_echo));
+		return;
+
+	case BCT_CURSOR:
+		if (len < sizeof(status))
+			break;
+
+		memcpy(&status, value, sizeof(status));
+		printf("\tcursor: %u\n", ntohl(status));
+		return;
+
+	case BCT_SEQ:
+		if (len < sizeof(dropped))
+			break;
+
+		memcpy(&dropped, value, sizeof(dropped));
+		printf("\tseq: %" PRIu64 "\n", be64toh(dropped));
+		return;
+
+	case BCT_RESUMED:
+		if (len < sizeof(status))
+			break;
+
+		memcpy(&status, value, sizeof(status));
+		printf("\tresumed: %s\n", ntohl(status) ? "true" : "false");
+		return;
+
+	case BCT_RESYNC:
+		if (len < sizeof(dropped))
+			break;
+
+		memcpy(&dropped, value, sizeof(dropped));
+		printf("\top: %s\n", BCM_NOTIFY_RESYNC);
+		printf("\tdropped: %" PRIu64 "\n", be64toh(dropped));
+		return;
+
+	default:
+		break;
 	}
 
-	return id;
+	printf("\tunknown TLV (type %u, length %u)\n", type, len);
 }
 
-int control_recv(int sd, control_recv_cb cb, void *arg)
+int bcm_recv_bin(struct bfd_control_msg *bcm)
 {
-	size_t bufpos, bufremaining, plen;
-	ssize_t bread;
-	struct bfd_control_msg *bcm, bcmh;
-	int ret;
+	struct bfd_control_tlv bct;
+	size_t pos = 0, datalen = ntohl(bcm->bcm_length);
 
-	bread = read(sd, &bcmh, sizeof(bcmh));
-	if (bread == 0) {
-		fprintf(stderr, "%s: bfdd closed connection\n", __FUNCTION__);
-		return -1;
-	}
+	switch (bcm->bcm_type) {
+	case BMT_RESPONSE:
+		printf("Response:\n");
+		break;
+	case BMT_NOTIFY:
+	case BMT_NOTIFY_SLA:
+		printf("Notification:\n");
+		break;
+
+	default:
+		fprintf(stderr, "%s: invalid response type (%d)\n",
+			__FUNCTION__, bcm->bcm_type);
+		return -1;
+	}
+
+	while (pos < datalen) {
+		if (datalen - pos < sizeof(bct)) {
+			fprintf(stderr, "%s: truncated TLV header\n",
+				__FUNCTION__);
+			return -1;
+		}
+
+		memcpy(&bct, &bcm->bcm_data[pos], sizeof(bct));
+		bct.bct_type = ntohs(bct.bct_type);
+		bct.bct_length = ntohs(bct.bct_length);
+		if (BCT_TOTLEN(bct.bct_length) > datalen - pos) {
+			fprintf(stderr, "%s: truncated TLV (type %u)\n",
+				__FUNCTION__, bct.bct_type);
+			return -1;
+		}
+
+		ctrl_bin_print(bct.bct_type, &bcm->bcm_data[pos + sizeof(bct)],
+			       bct.bct_length);
+		pos += BCT_TOTLEN(bct.bct_length);
+	}
+
+	return 0;
+}
+
+int bcm_recv_query(struct bfd_control_msg *bcm, void *arg)
+{
+	struct ctrl_query *cq = arg;
+	struct json_object *jo, *jo_val;
+	struct bfd_control_tlv bct;
+	size_t pos = 0, datalen = ntohl(bcm->bcm_length);
+	uint32_t cursor;
+
+	cq->cq_cursor = 0;
+	if (bcm_recv(bcm, &cq->cq_id) != 0)
+		return -1;
+
+	if (bcm->bcm_ver == BMV_VERSION_1) {
+		jo = json_tokener_parse((const char *)bcm->bcm_data);
+		if (jo == NULL)
+			return -1;
+
+		if (json_object_object_get_ex(jo, "cursor", &jo_val))
+			cq->cq_cursor = json_object_get_int64(jo_val);
+
+		json_object_put(jo);
+		return 0;
+	}
+
+	/* The TLVs were already validated by bcm_recv_bin(). */
+	while (pos < datalen) {
+		memcpy(&bct, &bcm->bcm_data[pos], sizeof(bct));
+		if (ntohs(bct.bct_type) == BCT_CURSOR
+		    && ntohs(bct.bct_length) == sizeof(cursor)) {
+			memcpy(&cursor, &bcm->bcm_data[pos + sizeof(bct)],
+			       sizeof(cursor));
+			cq->cq_cursor = ntohl(cursor);
+		}
+		pos += BCT_TOTLEN(ntohs(bct.bct_length));
+	}
+
+	return 0;
+}
+
+/* Reads all pages of the query. */
+int ctrl_show(int sd, enum bc_msg_version bmv, struct bfd_control_query *bcq)
+{
+	static const char *state_str[] = {
+		[BPS_SHUTDOWN] = "adm-down", [BPS_DOWN] = "down",
+		[BPS_INIT] = "init", [BPS_UP] = "up",
+	};
+	struct json_object *jo;
+	struct bfd_control_query bcqn;
+	struct ctrl_query cq = {};
+	uint8_t binmsg[BCT_TOTLEN(sizeof(bcqn))];
+	const void *msg;
+	size_t msglen;
+
+	do {
+		if (bmv == BMV_VERSION_2) {
+			bcqn = *bcq;
+			bcqn.bcq_flags = htonl(bcq->bcq_flags);
+			bcqn.bcq_cursor = htonl(cq.cq_cursor);
+			bcqn.bcq_limit = htonl(bcq->bcq_limit);
+			msglen = ctrl_bin_tlv(binmsg, BCT_QUERY, &bcqn,
+					      sizeof(bcqn));
+			msg = binmsg;
+			jo = NULL;
+		} else {
+			jo = json_object_new_object();
+			if (jo == NULL)
+				return -1;
+
+			if (bcq->bcq_flags & BCQ_F_STATE)
+				json_object_object_add(
+					jo, "state",
+					json_object_new_string(
+						state_str[bcq->bcq_state]));
+			if (bcq->bcq_flags & BCQ_F_LABEL)
+				json_object_object_add(
+					jo, "label-prefix",
+					json_object_new_string(bcq->bcq_label));
+			if (bcq->bcq_flags & BCQ_F_LOCALIF)
+				json_object_object_add(
+					jo, "local-interface",
+					json_object_new_string(
+						bcq->bcq_localif));
+			if (bcq->bcq_flags & BCQ_F_VRFNAME)
+				json_object_object_add(
+					jo, "vrf-name",
+					json_object_new_string(
+						bcq->bcq_vrfname));
+			if (bcq->bcq_flags & BCQ_F_MHOP)
+				json_object_object_add(
+					jo, "multihop",
+					json_object_new_boolean(true));
+			if (bcq->bcq_flags & (BCQ_F_IPV4 | BCQ_F_IPV6))
+				json_object_object_add(
+					jo, "ipv6",
+					json_object_new_boolean(
+						bcq->bcq_flags & BCQ_F_IPV6));
+			if (bcq->bcq_limit)
+				json_object_object_add(
+					jo, "limit",
+					json_object_new_int64(bcq->bcq_limit));
+			if (cq.cq_cursor)
+				json_object_object_add(
+					jo, "cursor",
+					json_object_new_int64(cq.cq_cursor));
+
+			msg = json_object_to_json_string_ext(
+				jo, JSON_C_TO_STRING_PLAIN);
+			msglen = strlen(msg);
+		}
+
+		cq.cq_id = control_send(sd, bmv, BMT_QUERY, msg, msglen);
+		if (jo)
+			json_object_put(jo);
+		if (cq.cq_id == 0) {
+			fprintf(stderr, "failed to send message\n");
+			return -1;
+		}
+
+		if (control_recv(sd, bcm_recv_query, &cq) != 0)
+			return -1;
+	} while (cq.cq_cursor != 0);
+
+	return 0;
+}
+
+
+/*
+ * Shared memory status table
+ */
+struct bfd_status_header *ctrl_status_open(const char *path, size_t *len,
+					   ino_t *ino)
+{
+	struct bfd_status_header *bsh;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "%s: fstat: %s\n", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(*bsh)) {
+		fprintf(stderr, "%s: not a status table\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	bsh = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (bsh == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (__atomic_load_n(&bsh->bsh_magic, __ATOMIC_ACQUIRE) != BSH_MAGIC
+	    || bsh->bsh_version != BSH_VERSION
+	    || bsh->bsh_entry_size != sizeof(struct bfd_status_entry)
+	    || bsh->bsh_entries_off
+			       + (size_t)bsh->bsh_entries
+					 * sizeof(struct bfd_status_entry)
+		       > (size_t)st.st_size) {
+		fprintf(stderr, "%s: unsupported status table\n", path);
+		munmap(bsh, st.st_size);
+		return NULL;
+	}
+
+	*len = st.st_size;
+	*ino = st.st_ino;
+
+	return bsh;
+}
+
+void ctrl_status_print(const struct bfd_status_header *bsh,
+		       const char *prefix)
+{
+	static const char *state_str[] = {
+		[BPS_SHUTDOWN] = "adm-down", [BPS_DOWN] = "down",
+		[BPS_INIT] = "init", [BPS_UP] = "up",
+	};
+	const struct bfd_status_entry *entries;
+	struct bfd_status_entry bse;
+	uint32_t idx;
+
+	printf("generation: %" PRIu64 "\n",
+	       __atomic_load_n(&bsh->bsh_generation, __ATOMIC_ACQUIRE));
+
+	entries = (const void *)((const uint8_t *)bsh + bsh->bsh_entries_off);
+	for (idx = 0; idx < bsh->bsh_entries; idx++) {
+		if (__atomic_load_n(&entries[idx].bse_discr, __ATOMIC_RELAXED)
+		    == 0)
+			continue;
+
+		bfd_status_read(&entries[idx], &bse);
+		if (bse.bse_discr == 0)
+			continue;
+		if (prefix
+		    && strncmp(bse.bse_label, prefix, strlen(prefix)) != 0)
+			continue;
+
+		printf("\nid: %u\n", bse.bse_discr);
+		printf("\tremote-id: %u\n", bse.bse_remote_discr);
+		printf("\tstate: %s\n", bse.bse_state <= BPS_UP
+						 ? state_str[bse.bse_state]
+						 : "unknown");
+		if (bse.bse_label[0])
+			printf("\tlabel: %.*s\n", MAXNAMELEN, bse.bse_label);
+		printf("\tmultihop: %s\n",
+		       (bse.bse_flags & BCP_F_MHOP) ? "true" : "false");
+		ctrl_bin_print_addr("peer-address", bse.bse_peer,
+				    bse.bse_flags & BCP_F_IPV6);
+		ctrl_bin_print_addr("local-address", bse.bse_local,
+				    bse.bse_flags & BCP_F_IPV6);
+		printf("\tdiagnostics: %u\n", bse.bse_diag);
+		printf("\tremote-diagnostics: %u\n", bse.bse_remote_diag);
+		printf("\tdetect-multiplier: %u\n", bse.bse_detect_mult);
+		printf("\treceive-interval: %u\n", bse.bse_rx_interval / 1000);
+		printf("\ttransmit-interval: %u\n", bse.bse_tx_interval / 1000);
+		printf("\techo-interval: %u\n", bse.bse_echo_interval / 1000);
+		printf("\tremote-detect-multiplier: %u\n",
+		       bse.bse_remote_detect_mult);
+		printf("\tremote-receive-interval: %u\n",
+		       bse.bse_remote_rx_interval / 1000);
+		printf("\tremote-transmit-interval: %u\n",
+		       bse.bse_remote_tx_interval / 1000);
+		printf("\tremote-echo-interval: %u\n",
+		       bse.bse_remote_echo_interval / 1000);
+		printf("\trx-ctrl: %" PRIu64 "\n", bse.bse_rx_ctrl);
+		printf("\ttx-ctrl: %" PRIu64 "\n", bse.bse_tx_ctrl);
+		printf("\trx-echo: %" PRIu64 "\n", bse.bse_rx_echo);
+		printf("\ttx-echo: %" PRIu64 "\n", bse.bse_tx_echo);
+	}
+}
+
+int ctrl_status(const char *path, bool monitor, const char *prefix)
+{
+	struct bfd_status_header *bsh;
+	struct timespec ts;
+	struct stat st;
+	uint64_t generation;
+	uint32_t wake;
+	size_t len;
+	ino_t ino;
+
+	bsh = ctrl_status_open(path, &len, &ino);
+	if (bsh == NULL)
+		return -1;
+
+	ctrl_status_print(bsh, prefix);
+	if (!monitor) {
+		munmap(bsh, len);
+		return 0;
+	}
+
+	generation = __atomic_load_n(&bsh->bsh_generation, __ATOMIC_ACQUIRE);
+	for (;;) {
+		/* Read the futex word first to not miss wake ups. */
+		wake = __atomic_load_n(&bsh->bsh_wake, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&bsh->bsh_generation, __ATOMIC_ACQUIRE)
+		    != generation) {
+			generation = __atomic_load_n(&bsh->bsh_generation,
+						     __ATOMIC_ACQUIRE);
+			printf("\n");
+			ctrl_status_print(bsh, prefix);
+			fflush(stdout);
+			continue;
+		}
+
+		/* Wake up periodically to detect daemon restarts. */
+		ts.tv_sec = 1;
+		ts.tv_nsec = 0;
+		syscall(SYS_futex, &bsh->bsh_wake, FUTEX_WAIT, wake, &ts, NULL,
+			0);
+
+		if (stat(path, &st) == 0 && st.st_ino == ino)
+			continue;
+
+		/* The table was replaced: wait for the new one. */
+		munmap(bsh, len);
+		while ((bsh = ctrl_status_open(path, &len, &ino)) == NULL)
+			sleep(1);
+
+		generation = __atomic_load_n(&bsh->bsh_generation,
+					     __ATOMIC_ACQUIRE);
+		printf("\n");
+		ctrl_status_print(bsh, prefix);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Batch mode
+ */
+int ctrl_batch_parse_json(const char *line, struct bfd_peer_cfg *bpc)
+{
+	struct json_object *jo, *jo_val;
+	const char *sval;
+	int error = -1;
+
+	jo = json_tokener_parse(line);
+	if (jo == NULL)
+		return -1;
+	if (!json_object_is_type(jo, json_type_object))
+		goto out;
+
+	if (!json_object_object_get_ex(jo, "peer-address", &jo_val)
+	    || strtosa(json_object_get_string(jo_val), &bpc->bpc_peer) != 0)
+		goto out;
+
+	if (json_object_object_get_ex(jo, "local-address", &jo_val)
+	    && strtosa(json_object_get_string(jo_val), &bpc->bpc_local) != 0)
+		goto out;
+
+	if (json_object_object_get_ex(jo, "local-interface", &jo_val)) {
+		sval = json_object_get_string(jo_val);
+		if (strlen(sval) >= sizeof(bpc->bpc_localif))
+			goto out;
+
+		bpc->bpc_has_localif = true;
+		strcpy(bpc->bpc_localif, sval);
+	}
+
+	if (json_object_object_get_ex(jo, "vrf-name", &jo_val)) {
+		sval = json_object_get_string(jo_val);
+		if (strlen(sval) >= sizeof(bpc->bpc_vrfname))
+			goto out;
+
+		bpc->bpc_has_vrfname = true;
+		strcpy(bpc->bpc_vrfname, sval);
+	}
+
+	if (json_object_object_get_ex(jo, "label", &jo_val)) {
+		sval = json_object_get_string(jo_val);
+		if (strlen(sval) >= sizeof(bpc->bpc_label))
+			goto out;
+
+		bpc->bpc_has_label = true;
+		strcpy(bpc->bpc_label, sval);
+	}
+
+	if (json_object_object_get_ex(jo, "multihop", &jo_val))
+		bpc->bpc_mhop = json_object_get_boolean(jo_val);
+	if (json_object_object_get_ex(jo, "track-sla", &jo_val))
+		bpc->bpc_track_sla = json_object_get_boolean(jo_val);
+
+	error = 0;
+
+out:
+	json_object_put(jo);
+	return error;
+}
+
+/* Fields: peer address, local address, interface and label. */
+int ctrl_batch_parse_csv(char *line, struct bfd_peer_cfg *bpc)
+{
+	char *field;
+	int idx;
+
+	for (idx = 0; (field = strsep(&line, ",")) != NULL; idx++) {
+		if (idx > 0 && *field == 0)
+			continue;
+
+		switch (idx) {
+		case 0:
+			if (strtosa(field, &bpc->bpc_peer) != 0)
+				return -1;
+			break;
+		case 1:
+			if (strtosa(field, &bpc->bpc_local) != 0)
+				return -1;
+			break;
+		case 2:
+			if (strlen(field) >= sizeof(bpc->bpc_localif))
+				return -1;
+
+			bpc->bpc_has_localif = true;
+			strcpy(bpc->bpc_localif, field);
+			break;
+		case 3:
+			if (strlen(field) >= sizeof(bpc->bpc_label))
+				return -1;
+
+			bpc->bpc_has_label = true;
+			strcpy(bpc->bpc_label, field);
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int ctrl_batch_send(int sd, enum bc_msg_version bmv, enum bc_msg_type bmt,
+		    struct ctrl_batch *cb, struct bfd_peer_cfg *bpc,
+		    size_t line)
+{
+	struct ctrl_batch_req *cbr;
+	struct json_object *jo = NULL;
+	uint8_t binmsg[BCT_TOTLEN(sizeof(struct bfd_control_peer))];
+	const void *msg;
+	size_t msglen;
+	uint16_t id;
+
+	if (bmv == BMV_VERSION_2) {
+		msglen = ctrl_bin_peer(binmsg, bpc);
+		msg = binmsg;
+	} else {
+		jo = ctrl_new_json();
+		if (jo == NULL)
+			return -1;
+
+		ctrl_add_peer(jo, bpc);
+		msg = json_object_to_json_string_ext(jo,
+						     JSON_C_TO_STRING_PLAIN);
+		msglen = strlen(msg);
+	}
+
+	id = control_send(sd, bmv, bmt, msg, msglen);
+	if (jo)
+		json_object_put(jo);
+	if (id == 0) {
+		fprintf(stderr, "failed to send message\n");
+		return -1;
+	}
+
+	cbr = &cb->cb_reqs[(cb->cb_head + cb->cb_count) % cb->cb_window];
+	cbr->cbr_id = id;
+	cbr->cbr_done = false;
+	cbr->cbr_line = line;
+	strcpy(cbr->cbr_peer, satostr(&bpc->bpc_peer));
+	cb->cb_count++;
+
+	return 0;
+}
+
+/*
+ * Tells whether the response status is "ok" and copies the error message
+ * (if any) to `error`. `data` must be NULL terminated.
+ */
+bool ctrl_response_ok(const struct bfd_control_msg *bcm, const uint8_t *data,
+		      char *error, size_t errorlen)
+{
+	struct json_object *jo, *jo_val;
+	struct bfd_control_tlv bct;
+	size_t pos = 0, datalen = ntohl(bcm->bcm_length);
+	uint32_t status;
+	bool ok = false;
+
+	error[0] = 0;
+	if (bcm->bcm_ver == BMV_VERSION_1) {
+		jo = json_tokener_parse((const char *)data);
+		if (jo == NULL)
+			return false;
+
+		if (json_object_object_get_ex(jo, "status", &jo_val))
+			ok = strcmp(json_object_get_string(jo_val),
+				    BCM_RESPONSE_OK)
+			     == 0;
+		if (json_object_object_get_ex(jo, "error", &jo_val))
+			snprintf(error, errorlen, "%s",
+				 json_object_get_string(jo_val));
+		json_object_put(jo);
+
+		return ok;
+	}
+
+	while (datalen - pos >= sizeof(bct)) {
+		memcpy(&bct, &data[pos], sizeof(bct));
+		bct.bct_type = ntohs(bct.bct_type);
+		bct.bct_length = ntohs(bct.bct_length);
+		if (BCT_TOTLEN(bct.bct_length) > datalen - pos)
+			break;
+
+		if (bct.bct_type == BCT_STATUS
+		    && bct.bct_length == sizeof(status)) {
+			memcpy(&status, &data[pos + sizeof(bct)],
+			       sizeof(status));
+			ok = ntohl(status) == BCS_STATUS_OK;
+		} else if (bct.bct_type == BCT_ERROR) {
+			snprintf(error, errorlen, "%.*s", bct.bct_length,
+				 (const char *)&data[pos + sizeof(bct)]);
+		}
+		pos += BCT_TOTLEN(bct.bct_length);
+	}
+
+	return ok;
+}
+
+int bcm_recv_batch(struct bfd_control_msg *bcm, void *arg)
+{
+	struct ctrl_batch *cb = arg;
+	struct ctrl_batch_req *cbr = NULL;
+	size_t idx;
+	char error[256];
+
+	if (bcm->bcm_type != BMT_RESPONSE)
+		return 0;
+
+	/* Responses normally come in order: the head matches first. */
+	for (idx = 0; idx < cb->cb_count; idx++) {
+		cbr = &cb->cb_reqs[(cb->cb_head + idx) % cb->cb_window];
+		if (!cbr->cbr_done && cbr->cbr_id == ntohs(bcm->bcm_id))
+			break;
+	}
+	if (idx == cb->cb_count) {
+		fprintf(stderr, "%s: unexpected response id %d\n",
+			__FUNCTION__, ntohs(bcm->bcm_id));
+		return 0;
+	}
+
+	if (ctrl_response_ok(bcm, bcm->bcm_data, error, sizeof(error))) {
+		cb->cb_ok++;
+		printf("line %zu: %s: ok\n", cbr->cbr_line, cbr->cbr_peer);
+	} else {
+		cb->cb_failed++;
+		printf("line %zu: %s: error: %s\n", cbr->cbr_line,
+		       cbr->cbr_peer, error[0] ? error : "unknown");
+	}
+
+	/* Release the answered requests at the head of the ring. */
+	cbr->cbr_done = true;
+	while (cb->cb_count > 0 && cb->cb_reqs[cb->cb_head].cbr_done) {
+		cb->cb_head = (cb->cb_head + 1) % cb->cb_window;
+		cb->cb_count--;
+	}
+
+	return 0;
+}
+
+/*
+ * Sends one request per peer read from `path` keeping up to `window`
+ * requests in flight, then prints the results summary. Returns non-zero
+ * if any peer failed.
+ */
+int ctrl_batch(int sd, enum bc_msg_version bmv, enum bc_msg_type bmt,
+	       const char *path, size_t window,
+	       const struct bfd_peer_cfg *defaults)
+{
+	struct ctrl_batch cb = {.cb_window = window};
+	struct bfd_peer_cfg bpc;
+	struct timespec start, end;
+	char *line = NULL, *str;
+	size_t linesize = 0, lineno = 0;
+	ssize_t linelen;
+	double elapsed;
+	FILE *fp;
+	int error = -1;
+
+	if (strcmp(path, "-") == 0) {
+		fp = stdin;
+	} else {
+		fp = fopen(path, "r");
+		if (fp == NULL) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	}
+
+	cb.cb_reqs = calloc(window, sizeof(*cb.cb_reqs));
+	if (cb.cb_reqs == NULL) {
+		fprintf(stderr, "%s: calloc: %s\n", __FUNCTION__,
+			strerror(errno));
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((linelen = getline(&line, &linesize, fp)) != -1) {
+		lineno++;
+		while (linelen > 0
+		       && (line[linelen - 1] == '\n'
+			   || line[linelen - 1] == '\r'))
+			line[--linelen] = 0;
+
+		/* Skip empty lines and comments. */
+		for (str = line; *str == ' ' || *str == '\t'; str++)
+			/* NOTHING */;
+		if (*str == 0 || *str == '#')
+			continue;
+
+		bpc = *defaults;
+		if ((*str == '{' ? ctrl_batch_parse_json(str, &bpc)
+				 : ctrl_batch_parse_csv(str, &bpc))
+			    != 0
+		    || (bpc.bpc_local.sa_sin.sin_family != 0
+			&& bpc.bpc_local.sa_sin.sin_family
+				   != bpc.bpc_peer.sa_sin.sin_family)) {
+			fprintf(stderr, "line %zu: invalid peer\n", lineno);
+			cb.cb_failed++;
+			continue;
+		}
+		bpc.bpc_ipv4 = bpc.bpc_peer.sa_sin.sin_family == AF_INET;
+
+		while (cb.cb_count == cb.cb_window) {
+			if (control_recv(sd, bcm_recv_batch, &cb) != 0)
+				goto out;
+		}
+
+		if (ctrl_batch_send(sd, bmv, bmt, &cb, &bpc, lineno) != 0)
+			goto out;
+	}
+
+	while (cb.cb_count > 0) {
+		if (control_recv(sd, bcm_recv_batch, &cb) != 0)
+			goto out;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec)
+		  + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%" PRIu64 " peers: %" PRIu64 " ok, %" PRIu64
+	       " failed in %.3f seconds (%.0f requests/s)\n",
+	       cb.cb_ok + cb.cb_failed, cb.cb_ok, cb.cb_failed, elapsed,
+	       elapsed > 0 ? (cb.cb_ok + cb.cb_failed) / elapsed : 0);
+
+	error = cb.cb_failed != 0;
+
+out:
+	free(line);
+	free(cb.cb_reqs);
+	if (fp != stdin)
+		fclose(fp);
+
+	return error;
+}
+
+
+/*
+ * Benchmark
+ */
+uint64_t ctrl_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void ctrl_bench_sample(struct ctrl_bench_samples *cbs, uint64_t ns)
+{
+	uint32_t *values;
+	size_t size;
+
+	if (cbs->cbs_count == cbs->cbs_size) {
+		size = cbs->cbs_size ? cbs->cbs_size * 2 : 4096;
+		values = realloc(cbs->cbs_values, size * sizeof(*values));
+		if (values == NULL)
+			return;
+
+		cbs->cbs_values = values;
+		cbs->cbs_size = size;
+	}
+
+	ns /= 1000;
+	cbs->cbs_values[cbs->cbs_count++] = ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+int ctrl_bench_cmp(const void *a, const void *b)
+{
+	const uint32_t *va = a, *vb = b;
+
+	if (*va < *vb)
+		return -1;
+
+	return *va > *vb;
+}
+
+void ctrl_bench_report(const char *name, struct ctrl_bench_samples *cbs)
+{
+	static const struct {
+		const char *name;
+		unsigned int permille;
+	} pct[] = {
+		{"p50", 500}, {"p90", 900}, {"p99", 990}, {"p99.9", 999},
+	};
+	unsigned int idx;
+
+	if (cbs->cbs_count == 0) {
+		printf("%s (us): no samples\n", name);
+		return;
+	}
+
+	qsort(cbs->cbs_values, cbs->cbs_count, sizeof(*cbs->cbs_values),
+	      ctrl_bench_cmp);
+
+	printf("%s (us): min %u", name, cbs->cbs_values[0]);
+	for (idx = 0; idx < sizeof(pct) / sizeof(pct[0]); idx++)
+		printf(" %s %u", pct[idx].name,
+		       cbs->cbs_values[(cbs->cbs_count - 1) * pct[idx].permille
+				       / 1000]);
+	printf(" max %u\n", cbs->cbs_values[cbs->cbs_count - 1]);
+}
+
+/* Connection peers: 127.(64 + conn / 256).(conn % 256).(peer + 1). */
+void ctrl_bench_peer(struct ctrl_bench_conn *cbc, size_t peer,
+		     struct sockaddr_any *sa)
+{
+	uint8_t *addr = (uint8_t *)&sa->sa_sin.sin_addr;
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sa_sin.sin_family = AF_INET;
+	addr[0] = 127;
+	addr[1] = 64 + cbc->cbc_idx / 256;
+	addr[2] = cbc->cbc_idx % 256;
+	addr[3] = peer + 1;
+}
+
+/*
+ * Every connection adds its peers and then deletes them in turns, so
+ * each add and delete is answered and notified to all connections.
+ */
+int ctrl_bench_send(struct ctrl_bench *cbn, struct ctrl_bench_conn *cbc,
+		    uint64_t now)
+{
+	struct ctrl_bench_req *cbr;
+	struct json_object *jo = NULL;
+	struct bfd_peer_cfg bpc;
+	uint8_t binmsg[BCT_TOTLEN(sizeof(struct bfd_control_peer))];
+	enum bc_msg_type bmt;
+	const void *msg;
+	size_t msglen, peer;
+	uint16_t id;
+
+	peer = cbc->cbc_sent % CTRL_BENCH_PEERS;
+	if ((cbc->cbc_sent / CTRL_BENCH_PEERS) % 2 == 0)
+		bmt = BMT_REQUEST_ADD;
+	else
+		bmt = BMT_REQUEST_DEL;
+
+	memset(&bpc, 0, sizeof(bpc));
+	bpc.bpc_ipv4 = true;
+	ctrl_bench_peer(cbc, peer, &bpc.bpc_peer);
+
+	if (cbn->cbn_bmv == BMV_VERSION_2) {
+		msglen = ctrl_bin_peer(binmsg, &bpc);
+		msg = binmsg;
+	} else {
+		jo = ctrl_new_json();
+		if (jo == NULL)
+			return -1;
+
+		ctrl_add_peer(jo, &bpc);
+		msg = json_object_to_json_string_ext(jo,
+						     JSON_C_TO_STRING_PLAIN);
+		msglen = strlen(msg);
+	}
+
+	id = control_send(cbc->cbc_sd, cbn->cbn_bmv, bmt, msg, msglen);
+	if (jo)
+		json_object_put(jo);
+	if (id == 0) {
+		fprintf(stderr, "failed to send message\n");
+		return -1;
+	}
+
+	if (bmt == BMT_REQUEST_ADD)
+		cbn->cbn_added[cbc->cbc_idx * CTRL_BENCH_PEERS + peer] = now;
+
+	cbr = &cbc->cbc_reqs[(cbc->cbc_head + cbc->cbc_count)
+			     % cbn->cbn_window];
+	cbr->cbr_id = id;
+	cbr->cbr_done = false;
+	cbr->cbr_measured = now < cbn->cbn_end;
+	cbr->cbr_sent = now;
+	cbc->cbc_count++;
+	cbc->cbc_sent++;
+
+	return 0;
+}
+
+/* Notification lag: from the add request to its notification. */
+void ctrl_bench_added(struct ctrl_bench *cbn, const uint8_t *addr,
+		      uint64_t now)
+{
+	size_t conn;
+	uint64_t sent;
+
+	if (addr[0] != 127 || addr[1] < 64 || addr[3] == 0
+	    || addr[3] > CTRL_BENCH_PEERS)
+		return;
+
+	conn = (addr[1] - 64) * 256 + addr[2];
+	if (conn >= cbn->cbn_nconns)
+		return;
+
+	sent = cbn->cbn_added[conn * CTRL_BENCH_PEERS + addr[3] - 1];
+	if (sent != 0 && sent < cbn->cbn_end && now >= sent)
+		ctrl_bench_sample(&cbn->cbn_lag, now - sent);
+}
+
+void ctrl_bench_notify(struct ctrl_bench *cbn,
+		       const struct bfd_control_msg *bcm, const uint8_t *data,
+		       uint64_t now)
+{
+	struct json_object *jo, *jo_val;
+	struct bfd_control_tlv bct;
+	struct bfd_control_peer bcp;
+	struct bfd_control_peer_config bcpc;
+	struct sockaddr_any sa;
+	size_t pos = 0, datalen = ntohl(bcm->bcm_length);
+	const uint8_t *peer = NULL;
+	const char *op;
+	bool add = false;
+
+	if (now < cbn->cbn_end)
+		cbn->cbn_notifications++;
+
+	if (bcm->bcm_ver == BMV_VERSION_1) {
+		jo = json_tokener_parse((const char *)data);
+		if (jo == NULL)
+			return;
+
+		if (json_object_object_get_ex(jo, "op", &jo_val)) {
+			op = json_object_get_string(jo_val);
+			if (strcmp(op, BCM_NOTIFY_RESYNC) == 0)
+				cbn->cbn_resyncs++;
+			else if (strcmp(op, BCM_NOTIFY_CONFIG_ADD) == 0
+				 && json_object_object_get_ex(
+					 jo, "peer-address", &jo_val)
+				 && strtosa(json_object_get_string(jo_val),
+					    &sa)
+					    == 0
+				 && sa.sa_sin.sin_family == AF_INET)
+				ctrl_bench_added(
+					cbn,
+					(const uint8_t *)&sa.sa_sin.sin_addr,
+					now);
+		}
+		json_object_put(jo);
+		return;
+	}
+
+	while (datalen - pos >= sizeof(bct)) {
+		memcpy(&bct, &data[pos], sizeof(bct));
+		bct.bct_type = ntohs(bct.bct_type);
+		bct.bct_length = ntohs(bct.bct_length);
+		if (BCT_TOTLEN(bct.bct_length) > datalen - pos)
+			return;
+
+		if (bct.bct_type == BCT_RESYNC) {
+			cbn->cbn_resyncs++;
+		} else if (bct.bct_type == BCT_PEER
+			   && bct.bct_length >= sizeof(bcp)) {
+			memcpy(&bcp, &data[pos + sizeof(bct)], sizeof(bcp));
+			if ((ntohl(bcp.bcp_flags) & BCP_F_IPV6) == 0)
+				peer = &data[pos + sizeof(bct)
+					     + offsetof(struct bfd_control_peer,
+							bcp_peer)];
+		} else if (bct.bct_type == BCT_PEER_CONFIG
+			   && bct.bct_length >= sizeof(bcpc)) {
+			memcpy(&bcpc, &data[pos + sizeof(bct)], sizeof(bcpc));
+			add = bcpc.bcpc_op == BCO_ADD;
+		}
+		pos += BCT_TOTLEN(bct.bct_length);
+	}
+
+	if (add && peer)
+		ctrl_bench_added(cbn, peer, now);
+}
+
+void ctrl_bench_msg(struct ctrl_bench *cbn, struct ctrl_bench_conn *cbc,
+		    const struct bfd_control_msg *bcm, const uint8_t *data,
+		    uint64_t now)
+{
+	struct ctrl_bench_req *cbr = NULL;
+	size_t idx;
+	char error[256];
+
+	switch (bcm->bcm_type) {
+	case BMT_NOTIFY:
+	case BMT_NOTIFY_SLA:
+		ctrl_bench_notify(cbn, bcm, data, now);
+		return;
+
+	case BMT_RESPONSE:
+		break;
+
+	default:
+		return;
+	}
+
+	for (idx = 0; idx < cbc->cbc_count; idx++) {
+		cbr = &cbc->cbc_reqs[(cbc->cbc_head + idx) % cbn->cbn_window];
+		if (!cbr->cbr_done && cbr->cbr_id == ntohs(bcm->bcm_id))
+			break;
+	}
+	if (idx == cbc->cbc_count)
+		return;
+
+	cbr->cbr_done = true;
+	if (cbr->cbr_measured) {
+		if (ctrl_response_ok(bcm, data, error, sizeof(error))) {
+			cbn->cbn_ok++;
+		} else {
+			/* Only show the first failures. */
+			if (cbn->cbn_failed++ < 10)
+				fprintf(stderr, "request failed: %s\n",
+					error[0] ? error : "unknown");
+		}
+
+		ctrl_bench_sample(&cbn->cbn_latency, now - cbr->cbr_sent);
+		cbn->cbn_last = now;
+	}
+
+	/* Release the answered requests at the head of the ring. */
+	while (cbc->cbc_count > 0 && cbc->cbc_reqs[cbc->cbc_head].cbr_done) {
+		cbc->cbc_head = (cbc->cbc_head + 1) % cbn->cbn_window;
+		cbc->cbc_count--;
+	}
+}
+
+/* Reads as much as available and handles all complete messages. */
+int ctrl_bench_read(struct ctrl_bench *cbn, struct ctrl_bench_conn *cbc)
+{
+	struct bfd_control_msg bcm;
+	size_t pos, msglen;
+	ssize_t bread;
+	uint64_t now;
+	uint8_t *buf, saved;
+
+	if (cbc->cbc_size - cbc->cbc_len < CTRL_BENCH_READ_SIZE + 1) {
+		buf = realloc(cbc->cbc_buf,
+			      cbc->cbc_size + CTRL_BENCH_READ_SIZE + 1);
+		if (buf == NULL) {
+			fprintf(stderr, "%s: realloc: %s\n", __FUNCTION__,
+				strerror(errno));
+			return -1;
+		}
+
+		cbc->cbc_buf = buf;
+		cbc->cbc_size += CTRL_BENCH_READ_SIZE + 1;
+	}
+
+	bread = read(cbc->cbc_sd, &cbc->cbc_buf[cbc->cbc_len],
+		     cbc->cbc_size - cbc->cbc_len - 1);
+	if (bread == 0) {
+		fprintf(stderr, "%s: bfdd closed connection\n", __FUNCTION__);
+		return -1;
+	}
 	if (bread < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+
 		fprintf(stderr, "%s: read: %s\n", __FUNCTION__,
 			strerror(errno));
 		return -1;
 	}
 
-	if (bcmh.bcm_ver != BMV_VERSION_1) {
+	cbc->cbc_len += bread;
+	now = ctrl_bench_now();
+
+	for (pos = 0; cbc->cbc_len - pos >= sizeof(bcm); pos += msglen) {
+		memcpy(&bcm, &cbc->cbc_buf[pos], sizeof(bcm));
+		if (bcm.bcm_ver != BMV_VERSION_1
+		    && bcm.bcm_ver != BMV_VERSION_2) {
+			fprintf(stderr, "%s: wrong protocol version (%d)\n",
+				__FUNCTION__, bcm.bcm_ver);
+			return -1;
+		}
+
+		msglen = sizeof(bcm) + ntohl(bcm.bcm_length);
+		if (cbc->cbc_len - pos < msglen)
+			break;
+
+		/* Terminate possible JSON strings with NULL. */
+		saved = cbc->cbc_buf[pos + msglen];
+		cbc->cbc_buf[pos + msglen] = 0;
+		ctrl_bench_msg(cbn, cbc, &bcm, &cbc->cbc_buf[pos + sizeof(bcm)],
+			       now);
+		cbc->cbc_buf[pos + msglen] = saved;
+	}
+
+	cbc->cbc_len -= pos;
+	memmove(cbc->cbc_buf, &cbc->cbc_buf[pos], cbc->cbc_len);
+
+	return 0;
+}
+
+/*
+ * Drives the daemon with `conns` subscribed connections sending a total
+ * of `rate` requests per second (0 is as fast as the windows allow) for
+ * `seconds`, then reports the requests latency, the notifications lag
+ * and the daemon throughput. The peers left behind are deleted before
+ * returning.
+ */
+int ctrl_bench(const char *path, enum bc_msg_version bmv, size_t conns,
+	       unsigned long rate, unsigned long seconds, size_t window)
+{
+	struct ctrl_bench cbn = {
+		.cbn_bmv = bmv, .cbn_window = window, .cbn_nconns = conns,
+	};
+	struct ctrl_bench_conn *cbc;
+	struct pollfd *pfds;
+	uint64_t now, interval, next, deadline, notify_flags = BCM_NOTIFY_ALL;
+	uint8_t binmsg[BCT_TOTLEN(sizeof(notify_flags))];
+	size_t idx;
+	int timeout, error = -1;
+	bool draining = false, done;
+	double elapsed;
+
+	cbn.cbn_conns = calloc(conns, sizeof(*cbn.cbn_conns));
+	cbn.cbn_added = calloc(conns * CTRL_BENCH_PEERS,
+			       sizeof(*cbn.cbn_added));
+	pfds = calloc(conns, sizeof(*pfds));
+	if (cbn.cbn_conns == NULL || cbn.cbn_added == NULL || pfds == NULL) {
+		fprintf(stderr, "%s: calloc: %s\n", __FUNCTION__,
+			strerror(errno));
+		goto out;
+	}
+
+	for (idx = 0; idx < conns; idx++)
+		cbn.cbn_conns[idx].cbc_sd = -1;
+
+	/* Connect and subscribe to all notifications. */
+	for (idx = 0; idx < conns; idx++) {
+		cbc = &cbn.cbn_conns[idx];
+		cbc->cbc_idx = idx;
+		cbc->cbc_reqs = calloc(window, sizeof(*cbc->cbc_reqs));
+		if (cbc->cbc_reqs == NULL) {
+			fprintf(stderr, "%s: calloc: %s\n", __FUNCTION__,
+				strerror(errno));
+			goto out;
+		}
+
+		cbc->cbc_sd = control_init(path);
+		if (cbc->cbc_sd == -1)
+			goto out;
+
+		if (bmv == BMV_VERSION_2) {
+			notify_flags = htobe64(BCM_NOTIFY_ALL);
+			if (control_send(cbc->cbc_sd, bmv, BMT_NOTIFY, binmsg,
+					 ctrl_bin_tlv(binmsg, BCT_NOTIFY_FLAGS,
+						      &notify_flags,
+						      sizeof(notify_flags)))
+			    == 0)
+				goto out;
+		} else if (control_send(cbc->cbc_sd, bmv, BMT_NOTIFY,
+					&notify_flags, sizeof(notify_flags))
+			   == 0) {
+			goto out;
+		}
+
+		if (control_recv(cbc->cbc_sd, NULL, NULL) != 0)
+			goto out;
+
+		pfds[idx].fd = cbc->cbc_sd;
+		pfds[idx].events = POLLIN;
+	}
+
+	interval = rate ? conns * 1000000000ULL / rate : 0;
+	cbn.cbn_start = ctrl_bench_now();
+	cbn.cbn_end = cbn.cbn_start + seconds * 1000000000ULL;
+	deadline = cbn.cbn_end + CTRL_BENCH_DRAIN_SECONDS * 1000000000ULL;
+	for (idx = 0; idx < conns; idx++)
+		cbn.cbn_conns[idx].cbc_next = cbn.cbn_start;
+
+	for (;;) {
+		now = ctrl_bench_now();
+		draining = now >= cbn.cbn_end;
+		if (now >= deadline) {
+			fprintf(stderr, "timed out waiting for responses\n");
+			break;
+		}
+
+		done = true;
+		next = UINT64_MAX;
+		for (idx = 0; idx < conns; idx++) {
+			cbc = &cbn.cbn_conns[idx];
+
+			/* When done finish the delete turn to clean up. */
+			while (cbc->cbc_count < window
+			       && (draining ? cbc->cbc_sent
+						      % (2 * CTRL_BENCH_PEERS)
+					      != 0
+					    : cbc->cbc_next <= now)) {
+				if (ctrl_bench_send(&cbn, cbc, now) != 0)
+					goto out;
+				cbc->cbc_next += interval;
+			}
+
+			if (cbc->cbc_count > 0
+			    || cbc->cbc_sent % (2 * CTRL_BENCH_PEERS) != 0)
+				done = false;
+			if (!draining && cbc->cbc_count < window
+			    && cbc->cbc_next < next)
+				next = cbc->cbc_next;
+		}
+		if (draining && done)
+			break;
+
+		/* Sleep until the next request is due or data arrives. */
+		if (draining || next == UINT64_MAX)
+			timeout = 100;
+		else if (next <= now)
+			timeout = 0;
+		else
+			timeout = (next - now + 999999) / 1000000;
+
+		if (poll(pfds, conns, timeout) == -1) {
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "%s: poll: %s\n", __FUNCTION__,
+				strerror(errno));
+			goto out;
+		}
+
+		for (idx = 0; idx < conns; idx++) {
+			if (pfds[idx].revents == 0)
+				continue;
+			if (ctrl_bench_read(&cbn, &cbn.cbn_conns[idx]) != 0)
+				goto out;
+		}
+	}
+
+	elapsed = ((cbn.cbn_last > cbn.cbn_start ? cbn.cbn_last
+						 : cbn.cbn_end)
+		   - cbn.cbn_start)
+		  / 1e9;
+	printf("connections: %zu, window: %zu, target rate: %lu requests/s, "
+	       "duration: %lu s\n",
+	       conns, window, rate, seconds);
+	printf("requests: %" PRIu64 " ok, %" PRIu64
+	       " failed (%.0f requests/s)\n",
+	       cbn.cbn_ok, cbn.cbn_failed,
+	       (cbn.cbn_ok + cbn.cbn_failed) / elapsed);
+	ctrl_bench_report("request latency", &cbn.cbn_latency);
+	printf("notifications: %" PRIu64 " (%.0f/s), resyncs: %" PRIu64 "\n",
+	       cbn.cbn_notifications, cbn.cbn_notifications / (seconds * 1.0),
+	       cbn.cbn_resyncs);
+	ctrl_bench_report("notification lag", &cbn.cbn_lag);
+
+	error = 0;
+
+out:
+	for (idx = 0; cbn.cbn_conns && idx < conns; idx++) {
+		cbc = &cbn.cbn_conns[idx];
+		if (cbc->cbc_sd != -1)
+			close(cbc->cbc_sd);
+		free(cbc->cbc_reqs);
+		free(cbc->cbc_buf);
+	}
+	free(cbn.cbn_conns);
+	free(cbn.cbn_added);
+	free(cbn.cbn_latency.cbs_values);
+	free(cbn.cbn_lag.cbs_values);
+	free(pfds);
+
+	return error;
+}
+
+
+/*
+ * Control socket
+ */
+int control_init(const char *path)
+{
+	struct sockaddr_un sun = {.sun_family = AF_UNIX,
+				  .sun_path = BFD_CONTROL_SOCK_PATH};
+	int sd;
+
+	if (path) {
+		strncpy(sun.sun_path, path, sizeof(sun.sun_path));
+		sun.sun_path[sizeof(sun.sun_path) - 1] = 0;
+	}
+
+	sd = socket(AF_UNIX, SOCK_STREAM, PF_UNSPEC);
+	if (sd == -1) {
+		fprintf(stderr, "%s: socket: %s\n", __FUNCTION__,
+			strerror(errno));
+		return -1;
+	}
+
+	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		fprintf(stderr, "%s: connect: %s\n", __FUNCTION__,
+			strerror(errno));
+		return -1;
+	}
+
+	return sd;
+}
+
+uint16_t control_send(int sd, enum bc_msg_version bmv, enum bc_msg_type bmt,
+		      const void *data, size_t datalen)
+{
+	static uint16_t id = 0;
+	const uint8_t *dataptr = data;
+	ssize_t sent;
+	size_t cur = 0;
+	struct bfd_control_msg bcm = {
+		.bcm_length = htonl(datalen),
+		.bcm_type = bmt,
+		.bcm_ver = bmv,
+	};
+
+	/* The notifications ID is never used by requests. */
+	if (++id == BCM_NOTIFY_ID)
+		id++;
+	bcm.bcm_id = htons(id);
+
+	sent = write(sd, &bcm, sizeof(bcm));
+	if (sent == 0) {
+		fprintf(stderr, "%s: bfdd closed connection\n", __FUNCTION__);
+		return 0;
+	}
+	if (sent < 0) {
+		fprintf(stderr, "%s: write: %s\n", __FUNCTION__,
+			strerror(errno));
+		return 0;
+	}
+
+	while (datalen > 0) {
+		sent = write(sd, &dataptr[cur], datalen);
+		if (sent == 0) {
+			fprintf(stderr, "%s: bfdd closed connection\n",
+				__FUNCTION__);
+			return 0;
+		}
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK
+			    || errno == EINTR)
+				continue;
+
+			fprintf(stderr, "%s: write: %s\n", __FUNCTION__,
+				strerror(errno));
+			return 0;
+		}
+
+		datalen -= sent;
+		cur += sent;
+	}
+
+	return id;
+}
+
+int control_recv(int sd, control_recv_cb cb, void *arg)
+{
+	size_t bufpos, bufremaining, plen;
+	ssize_t bread;
+	struct bfd_control_msg *bcm, bcmh;
+	int ret;
+
+	/* Pipelined responses may split the header between reads. */
+	for (bufpos = 0; bufpos < sizeof(bcmh); bufpos += bread) {
+		bread = read(sd, (uint8_t *)&bcmh + bufpos,
+			     sizeof(bcmh) - bufpos);
+		if (bread == 0) {
+			fprintf(stderr, "%s: bfdd closed connection\n",
+				__FUNCTION__);
+			return -1;
+		}
+		if (bread < 0) {
+			if (errno == EINTR) {
+				bread = 0;
+				continue;
+			}
+
+			fprintf(stderr, "%s: read: %s\n", __FUNCTION__,
+				strerror(errno));
+			return -1;
+		}
+	}
+
+	if (bcmh.bcm_ver != BMV_VERSION_1 && bcmh.bcm_ver != BMV_VERSION_2) {
 		fprintf(stderr, "%s: wrong protocol version (%d)\n",
 			__FUNCTION__, bcmh.bcm_ver);
 		return -1;
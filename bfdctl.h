@@ -29,6 +29,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 /*
  * Auxiliary definitions
@@ -66,6 +67,9 @@ struct bfd_peer_cfg {
 	bool bpc_has_label;
 	char bpc_label[MAXNAMELEN];
 
+	bool bpc_has_profile;
+	char bpc_profile[MAXNAMELEN];
+
 	bool bpc_has_vxlan;
 	unsigned int bpc_vxlan;
 
@@ -116,8 +120,13 @@ struct bfd_peer_cfg {
 
 #define BFD_CONTROL_SOCK_PATH "/var/run/bfdd.sock"
 
+/*
+ * The first message sent by the client selects the protocol version used
+ * by the connection: all responses and notifications will use it.
+ */
 enum bc_msg_version {
-	BMV_VERSION_1 = 1,
+	BMV_VERSION_1 = 1, /* JSON payload. */
+	BMV_VERSION_2 = 2, /* Binary TLV payload. */
 };
 
 enum bc_msg_type {
@@ -130,6 +139,13 @@ enum bc_msg_type {
         BMT_NOTIFY_SLA = 7,
         BMT_NOTIFY_SLA_ADD = 8,
         BMT_NOTIFY_SLA_DEL = 9,
+	BMT_REQUEST_BULK_ADD = 10,
+	BMT_REQUEST_BULK_DEL = 11,
+	BMT_NOTIFY_COALESCE = 12,
+	BMT_STATS = 13,
+	BMT_QUERY = 14,
+	BMT_RELOAD = 15,
+	BMT_HANDOVER = 16,
 };
 
 /* Notify flags to use with bcm_notify. */
@@ -149,10 +165,112 @@ enum bc_msg_type {
 #define BCM_NOTIFY_CONFIG_ADD "add"
 #define BCM_NOTIFY_CONFIG_DELETE "delete"
 #define BCM_NOTIFY_CONFIG_UPDATE "update"
+#define BCM_NOTIFY_RESYNC "resync"
 
 /* Notification special ID. */
 #define BCM_NOTIFY_ID 0
 
+/*
+ * Notification coalescing (BMT_NOTIFY_COALESCE): the client selects a
+ * window in milliseconds ('window') during which the daemon holds the
+ * peer state/SLA/configuration update notifications and only delivers
+ * the latest one for each peer. Configuration updates that don't change
+ * the peer parameters are suppressed. A zero window disables it (the
+ * default).
+ *
+ * The number of merged/suppressed notifications is reported by
+ * BMT_STATS ('sockets' list).
+ */
+#define BCM_COALESCE_MAX 60000
+
+/*
+ * Session queries (BMT_QUERY): the response lists the status,
+ * configuration, counters and SLA of the peers matching the request
+ * filters ('state', 'label-prefix', 'local-interface', 'vrf-name',
+ * 'multihop' and 'ipv6') ordered by local discriminator. At most
+ * 'limit' peers are returned: when there are more the response carries
+ * a 'cursor' to use in the next request.
+ */
+#define BCM_QUERY_LIMIT 100
+#define BCM_QUERY_LIMIT_MAX 1000
+
+/*
+ * Configuration reload (BMT_RELOAD): the daemon reads its configuration
+ * file again and only applies the differences: new peers are added,
+ * peers with changed parameters are updated and the peers removed from
+ * the file are deleted (peers added by the control sockets are kept).
+ * Nothing changes if the file has errors. Same as sending SIGHUP.
+ */
+
+/*
+ * Handover (BMT_HANDOVER, no payload): used by a new daemon started with
+ * '-T' to take the sockets and sessions over. On success the daemon
+ * answers with the handover messages (see bfd_handover.c) instead of a
+ * response and exits. The daemon answers with an error response when it
+ * can't start the transfer, and closes the connection when the transfer
+ * fails (including a new daemon that doesn't read for
+ * BFD_HANDOVER_TIMEOUT seconds).
+ */
+
+/*
+ * Notification sequence numbers: peer state, SLA and configuration
+ * notifications carry the daemon-wide sequence number of the event
+ * ('seq'). Sequence numbers start at the daemon start time in
+ * microseconds, so they keep growing across daemon restarts.
+ *
+ * The daemon keeps a journal of the latest events. A client that
+ * reconnects may send BMT_NOTIFY with the last sequence number it
+ * received (version 1: a second uint64_t after the flags, version 2: a
+ * BCT_SEQ) to only get the events it missed. The response carries the
+ * current sequence number and tells if the subscription was resumed
+ * ('resumed'): when the missed events already left the journal the
+ * usual snapshot of all peers is sent instead. Only BMT_NOTIFY
+ * subscriptions are resumed, BMT_NOTIFY_ADD peers must be added again.
+ * Bulk request notifications are only journaled in the protocol versions
+ * of the clients connected when they happened: missing one also gets the
+ * snapshot.
+ *
+ * Notifications delivered late (coalescing window or collapsed queue)
+ * carry the sequence number of the oldest event they replace, so
+ * resuming may deliver some events twice.
+ */
+
+/*
+ * The daemon bounds the notifications queued for each control socket.
+ * When the consumer doesn't keep up, depending on the daemon policy, the
+ * socket is disconnected or the notifications are dropped (peer state,
+ * SLA and configuration updates may be collapsed into the latest state
+ * instead). After
+ * dropping notifications the daemon sends a BCM_NOTIFY_RESYNC
+ * notification ('dropped' notifications count) once the queue drains:
+ * the client must then reload the peers state.
+ */
+
+/*
+ * Bulk requests (BMT_REQUEST_BULK_*) per-peer results. The response
+ * carries one result per peer in the request order ('results').
+ *
+ * Bulk requests are transactional: if one peer fails nothing is changed
+ * and the other peers are reported as skipped. Configuration
+ * notifications of a bulk request are aggregated in a single message
+ * ('peers' list).
+ *
+ * The new sessions sockets are created after the response, they start
+ * transmitting once they have it. This part isn't transactional: a
+ * session that can't get a socket (e.g. no source port left) is deleted
+ * after being reported "ok", clients only learn it from the configuration
+ * delete notification.
+ */
+enum bc_bulk_result {
+	BBR_OK = 0,	/* "ok" */
+	BBR_SKIPPED = 1,   /* "skipped": transaction aborted */
+	BBR_INVALID = 2,   /* "invalid": bad peer configuration */
+	BBR_EXISTS = 3,    /* "exists": duplicated or create-only peer */
+	BBR_NOT_FOUND = 4, /* "not-found": peer doesn't exist */
+	BBR_BUSY = 5,      /* "busy": peer is referenced */
+	BBR_FAILED = 6,    /* "failed": resource allocation failure */
+};
+
 struct bfd_control_msg {
 	/* Total length without the header. */
 	uint32_t bcm_length;
@@ -170,4 +288,346 @@ struct bfd_control_msg {
 	uint8_t bcm_data[0];
 };
 
+
+/*
+ * Version 2 (binary) protocol definitions.
+ *
+ * The message payload is a sequence of TLVs. The TLV header and all
+ * integer fields are in network byte order. Values are fixed-layout
+ * structures (except strings, which are not NULL terminated) and every
+ * TLV is padded to a 4 bytes boundary.
+ *
+ * Requests (BMT_REQUEST_ADD, BMT_REQUEST_DEL, BMT_NOTIFY_ADD,
+ * BMT_NOTIFY_DEL) carry one BCT_PEER per peer. BMT_NOTIFY carries a
+ * BCT_NOTIFY_FLAGS and optionally a BCT_SEQ to resume from.
+ *
+ * BMT_NOTIFY_COALESCE carries a BCT_COALESCE, BMT_QUERY carries a
+ * BCT_QUERY and BMT_STATS and BMT_RELOAD have no payload.
+ *
+ * Responses carry BCT_STATUS and optionally BCT_ERROR and BCT_RESULTS.
+ * BMT_NOTIFY responses also carry BCT_SEQ and BCT_RESUMED.
+ * BMT_STATS responses carry one BCT_CONTROL_STATS per control socket.
+ * BMT_QUERY responses carry BCT_PEER, BCT_PEER_CONFIG, BCT_PEER_STATE,
+ * BCT_PEER_COUNTERS and (if tracked) BCT_PEER_SLA for each peer, then
+ * a BCT_CURSOR if there are more peers.
+ *
+ * Notifications carry BCT_SEQ, BCT_PEER (the peer key) followed by one of
+ * BCT_PEER_STATE, BCT_PEER_CONFIG or BCT_PEER_SLA. Aggregated config
+ * notifications repeat the BCT_PEER/BCT_PEER_CONFIG pair for each peer.
+ * Resync notifications only carry BCT_RESYNC.
+ */
+struct bfd_control_tlv {
+	uint16_t bct_type;
+	/* Value length without the header and padding. */
+	uint16_t bct_length;
+	uint8_t bct_value[0];
+};
+
+#define BCT_ALIGN(len) (((len) + 3) & ~3)
+#define BCT_TOTLEN(len) (sizeof(struct bfd_control_tlv) + BCT_ALIGN(len))
+
+enum bc_tlv_type {
+	BCT_PEER = 1,	  /* struct bfd_control_peer */
+	BCT_STATUS = 2,	/* uint32_t: BCS_STATUS_* */
+	BCT_ERROR = 3,	 /* string */
+	BCT_NOTIFY_FLAGS = 4, /* uint64_t: BCM_NOTIFY_* */
+	BCT_PEER_STATE = 5,   /* struct bfd_control_peer_state */
+	BCT_PEER_CONFIG = 6,  /* struct bfd_control_peer_config */
+	BCT_PEER_SLA = 7,     /* struct bfd_control_peer_sla */
+	BCT_RESULTS = 8,      /* uint8_t[]: enum bc_bulk_result per peer */
+	BCT_COALESCE = 9,     /* uint32_t: window in milliseconds */
+	BCT_CONTROL_STATS = 10, /* struct bfd_control_stats */
+	BCT_RESYNC = 11,	/* uint64_t: dropped notifications */
+	BCT_QUERY = 12,		/* struct bfd_control_query */
+	BCT_PEER_COUNTERS = 13, /* struct bfd_control_peer_counters */
+	BCT_CURSOR = 14,	/* uint32_t: next query cursor */
+	BCT_SEQ = 15,		/* uint64_t: notification sequence number */
+	BCT_RESUMED = 16,	/* uint32_t: boolean */
+};
+
+/* BCT_STATUS values. */
+#define BCS_STATUS_OK 0
+#define BCS_STATUS_ERROR 1
+
+/* bfd_control_peer/bfd_control_peer_config flags. */
+#define BCP_F_MHOP (1U << 0)
+#define BCP_F_IPV6 (1U << 1)
+#define BCP_F_ECHO (1U << 2)
+#define BCP_F_SHUTDOWN (1U << 3)
+#define BCP_F_CREATEONLY (1U << 4)
+#define BCP_F_TRACK_SLA (1U << 5)
+#define BCP_F_HAS_PEER (1U << 8)
+#define BCP_F_HAS_LOCAL (1U << 9)
+#define BCP_F_HAS_LOCALIF (1U << 10)
+#define BCP_F_HAS_VRFNAME (1U << 11)
+#define BCP_F_HAS_LABEL (1U << 12)
+#define BCP_F_HAS_DISCR (1U << 13)
+#define BCP_F_HAS_DETECTMULTIPLIER (1U << 14)
+#define BCP_F_HAS_RECVINTERVAL (1U << 15)
+#define BCP_F_HAS_TXINTERVAL (1U << 16)
+#define BCP_F_HAS_ECHOINTERVAL (1U << 17)
+
+/* Peer key and configuration. */
+struct bfd_control_peer {
+	uint32_t bcp_flags;
+	uint32_t bcp_discr;
+	uint32_t bcp_recvinterval; /* milliseconds */
+	uint32_t bcp_txinterval;   /* milliseconds */
+	uint32_t bcp_echointerval; /* milliseconds */
+	uint8_t bcp_detectmultiplier;
+	uint8_t bcp_pad[3];
+	/* IPv4 addresses use the first 4 bytes. */
+	uint8_t bcp_peer[16];
+	uint8_t bcp_local[16];
+	char bcp_localif[MAXNAMELEN];
+	char bcp_vrfname[MAXNAMELEN];
+	char bcp_label[MAXNAMELEN];
+};
+
+/* Peer status notification. */
+struct bfd_control_peer_state {
+	uint32_t bcps_id;
+	uint32_t bcps_remoteid;
+	/* Seconds since the session went up (or down). */
+	uint32_t bcps_time;
+	uint8_t bcps_state; /* enum bfd_peer_status */
+	uint8_t bcps_diag;
+	uint8_t bcps_remotediag;
+	uint8_t bcps_pad;
+};
+
+/* Peer configuration notification operations (0 for queries). */
+enum bc_config_op {
+	BCO_ADD = 1,    /* BCM_NOTIFY_CONFIG_ADD */
+	BCO_DELETE = 2, /* BCM_NOTIFY_CONFIG_DELETE */
+	BCO_UPDATE = 3, /* BCM_NOTIFY_CONFIG_UPDATE */
+};
+
+/* Peer configuration notification. */
+struct bfd_control_peer_config {
+	uint32_t bcpc_flags; /* BCP_F_ECHO, BCP_F_SHUTDOWN, BCP_F_TRACK_SLA */
+	uint32_t bcpc_recvinterval;	/* milliseconds */
+	uint32_t bcpc_txinterval;	  /* milliseconds */
+	uint32_t bcpc_echointerval;	/* milliseconds */
+	uint32_t bcpc_remote_recvinterval; /* milliseconds */
+	uint32_t bcpc_remote_txinterval;   /* milliseconds */
+	uint32_t bcpc_remote_echointerval; /* milliseconds */
+	uint8_t bcpc_op; /* enum bc_config_op */
+	uint8_t bcpc_detectmultiplier;
+	uint8_t bcpc_remote_detectmultiplier;
+	uint8_t bcpc_pad;
+};
+
+/* Peer SLA notification. */
+struct bfd_control_peer_sla {
+	uint32_t bcpl_id;
+	uint32_t bcpl_remoteid;
+	uint32_t bcpl_latency; /* microseconds */
+	uint32_t bcpl_jitter;  /* microseconds */
+	/* Packet loss in parts per million. */
+	uint32_t bcpl_pkt_loss;
+};
+
+/*
+ * Control socket statistics. New fields are only appended: clients must
+ * use the TLV length to find out which ones are present.
+ */
+struct bfd_control_stats {
+	uint32_t bcst_sd;
+	uint32_t bcst_coalesce; /* milliseconds */
+	uint64_t bcst_notify_merged;
+	uint64_t bcst_notify_suppressed;
+	/* Output queue depth, high-water marks and dropped notifications. */
+	uint32_t bcst_queue_msgs;
+	uint32_t bcst_queue_msgs_hwm;
+	uint64_t bcst_queue_bytes;
+	uint64_t bcst_queue_bytes_hwm;
+	uint64_t bcst_queue_drops;
+};
+
+/* bfd_control_query flags. */
+#define BCQ_F_STATE (1U << 0)
+#define BCQ_F_LABEL (1U << 1)
+#define BCQ_F_LOCALIF (1U << 2)
+#define BCQ_F_VRFNAME (1U << 3)
+#define BCQ_F_MHOP (1U << 4)
+#define BCQ_F_SHOP (1U << 5)
+#define BCQ_F_IPV4 (1U << 6)
+#define BCQ_F_IPV6 (1U << 7)
+
+/* Session query filters and page. */
+struct bfd_control_query {
+	uint32_t bcq_flags;
+	/* Return peers after this local discriminator (0 to start). */
+	uint32_t bcq_cursor;
+	uint32_t bcq_limit; /* 0 selects BCM_QUERY_LIMIT */
+	uint8_t bcq_state;  /* enum bfd_peer_status */
+	uint8_t bcq_pad[3];
+	char bcq_label[MAXNAMELEN]; /* label prefix */
+	char bcq_localif[MAXNAMELEN];
+	char bcq_vrfname[MAXNAMELEN];
+};
+
+/* Peer packet counters. */
+struct bfd_control_peer_counters {
+	uint64_t bcpn_rx_ctrl;
+	uint64_t bcpn_tx_ctrl;
+	uint64_t bcpn_rx_echo;
+	uint64_t bcpn_tx_echo;
+};
+
+/*
+ * Shared memory status table ('bfdd -s <path>').
+ *
+ * The daemon publishes the status of every session in a memory mapped
+ * file so local consumers can read it without talking to the control
+ * socket. All fields are in host byte order.
+ *
+ * The file starts with a `struct bfd_status_header` followed by two
+ * indexes (local discriminator and label) and the status entries. The
+ * indexes are open addressing hash tables (linear probing) of entry
+ * positions plus one: readers use `bfd_status_find()` to look up
+ * sessions.
+ *
+ * Entries are protected by a sequence lock (`bse_seq` is odd while the
+ * daemon updates them): use `bfd_status_read()` to copy them. Packet
+ * counters are updated in place, every other status change also
+ * increments the header generation. Readers may poll `bsh_generation`
+ * or block with FUTEX_WAIT on `bsh_wake` (the daemon wakes the waiters
+ * once per event loop iteration with changes).
+ *
+ * The file is recreated (not truncated) when the daemon restarts:
+ * readers should reopen it when it is replaced.
+ */
+#define BSH_MAGIC 0x42464453 /* "BFDS" */
+#define BSH_VERSION 1
+
+/* Index slots values (other values are entry positions plus one). */
+#define BSH_INDEX_EMPTY 0
+#define BSH_INDEX_DELETED UINT32_MAX
+
+struct bfd_status_header {
+	uint32_t bsh_magic;
+	uint16_t bsh_version;
+	uint16_t bsh_entry_size; /* sizeof(struct bfd_status_entry) */
+	uint32_t bsh_entries;
+	uint32_t bsh_index_size; /* power of two */
+	/* Offsets from the start of the file. */
+	uint32_t bsh_discr_index;
+	uint32_t bsh_label_index;
+	uint32_t bsh_entries_off;
+	/* Futex word: changes with the generation. */
+	uint32_t bsh_wake;
+	uint64_t bsh_generation;
+};
+
+struct bfd_status_entry {
+	/* Sequence lock: odd while the entry is being written. */
+	uint32_t bse_seq;
+	/* Local discriminator (0 for unused entries). */
+	uint32_t bse_discr;
+	uint32_t bse_remote_discr;
+	/* BCP_F_MHOP, BCP_F_IPV6, BCP_F_ECHO, BCP_F_SHUTDOWN, BCP_F_TRACK_SLA */
+	uint32_t bse_flags;
+	uint8_t bse_state; /* enum bfd_peer_status */
+	uint8_t bse_diag;
+	uint8_t bse_remote_diag;
+	uint8_t bse_detect_mult;
+	uint8_t bse_remote_detect_mult;
+	uint8_t bse_pad[3];
+	/* Timers in microseconds. */
+	uint32_t bse_rx_interval;
+	uint32_t bse_tx_interval;
+	uint32_t bse_echo_interval;
+	uint32_t bse_remote_rx_interval;
+	uint32_t bse_remote_tx_interval;
+	uint32_t bse_remote_echo_interval;
+	/* Monotonic clock seconds of the last time the session went up/down. */
+	int64_t bse_uptime;
+	int64_t bse_downtime;
+	/* Packet counters. */
+	uint64_t bse_rx_ctrl;
+	uint64_t bse_tx_ctrl;
+	uint64_t bse_rx_echo;
+	uint64_t bse_tx_echo;
+	/* IPv4 addresses use the first 4 bytes. */
+	uint8_t bse_peer[16];
+	uint8_t bse_local[16];
+	char bse_label[MAXNAMELEN];
+};
+
+static inline uint32_t bfd_status_hash_discr(uint32_t discr)
+{
+	return discr * 2654435761U;
+}
+
+static inline uint32_t bfd_status_hash_label(const char *label)
+{
+	uint32_t hash = 2166136261U;
+	size_t idx;
+
+	/* FNV-1a */
+	for (idx = 0; idx < MAXNAMELEN && label[idx]; idx++)
+		hash = (hash ^ (uint8_t)label[idx]) * 16777619U;
+
+	return hash;
+}
+
+/* Copies a consistent snapshot of the entry. */
+static inline void bfd_status_read(const struct bfd_status_entry *bse,
+				   struct bfd_status_entry *copy)
+{
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&bse->bse_seq, __ATOMIC_ACQUIRE);
+		memcpy(copy, bse, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1)
+		 || seq != __atomic_load_n(&bse->bse_seq, __ATOMIC_RELAXED));
+}
+
+/*
+ * Looks up a session by label (if not `NULL`) or local discriminator
+ * and copies its status to `bse`.
+ */
+static inline bool bfd_status_find(const struct bfd_status_header *bsh,
+				   uint32_t discr, const char *label,
+				   struct bfd_status_entry *bse)
+{
+	const struct bfd_status_entry *entries;
+	const uint32_t *index;
+	uint32_t mask = bsh->bsh_index_size - 1, pos, probe, slot;
+
+	entries = (const void *)((const uint8_t *)bsh + bsh->bsh_entries_off);
+	if (label) {
+		index = (const void *)((const uint8_t *)bsh
+				       + bsh->bsh_label_index);
+		pos = bfd_status_hash_label(label);
+	} else {
+		index = (const void *)((const uint8_t *)bsh
+				       + bsh->bsh_discr_index);
+		pos = bfd_status_hash_discr(discr);
+	}
+
+	for (probe = 0; probe <= mask; probe++, pos++) {
+		slot = __atomic_load_n(&index[pos & mask], __ATOMIC_ACQUIRE);
+		if (slot == BSH_INDEX_EMPTY)
+			return false;
+		if (slot == BSH_INDEX_DELETED || slot > bsh->bsh_entries)
+			continue;
+
+		bfd_status_read(&entries[slot - 1], bse);
+		if (bse->bse_discr == 0)
+			continue;
+		if (label) {
+			if (strncmp(bse->bse_label, label, MAXNAMELEN) == 0)
+				return true;
+		} else if (bse->bse_discr == discr)
+			return true;
+	}
+
+	return false;
+}
+
 #endif
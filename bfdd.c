@@ -33,6 +33,8 @@
 
 void usage(void);
 void bg_init(void);
+void bg_listen(void);
+void bg_sighup_cb(evutil_socket_t sig, short ev, void *arg);
 
 struct bfd_global bglobal;
 
@@ -42,8 +44,30 @@ void usage(void)
 
 	fprintf(stderr,
 		"%s: [OPTIONS...]\n"
-		"\t-c - select a configuration file\n"
+		"\t-c - select a configuration file (reloaded on SIGHUP)\n"
 		"\t-C unix-socket - configuration socket path\n"
+		"\t-P policy - full control queue policy: drop (default), "
+		"disconnect or collapse\n"
+		"\t-q bytes - control socket queue size limit (0 is unlimited)\n"
+		"\t-Q messages - control socket queue messages limit (0 is "
+		"unlimited)\n"
+		"\t-j entries - notifications journal size (0 disables "
+		"resuming)\n"
+		"\t-s path - publish the sessions status in a shared memory "
+		"file\n"
+		"\t-S entries - shared memory status table size\n"
+		"\t-w path - checkpoint the sessions state in a file to resume "
+		"them after a restart\n"
+		"\t-W entries - state file size\n"
+		"\t-T - take the sockets and sessions over from the daemon "
+		"running on the control socket\n"
+		"\t-r path - replicate the sessions to standby daemons on a "
+		"unix socket path\n"
+		"\t-f path - stand by for the active daemon replicating on a "
+		"unix socket path and resume its sessions when it is gone\n"
+		"\t-m address - export OpenMetrics on a unix socket path or on "
+		"a TCP [address:]port (default address 127.0.0.1)\n"
+		"\t-M mode - exported metrics: session (default) or aggregate\n"
 		"\t-h - show this message\n",
 		__progname);
 
@@ -53,15 +77,38 @@ void usage(void)
 void bg_init(void)
 {
 	TAILQ_INIT(&bglobal.bg_bcslist);
-
-	bglobal.bg_shop = bp_udp_shop();
-	bglobal.bg_mhop = bp_udp_mhop();
-	bglobal.bg_shop6 = bp_udp6_shop();
-	bglobal.bg_mhop6 = bp_udp6_mhop();
-	bglobal.bg_echo = ptm_bfd_echo_sock_init();
-	bglobal.bg_vxlan = ptm_bfd_vxlan_sock_init();
+	TAILQ_INIT(&bglobal.bg_ranges);
+	TAILQ_INIT(&bglobal.bg_rconns);
+	bglobal.bg_cqbytes = BFD_CONTROL_QUEUE_BYTES;
+	bglobal.bg_cqmsgs = BFD_CONTROL_QUEUE_MSGS;
+	bglobal.bg_journal_size = BFD_NOTIFY_JOURNAL;
+	bglobal.bg_shmentries = BFD_STATUS_ENTRIES;
+	bglobal.bg_stateentries = BFD_STATE_ENTRIES;
+	bglobal.bg_cqpolicy = BQP_DROP;
+	bglobal.bg_msock = -1;
+	bglobal.bg_rsock = -1;
+	TAILQ_INIT(&bglobal.bg_sockq);
 
 	bglobal.bg_eb = event_base_new();
+	evtimer_assign(&bglobal.bg_sockev, bglobal.bg_eb, bfd_socket_cb, NULL);
+}
+
+void bg_listen(void)
+{
+	/* Handed over sockets are already bound. */
+	if (!bglobal.bg_handover || bglobal.bg_shop == -1)
+		bglobal.bg_shop = bp_udp_shop();
+	if (!bglobal.bg_handover || bglobal.bg_mhop == -1)
+		bglobal.bg_mhop = bp_udp_mhop();
+	if (!bglobal.bg_handover || bglobal.bg_shop6 == -1)
+		bglobal.bg_shop6 = bp_udp6_shop();
+	if (!bglobal.bg_handover || bglobal.bg_mhop6 == -1)
+		bglobal.bg_mhop6 = bp_udp6_mhop();
+	if (!bglobal.bg_handover || bglobal.bg_echo == -1)
+		bglobal.bg_echo = ptm_bfd_echo_sock_init();
+	if (!bglobal.bg_handover || bglobal.bg_vxlan == -1)
+		bglobal.bg_vxlan = ptm_bfd_vxlan_sock_init();
+
 	event_assign(&bglobal.bg_ev[0], bglobal.bg_eb, bglobal.bg_shop,
 		     EV_PERSIST | EV_READ, bfd_recv_cb, NULL);
 	event_assign(&bglobal.bg_ev[1], bglobal.bg_eb, bglobal.bg_mhop,
@@ -87,10 +134,25 @@ void bg_init(void)
 	}
 }
 
+void bg_sighup_cb(evutil_socket_t sig __attribute__((unused)),
+		  short ev __attribute__((unused)),
+		  void *arg __attribute__((unused)))
+{
+	log_info("%s: reloading %s\n", __FUNCTION__, bglobal.bg_config);
+	parse_config_reload(bglobal.bg_config);
+}
+
 int main(int argc, char *argv[])
 {
 	const char *conf = BFDD_DEFAULT_CONFIG;
 	const char *ctl_path = BFD_CONTROL_SOCK_PATH;
+	const char *shm_path = NULL;
+	const char *state_path = NULL;
+	const char *metrics_address = NULL;
+	const char *repl_path = NULL;
+	const char *standby_path = NULL;
+	bool handover = false;
+	char *ep;
 	int opt;
 
 	/* Ignore SIGPIPE on write() failures. */
@@ -99,7 +161,7 @@ int main(int argc, char *argv[])
 	log_init(1, BLOG_DEBUG);
 	bg_init();
 
-	while ((opt = getopt(argc, argv, "c:C:")) != -1) {
+	while ((opt = getopt(argc, argv, "c:C:f:j:m:M:P:q:Q:r:s:S:Tw:W:")) != -1) {
 		switch (opt) {
 		case 'c':
 			conf = optarg;
@@ -109,19 +171,142 @@ int main(int argc, char *argv[])
 			ctl_path = optarg;
 			break;
 
+		case 'f':
+			standby_path = optarg;
+			break;
+
+		case 'j':
+			bglobal.bg_journal_size = strtoul(optarg, &ep, 10);
+			if (*ep != 0)
+				usage();
+			break;
+
+		case 'm':
+			metrics_address = optarg;
+			break;
+
+		case 'M':
+			if (strcmp(optarg, "session") == 0)
+				bglobal.bg_maggregate = false;
+			else if (strcmp(optarg, "aggregate") == 0)
+				bglobal.bg_maggregate = true;
+			else
+				usage();
+			break;
+
+		case 'P':
+			if (strcmp(optarg, "drop") == 0)
+				bglobal.bg_cqpolicy = BQP_DROP;
+			else if (strcmp(optarg, "disconnect") == 0)
+				bglobal.bg_cqpolicy = BQP_DISCONNECT;
+			else if (strcmp(optarg, "collapse") == 0)
+				bglobal.bg_cqpolicy = BQP_COLLAPSE;
+			else
+				usage();
+			break;
+
+		case 'q':
+			bglobal.bg_cqbytes = strtoull(optarg, &ep, 10);
+			if (*ep != 0)
+				usage();
+			break;
+
+		case 'Q':
+			bglobal.bg_cqmsgs = strtoul(optarg, &ep, 10);
+			if (*ep != 0)
+				usage();
+			break;
+
+		case 'r':
+			repl_path = optarg;
+			break;
+
+		case 's':
+			shm_path = optarg;
+			break;
+
+		case 'S':
+			bglobal.bg_shmentries = strtoul(optarg, &ep, 10);
+			if (*ep != 0)
+				usage();
+			break;
+
+		case 'T':
+			handover = true;
+			break;
+
+		case 'w':
+			state_path = optarg;
+			break;
+
+		case 'W':
+			bglobal.bg_stateentries = strtoul(optarg, &ep, 10);
+			if (*ep != 0)
+				usage();
+			break;
+
 		default:
 			usage();
 			break;
 		}
 	}
 
+	/* The previous daemon exits once everything was handed over. */
+	if (handover && bfd_handover_recv(ctl_path) != 0)
+		exit(1);
+
+	/* A standby only creates its sockets once the active daemon is gone. */
+	if (standby_path != NULL && bfd_repl_standby(standby_path) != 0)
+		exit(1);
+
+	bg_listen();
+
 	/* Initialize control socket. */
 	control_init(ctl_path);
 
+	/* Initialize the status table before creating any session. */
+	if (shm_path != NULL && bfd_shm_init(shm_path) != 0)
+		exit(1);
+
+	/* Load the previous state before the sessions are created. */
+	if (state_path != NULL && bfd_state_init(state_path) != 0)
+		exit(1);
+
+	if (metrics_address != NULL && bfd_metrics_init(metrics_address) != 0)
+		exit(1);
+	else if (metrics_address == NULL && bglobal.bg_msock != -1) {
+		/* Metrics were disabled: drop the handed over socket. */
+		close(bglobal.bg_msock);
+		bglobal.bg_msock = -1;
+	}
+
+	if (repl_path != NULL && bfd_repl_init(repl_path) != 0)
+		exit(1);
+	else if (repl_path == NULL && bglobal.bg_rsock != -1) {
+		/* Replication was disabled: drop the handed over socket. */
+		close(bglobal.bg_rsock);
+		bglobal.bg_rsock = -1;
+	}
+
+	/* Checkpointed sessions transmit while the configuration is loaded. */
+	bfd_state_resume();
 	parse_config(conf);
+	bfd_state_finish();
+	range_init();
+
+	bglobal.bg_config = conf;
+	evsignal_assign(&bglobal.bg_sighupev, bglobal.bg_eb, SIGHUP,
+			bg_sighup_cb, NULL);
+	evsignal_add(&bglobal.bg_sighupev, NULL);
 
 	event_base_dispatch(bglobal.bg_eb);
-	/* NOTREACHED */
+
+	/*
+	 * Only a handover stops the protocol loop: the new daemon runs the
+	 * sessions, so exit without bringing them down.
+	 */
+	control_shutdown();
+	log_info("%s: sessions handed over: exiting\n", __FUNCTION__);
 
 	return 0;
 }
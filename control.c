@@ -23,62 +23,251 @@
  * Rafael Zalamena <rzalamena@opensourcerouting.org>
  */
 
+/* accept4() */
+#define _GNU_SOURCE
+
 #include <sys/types.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 
 #include <errno.h>
 #include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "bfd.h"
 
+/*
+ * Definitions
+ */
+
+/* Maximum number of queued messages flushed by a single writev(). */
+#ifdef IOV_MAX
+#define CONTROL_WRITE_IOV_MAX IOV_MAX
+#else
+#define CONTROL_WRITE_IOV_MAX 1024
+#endif /* IOV_MAX */
+
+/* Control socket input buffer size (it grows for larger messages). */
+#define CONTROL_READ_SIZE 16384
+
+/*
+ * Largest accepted message payload: enough for bulk requests with a
+ * hundred thousand peers, but a client can't make the daemon allocate
+ * whatever the length field says.
+ */
+#define CONTROL_MSG_MAX (64 * 1024 * 1024)
+
+/*
+ * Notifications are serialized once per protocol version: the fan-out
+ * functions keep one cached message per version (see
+ * `_control_notify_enqueue`).
+ */
+#define CONTROL_NOTIFY_SLOTS 2
+#define CONTROL_NOTIFY_SLOT(bcs) ((bcs)->bcs_version == BMV_VERSION_2)
+#define CONTROL_NOTIFY_SLOT_VERSION(slot)                                      \
+	((slot) ? BMV_VERSION_2 : BMV_VERSION_1)
+
+/* Notification event: the messages of every version are built from it. */
+struct bfd_notify_event {
+	uint64_t bne_seq;
+	/* BCM_NOTIFY_PEER_STATE, BCM_NOTIFY_PEER_SLA or BCM_NOTIFY_CONFIG. */
+	uint64_t bne_notify;
+	/* Configuration operation (BCM_NOTIFY_CONFIG_*). */
+	const char *bne_op;
+	bfd_session **bne_bsv;
+	size_t bne_bscnt;
+	/* Bulk request configuration notification ('peers' list). */
+	bool bne_bulk;
+};
+
+/*
+ * Notifications journal entry: the event values are copied when it
+ * happens, so it is replayed as it was even after the session changed,
+ * went away or had its discriminator reused. The messages are only built
+ * when a client replays the event, unless a connected socket already got
+ * one in that protocol version.
+ */
+struct bfd_journal_entry {
+	uint64_t bje_seq;
+	uint64_t bje_notify;
+	/* Configuration operation (BCM_NOTIFY_CONFIG_*). */
+	const char *bje_op;
+	/* Bulk requests only keep the messages sent to the sockets. */
+	bool bje_bulk;
+
+	/* Peer */
+	bfd_session_flags bje_flags;
+	union {
+		bfd_shop_key bje_shop;
+		bfd_mhop_key bje_mhop;
+	};
+	struct sockaddr_any bje_local;
+	bfd_discrs_t bje_discrs;
+	char bje_label[MAXNAMELEN];
+	char bje_profile[MAXNAMELEN];
+
+	union {
+		/* BCM_NOTIFY_PEER_STATE */
+		struct {
+			uint8_t bje_state;
+			uint8_t bje_diag;
+			uint8_t bje_remote_diag;
+			time_t bje_uptime;
+			time_t bje_downtime;
+		};
+		/* BCM_NOTIFY_PEER_SLA */
+		struct {
+			uint32_t bje_latency;
+			uint32_t bje_jitter;
+			float bje_pkt_loss;
+		};
+		/* BCM_NOTIFY_CONFIG */
+		struct {
+			uint64_t bje_recvinterval;
+			uint64_t bje_txinterval;
+			uint64_t bje_echointerval;
+			uint8_t bje_detectmultiplier;
+			bool bje_echo;
+			bool bje_track_sla;
+			uint8_t bje_remote_detect_mult;
+			bfd_timers_t bje_remote_timers;
+		};
+	};
+
+	struct bfd_control_msgref *bje_bcmr[CONTROL_NOTIFY_SLOTS];
+};
+
+/* Query page being collected. */
+struct bfd_query_page {
+	struct bfd_query *bqp_bq;
+	bfd_session **bqp_bsv;
+	size_t bqp_cnt;
+	size_t bqp_size;
+};
+
+
 /*
  * Prototypes
  */
+int control_listen(struct sockaddr_un *sun);
 void control_accept(evutil_socket_t sd, short ev, void *arg);
+void *control_thread(void *arg);
+int control_mbox_init(struct bfd_mbox *bmb, struct event_base *eb,
+		      event_callback_fn cb);
+void control_mbox_post(struct bfd_mbox *bmb, struct bfd_mbox_entry *bme);
+struct bfd_mbox_entry *control_mbox_take(struct bfd_mbox *bmb);
+void control_cmd_cb(evutil_socket_t sd, short ev, void *arg);
+void control_out_cb(evutil_socket_t sd, short ev, void *arg);
+struct bfd_control_cmd *control_cmd_new(struct bfd_control_socket *bcs,
+					enum bfd_control_cmd_type bcct);
+void control_cmd_free(struct bfd_control_cmd *bcc);
 
-struct bfd_control_queue *control_queue_new(struct bfd_control_socket *bcs);
 void control_queue_free(struct bfd_control_socket *bcs,
 			struct bfd_control_queue *bcq);
 int control_queue_dequeue(struct bfd_control_socket *bcs);
 int control_queue_enqueue(struct bfd_control_socket *bcs,
-			  struct bfd_control_msg *bcm);
+			  struct bfd_control_msgref *bcmr);
+bool control_queue_full(struct bfd_control_socket *bcs, size_t len);
+int control_queue_notify(struct bfd_control_socket *bcs,
+			 struct bfd_control_msgref *bcmr);
+void control_queue_drained(struct bfd_control_socket *bcs);
+void control_notify_resync(struct bfd_control_socket *bcs);
+struct bfd_control_msgref *control_msgref_json(enum bc_msg_type bmt,
+					       uint16_t id, char *jsonstr);
 struct bfd_notify_peer *control_notifypeer_new(struct bfd_control_socket *bcs,
 					       bfd_session *bs);
 void control_notifypeer_free(struct bfd_control_socket *bcs,
 			     struct bfd_notify_peer *bnp);
 struct bfd_notify_peer *control_notifypeer_find(struct bfd_control_socket *bcs,
 						bfd_session *bs);
+void control_notify_cfg_get(bfd_session *bs, struct bfd_notify_cfg *bnc);
+bool control_coalesce_hold(struct bfd_control_socket *bcs,
+			   const struct bfd_notify_event *bne,
+			   const struct bfd_notify_cfg *bnc);
+void control_coalesce_free(struct bfd_control_socket *bcs,
+			   struct bfd_notify_pending *bnpe);
+void control_coalesce_purge(bfd_session *bs);
+void control_coalesce_flush(struct bfd_control_socket *bcs);
+void control_coalesce_timer(evutil_socket_t sd, short ev, void *arg);
+int control_journal_init(void);
+void control_journal_add(const struct bfd_notify_event *bne,
+			 struct bfd_control_msgref **bcmr);
+void control_journal_record(struct bfd_journal_entry *bje, bfd_session *bs);
+bool control_journal_check(struct bfd_control_socket *bcs, uint64_t seq);
+struct bfd_control_msgref *control_journal_msg(struct bfd_control_socket *bcs,
+					       struct bfd_journal_entry *bje);
+void control_journal_replay(struct bfd_control_socket *bcs, uint64_t seq);
 
 
 struct bfd_control_socket *control_new(int sd);
+void control_open(struct bfd_control_socket *bcs);
 void control_free(struct bfd_control_socket *bcs);
-void control_reset_buf(struct bfd_control_buffer *bcb);
+void control_close(struct bfd_control_socket *bcs);
+void control_io_close(struct bfd_control_socket *bcs);
+void control_release(struct bfd_control_socket *bcs);
+void control_handover_send(struct bfd_control_socket *bcs,
+			   struct bfd_control_queue *bcq);
+int control_inbuf_reserve(struct bfd_control_socket *bcs, size_t len);
+void control_inbuf_free(struct bfd_control_socket *bcs);
 void control_read(evutil_socket_t sd, short ev, void *arg);
 void control_write(evutil_socket_t sd, short ev, void *arg);
+void control_parse_message(struct bfd_control_socket *bcs,
+			   struct bfd_control_msg *bcm);
 
-void control_handle_request_add(struct bfd_control_socket *bcs,
-				struct bfd_control_msg *bcm);
-void control_handle_request_del(struct bfd_control_socket *bcs,
-				struct bfd_control_msg *bcm);
+void control_handle_message(struct bfd_control_socket *bcs,
+			    struct bfd_control_cmd *bcc);
+void control_handle_request(struct bfd_control_socket *bcs,
+			    struct bfd_control_cmd *bcc);
+void control_handle_request_bulk(struct bfd_control_socket *bcs,
+				 struct bfd_control_cmd *bcc);
 int notify_add_cb(struct bfd_peer_cfg *bpc, void *arg);
 int notify_del_cb(struct bfd_peer_cfg *bpc, void *arg);
-void control_handle_notify_add(struct bfd_control_socket *bcs,
-			       struct bfd_control_msg *bcm);
-void control_handle_notify_del(struct bfd_control_socket *bcs,
-			       struct bfd_control_msg *bcm);
+void control_handle_notify_peers(struct bfd_control_socket *bcs,
+				 struct bfd_control_cmd *bcc);
 void control_handle_notify(struct bfd_control_socket *bcs,
-			   struct bfd_control_msg *bcm);
+			   struct bfd_control_cmd *bcc);
+void control_handle_notify_coalesce(struct bfd_control_socket *bcs,
+				    struct bfd_control_cmd *bcc);
+void control_handle_stats(struct bfd_control_socket *bcs, uint16_t id);
+bool control_query_match(struct bfd_query *bq, bfd_session *bs);
+int query_collect_cb(bfd_session *bs, void *arg);
+int query_label_cb(struct peer_label *pl, void *arg);
+int query_discr_cmp(const void *a, const void *b);
+int query_collect_label(struct bfd_query_page *bqp);
+void control_handle_query(struct bfd_control_socket *bcs,
+			  struct bfd_control_cmd *bcc);
+void control_handover(struct bfd_control_socket *bcs, uint16_t id);
 void control_response(struct bfd_control_socket *bcs, uint16_t id,
 		      const char *status, const char *error);
-
+void control_response_results(struct bfd_control_socket *bcs, uint16_t id,
+			      const char *status, const char *error,
+			      const uint8_t *results, size_t rescnt);
+void control_response_notify(struct bfd_control_socket *bcs, uint16_t id,
+			     bool resumed);
+
+static struct bfd_control_msgref *
+control_notify_msg(enum bc_msg_version bmv,
+		   const struct bfd_notify_event *bne);
+static void _control_notify_event(struct bfd_control_socket *bcs,
+				  const struct bfd_notify_event *bne,
+				  struct bfd_control_msgref **bcmr);
+static void _control_notify_release(struct bfd_control_msgref **bcmr);
 static void _control_notify_config(struct bfd_control_socket *bcs,
-				   const char *op, bfd_session *bs);
-static void _control_notify(struct bfd_control_socket *bcs, bfd_session *bs);
+				   const char *op, bfd_session *bs,
+				   uint64_t seq);
+static void _control_notify(struct bfd_control_socket *bcs, bfd_session *bs,
+			    uint64_t seq);
+static void _control_notify_sla(struct bfd_control_socket *bcs,
+				bfd_session *bs, uint64_t seq);
 
 
 /*
@@ -86,8 +275,7 @@ static void _control_notify(struct bfd_control_socket *bcs, bfd_session *bs);
  */
 int control_init(const char *path)
 {
-	int sd;
-	mode_t umval;
+	int sd, error;
 	struct sockaddr_un sun = {
 		.sun_family = AF_UNIX, .sun_path = BFD_CONTROL_SOCK_PATH,
 	};
@@ -96,8 +284,55 @@ int control_init(const char *path)
 		strxcpy(sun.sun_path, path, sizeof(sun.sun_path));
 	}
 
+	control_journal_init();
+
+	bglobal.bg_ceb = event_base_new();
+	if (bglobal.bg_ceb == NULL) {
+		log_error("%s: failed to create control event base\n",
+			  __FUNCTION__);
+		return -1;
+	}
+
+	if (control_mbox_init(&bglobal.bg_cmdq, bglobal.bg_eb, control_cmd_cb)
+		    != 0
+	    || control_mbox_init(&bglobal.bg_outq, bglobal.bg_ceb,
+				 control_out_cb)
+		       != 0)
+		return -1;
+
+	/* Keep the socket handed over by the previous daemon. */
+	if (bglobal.bg_handover && bglobal.bg_csock != -1)
+		sd = bglobal.bg_csock;
+	else
+		sd = control_listen(&sun);
+	if (sd == -1)
+		return -1;
+
+	bglobal.bg_csock = sd;
+	event_assign(&bglobal.bg_csockev, bglobal.bg_ceb, sd,
+		     EV_READ | EV_PERSIST, control_accept, NULL);
+	event_add(&bglobal.bg_csockev, NULL);
+
+	/* From now on the control sockets belong to the control thread. */
+	error = pthread_create(&bglobal.bg_cthread, NULL, control_thread, NULL);
+	if (error != 0) {
+		log_error("%s: pthread_create: %s\n", __FUNCTION__,
+			  strerror(error));
+		event_del(&bglobal.bg_csockev);
+		close(sd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int control_listen(struct sockaddr_un *sun)
+{
+	mode_t umval;
+	int sd;
+
 	/* Remove previously created sockets. */
-	unlink(sun.sun_path);
+	unlink(sun->sun_path);
 
 	sd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
 		    PF_UNSPEC);
@@ -107,7 +342,7 @@ int control_init(const char *path)
 	}
 
 	umval = umask(0);
-	if (bind(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+	if (bind(sd, (struct sockaddr *)sun, sizeof(*sun)) == -1) {
 		log_error("%s: bind: %s\n", __FUNCTION__, strerror(errno));
 		close(sd);
 		return -1;
@@ -120,12 +355,31 @@ int control_init(const char *path)
 		return -1;
 	}
 
-	bglobal.bg_csock = sd;
-	event_assign(&bglobal.bg_csockev, bglobal.bg_eb, sd,
-		     EV_READ | EV_PERSIST, control_accept, NULL);
-	event_add(&bglobal.bg_csockev, NULL);
+	return sd;
+}
 
-	return 0;
+void *control_thread(void *arg __attribute__((unused)))
+{
+	sigset_t sigset;
+
+	/* Signals are handled by the protocol thread. */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	event_base_dispatch(bglobal.bg_ceb);
+
+	return NULL;
+}
+
+/* Stops the control thread: the sockets are closed with the process. */
+void control_shutdown(void)
+{
+	static struct bfd_control_queue bcq = {
+		.bcq_type = BCQT_STOP,
+	};
+
+	control_mbox_post(&bglobal.bg_outq, &bcq.bcq_mbe);
+	pthread_join(bglobal.bg_cthread, NULL);
 }
 
 void control_accept(evutil_socket_t sd, short ev __attribute__((unused)),
@@ -133,7 +387,11 @@ void control_accept(evutil_socket_t sd, short ev __attribute__((unused)),
 {
 	int csock;
 
-	csock = accept(sd, NULL, 0);
+	/*
+	 * A client that stops reading must never block the control thread:
+	 * its output is queued (and the queue policy applied) instead.
+	 */
+	csock = accept4(sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
 	if (csock == -1) {
 		log_warning("%s: accept: %s\n", __FUNCTION__, strerror(errno));
 		return;
@@ -144,59 +402,341 @@ void control_accept(evutil_socket_t sd, short ev __attribute__((unused)),
 }
 
 
+/*
+ * Thread communication
+ */
+int control_mbox_init(struct bfd_mbox *bmb, struct event_base *eb,
+		      event_callback_fn cb)
+{
+	bmb->bmb_head = NULL;
+	bmb->bmb_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (bmb->bmb_fd == -1) {
+		log_error("%s: eventfd: %s\n", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	event_assign(&bmb->bmb_ev, eb, bmb->bmb_fd, EV_READ | EV_PERSIST, cb,
+		     bmb);
+	event_add(&bmb->bmb_ev, NULL);
+
+	return 0;
+}
+
+void control_mbox_post(struct bfd_mbox *bmb, struct bfd_mbox_entry *bme)
+{
+	struct bfd_mbox_entry *head;
+	uint64_t one = 1;
+
+	head = __atomic_load_n(&bmb->bmb_head, __ATOMIC_RELAXED);
+	do {
+		bme->bme_next = head;
+	} while (!__atomic_compare_exchange_n(&bmb->bmb_head, &head, bme, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+
+	/*
+	 * Only the first entry wakes up the consumer: the others are taken
+	 * together with it.
+	 */
+	if (head != NULL)
+		return;
+
+	if (write(bmb->bmb_fd, &one, sizeof(one)) == -1)
+		log_warning("%s: write: %s\n", __FUNCTION__, strerror(errno));
+}
+
+/* Takes all posted entries in the order they were posted. */
+struct bfd_mbox_entry *control_mbox_take(struct bfd_mbox *bmb)
+{
+	struct bfd_mbox_entry *bme, *bmenext, *bmelist = NULL;
+	uint64_t cnt;
+
+	/* Clear the wake up first so entries posted after the take signal. */
+	if (read(bmb->bmb_fd, &cnt, sizeof(cnt)) == -1 && errno != EAGAIN)
+		log_warning("%s: read: %s\n", __FUNCTION__, strerror(errno));
+
+	bme = __atomic_exchange_n(&bmb->bmb_head, NULL, __ATOMIC_ACQUIRE);
+	while (bme != NULL) {
+		bmenext = bme->bme_next;
+		bme->bme_next = bmelist;
+		bmelist = bme;
+		bme = bmenext;
+	}
+
+	return bmelist;
+}
+
+/* Protocol thread: handles the control thread commands. */
+void control_cmd_cb(evutil_socket_t sd __attribute__((unused)),
+		    short ev __attribute__((unused)), void *arg)
+{
+	struct bfd_mbox_entry *bme, *bmenext;
+	struct bfd_control_cmd *bcc;
+	struct bfd_control_socket *bcs;
+
+	for (bme = control_mbox_take(arg); bme != NULL; bme = bmenext) {
+		bmenext = bme->bme_next;
+		bcc = (struct bfd_control_cmd *)bme;
+		bcs = bcc->bcc_bcs;
+
+		switch (bcc->bcc_type) {
+		case BCCT_OPEN:
+			control_open(bcs);
+			break;
+		case BCCT_MESSAGE:
+			/* Nothing runs after a handover (see main()). */
+			if (!bcs->bcs_closing
+			    && !event_base_got_break(bglobal.bg_eb))
+				control_handle_message(bcs, bcc);
+			break;
+		case BCCT_DRAINED:
+			if (!bcs->bcs_closing)
+				control_queue_drained(bcs);
+			break;
+		case BCCT_CLOSE:
+			/* The command is part of the socket: don't free it. */
+			control_free(bcs);
+			continue;
+		}
+
+		control_cmd_free(bcc);
+	}
+}
+
+/* Control thread: handles the protocol thread output. */
+void control_out_cb(evutil_socket_t sd __attribute__((unused)),
+		    short ev __attribute__((unused)), void *arg)
+{
+	struct bfd_mbox_entry *bme, *bmenext;
+	struct bfd_control_queue *bcq;
+	struct bfd_control_socket *bcs;
+
+	for (bme = control_mbox_take(arg); bme != NULL; bme = bmenext) {
+		bmenext = bme->bme_next;
+		bcq = (struct bfd_control_queue *)bme;
+		bcs = bcq->bcq_bcs;
+
+		switch (bcq->bcq_type) {
+		case BCQT_MESSAGE:
+			if (bcs->bcs_ioclosed) {
+				control_queue_free(bcs, bcq);
+				break;
+			}
+
+			TAILQ_INSERT_TAIL(&bcs->bcs_bcqueue, bcq, bcq_entry);
+
+			/* First item: start writing. */
+			if (bcs->bcs_bout == NULL) {
+				bcs->bcs_bout = &bcq->bcq_bcb;
+				event_add(&bcs->bcs_outev, NULL);
+			}
+			break;
+		case BCQT_CLOSE:
+			control_io_close(bcs);
+			break;
+		case BCQT_RELEASE:
+			control_release(bcs);
+			break;
+		case BCQT_HANDOVER:
+			control_handover_send(bcs, bcq);
+			break;
+		case BCQT_STOP:
+			event_base_loopbreak(bglobal.bg_ceb);
+			break;
+		}
+	}
+}
+
+struct bfd_control_cmd *control_cmd_new(struct bfd_control_socket *bcs,
+					enum bfd_control_cmd_type bcct)
+{
+	struct bfd_control_cmd *bcc;
+
+	bcc = calloc(1, sizeof(*bcc));
+	if (bcc == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		return NULL;
+	}
+
+	bcc->bcc_type = bcct;
+	bcc->bcc_bcs = bcs;
+
+	return bcc;
+}
+
+void control_cmd_free(struct bfd_control_cmd *bcc)
+{
+	free(bcc->bcc_bpv.bpv_bpcv);
+	free(bcc->bcc_buf);
+	free(bcc);
+}
+
+
 /*
  * Client handling
  */
 struct bfd_control_socket *control_new(int sd)
 {
 	struct bfd_control_socket *bcs;
+	struct bfd_control_cmd *bcc;
 
 	bcs = calloc(1, sizeof(*bcs));
 	if (bcs == NULL)
 		return NULL;
 
+	bcc = control_cmd_new(bcs, BCCT_OPEN);
+	if (bcc == NULL) {
+		free(bcs);
+		return NULL;
+	}
+
 	/* Disable notifications by default. */
 	bcs->bcs_notify = 0;
 
 	bcs->bcs_sd = sd;
-	event_assign(&bcs->bcs_ev, bglobal.bg_eb, sd, EV_READ | EV_PERSIST,
+	event_assign(&bcs->bcs_ev, bglobal.bg_ceb, sd, EV_READ | EV_PERSIST,
 		     control_read, bcs);
-	event_assign(&bcs->bcs_outev, bglobal.bg_eb, sd, EV_WRITE | EV_PERSIST,
+	event_assign(&bcs->bcs_outev, bglobal.bg_ceb, sd, EV_WRITE | EV_PERSIST,
 		     control_write, bcs);
-	event_add(&bcs->bcs_ev, NULL);
 
 	TAILQ_INIT(&bcs->bcs_bcqueue);
-	TAILQ_INIT(&bcs->bcs_bnplist);
-	TAILQ_INSERT_TAIL(&bglobal.bg_bcslist, bcs, bcs_entry);
+	TAILQ_INIT(&bcs->bcs_bnpelist);
+
+	bcs->bcs_closecmd.bcc_type = BCCT_CLOSE;
+	bcs->bcs_closecmd.bcc_bcs = bcs;
+	bcs->bcs_closeq.bcq_type = BCQT_CLOSE;
+	bcs->bcs_closeq.bcq_bcs = bcs;
+	bcs->bcs_releaseq.bcq_type = BCQT_RELEASE;
+	bcs->bcs_releaseq.bcq_bcs = bcs;
+
+	/* The protocol thread learns about the socket before its requests. */
+	control_mbox_post(&bglobal.bg_cmdq, &bcc->bcc_mbe);
+	event_add(&bcs->bcs_ev, NULL);
 
 	return bcs;
 }
 
+/* Protocol thread: starts handling the new socket. */
+void control_open(struct bfd_control_socket *bcs)
+{
+	evtimer_assign(&bcs->bcs_coalesce_ev, bglobal.bg_eb,
+		       control_coalesce_timer, bcs);
+	TAILQ_INSERT_TAIL(&bglobal.bg_bcslist, bcs, bcs_entry);
+}
+
+/*
+ * Protocol thread: releases the notification state of a closed socket and
+ * gives it back to the control thread to be freed.
+ */
 void control_free(struct bfd_control_socket *bcs)
 {
-	struct bfd_control_queue *bcq;
-	struct bfd_notify_peer *bnp;
+	struct bfd_notify_peer *bnp, *bnptmp;
+
+	bcs->bcs_closing = true;
+	event_del(&bcs->bcs_coalesce_ev);
+
+	TAILQ_REMOVE(&bglobal.bg_bcslist, bcs, bcs_entry);
+
+	/* Empty notification list. */
+	HASH_ITER (bnp_hh, bcs->bcs_bnphash, bnp, bnptmp) {
+		control_notifypeer_free(bcs, bnp);
+	}
+
+	/* Drop the held notifications. */
+	while (!TAILQ_EMPTY(&bcs->bcs_bnpelist))
+		control_coalesce_free(bcs, TAILQ_FIRST(&bcs->bcs_bnpelist));
+
+	control_mbox_post(&bglobal.bg_outq, &bcs->bcs_releaseq.bcq_mbe);
+}
+
+/*
+ * Closes the connection from the protocol thread: the control thread
+ * stops the socket I/O and answers with BCCT_CLOSE (see `control_free`).
+ */
+void control_close(struct bfd_control_socket *bcs)
+{
+	if (bcs->bcs_closing)
+		return;
+
+	bcs->bcs_closing = true;
+	control_mbox_post(&bglobal.bg_outq, &bcs->bcs_closeq.bcq_mbe);
+}
+
+/* Control thread: stops the socket I/O and tells the protocol thread. */
+void control_io_close(struct bfd_control_socket *bcs)
+{
+	if (bcs->bcs_ioclosed)
+		return;
 
+	bcs->bcs_ioclosed = true;
 	event_del(&bcs->bcs_outev);
 	event_del(&bcs->bcs_ev);
-	close(bcs->bcs_sd);
+	control_inbuf_free(bcs);
 
-	TAILQ_REMOVE(&bglobal.bg_bcslist, bcs, bcs_entry);
+	control_mbox_post(&bglobal.bg_cmdq, &bcs->bcs_closecmd.bcc_mbe);
+}
+
+/* Control thread: the protocol thread is done with the socket. */
+void control_release(struct bfd_control_socket *bcs)
+{
+	struct bfd_control_queue *bcq;
 
 	/* Empty output queue. */
 	while (!TAILQ_EMPTY(&bcs->bcs_bcqueue)) {
 		bcq = TAILQ_FIRST(&bcs->bcs_bcqueue);
+		TAILQ_REMOVE(&bcs->bcs_bcqueue, bcq, bcq_entry);
 		control_queue_free(bcs, bcq);
 	}
 
-	/* Empty notification list. */
-	while (!TAILQ_EMPTY(&bcs->bcs_bnplist)) {
-		bnp = TAILQ_FIRST(&bcs->bcs_bnplist);
-		control_notifypeer_free(bcs, bnp);
+	close(bcs->bcs_sd);
+	free(bcs);
+}
+
+/*
+ * Control thread: writes the messages queued before the handover request
+ * and sends the snapshot. The connection is closed on failure: the new
+ * daemon can't parse anything after a partial transfer.
+ */
+void control_handover_send(struct bfd_control_socket *bcs,
+			   struct bfd_control_queue *bcq)
+{
+	struct bfd_handover *bho = bcq->bcq_bho;
+	struct timeval tv = {
+		.tv_sec = BFD_HANDOVER_TIMEOUT,
+	};
+	int flags, result = -1;
+
+	free(bcq);
+	if (bcs->bcs_ioclosed)
+		goto done;
+
+	/* Nothing else is read or written on the connection. */
+	event_del(&bcs->bcs_ev);
+	event_del(&bcs->bcs_outev);
+
+	/* A new daemon that doesn't read must not freeze the sessions. */
+	flags = fcntl(bcs->bcs_sd, F_GETFL);
+	if (flags == -1
+	    || fcntl(bcs->bcs_sd, F_SETFL, flags & ~O_NONBLOCK) == -1
+	    || setsockopt(bcs->bcs_sd, SOL_SOCKET, SO_SNDTIMEO, &tv,
+			  sizeof(tv))
+		       == -1) {
+		log_warning("%s: %s\n", __FUNCTION__, strerror(errno));
+		control_io_close(bcs);
+		goto done;
 	}
 
-	control_reset_buf(&bcs->bcs_bin);
-	free(bcs);
+	while (bcs->bcs_bout != NULL && !bcs->bcs_ioclosed)
+		control_write(bcs->bcs_sd, EV_WRITE, bcs);
+	if (bcs->bcs_ioclosed)
+		goto done;
+
+	result = bfd_handover_send(bho, bcs->bcs_sd);
+	if (result != 0)
+		control_io_close(bcs);
+
+done:
+	bfd_handover_done(bho, result);
 }
 
 struct bfd_notify_peer *control_notifypeer_new(struct bfd_control_socket *bcs,
@@ -214,8 +754,10 @@ struct bfd_notify_peer *control_notifypeer_new(struct bfd_control_socket *bcs,
 		return NULL;
 	}
 
-	TAILQ_INSERT_TAIL(&bcs->bcs_bnplist, bnp, bnp_entry);
+	bnp->bnp_bcs = bcs;
 	bnp->bnp_bs = bs;
+	HASH_ADD(bnp_hh, bcs->bcs_bnphash, bnp_bs, sizeof(bnp->bnp_bs), bnp);
+	TAILQ_INSERT_TAIL(&bs->notify_list, bnp, bnp_sentry);
 	bs->refcount++;
 
 	return bnp;
@@ -224,7 +766,8 @@ struct bfd_notify_peer *control_notifypeer_new(struct bfd_control_socket *bcs,
 void control_notifypeer_free(struct bfd_control_socket *bcs,
 			     struct bfd_notify_peer *bnp)
 {
-	TAILQ_REMOVE(&bcs->bcs_bnplist, bnp, bnp_entry);
+	HASH_DELETE(bnp_hh, bcs->bcs_bnphash, bnp);
+	TAILQ_REMOVE(&bnp->bnp_bs->notify_list, bnp, bnp_sentry);
 	bnp->bnp_bs->refcount--;
 	free(bnp);
 }
@@ -234,35 +777,164 @@ struct bfd_notify_peer *control_notifypeer_find(struct bfd_control_socket *bcs,
 {
 	struct bfd_notify_peer *bnp;
 
-	TAILQ_FOREACH (bnp, &bcs->bcs_bnplist, bnp_entry) {
-		if (bnp->bnp_bs == bs)
-			return bnp;
+	HASH_FIND(bnp_hh, bcs->bcs_bnphash, &bs, sizeof(bs), bnp);
+
+	return bnp;
+}
+
+void control_notify_cfg_get(bfd_session *bs, struct bfd_notify_cfg *bnc)
+{
+	/* Zero the padding: the snapshots are compared with memcmp(). */
+	memset(bnc, 0, sizeof(*bnc));
+	bnc->timers = bs->timers;
+	bnc->remote_timers = bs->remote_timers;
+	bnc->up_min_tx = bs->profile->bp_txinterval * 1000;
+	bnc->flags = bs->flags & BFD_SESS_FLAG_SHUTDOWN;
+	if (bs->profile->bp_echo)
+		bnc->flags |= BFD_SESS_FLAG_ECHO;
+	bnc->detect_mult = bs->profile->bp_detectmultiplier;
+	bnc->remote_detect_mult = bs->remote_detect_mult;
+}
+
+/*
+ * Holds the notification in the control socket coalescing window.
+ * `bnc` is the configuration before the update (only for
+ * BCM_NOTIFY_CONFIG).
+ *
+ * Returns `false` if the socket doesn't coalesce notifications (or on
+ * memory shortage) and the caller must send it right away.
+ */
+bool control_coalesce_hold(struct bfd_control_socket *bcs,
+			   const struct bfd_notify_event *bne,
+			   const struct bfd_notify_cfg *bnc)
+{
+	struct bfd_notify_pending *bnpe;
+	bfd_session *bs = bne->bne_bsv[0];
+	uint64_t notify = bne->bne_notify;
+	struct timeval tv;
+	bool collapse;
+
+	/*
+	 * Slow consumers get the latest peer state/update once the queue
+	 * drains: keep holding until then to not reorder the notifications.
+	 */
+	collapse = bglobal.bg_cqpolicy == BQP_COLLAPSE
+		   && (!TAILQ_EMPTY(&bcs->bcs_bnpelist)
+		       || control_queue_full(bcs, 0));
+	if (bcs->bcs_coalesce == 0 && !collapse)
+		return false;
+
+	HASH_FIND(bnpe_hh, bcs->bcs_bnpehash, &bs, sizeof(bs), bnpe);
+	if (bnpe == NULL) {
+		bnpe = calloc(1, sizeof(*bnpe));
+		if (bnpe == NULL) {
+			log_warning("%s: calloc: %s\n", __FUNCTION__,
+				    strerror(errno));
+			return false;
+		}
+
+		bnpe->bnpe_bs = bs;
+		bnpe->bnpe_seq = bne->bne_seq;
+		HASH_ADD(bnpe_hh, bcs->bcs_bnpehash, bnpe_bs,
+			 sizeof(bnpe->bnpe_bs), bnpe);
+		TAILQ_INSERT_TAIL(&bcs->bcs_bnpelist, bnpe, bnpe_entry);
 	}
 
-	return NULL;
+	/* The previous notification is replaced by this one. */
+	if (bnpe->bnpe_notify & notify)
+		bcs->bcs_notify_merged++;
+	else if (notify == BCM_NOTIFY_CONFIG)
+		bnpe->bnpe_cfg = *bnc;
+
+	bnpe->bnpe_notify |= notify;
+
+	/* Start the window with the first held notification. */
+	if (bcs->bcs_coalesce && !evtimer_pending(&bcs->bcs_coalesce_ev, NULL)) {
+		tv.tv_sec = bcs->bcs_coalesce / MSEC_PER_SEC;
+		tv.tv_usec = (bcs->bcs_coalesce % MSEC_PER_SEC) * 1000;
+		evtimer_add(&bcs->bcs_coalesce_ev, &tv);
+	}
+
+	return true;
 }
 
-struct bfd_control_queue *control_queue_new(struct bfd_control_socket *bcs)
+void control_coalesce_free(struct bfd_control_socket *bcs,
+			   struct bfd_notify_pending *bnpe)
 {
-	struct bfd_control_queue *bcq;
+	HASH_DELETE(bnpe_hh, bcs->bcs_bnpehash, bnpe);
+	TAILQ_REMOVE(&bcs->bcs_bnpelist, bnpe, bnpe_entry);
+	free(bnpe);
+}
 
-	bcq = calloc(1, sizeof(*bcq));
-	if (bcq == NULL) {
-		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
-		return NULL;
+/* Drops the held notifications of a session that is going away. */
+void control_coalesce_purge(bfd_session *bs)
+{
+	struct bfd_control_socket *bcs;
+	struct bfd_notify_pending *bnpe;
+
+	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
+		if (bcs->bcs_bnpehash == NULL)
+			continue;
+
+		HASH_FIND(bnpe_hh, bcs->bcs_bnpehash, &bs, sizeof(bs), bnpe);
+		if (bnpe)
+			control_coalesce_free(bcs, bnpe);
 	}
+}
+
+/* Delivers the latest state of every session held by the window. */
+void control_coalesce_flush(struct bfd_control_socket *bcs)
+{
+	struct bfd_notify_pending *bnpe;
+	struct bfd_notify_cfg bnc;
+	bfd_session *bs;
+
+	event_del(&bcs->bcs_coalesce_ev);
+
+	while (!TAILQ_EMPTY(&bcs->bcs_bnpelist)) {
+		/* The rest is delivered when the queue drains. */
+		if (bglobal.bg_cqpolicy == BQP_COLLAPSE
+		    && control_queue_full(bcs, 0))
+			break;
+
+		bnpe = TAILQ_FIRST(&bcs->bcs_bnpelist);
+		bs = bnpe->bnpe_bs;
+
+		if (bnpe->bnpe_notify & BCM_NOTIFY_CONFIG) {
+			/* Updates that cancelled each other. */
+			control_notify_cfg_get(bs, &bnc);
+			if (memcmp(&bnc, &bnpe->bnpe_cfg, sizeof(bnc)) == 0)
+				bcs->bcs_notify_suppressed++;
+			else
+				_control_notify_config(
+					bcs, BCM_NOTIFY_CONFIG_UPDATE, bs,
+					bnpe->bnpe_seq);
+		}
+		if (bnpe->bnpe_notify & BCM_NOTIFY_PEER_STATE)
+			_control_notify(bcs, bs, bnpe->bnpe_seq);
+		if (bnpe->bnpe_notify & BCM_NOTIFY_PEER_SLA)
+			_control_notify_sla(bcs, bs, bnpe->bnpe_seq);
 
-	control_reset_buf(&bcq->bcq_bcb);
-	TAILQ_INSERT_TAIL(&bcs->bcs_bcqueue, bcq, bcq_entry);
+		control_coalesce_free(bcs, bnpe);
+	}
+}
 
-	return bcq;
+void control_coalesce_timer(evutil_socket_t sd __attribute__((unused)),
+			    short ev __attribute__((unused)), void *arg)
+{
+	control_coalesce_flush(arg);
 }
 
+/* The caller removes the entry from the output queue first. */
 void control_queue_free(struct bfd_control_socket *bcs,
 			struct bfd_control_queue *bcq)
 {
-	control_reset_buf(&bcq->bcq_bcb);
-	TAILQ_REMOVE(&bcs->bcs_bcqueue, bcq, bcq_entry);
+	__atomic_sub_fetch(&bcs->bcs_queue_msgs, 1, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&bcs->bcs_queue_bytes, bcq->bcq_bcmr->bcmr_len,
+			   __ATOMIC_SEQ_CST);
+
+	/* The buffer points to the shared message: don't free it here. */
+	control_msgref_unref(bcq->bcq_bcmr);
 	free(bcq);
 }
 
@@ -278,6 +950,7 @@ int control_queue_dequeue(struct bfd_control_socket *bcs)
 	}
 
 	bcq = TAILQ_FIRST(&bcs->bcs_bcqueue);
+	TAILQ_REMOVE(&bcs->bcs_bcqueue, bcq, bcq_entry);
 	control_queue_free(bcs, bcq);
 
 	/* Get the next buffer to send. */
@@ -293,115 +966,249 @@ int control_queue_dequeue(struct bfd_control_socket *bcs)
 	return 1;
 }
 
+/* Protocol thread: hands a message to the control thread. */
 int control_queue_enqueue(struct bfd_control_socket *bcs,
-			  struct bfd_control_msg *bcm)
+			  struct bfd_control_msgref *bcmr)
 {
 	struct bfd_control_queue *bcq;
 	struct bfd_control_buffer *bcb;
+	uint32_t msgs;
+	size_t bytes;
+
+	/* Don't bother with sockets going away. */
+	if (bcs->bcs_closing)
+		return -1;
 
-	bcq = control_queue_new(bcs);
-	if (bcq == NULL)
+	bcq = calloc(1, sizeof(*bcq));
+	if (bcq == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
 		return -1;
+	}
+
+	bcq->bcq_type = BCQT_MESSAGE;
+	bcq->bcq_bcs = bcs;
+
+	__atomic_add_fetch(&bcmr->bcmr_refcount, 1, __ATOMIC_RELAXED);
+	bcq->bcq_bcmr = bcmr;
+
+	msgs = __atomic_add_fetch(&bcs->bcs_queue_msgs, 1, __ATOMIC_SEQ_CST);
+	bytes = __atomic_add_fetch(&bcs->bcs_queue_bytes, bcmr->bcmr_len,
+				   __ATOMIC_SEQ_CST);
+	if (msgs > bcs->bcs_queue_msgs_hwm)
+		bcs->bcs_queue_msgs_hwm = msgs;
+	if (bytes > bcs->bcs_queue_bytes_hwm)
+		bcs->bcs_queue_bytes_hwm = bytes;
 
 	bcb = &bcq->bcq_bcb;
-	bcb->bcb_left = sizeof(struct bfd_control_msg) + ntohl(bcm->bcm_length);
+	bcb->bcb_left = bcmr->bcmr_len;
 	bcb->bcb_pos = 0;
-	bcb->bcb_bcm = bcm;
-
-	/* If this is the first item, then dequeue and start using it. */
-	if (bcs->bcs_bout == NULL) {
-		bcs->bcs_bout = bcb;
+	bcb->bcb_bcm = bcmr->bcmr_bcm;
 
-		/* New messages, active write events. */
-		event_add(&bcs->bcs_outev, NULL);
-	}
+	control_mbox_post(&bglobal.bg_outq, &bcq->bcq_mbe);
 
 	return 0;
 }
 
-void control_reset_buf(struct bfd_control_buffer *bcb)
+static bool control_queue_over(struct bfd_control_socket *bcs, size_t len)
 {
-	/* Get ride of old data. */
-	free(bcb->bcb_buf);
-	bcb->bcb_buf = NULL;
-	bcb->bcb_pos = 0;
-	bcb->bcb_left = 0;
+	if (bglobal.bg_cqmsgs
+	    && __atomic_load_n(&bcs->bcs_queue_msgs, __ATOMIC_SEQ_CST)
+		       >= bglobal.bg_cqmsgs)
+		return true;
+	if (bglobal.bg_cqbytes
+	    && __atomic_load_n(&bcs->bcs_queue_bytes, __ATOMIC_SEQ_CST) + len
+		       > bglobal.bg_cqbytes)
+		return true;
+
+	return false;
 }
 
-void control_read(evutil_socket_t sd, short ev __attribute__((unused)),
-		  void *arg)
+/*
+ * Tells if queueing `len` more bytes would exceed the socket limits. When
+ * it does the control thread sends BCCT_DRAINED once the queue empties.
+ */
+bool control_queue_full(struct bfd_control_socket *bcs, size_t len)
 {
-	struct bfd_control_socket *bcs = arg;
-	struct bfd_control_buffer *bcb = &bcs->bcs_bin;
-	struct bfd_control_msg bcm;
-	ssize_t bread;
-	size_t plen;
+	if (!control_queue_over(bcs, len))
+		return false;
 
-	/*
-	 * Check if we have already downloaded message content, if so then skip
-	 * to
-	 * download the rest of it and process.
-	 *
-	 * Otherwise download a new message header and allocate the necessary
-	 * memory.
-	 */
-	if (bcb->bcb_buf != NULL)
-		goto skip_header;
+	/* Check again: the queue might have drained before the flag was set. */
+	__atomic_store_n(&bcs->bcs_drain, true, __ATOMIC_SEQ_CST);
 
-	bread = read(sd, &bcm, sizeof(bcm));
-	if (bread == 0) {
-		control_free(bcs);
-		return;
-	}
-	if (bread < 0) {
-		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
-			return;
+	return control_queue_over(bcs, len);
+}
 
-		log_warning("%s: read: %s\n", __FUNCTION__, strerror(errno));
-		control_free(bcs);
-		return;
+/*
+ * Queues a notification respecting the output queue limits. Responses
+ * are not limited: they are bounded by the client requests.
+ */
+int control_queue_notify(struct bfd_control_socket *bcs,
+			 struct bfd_control_msgref *bcmr)
+{
+	if (!control_queue_full(bcs, bcmr->bcmr_len))
+		return control_queue_enqueue(bcs, bcmr);
+
+	if (bcs->bcs_closing)
+		return -1;
+
+	bcs->bcs_queue_drops++;
+	if (bglobal.bg_cqpolicy == BQP_DISCONNECT) {
+		log_warning("%s: closing slow control socket %d (%u messages, "
+			    "%zu bytes queued)\n",
+			    __FUNCTION__, bcs->bcs_sd,
+			    __atomic_load_n(&bcs->bcs_queue_msgs,
+					    __ATOMIC_RELAXED),
+			    __atomic_load_n(&bcs->bcs_queue_bytes,
+					    __ATOMIC_RELAXED));
+		control_close(bcs);
+		return -1;
 	}
 
-	/* Validate header fields. */
-	plen = ntohl(bcm.bcm_length);
-	if (plen < 2) {
-		log_debug("%s: client closed due small message length: %d\n",
-			  __FUNCTION__, bcm.bcm_length);
-		control_free(bcs);
-		return;
+	if (bcs->bcs_resync == 0)
+		log_debug("%s: control socket %d queue is full, dropping "
+			  "notifications\n",
+			  __FUNCTION__, bcs->bcs_sd);
+
+	bcs->bcs_resync++;
+
+	return -1;
+}
+
+/* The client caught up: tell it what it missed. */
+void control_queue_drained(struct bfd_control_socket *bcs)
+{
+	if (bcs->bcs_resync)
+		control_notify_resync(bcs);
+
+	/* Deliver the notifications held while the queue was full. */
+	if (!TAILQ_EMPTY(&bcs->bcs_bnpelist)
+	    && !evtimer_pending(&bcs->bcs_coalesce_ev, NULL))
+		control_coalesce_flush(bcs);
+}
+
+struct bfd_control_msgref *control_msgref_new(enum bc_msg_version bmv,
+					      enum bc_msg_type bmt, uint16_t id,
+					      size_t datalen)
+{
+	struct bfd_control_msgref *bcmr;
+
+	/*
+	 * Allocate the message reference and data in one chunk: the caller
+	 * fills `datalen` bytes of payload.
+	 */
+	bcmr = malloc(sizeof(*bcmr) + sizeof(struct bfd_control_msg)
+		      + datalen);
+	if (bcmr == NULL) {
+		log_warning("%s: malloc: %s\n", __FUNCTION__, strerror(errno));
+		return NULL;
 	}
 
-	if (bcm.bcm_ver != BMV_VERSION_1) {
-		log_debug("%s: client closed due bad version: %d\n",
-			  __FUNCTION__, bcm.bcm_ver);
-		control_free(bcs);
+	/* The creator holds the first reference. */
+	bcmr->bcmr_refcount = 1;
+	bcmr->bcmr_len = sizeof(struct bfd_control_msg) + datalen;
+	bcmr->bcmr_bcm = (struct bfd_control_msg *)(bcmr + 1);
+	bcmr->bcmr_bcm->bcm_length = htonl(datalen);
+	bcmr->bcmr_bcm->bcm_ver = bmv;
+	bcmr->bcmr_bcm->bcm_type = bmt;
+	bcmr->bcmr_bcm->bcm_id = id;
+
+	return bcmr;
+}
+
+struct bfd_control_msgref *control_msgref_json(enum bc_msg_type bmt,
+					       uint16_t id, char *jsonstr)
+{
+	struct bfd_control_msgref *bcmr;
+	size_t jsonstrlen;
+
+	jsonstrlen = strlen(jsonstr);
+	bcmr = control_msgref_new(BMV_VERSION_1, bmt, id, jsonstrlen);
+	if (bcmr != NULL)
+		memcpy(bcmr->bcmr_bcm->bcm_data, jsonstr, jsonstrlen);
+
+	free(jsonstr);
+
+	return bcmr;
+}
+
+void control_msgref_unref(struct bfd_control_msgref *bcmr)
+{
+	if (bcmr == NULL)
+		return;
+
+	/* Messages are shared by the protocol and control threads. */
+	if (__atomic_sub_fetch(&bcmr->bcmr_refcount, 1, __ATOMIC_ACQ_REL) > 0)
 		return;
+
+	free(bcmr);
+}
+
+/* Makes room to read `len` more bytes after the data not parsed yet. */
+int control_inbuf_reserve(struct bfd_control_socket *bcs, size_t len)
+{
+	size_t size;
+	uint8_t *buf;
+
+	/* Move the partial message to the buffer start. */
+	if (bcs->bcs_inpos > 0) {
+		memmove(bcs->bcs_inbuf, &bcs->bcs_inbuf[bcs->bcs_inpos],
+			bcs->bcs_inlen - bcs->bcs_inpos);
+		bcs->bcs_inlen -= bcs->bcs_inpos;
+		bcs->bcs_inpos = 0;
 	}
 
-	/* Prepare the buffer to load the message. */
-	bcs->bcs_version = bcm.bcm_ver;
-	bcs->bcs_type = bcm.bcm_type;
+	if (bcs->bcs_inlen + len <= bcs->bcs_insize)
+		return 0;
 
-	bcb->bcb_pos = sizeof(bcm);
-	bcb->bcb_left = plen;
-	bcb->bcb_buf = malloc(sizeof(bcm) + bcb->bcb_left + 1);
-	if (bcb->bcb_buf == NULL) {
-		log_warning("%s: not enough memory for message size: %u\n",
-			    __FUNCTION__, bcb->bcb_left);
-		control_free(bcs);
-		return;
+	size = bcs->bcs_insize ? bcs->bcs_insize : CONTROL_READ_SIZE;
+	while (size < bcs->bcs_inlen + len)
+		size *= 2;
+
+	buf = realloc(bcs->bcs_inbuf, size + 1);
+	if (buf == NULL) {
+		log_warning("%s: not enough memory for message size: %zu\n",
+			    __FUNCTION__, bcs->bcs_inlen + len);
+		return -1;
 	}
 
-	memcpy(bcb->bcb_buf, &bcm, sizeof(bcm));
+	bcs->bcs_inbuf = buf;
+	bcs->bcs_insize = size;
+
+	return 0;
+}
+
+void control_inbuf_free(struct bfd_control_socket *bcs)
+{
+	free(bcs->bcs_inbuf);
+	bcs->bcs_inbuf = NULL;
+	bcs->bcs_insize = 0;
+	bcs->bcs_inpos = 0;
+	bcs->bcs_inlen = 0;
+}
+
+/*
+ * Reads as much as the buffer holds and parses every complete message:
+ * the requests are parsed in place, without copying them.
+ */
+void control_read(evutil_socket_t sd, short ev __attribute__((unused)),
+		  void *arg)
+{
+	struct bfd_control_socket *bcs = arg;
+	struct bfd_control_msg bcm;
+	ssize_t bread;
+	size_t plen, msglen, avail;
+	uint8_t *msgend, msgendc;
 
-	/* Terminate data string with NULL for later processing. */
-	bcb->bcb_buf[sizeof(bcm) + bcb->bcb_left] = 0;
+	if (bcs->bcs_inlen == bcs->bcs_insize
+	    && control_inbuf_reserve(bcs, CONTROL_READ_SIZE) != 0) {
+		control_io_close(bcs);
+		return;
+	}
 
-skip_header:
-	/* Download the remaining data of the message and process it. */
-	bread = read(sd, &bcb->bcb_buf[bcb->bcb_pos], bcb->bcb_left);
+	bread = read(sd, &bcs->bcs_inbuf[bcs->bcs_inlen],
+		     bcs->bcs_insize - bcs->bcs_inlen);
 	if (bread == 0) {
-		control_free(bcs);
+		control_io_close(bcs);
 		return;
 	}
 	if (bread < 0) {
@@ -409,145 +1216,444 @@ skip_header:
 			return;
 
 		log_warning("%s: read: %s\n", __FUNCTION__, strerror(errno));
-		control_free(bcs);
+		control_io_close(bcs);
 		return;
 	}
 
-	bcb->bcb_pos += bread;
-	bcb->bcb_left -= bread;
-	/* We need more data, return to wait more. */
-	if (bcb->bcb_left > 0)
+	bcs->bcs_inlen += bread;
+
+	while (bcs->bcs_inlen - bcs->bcs_inpos >= sizeof(bcm)) {
+		/* Validate header fields. */
+		memcpy(&bcm, &bcs->bcs_inbuf[bcs->bcs_inpos], sizeof(bcm));
+		plen = ntohl(bcm.bcm_length);
+		if (bcm.bcm_ver == BMV_VERSION_1 && plen < 2) {
+			log_debug("%s: client closed due small message length: "
+				  "%d\n",
+				  __FUNCTION__, bcm.bcm_length);
+			control_io_close(bcs);
+			return;
+		}
+
+		if (bcm.bcm_ver != BMV_VERSION_1
+		    && bcm.bcm_ver != BMV_VERSION_2) {
+			log_debug("%s: client closed due bad version: %d\n",
+				  __FUNCTION__, bcm.bcm_ver);
+			control_io_close(bcs);
+			return;
+		}
+
+		if (plen > CONTROL_MSG_MAX) {
+			log_debug("%s: client closed due large message length: "
+				  "%zu\n",
+				  __FUNCTION__, plen);
+			control_io_close(bcs);
+			return;
+		}
+
+		/* The first message selects the connection protocol version. */
+		if (bcs->bcs_rversion == 0) {
+			bcs->bcs_rversion = bcm.bcm_ver;
+		} else if (bcs->bcs_rversion != bcm.bcm_ver) {
+			log_debug("%s: client closed due version change: %d -> "
+				  "%d\n",
+				  __FUNCTION__, bcs->bcs_rversion, bcm.bcm_ver);
+			control_io_close(bcs);
+			return;
+		}
+
+		/* Wait for the rest of the message. */
+		msglen = sizeof(bcm) + plen;
+		avail = bcs->bcs_inlen - bcs->bcs_inpos;
+		if (avail < msglen) {
+			if (control_inbuf_reserve(bcs, msglen - avail) != 0)
+				control_io_close(bcs);
+			return;
+		}
+
+		/*
+		 * Terminate the data string with NULL for the JSON parser:
+		 * the byte belongs to the next message (or it is the spare
+		 * one), so restore it afterwards.
+		 */
+		msgend = &bcs->bcs_inbuf[bcs->bcs_inpos + msglen];
+		msgendc = *msgend;
+		*msgend = 0;
+
+		control_parse_message(
+			bcs, (struct bfd_control_msg *)&bcs->bcs_inbuf
+				     [bcs->bcs_inpos]);
+
+		/* Closing released the input buffer (see control_io_close()). */
+		if (bcs->bcs_ioclosed)
+			return;
+
+		*msgend = msgendc;
+		bcs->bcs_inpos += msglen;
+	}
+
+	/* Everything was parsed: start over or drop the large buffer. */
+	if (bcs->bcs_inpos == bcs->bcs_inlen) {
+		if (bcs->bcs_insize > CONTROL_READ_SIZE) {
+			control_inbuf_free(bcs);
+			return;
+		}
+
+		bcs->bcs_inpos = 0;
+		bcs->bcs_inlen = 0;
+	}
+}
+
+/*
+ * Control thread: parses what can be parsed without the protocol thread
+ * state and passes the request to the protocol thread.
+ */
+void control_parse_message(struct bfd_control_socket *bcs,
+			   struct bfd_control_msg *bcm)
+{
+	struct bfd_control_cmd *bcc;
+	const char *json = (const char *)bcm->bcm_data;
+	size_t datalen = ntohl(bcm->bcm_length);
+	bool labels = false;
+	int error;
+
+	bcc = control_cmd_new(bcs, BCCT_MESSAGE);
+	if (bcc == NULL) {
+		control_io_close(bcs);
 		return;
+	}
+
+	bcc->bcc_version = bcm->bcm_ver;
+	bcc->bcc_msgtype = bcm->bcm_type;
+	bcc->bcc_id = bcm->bcm_id;
 
-	switch (bcm.bcm_type) {
+	switch (bcm->bcm_type) {
 	case BMT_REQUEST_ADD:
-		control_handle_request_add(bcs, bcb->bcb_bcm);
-		break;
 	case BMT_REQUEST_DEL:
-		control_handle_request_del(bcs, bcb->bcb_bcm);
+	case BMT_REQUEST_BULK_ADD:
+	case BMT_REQUEST_BULK_DEL:
+	case BMT_NOTIFY_ADD:
+	case BMT_NOTIFY_DEL:
+		if (bcm->bcm_ver == BMV_VERSION_2)
+			error = binconfig_request_nolabel(bcm->bcm_data, datalen,
+							  bulk_collect_cb,
+							  &bcc->bcc_bpv, &labels);
+		else
+			error = config_request_nolabel(json, bulk_collect_cb,
+						       &bcc->bcc_bpv, &labels);
+
+		/* Labels are looked up by the protocol thread: copy it. */
+		if (labels) {
+			bcc->bcc_buf = malloc(sizeof(*bcm) + datalen + 1);
+			if (bcc->bcc_buf == NULL) {
+				bcc->bcc_error = "not enough memory";
+				break;
+			}
+
+			memcpy(bcc->bcc_buf, bcm, sizeof(*bcm) + datalen + 1);
+			break;
+		}
+
+		bcc->bcc_errors = error < 0 ? 1 : error;
 		break;
 	case BMT_NOTIFY:
-		control_handle_notify(bcs, bcb->bcb_bcm);
+		if (bcm->bcm_ver == BMV_VERSION_2) {
+			if (binconfig_notify_flags(bcm->bcm_data, datalen,
+						   &bcc->bcc_notify,
+						   &bcc->bcc_seq)
+			    != 0)
+				bcc->bcc_error = "failed to parse notify flags";
+			break;
+		}
+
+		if (datalen < sizeof(uint64_t)) {
+			bcc->bcc_error = "failed to parse notify flags";
+			break;
+		}
+
+		memcpy(&bcc->bcc_notify, bcm->bcm_data, sizeof(uint64_t));
+		/* Optional sequence number to resume from. */
+		if (datalen >= 2 * sizeof(uint64_t))
+			memcpy(&bcc->bcc_seq, &bcm->bcm_data[sizeof(uint64_t)],
+			       sizeof(bcc->bcc_seq));
 		break;
-	case BMT_NOTIFY_ADD:
-		control_handle_notify_add(bcs, bcb->bcb_bcm);
+	case BMT_NOTIFY_COALESCE:
+		if (bcm->bcm_ver == BMV_VERSION_2)
+			error = binconfig_notify_coalesce(bcm->bcm_data, datalen,
+							  &bcc->bcc_window);
+		else
+			error = config_notify_coalesce(json, &bcc->bcc_window);
+		if (error != 0)
+			bcc->bcc_error = "invalid coalescing window";
 		break;
-	case BMT_NOTIFY_DEL:
-		control_handle_notify_del(bcs, bcb->bcb_bcm);
+	case BMT_QUERY:
+		if (bcm->bcm_ver == BMV_VERSION_2)
+			error = binconfig_query(bcm->bcm_data, datalen,
+						&bcc->bcc_bq);
+		else
+			error = config_query(json, &bcc->bcc_bq);
+		if (error != 0)
+			bcc->bcc_error = "failed to parse query";
+		break;
+	case BMT_STATS:
+	case BMT_RELOAD:
+	case BMT_HANDOVER:
 		break;
 
 	default:
 		log_debug("%s: unhandled message type: %d\n", __FUNCTION__,
-			  bcm.bcm_type);
-		control_response(bcs, bcm.bcm_id, BCM_RESPONSE_ERROR,
-				 "invalid message type");
+			  bcm->bcm_type);
+		bcc->bcc_error = "invalid message type";
 		break;
 	}
 
-	bcs->bcs_version = 0;
-	bcs->bcs_type = 0;
-	control_reset_buf(bcb);
+	control_mbox_post(&bglobal.bg_cmdq, &bcc->bcc_mbe);
 }
 
 void control_write(evutil_socket_t sd, short ev __attribute__((unused)),
 		   void *arg)
 {
 	struct bfd_control_socket *bcs = arg;
-	struct bfd_control_buffer *bcb = bcs->bcs_bout;
+	struct bfd_control_buffer *bcb;
+	struct bfd_control_queue *bcq;
+	struct bfd_control_cmd *bcc;
+	struct iovec iov[CONTROL_WRITE_IOV_MAX];
 	ssize_t bwrite;
+	int iovcnt = 0;
+
+	/*
+	 * Gather as many queued messages as possible: the first one might
+	 * have been partially written already (see `bcb_pos`).
+	 */
+	TAILQ_FOREACH (bcq, &bcs->bcs_bcqueue, bcq_entry) {
+		bcb = &bcq->bcq_bcb;
+		iov[iovcnt].iov_base = &bcb->bcb_buf[bcb->bcb_pos];
+		iov[iovcnt].iov_len = bcb->bcb_left;
+		if (++iovcnt == CONTROL_WRITE_IOV_MAX)
+			break;
+	}
+
+	/* Nothing to write, stop the write event. */
+	if (iovcnt == 0) {
+		control_queue_dequeue(bcs);
+		return;
+	}
 
-	bwrite = write(sd, &bcb->bcb_buf[bcb->bcb_pos], bcb->bcb_left);
+	bwrite = writev(sd, iov, iovcnt);
 	if (bwrite == 0) {
-		control_free(bcs);
+		control_io_close(bcs);
 		return;
 	}
 	if (bwrite < 0) {
 		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
 			return;
 
-		log_warning("%s: write: %s\n", __FUNCTION__, strerror(errno));
-		control_free(bcs);
+		log_warning("%s: writev: %s\n", __FUNCTION__, strerror(errno));
+		control_io_close(bcs);
 		return;
 	}
 
-	bcb->bcb_pos += bwrite;
-	bcb->bcb_left -= bwrite;
-	if (bcb->bcb_left > 0)
-		return;
+	/* Release fully written messages and account the partial one. */
+	while (bwrite > 0 && bcs->bcs_bout != NULL) {
+		bcb = bcs->bcs_bout;
+		if ((size_t)bwrite < bcb->bcb_left) {
+			bcb->bcb_pos += bwrite;
+			bcb->bcb_left -= bwrite;
+			return;
+		}
+
+		bwrite -= bcb->bcb_left;
+		bcb->bcb_pos += bcb->bcb_left;
+		bcb->bcb_left = 0;
+		control_queue_dequeue(bcs);
+	}
+
+	/* The protocol thread is waiting for the queue to drain. */
+	if (bcs->bcs_bout == NULL
+	    && __atomic_exchange_n(&bcs->bcs_drain, false, __ATOMIC_SEQ_CST)) {
+		bcc = control_cmd_new(bcs, BCCT_DRAINED);
+		if (bcc == NULL) {
+			__atomic_store_n(&bcs->bcs_drain, true,
+					 __ATOMIC_SEQ_CST);
+			return;
+		}
 
-	control_queue_dequeue(bcs);
+		control_mbox_post(&bglobal.bg_cmdq, &bcc->bcc_mbe);
+	}
 }
 
 
 /*
  * Message processing
  */
-void control_handle_request_add(struct bfd_control_socket *bcs,
-				struct bfd_control_msg *bcm)
+void control_handle_message(struct bfd_control_socket *bcs,
+			    struct bfd_control_cmd *bcc)
 {
-	const char *json = (const char *)bcm->bcm_data;
+	struct bfd_control_msg *bcm;
 
-	if (config_request_add(json) == 0)
-		control_response(bcs, bcm->bcm_id, BCM_RESPONSE_OK, NULL);
-	else
-		control_response(bcs, bcm->bcm_id, BCM_RESPONSE_ERROR,
-				 "request add failed");
+	bcs->bcs_version = bcc->bcc_version;
+
+	if (bcc->bcc_error) {
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+				 bcc->bcc_error);
+		return;
+	}
+
+	/* The request references peers by label: parse it here. */
+	if (bcc->bcc_buf) {
+		bcm = (struct bfd_control_msg *)bcc->bcc_buf;
+		if (bcc->bcc_version == BMV_VERSION_2)
+			bcc->bcc_errors = binconfig_request(
+				bcm->bcm_data, ntohl(bcm->bcm_length),
+				bulk_collect_cb, &bcc->bcc_bpv);
+		else
+			bcc->bcc_errors = config_request(
+				(const char *)bcm->bcm_data, bulk_collect_cb,
+				&bcc->bcc_bpv);
+		if (bcc->bcc_errors < 0)
+			bcc->bcc_errors = 1;
+	}
+
+	switch (bcc->bcc_msgtype) {
+	case BMT_REQUEST_ADD:
+	case BMT_REQUEST_DEL:
+		control_handle_request(bcs, bcc);
+		break;
+	case BMT_REQUEST_BULK_ADD:
+	case BMT_REQUEST_BULK_DEL:
+		control_handle_request_bulk(bcs, bcc);
+		break;
+	case BMT_NOTIFY:
+		control_handle_notify(bcs, bcc);
+		break;
+	case BMT_NOTIFY_ADD:
+	case BMT_NOTIFY_DEL:
+		control_handle_notify_peers(bcs, bcc);
+		break;
+	case BMT_NOTIFY_COALESCE:
+		control_handle_notify_coalesce(bcs, bcc);
+		break;
+	case BMT_STATS:
+		control_handle_stats(bcs, bcc->bcc_id);
+		break;
+	case BMT_RELOAD:
+		if (parse_config_reload(bglobal.bg_config) == 0)
+			control_response(bcs, bcc->bcc_id, BCM_RESPONSE_OK,
+					 NULL);
+		else
+			control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+					 "configuration reload failed");
+		break;
+	case BMT_HANDOVER:
+		control_handover(bcs, bcc->bcc_id);
+		break;
+	case BMT_QUERY:
+		control_handle_query(bcs, bcc);
+		break;
+
+	default:
+		/* Rejected by `control_parse_message`. */
+		break;
+	}
 }
 
-void control_handle_request_del(struct bfd_control_socket *bcs,
-				struct bfd_control_msg *bcm)
+void control_handle_request(struct bfd_control_socket *bcs,
+			    struct bfd_control_cmd *bcc)
 {
-	const char *json = (const char *)bcm->bcm_data;
-
-	if (config_request_del(json) == 0)
-		control_response(bcs, bcm->bcm_id, BCM_RESPONSE_OK, NULL);
+	struct bfd_peer_vec *bpv = &bcc->bcc_bpv;
+	bpc_handle bh;
+	size_t idx;
+
+	bh = (bcc->bcc_msgtype == BMT_REQUEST_ADD) ? config_add : config_del;
+	for (idx = 0; idx < bpv->bpv_cnt; idx++)
+		bcc->bcc_errors += (bh(&bpv->bpv_bpcv[idx], NULL) != 0);
+
+	if (bcc->bcc_errors == 0)
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_OK, NULL);
+	else if (bcc->bcc_msgtype == BMT_REQUEST_ADD)
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+				 "request add failed");
 	else
-		control_response(bcs, bcm->bcm_id, BCM_RESPONSE_ERROR,
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
 				 "request del failed");
 }
 
-static bfd_session *_notify_find_peer(struct bfd_peer_cfg *bpc)
+int bulk_collect_cb(struct bfd_peer_cfg *bpc, void *arg)
 {
-	struct peer_label *pl;
-	bfd_session *bs;
-	bfd_shop_key shop;
-	bfd_mhop_key mhop;
+	struct bfd_peer_vec *bpv = arg;
+	struct bfd_peer_cfg *bpcv;
+	size_t size;
+
+	if (bpv->bpv_cnt == bpv->bpv_size) {
+		size = bpv->bpv_size ? bpv->bpv_size * 2 : 64;
+		bpcv = realloc(bpv->bpv_bpcv, size * sizeof(*bpcv));
+		if (bpcv == NULL) {
+			log_warning("%s: realloc: %s\n", __FUNCTION__,
+				    strerror(errno));
+			return -1;
+		}
 
-	if (bpc->bpc_has_label) {
-		pl = pl_find(bpc->bpc_label);
-		if (pl)
-			return pl->pl_bs;
+		bpv->bpv_bpcv = bpcv;
+		bpv->bpv_size = size;
 	}
 
-	memset(&shop, 0, sizeof(shop));
-	if (bpc->bpc_mhop) {
-		memset(&mhop, 0, sizeof(mhop));
-		mhop.peer = bpc->bpc_peer;
-		mhop.local = bpc->bpc_local;
-		if (bpc->bpc_has_vrfname)
-			strxcpy(mhop.vrf_name, bpc->bpc_vrfname,
-				sizeof(mhop.vrf_name));
+	bpv->bpv_bpcv[bpv->bpv_cnt++] = *bpc;
 
-		bs = bfd_find_mhop(&mhop);
-	} else {
-		memset(&shop, 0, sizeof(shop));
-		shop.peer = bpc->bpc_peer;
-		if (!bpc->bpc_has_vxlan && bpc->bpc_has_localif)
-			strxcpy(shop.port_name, bpc->bpc_localif,
-				sizeof(shop.port_name));
+	return 0;
+}
 
-		bs = bfd_find_shop(&shop);
+void control_handle_request_bulk(struct bfd_control_socket *bcs,
+				 struct bfd_control_cmd *bcc)
+{
+	struct bfd_peer_vec *bpv = &bcc->bcc_bpv;
+	uint8_t *results;
+	int error;
+
+	if (bcc->bcc_errors != 0) {
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+				 "failed to parse bulk request");
+		return;
 	}
 
-	return bs;
+	results = calloc(bpv->bpv_cnt + 1, sizeof(*results));
+	if (results == NULL) {
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+				 "not enough memory");
+		return;
+	}
+
+	if (bcc->bcc_msgtype == BMT_REQUEST_BULK_ADD)
+		error = ptm_bfd_sess_bulk_new(bpv->bpv_bpcv, bpv->bpv_cnt,
+					      results);
+	else
+		error = ptm_bfd_ses_bulk_del(bpv->bpv_bpcv, bpv->bpv_cnt,
+					     results);
+
+	if (error == 0)
+		control_response_results(bcs, bcc->bcc_id, BCM_RESPONSE_OK,
+					 NULL, results, bpv->bpv_cnt);
+	else
+		control_response_results(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+					 "bulk request failed", results,
+					 bpv->bpv_cnt);
+
+	free(results);
 }
 
 void control_handle_notify(struct bfd_control_socket *bcs,
-			   struct bfd_control_msg *bcm)
+			   struct bfd_control_cmd *bcc)
 {
-	bcs->bcs_notify = *(uint64_t *)bcm->bcm_data;
+	uint64_t seq = bcc->bcc_seq;
+	bool resumed;
 
-	control_response(bcs, bcm->bcm_id, BCM_RESPONSE_OK, NULL);
+	bcs->bcs_notify = bcc->bcc_notify;
+
+	/* Only send what the client missed if we still have all of it. */
+	resumed = seq != 0 && control_journal_check(bcs, seq);
+	control_response_notify(bcs, bcc->bcc_id, resumed);
+	if (resumed) {
+		control_journal_replay(bcs, seq);
+		return;
+	}
 
 	/*
 	 * If peer asked for notification configuration, send everything that
@@ -559,9 +1665,10 @@ void control_handle_notify(struct bfd_control_socket *bcs,
 
 		HASH_ITER (sh, session_hash, bs, tmp) {
 			/* Notify peer configuration. */
-			_control_notify_config(bcs, BCM_NOTIFY_CONFIG_ADD, bs);
+			_control_notify_config(bcs, BCM_NOTIFY_CONFIG_ADD, bs,
+					       bglobal.bg_nseq);
 			/* Notify peer status. */
-			_control_notify(bcs, bs);
+			_control_notify(bcs, bs, bglobal.bg_nseq);
 		}
 	}
 
@@ -575,7 +1682,7 @@ void control_handle_notify(struct bfd_control_socket *bcs,
 
 		HASH_ITER (sh, session_hash, bs, tmp) {
 			/* Notify peer status. */
-			_control_notify(bcs, bs);
+			_control_notify(bcs, bs, bglobal.bg_nseq);
 		}
 	}
 }
@@ -583,7 +1690,7 @@ void control_handle_notify(struct bfd_control_socket *bcs,
 int notify_add_cb(struct bfd_peer_cfg *bpc, void *arg)
 {
 	struct bfd_control_socket *bcs = arg;
-	bfd_session *bs = _notify_find_peer(bpc);
+	bfd_session *bs = bs_peer_find(bpc);
 
 	if (bs == NULL)
 		return -1;
@@ -592,7 +1699,7 @@ int notify_add_cb(struct bfd_peer_cfg *bpc, void *arg)
 		return -1;
 
 	/* Notify peer status. */
-	_control_notify(bcs, bs);
+	_control_notify(bcs, bs, bglobal.bg_nseq);
 
 	return 0;
 }
@@ -600,7 +1707,7 @@ int notify_add_cb(struct bfd_peer_cfg *bpc, void *arg)
 int notify_del_cb(struct bfd_peer_cfg *bpc, void *arg)
 {
 	struct bfd_control_socket *bcs = arg;
-	bfd_session *bs = _notify_find_peer(bpc);
+	bfd_session *bs = bs_peer_find(bpc);
 	struct bfd_notify_peer *bnp;
 
 	if (bs == NULL)
@@ -613,252 +1720,763 @@ int notify_del_cb(struct bfd_peer_cfg *bpc, void *arg)
 	return 0;
 }
 
-void control_handle_notify_add(struct bfd_control_socket *bcs,
-			       struct bfd_control_msg *bcm)
+void control_handle_notify_peers(struct bfd_control_socket *bcs,
+				 struct bfd_control_cmd *bcc)
 {
-	const char *json = (const char *)bcm->bcm_data;
+	struct bfd_peer_vec *bpv = &bcc->bcc_bpv;
+	bpc_handle bh;
+	size_t idx;
 
-	if (config_notify_request(bcs, json, notify_add_cb) == 0) {
-		control_response(bcs, bcm->bcm_id, BCM_RESPONSE_OK, NULL);
+	bh = (bcc->bcc_msgtype == BMT_NOTIFY_ADD) ? notify_add_cb
+						   : notify_del_cb;
+	for (idx = 0; idx < bpv->bpv_cnt; idx++)
+		bcc->bcc_errors += (bh(&bpv->bpv_bpcv[idx], bcs) != 0);
+
+	if (bcc->bcc_errors == 0) {
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_OK, NULL);
 		return;
 	}
 
-	control_response(bcs, bcm->bcm_id, BCM_RESPONSE_ERROR,
+	control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
 			 "failed to parse notify data");
 }
 
-void control_handle_notify_del(struct bfd_control_socket *bcs,
-			       struct bfd_control_msg *bcm)
+void control_handle_notify_coalesce(struct bfd_control_socket *bcs,
+				    struct bfd_control_cmd *bcc)
 {
-	const char *json = (const char *)bcm->bcm_data;
+	/* Deliver what was held with the old window. */
+	control_coalesce_flush(bcs);
+	bcs->bcs_coalesce = bcc->bcc_window;
+
+	control_response(bcs, bcc->bcc_id, BCM_RESPONSE_OK, NULL);
+}
+
+void control_handle_stats(struct bfd_control_socket *bcs, uint16_t id)
+{
+	struct bfd_control_msgref *bcmr;
+	char *jsonstr;
 
-	if (config_notify_request(bcs, json, notify_del_cb) == 0) {
-		control_response(bcs, bcm->bcm_id, BCM_RESPONSE_OK, NULL);
+	if (bcs->bcs_version == BMV_VERSION_2) {
+		bcmr = binconfig_control_stats(id);
+	} else {
+		jsonstr = config_control_stats();
+		if (jsonstr == NULL) {
+			control_response(bcs, id, BCM_RESPONSE_ERROR,
+					 "failed to generate statistics");
+			return;
+		}
+
+		bcmr = control_msgref_json(BMT_RESPONSE, id, jsonstr);
+	}
+	if (bcmr == NULL)
 		return;
+
+	control_queue_enqueue(bcs, bcmr);
+	control_msgref_unref(bcmr);
+}
+
+bool control_query_match(struct bfd_query *bq, bfd_session *bs)
+{
+	bool mhop = BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH);
+	bool ipv6 = BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_IPV6);
+
+	if ((bq->bq_flags & BCQ_F_STATE) && bs->ses_state != bq->bq_state)
+		return false;
+	if ((bq->bq_flags & BCQ_F_MHOP) && !mhop)
+		return false;
+	if ((bq->bq_flags & BCQ_F_SHOP) && mhop)
+		return false;
+	if ((bq->bq_flags & BCQ_F_IPV6) && !ipv6)
+		return false;
+	if ((bq->bq_flags & BCQ_F_IPV4) && ipv6)
+		return false;
+	if ((bq->bq_flags & BCQ_F_LABEL)
+	    && (bs->pl == NULL
+		|| strncmp(bs->pl->pl_label, bq->bq_label,
+			   strlen(bq->bq_label))
+			   != 0))
+		return false;
+	/* Interfaces are only used by single hop and VRFs by multihop. */
+	if ((bq->bq_flags & BCQ_F_LOCALIF)
+	    && (mhop || strcmp(bs->shop.port_name, bq->bq_localif) != 0))
+		return false;
+	if ((bq->bq_flags & BCQ_F_VRFNAME)
+	    && (!mhop || strcmp(bs->mhop.vrf_name, bq->bq_vrfname) != 0))
+		return false;
+
+	return true;
+}
+
+int query_collect_cb(bfd_session *bs, void *arg)
+{
+	struct bfd_query_page *bqp = arg;
+
+	if (!control_query_match(bqp->bqp_bq, bs))
+		return 0;
+
+	/* Collect one more peer to know if there is a next page. */
+	bqp->bqp_bsv[bqp->bqp_cnt++] = bs;
+
+	return bqp->bqp_cnt > bqp->bqp_bq->bq_limit;
+}
+
+int query_label_cb(struct peer_label *pl, void *arg)
+{
+	struct bfd_query_page *bqp = arg;
+	bfd_session **bsv;
+	size_t size;
+
+	if (pl->pl_bs->discrs.my_discr <= bqp->bqp_bq->bq_cursor
+	    || !control_query_match(bqp->bqp_bq, pl->pl_bs))
+		return 0;
+
+	if (bqp->bqp_cnt == bqp->bqp_size) {
+		size = bqp->bqp_size * 2;
+		bsv = realloc(bqp->bqp_bsv, size * sizeof(*bsv));
+		if (bsv == NULL)
+			return -1;
+
+		bqp->bqp_bsv = bsv;
+		bqp->bqp_size = size;
 	}
 
-	control_response(bcs, bcm->bcm_id, BCM_RESPONSE_ERROR,
-			 "failed to parse notify data");
+	bqp->bqp_bsv[bqp->bqp_cnt++] = pl->pl_bs;
+
+	return 0;
 }
 
+int query_discr_cmp(const void *a, const void *b)
+{
+	const bfd_session *bsa = *(bfd_session *const *)a;
+	const bfd_session *bsb = *(bfd_session *const *)b;
+
+	if (bsa->discrs.my_discr < bsb->discrs.my_discr)
+		return -1;
+
+	return bsa->discrs.my_discr > bsb->discrs.my_discr;
+}
 
 /*
- * Internal functions used by the BFD daemon.
+ * Label queries only visit the labels with the prefix (see
+ * pl_foreach_prefix()) instead of every session: the matches after the
+ * cursor are then put in discriminator order to cut the page.
  */
-void control_response(struct bfd_control_socket *bcs, uint16_t id,
-		      const char *status, const char *error)
+int query_collect_label(struct bfd_query_page *bqp)
 {
-	struct bfd_control_msg *bcm;
+	if (pl_foreach_prefix(bqp->bqp_bq->bq_label, query_label_cb, bqp)
+	    != 0)
+		return -1;
+
+	qsort(bqp->bqp_bsv, bqp->bqp_cnt, sizeof(*bqp->bqp_bsv),
+	      query_discr_cmp);
+
+	/* Keep one more peer to know if there is a next page. */
+	if (bqp->bqp_cnt > bqp->bqp_bq->bq_limit + 1)
+		bqp->bqp_cnt = bqp->bqp_bq->bq_limit + 1;
+
+	return 0;
+}
+
+void control_handle_query(struct bfd_control_socket *bcs,
+			  struct bfd_control_cmd *bcc)
+{
+	struct bfd_control_msgref *bcmr;
+	struct bfd_query bq = bcc->bcc_bq;
+	struct bfd_query_page bqp;
+	uint32_t cursor = 0;
 	char *jsonstr;
-	size_t jsonstrlen;
 
-	/* Generate JSON response. */
-	jsonstr = config_response(status, error);
-	if (jsonstr == NULL) {
-		log_warning("%s: config_response: failed to get JSON str\n",
-			    __FUNCTION__);
+	memset(&bqp, 0, sizeof(bqp));
+	bqp.bqp_bq = &bq;
+	bqp.bqp_size = bq.bq_limit + 1;
+	bqp.bqp_bsv = calloc(bqp.bqp_size, sizeof(*bqp.bqp_bsv));
+	if (bqp.bqp_bsv == NULL) {
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+				 "not enough memory");
 		return;
 	}
 
-	/* Allocate data and answer. */
-	jsonstrlen = strlen(jsonstr);
-	bcm = malloc(sizeof(struct bfd_control_msg) + jsonstrlen);
-	if (bcm == NULL) {
-		log_warning("%s: malloc: %s\n", __FUNCTION__, strerror(errno));
-		free(jsonstr);
+	if (((bq.bq_flags & BCQ_F_LABEL)
+		     ? query_collect_label(&bqp)
+		     : bs_foreach_discr(bq.bq_cursor, query_collect_cb, &bqp))
+	    != 0) {
+		free(bqp.bqp_bsv);
+		control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+				 "failed to search peers");
 		return;
 	}
 
-	bcm->bcm_length = htonl(jsonstrlen);
-	bcm->bcm_ver = BMV_VERSION_1;
-	bcm->bcm_type = BMT_RESPONSE;
-	bcm->bcm_id = id;
-	memcpy(bcm->bcm_data, jsonstr, jsonstrlen);
-	free(jsonstr);
+	/* There are more peers: continue after the last one returned. */
+	if (bqp.bqp_cnt > bq.bq_limit) {
+		bqp.bqp_cnt = bq.bq_limit;
+		cursor = bqp.bqp_bsv[bqp.bqp_cnt - 1]->discrs.my_discr;
+	}
 
-	control_queue_enqueue(bcs, bcm);
+	if (bcs->bcs_version == BMV_VERSION_2) {
+		bcmr = binconfig_query_response(bcc->bcc_id, bqp.bqp_bsv,
+						bqp.bqp_cnt, cursor);
+	} else {
+		jsonstr = config_query_response(bqp.bqp_bsv, bqp.bqp_cnt,
+						cursor);
+		if (jsonstr == NULL) {
+			free(bqp.bqp_bsv);
+			control_response(bcs, bcc->bcc_id, BCM_RESPONSE_ERROR,
+					 "failed to generate response");
+			return;
+		}
+
+		bcmr = control_msgref_json(BMT_RESPONSE, bcc->bcc_id, jsonstr);
+	}
+
+	free(bqp.bqp_bsv);
+	if (bcmr == NULL)
+		return;
+
+	control_queue_enqueue(bcs, bcmr);
+	control_msgref_unref(bcmr);
 }
 
-static void _control_notify_sla(struct bfd_control_socket *bcs, bfd_session *bs)
+/*
+ * Hands the sockets and sessions over to the new daemon on the connection.
+ * The sessions are frozen until the control thread is done with the
+ * transfer, then the protocol loop stops without bringing them down.
+ */
+void control_handover(struct bfd_control_socket *bcs, uint16_t id)
 {
-	struct bfd_control_msg *bcm;
-	char *jsonstr;
-	size_t jsonstrlen;
+	struct bfd_control_queue *bcq;
+	struct bfd_handover *bho;
+	int result;
+
+	bho = bfd_handover_prepare();
+	bcq = calloc(1, sizeof(*bcq));
+	if (bho == NULL || bcq == NULL) {
+		bfd_handover_free(bho);
+		free(bcq);
+		/* Nothing was sent yet: the client can read a response. */
+		control_response(bcs, id, BCM_RESPONSE_ERROR,
+				 "handover failed");
+		return;
+	}
 
-	/* Generate JSON response. */
-	jsonstr = config_notify_sla(bs);
-	if (jsonstr == NULL) {
-		log_warning("%s: config_notify: failed to get JSON str\n",
+	bcq->bcq_type = BCQT_HANDOVER;
+	bcq->bcq_bcs = bcs;
+	bcq->bcq_bho = bho;
+	control_mbox_post(&bglobal.bg_outq, &bcq->bcq_mbe);
+
+	result = bfd_handover_wait(bho);
+	bfd_handover_free(bho);
+	if (result != 0) {
+		log_warning("%s: handover failed: keep running\n",
 			    __FUNCTION__);
 		return;
 	}
 
-	/* Allocate data and answer. */
-	jsonstrlen = strlen(jsonstr);
-	bcm = malloc(sizeof(struct bfd_control_msg) + jsonstrlen);
-	if (bcm == NULL) {
-		log_warning("%s: malloc: %s\n", __FUNCTION__, strerror(errno));
-		free(jsonstr);
+	/* The new daemon runs the sessions from now on (see main()). */
+	event_base_loopbreak(bglobal.bg_eb);
+}
+
+
+/*
+ * Internal functions used by the BFD daemon.
+ */
+void control_response(struct bfd_control_socket *bcs, uint16_t id,
+		      const char *status, const char *error)
+{
+	control_response_results(bcs, id, status, error, NULL, 0);
+}
+
+void control_response_results(struct bfd_control_socket *bcs, uint16_t id,
+			      const char *status, const char *error,
+			      const uint8_t *results, size_t rescnt)
+{
+	struct bfd_control_msgref *bcmr;
+
+	if (bcs->bcs_version == BMV_VERSION_2)
+		bcmr = binconfig_response(id, status, error, results, rescnt);
+	else
+		bcmr = config_response(id, status, error, results, rescnt);
+	if (bcmr == NULL) {
+		log_warning("%s: failed to generate response\n", __FUNCTION__);
 		return;
 	}
 
-	bcm->bcm_length = htonl(jsonstrlen);
-	bcm->bcm_ver = BMV_VERSION_1;
-	bcm->bcm_type = BMT_NOTIFY_SLA;
-	bcm->bcm_id = htons(BCM_NOTIFY_ID);
-	memcpy(bcm->bcm_data, jsonstr, jsonstrlen);
-	free(jsonstr);
+	control_queue_enqueue(bcs, bcmr);
+	control_msgref_unref(bcmr);
+}
 
-	control_queue_enqueue(bcs, bcm);
+void control_response_notify(struct bfd_control_socket *bcs, uint16_t id,
+			     bool resumed)
+{
+	struct bfd_control_msgref *bcmr;
+
+	if (bcs->bcs_version == BMV_VERSION_2)
+		bcmr = binconfig_notify_response(id, bglobal.bg_nseq, resumed);
+	else
+		bcmr = config_notify_response(id, bglobal.bg_nseq, resumed);
+	if (bcmr == NULL)
+		return;
+
+	control_queue_enqueue(bcs, bcmr);
+	control_msgref_unref(bcmr);
 }
 
-int control_notify_sla(bfd_session *bs)
+
+/*
+ * Notifications journal: the last `bg_journal_size` events are kept so
+ * reconnecting clients can resume from the last sequence number they got.
+ * Recording an event only copies its values (see `bfd_journal_entry`):
+ * the messages are serialized when a client replays it.
+ */
+int control_journal_init(void)
 {
-	struct bfd_control_socket *bcs;
-	struct bfd_notify_peer *bnp;
+	struct timespec ts;
 
 	/*
-	 * PERFORMANCE: reuse the bfd_control_msg allocated data for
-	 * all control sockets to avoid wasting memory.
+	 * Start the sequence numbers from the current time so the ones
+	 * from a previous daemon run are never mistaken for ours.
 	 */
-	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
-		/*
-		 * Test for all notifications first, then search for
-		 * specific peers.
-		 */
-		if ((bcs->bcs_notify & BCM_NOTIFY_PEER_SLA) == 0) {
-			bnp = control_notifypeer_find(bcs, bs);
-			/*
-			 * If the notification is not configured here,
-			 * don't send it.
-			 */
-			if (bnp == NULL)
-				continue;
-		}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	bglobal.bg_nseq = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	if (bglobal.bg_journal_size == 0)
+		return 0;
 
-		_control_notify_sla(bcs, bs);
+	bglobal.bg_journal = calloc(bglobal.bg_journal_size,
+				    sizeof(*bglobal.bg_journal));
+	if (bglobal.bg_journal == NULL) {
+		log_warning("%s: calloc: %s\n", __FUNCTION__, strerror(errno));
+		bglobal.bg_journal_size = 0;
+		return -1;
 	}
 
 	return 0;
 }
 
+void control_journal_add(const struct bfd_notify_event *bne,
+			 struct bfd_control_msgref **bcmr)
+{
+	struct bfd_journal_entry *bje;
+	int slot;
+
+	if (bglobal.bg_journal_size == 0)
+		return;
 
-static void _control_notify(struct bfd_control_socket *bcs, bfd_session *bs)
+	/* Replace the oldest event. */
+	bje = &bglobal.bg_journal[bne->bne_seq % bglobal.bg_journal_size];
+	_control_notify_release(bje->bje_bcmr);
+
+	bje->bje_seq = bne->bne_seq;
+	bje->bje_notify = bne->bne_notify;
+	bje->bje_op = bne->bne_op;
+	bje->bje_bulk = bne->bne_bulk;
+	if (!bne->bne_bulk)
+		control_journal_record(bje, bne->bne_bsv[0]);
+
+	/* Keep the messages already built for the connected sockets. */
+	for (slot = 0; slot < CONTROL_NOTIFY_SLOTS; slot++) {
+		bje->bje_bcmr[slot] = bcmr[slot];
+		if (bcmr[slot])
+			__atomic_add_fetch(&bcmr[slot]->bcmr_refcount, 1,
+					   __ATOMIC_RELAXED);
+	}
+}
+
+/* Copies the session values the event messages are built from. */
+void control_journal_record(struct bfd_journal_entry *bje, bfd_session *bs)
 {
-	struct bfd_control_msg *bcm;
-	char *jsonstr;
-	size_t jsonstrlen;
+	struct bfd_profile *bp = bs->profile;
 
-	/* Generate JSON response. */
-	jsonstr = config_notify(bs);
-	if (jsonstr == NULL) {
-		log_warning("%s: config_notify: failed to get JSON str\n",
-			    __FUNCTION__);
+	bje->bje_flags = bs->flags;
+	if (BFD_CHECK_FLAG(bs->flags, BFD_SESS_FLAG_MH))
+		bje->bje_mhop = bs->mhop;
+	else
+		bje->bje_shop = bs->shop;
+	bje->bje_local = bs->local_ip;
+	bje->bje_discrs = bs->discrs;
+	if (bs->pl)
+		strxcpy(bje->bje_label, bs->pl->pl_label,
+			sizeof(bje->bje_label));
+	else
+		bje->bje_label[0] = 0;
+	strxcpy(bje->bje_profile, bp->bp_name, sizeof(bje->bje_profile));
+
+	switch (bje->bje_notify) {
+	case BCM_NOTIFY_PEER_STATE:
+		bje->bje_state = bs->ses_state;
+		bje->bje_diag = bs->local_diag;
+		bje->bje_remote_diag = bs->remote_diag;
+		bje->bje_uptime = bs->uptime.tv_sec;
+		bje->bje_downtime = bs->downtime.tv_sec;
+		break;
+	case BCM_NOTIFY_PEER_SLA:
+		bje->bje_latency = bs->sla.lattency;
+		bje->bje_jitter = bs->sla.jitter;
+		bje->bje_pkt_loss = bs->sla.pkt_loss;
+		break;
+	case BCM_NOTIFY_CONFIG:
+		bje->bje_recvinterval = bp->bp_recvinterval;
+		bje->bje_txinterval = bp->bp_txinterval;
+		bje->bje_echointerval = bp->bp_echointerval;
+		bje->bje_detectmultiplier = bp->bp_detectmultiplier;
+		bje->bje_echo = bp->bp_echo;
+		bje->bje_track_sla = bp->bp_track_sla;
+		bje->bje_remote_detect_mult = bs->remote_detect_mult;
+		bje->bje_remote_timers = bs->remote_timers;
+		break;
+	}
+}
+
+/* Tells if the journal has every event the socket missed after `seq`. */
+bool control_journal_check(struct bfd_control_socket *bcs, uint64_t seq)
+{
+	struct bfd_journal_entry *bje;
+	uint64_t cur;
+
+	if (bglobal.bg_journal_size == 0 || seq > bglobal.bg_nseq
+	    || bglobal.bg_nseq - seq > bglobal.bg_journal_size)
+		return false;
+
+	for (cur = seq + 1; cur <= bglobal.bg_nseq; cur++) {
+		bje = &bglobal.bg_journal[cur % bglobal.bg_journal_size];
+		if (bje->bje_seq != cur)
+			return false;
+		/* Bulk requests no socket of this version got are missing. */
+		if ((bje->bje_notify & bcs->bcs_notify) && bje->bje_bulk
+		    && bje->bje_bcmr[CONTROL_NOTIFY_SLOT(bcs)] == NULL)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Builds the message of a recorded event in the socket version: the
+ * message builders read the event values from a scratch session.
+ */
+struct bfd_control_msgref *control_journal_msg(struct bfd_control_socket *bcs,
+					       struct bfd_journal_entry *bje)
+{
+	bfd_session bs, *bsp = &bs;
+	struct bfd_profile bp;
+	struct peer_label pl;
+	struct bfd_notify_event bne = {
+		.bne_seq = bje->bje_seq,
+		.bne_notify = bje->bje_notify,
+		.bne_op = bje->bje_op,
+		.bne_bsv = &bsp,
+		.bne_bscnt = 1,
+	};
+
+	memset(&bs, 0, sizeof(bs));
+	memset(&bp, 0, sizeof(bp));
+	bs.flags = bje->bje_flags;
+	if (BFD_CHECK_FLAG(bje->bje_flags, BFD_SESS_FLAG_MH))
+		bs.mhop = bje->bje_mhop;
+	else
+		bs.shop = bje->bje_shop;
+	bs.local_ip = bje->bje_local;
+	bs.discrs = bje->bje_discrs;
+	if (bje->bje_label[0]) {
+		strxcpy(pl.pl_label, bje->bje_label, sizeof(pl.pl_label));
+		bs.pl = &pl;
+	}
+	strxcpy(bp.bp_name, bje->bje_profile, sizeof(bp.bp_name));
+	bs.profile = &bp;
+
+	switch (bje->bje_notify) {
+	case BCM_NOTIFY_PEER_STATE:
+		bs.ses_state = bje->bje_state;
+		bs.local_diag = bje->bje_diag;
+		bs.remote_diag = bje->bje_remote_diag;
+		bs.uptime.tv_sec = bje->bje_uptime;
+		bs.downtime.tv_sec = bje->bje_downtime;
+		break;
+	case BCM_NOTIFY_PEER_SLA:
+		bs.sla.lattency = bje->bje_latency;
+		bs.sla.jitter = bje->bje_jitter;
+		bs.sla.pkt_loss = bje->bje_pkt_loss;
+		break;
+	case BCM_NOTIFY_CONFIG:
+		bp.bp_recvinterval = bje->bje_recvinterval;
+		bp.bp_txinterval = bje->bje_txinterval;
+		bp.bp_echointerval = bje->bje_echointerval;
+		bp.bp_detectmultiplier = bje->bje_detectmultiplier;
+		bp.bp_echo = bje->bje_echo;
+		bp.bp_track_sla = bje->bje_track_sla;
+		bs.remote_detect_mult = bje->bje_remote_detect_mult;
+		bs.remote_timers = bje->bje_remote_timers;
+		break;
+	}
+
+	return control_notify_msg(bcs->bcs_version, &bne);
+}
+
+void control_journal_replay(struct bfd_control_socket *bcs, uint64_t seq)
+{
+	struct bfd_journal_entry *bje;
+	struct bfd_control_msgref **bcmr;
+	uint64_t cur;
+
+	for (cur = seq + 1; cur <= bglobal.bg_nseq; cur++) {
+		bje = &bglobal.bg_journal[cur % bglobal.bg_journal_size];
+		if ((bje->bje_notify & bcs->bcs_notify) == 0)
+			continue;
+
+		/* Keep the message for the next clients of this version. */
+		bcmr = &bje->bje_bcmr[CONTROL_NOTIFY_SLOT(bcs)];
+		if (*bcmr == NULL) {
+			*bcmr = control_journal_msg(bcs, bje);
+			if (*bcmr == NULL)
+				continue;
+		}
+
+		control_queue_notify(bcs, *bcmr);
+	}
+}
+
+
+/*
+ * Notification messages are serialized only once per event and protocol
+ * version: the first socket that needs it builds the message in its
+ * version slot (`bcmr[CONTROL_NOTIFY_SLOT(bcs)]`) and the following
+ * sockets just take a reference to it. Callers that pass a `NULL`
+ * `bcmr` get a private message.
+ */
+static struct bfd_control_msgref *
+control_notify_msg(enum bc_msg_version bmv, const struct bfd_notify_event *bne)
+{
+	bfd_session *bs = bne->bne_bsv[0];
+
+	if (bmv == BMV_VERSION_2) {
+		if (bne->bne_notify == BCM_NOTIFY_PEER_STATE)
+			return binconfig_notify(bs, bne->bne_seq);
+		if (bne->bne_notify == BCM_NOTIFY_PEER_SLA)
+			return binconfig_notify_sla(bs, bne->bne_seq);
+
+		return binconfig_notify_config_bulk(bne->bne_op, bne->bne_bsv,
+						    bne->bne_bscnt,
+						    bne->bne_seq);
+	}
+
+	/* Generate JSON notification. */
+	if (bne->bne_notify == BCM_NOTIFY_PEER_STATE)
+		return config_notify(bs, bne->bne_seq);
+	if (bne->bne_notify == BCM_NOTIFY_PEER_SLA)
+		return config_notify_sla(bs, bne->bne_seq);
+	if (bne->bne_bulk)
+		return config_notify_config_bulk(bne->bne_op, bne->bne_bsv,
+						 bne->bne_bscnt, bne->bne_seq);
+
+	return config_notify_config(bne->bne_op, bs, bne->bne_seq);
+}
+
+static void _control_notify_event(struct bfd_control_socket *bcs,
+				  const struct bfd_notify_event *bne,
+				  struct bfd_control_msgref **bcmr)
+{
+	struct bfd_control_msgref *bcmrn;
+
+	/* Reuse the already serialized message. */
+	if (bcmr && bcmr[CONTROL_NOTIFY_SLOT(bcs)]) {
+		control_queue_notify(bcs, bcmr[CONTROL_NOTIFY_SLOT(bcs)]);
 		return;
 	}
 
-	/* Allocate data and answer. */
-	jsonstrlen = strlen(jsonstr);
-	bcm = malloc(sizeof(struct bfd_control_msg) + jsonstrlen);
-	if (bcm == NULL) {
-		log_warning("%s: malloc: %s\n", __FUNCTION__, strerror(errno));
-		free(jsonstr);
+	bcmrn = control_notify_msg(bcs->bcs_version, bne);
+	if (bcmrn == NULL)
 		return;
+
+	control_queue_notify(bcs, bcmrn);
+	if (bcmr)
+		bcmr[CONTROL_NOTIFY_SLOT(bcs)] = bcmrn;
+	else
+		control_msgref_unref(bcmrn);
+}
+
+static void _control_notify_release(struct bfd_control_msgref **bcmr)
+{
+	int slot;
+
+	for (slot = 0; slot < CONTROL_NOTIFY_SLOTS; slot++) {
+		control_msgref_unref(bcmr[slot]);
+		bcmr[slot] = NULL;
 	}
+}
 
-	bcm->bcm_length = htonl(jsonstrlen);
-	bcm->bcm_ver = BMV_VERSION_1;
-	bcm->bcm_type = BMT_NOTIFY;
-	bcm->bcm_id = htons(BCM_NOTIFY_ID);
-	memcpy(bcm->bcm_data, jsonstr, jsonstrlen);
-	free(jsonstr);
+void control_notify_resync(struct bfd_control_socket *bcs)
+{
+	struct bfd_control_msgref *bcmr;
+
+	if (bcs->bcs_version == BMV_VERSION_2)
+		bcmr = binconfig_notify_resync(bcs->bcs_resync);
+	else
+		bcmr = config_notify_resync(bcs->bcs_resync);
+	if (bcmr == NULL)
+		return;
+
+	/* The queue is empty: this one is not limited. */
+	if (control_queue_enqueue(bcs, bcmr) == 0)
+		bcs->bcs_resync = 0;
 
-	control_queue_enqueue(bcs, bcm);
+	control_msgref_unref(bcmr);
 }
 
-int control_notify(bfd_session *bs)
+static void _control_notify_sla(struct bfd_control_socket *bcs,
+				bfd_session *bs, uint64_t seq)
+{
+	struct bfd_notify_event bne = {
+		.bne_seq = seq,
+		.bne_notify = BCM_NOTIFY_PEER_SLA,
+		.bne_bsv = &bs,
+		.bne_bscnt = 1,
+	};
+
+	_control_notify_event(bcs, &bne, NULL);
+}
+
+int control_notify_sla(bfd_session *bs)
 {
 	struct bfd_control_socket *bcs;
 	struct bfd_notify_peer *bnp;
+	struct bfd_control_msgref *bcmr[CONTROL_NOTIFY_SLOTS] = {NULL};
+	struct bfd_notify_event bne = {
+		.bne_seq = ++bglobal.bg_nseq,
+		.bne_notify = BCM_NOTIFY_PEER_SLA,
+		.bne_bsv = &bs,
+		.bne_bscnt = 1,
+	};
 
-	/*
-	 * PERFORMANCE: reuse the bfd_control_msg allocated data for
-	 * all control sockets to avoid wasting memory.
-	 */
 	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
-		/*
-		 * Test for all notifications first, then search for
-		 * specific peers.
-		 */
-		if ((bcs->bcs_notify & BCM_NOTIFY_PEER_STATE) == 0) {
-			bnp = control_notifypeer_find(bcs, bs);
-			/*
-			 * If the notification is not configured here,
-			 * don't send it.
-			 */
-			if (bnp == NULL)
-				continue;
-		}
+		/* Send to the sockets that want all notifications. */
+		if ((bcs->bcs_notify & BCM_NOTIFY_PEER_SLA) == 0)
+			continue;
 
-		_control_notify(bcs, bs);
+		if (!control_coalesce_hold(bcs, &bne, NULL))
+			_control_notify_event(bcs, &bne, bcmr);
 	}
 
+	/* Then to the sockets that subscribed this specific peer. */
+	TAILQ_FOREACH (bnp, &bs->notify_list, bnp_sentry) {
+		if (bnp->bnp_bcs->bcs_notify & BCM_NOTIFY_PEER_SLA)
+			continue;
+
+		if (!control_coalesce_hold(bnp->bnp_bcs, &bne, NULL))
+			_control_notify_event(bnp->bnp_bcs, &bne, bcmr);
+	}
+
+	control_journal_add(&bne, bcmr);
+	_control_notify_release(bcmr);
+
 	return 0;
 }
 
-static void _control_notify_config(struct bfd_control_socket *bcs,
-				   const char *op, bfd_session *bs)
+
+static void _control_notify(struct bfd_control_socket *bcs, bfd_session *bs,
+			    uint64_t seq)
 {
-	struct bfd_control_msg *bcm;
-	char *jsonstr;
-	size_t jsonstrlen;
+	struct bfd_notify_event bne = {
+		.bne_seq = seq,
+		.bne_notify = BCM_NOTIFY_PEER_STATE,
+		.bne_bsv = &bs,
+		.bne_bscnt = 1,
+	};
 
-	/* Generate JSON response. */
-	jsonstr = config_notify_config(op, bs);
-	if (jsonstr == NULL) {
-		log_warning(
-			"%s: config_notify_config: failed to get JSON str\n",
-			__FUNCTION__);
-		return;
+	_control_notify_event(bcs, &bne, NULL);
+}
+
+int control_notify(bfd_session *bs)
+{
+	struct bfd_control_socket *bcs;
+	struct bfd_notify_peer *bnp;
+	struct bfd_control_msgref *bcmr[CONTROL_NOTIFY_SLOTS] = {NULL};
+	struct bfd_notify_event bne = {
+		.bne_seq = ++bglobal.bg_nseq,
+		.bne_notify = BCM_NOTIFY_PEER_STATE,
+		.bne_bsv = &bs,
+		.bne_bscnt = 1,
+	};
+
+	bfd_repl_update(bs);
+
+	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
+		/* Send to the sockets that want all notifications. */
+		if ((bcs->bcs_notify & BCM_NOTIFY_PEER_STATE) == 0)
+			continue;
+
+		if (!control_coalesce_hold(bcs, &bne, NULL))
+			_control_notify_event(bcs, &bne, bcmr);
 	}
 
-	/* Allocate data and answer. */
-	jsonstrlen = strlen(jsonstr);
-	bcm = malloc(sizeof(struct bfd_control_msg) + jsonstrlen);
-	if (bcm == NULL) {
-		log_warning("%s: malloc: %s\n", __FUNCTION__, strerror(errno));
-		free(jsonstr);
-		return;
+	/* Then to the sockets that subscribed this specific peer. */
+	TAILQ_FOREACH (bnp, &bs->notify_list, bnp_sentry) {
+		if (bnp->bnp_bcs->bcs_notify & BCM_NOTIFY_PEER_STATE)
+			continue;
+
+		if (!control_coalesce_hold(bnp->bnp_bcs, &bne, NULL))
+			_control_notify_event(bnp->bnp_bcs, &bne, bcmr);
 	}
 
-	bcm->bcm_length = htonl(jsonstrlen);
-	bcm->bcm_ver = BMV_VERSION_1;
-	bcm->bcm_type = BMT_NOTIFY;
-	bcm->bcm_id = htons(BCM_NOTIFY_ID);
-	memcpy(bcm->bcm_data, jsonstr, jsonstrlen);
-	free(jsonstr);
+	control_journal_add(&bne, bcmr);
+	_control_notify_release(bcmr);
 
-	control_queue_enqueue(bcs, bcm);
+	return 0;
+}
+
+static void _control_notify_config(struct bfd_control_socket *bcs,
+				   const char *op, bfd_session *bs,
+				   uint64_t seq)
+{
+	struct bfd_notify_event bne = {
+		.bne_seq = seq,
+		.bne_notify = BCM_NOTIFY_CONFIG,
+		.bne_op = op,
+		.bne_bsv = &bs,
+		.bne_bscnt = 1,
+	};
+
+	_control_notify_event(bcs, &bne, NULL);
 }
 
 int control_notify_config(const char *op, bfd_session *bs)
 {
 	struct bfd_control_socket *bcs;
 	struct bfd_notify_peer *bnp;
+	struct bfd_control_msgref *bcmr[CONTROL_NOTIFY_SLOTS] = {NULL};
+	struct bfd_notify_cfg bnc;
+	struct bfd_notify_event bne = {
+		.bne_seq = ++bglobal.bg_nseq,
+		.bne_notify = BCM_NOTIFY_CONFIG,
+		.bne_op = op,
+		.bne_bsv = &bs,
+		.bne_bscnt = 1,
+	};
+	bool update = false, changed = true;
 
-	/* Remove the control sockets notification for this peer. */
-	if (strcmp(op, BCM_NOTIFY_CONFIG_DELETE) == 0 && bs->refcount > 0) {
-		TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
-			bnp = control_notifypeer_find(bcs, bs);
-			if (bnp)
-				control_notifypeer_free(bcs, bnp);
+	if (strcmp(op, BCM_NOTIFY_CONFIG_DELETE) == 0) {
+		bfd_repl_delete(bs);
+
+		/* Remove the control sockets notification for this peer. */
+		if (bs->refcount > 0) {
+			while (!TAILQ_EMPTY(&bs->notify_list)) {
+				bnp = TAILQ_FIRST(&bs->notify_list);
+				control_notifypeer_free(bnp->bnp_bcs, bnp);
+			}
+		}
+
+		control_coalesce_purge(bs);
+	} else {
+		bfd_repl_update(bs);
+
+		/* Remember the notified parameters. */
+		bnc = bs->notify_cfg;
+		control_notify_cfg_get(bs, &bs->notify_cfg);
+		if (strcmp(op, BCM_NOTIFY_CONFIG_UPDATE) == 0) {
+			update = true;
+			changed = memcmp(&bnc, &bs->notify_cfg, sizeof(bnc))
+				  != 0;
 		}
 	}
 
-	/*
-	 * PERFORMANCE: reuse the bfd_control_msg allocated data for
-	 * all control sockets to avoid wasting memory.
-	 */
 	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
 		/*
 		 * Test for all notifications first, then search for
@@ -868,8 +2486,93 @@ int control_notify_config(const char *op, bfd_session *bs)
 			continue;
 		}
 
-		_control_notify_config(bcs, op, bs);
+		/* Coalescing sockets only get updates that change things. */
+		if (update) {
+			if (bcs->bcs_coalesce && !changed) {
+				bcs->bcs_notify_suppressed++;
+				continue;
+			}
+			if (control_coalesce_hold(bcs, &bne, &bnc))
+				continue;
+		}
+
+		_control_notify_event(bcs, &bne, bcmr);
+	}
+
+	control_journal_add(&bne, bcmr);
+	_control_notify_release(bcmr);
+
+	return 0;
+}
+
+/*
+ * Sends a single configuration notification for a group of peers changed
+ * by the same (bulk) request.
+ */
+int control_notify_config_bulk(const char *op, bfd_session **bsv,
+			       size_t bscnt)
+{
+	struct bfd_control_socket *bcs;
+	struct bfd_notify_peer *bnp;
+	struct bfd_control_msgref *bcmr[CONTROL_NOTIFY_SLOTS] = {NULL};
+	struct bfd_notify_cfg bnc;
+	struct bfd_notify_event bne = {
+		.bne_notify = BCM_NOTIFY_CONFIG,
+		.bne_op = op,
+		.bne_bsv = bsv,
+		.bne_bscnt = bscnt,
+		.bne_bulk = true,
+	};
+	bool update, changed = false;
+	size_t idx;
+
+	if (bscnt == 0)
+		return 0;
+
+	bne.bne_seq = ++bglobal.bg_nseq;
+
+	/* Remove the control sockets notification for these peers. */
+	if (strcmp(op, BCM_NOTIFY_CONFIG_DELETE) == 0) {
+		for (idx = 0; idx < bscnt; idx++) {
+			bfd_repl_delete(bsv[idx]);
+
+			while (!TAILQ_EMPTY(&bsv[idx]->notify_list)) {
+				bnp = TAILQ_FIRST(&bsv[idx]->notify_list);
+				control_notifypeer_free(bnp->bnp_bcs, bnp);
+			}
+
+			control_coalesce_purge(bsv[idx]);
+		}
+	} else {
+		/* Remember the notified parameters. */
+		for (idx = 0; idx < bscnt; idx++) {
+			bfd_repl_update(bsv[idx]);
+
+			bnc = bsv[idx]->notify_cfg;
+			control_notify_cfg_get(bsv[idx], &bsv[idx]->notify_cfg);
+			if (memcmp(&bnc, &bsv[idx]->notify_cfg, sizeof(bnc))
+			    != 0)
+				changed = true;
+		}
+	}
+
+	update = (strcmp(op, BCM_NOTIFY_CONFIG_UPDATE) == 0);
+
+	TAILQ_FOREACH (bcs, &bglobal.bg_bcslist, bcs_entry) {
+		if ((bcs->bcs_notify & BCM_NOTIFY_CONFIG) == 0)
+			continue;
+
+		/* Coalescing sockets only get updates that change things. */
+		if (update && !changed && bcs->bcs_coalesce) {
+			bcs->bcs_notify_suppressed++;
+			continue;
+		}
+
+		_control_notify_event(bcs, &bne, bcmr);
 	}
 
+	control_journal_add(&bne, bcmr);
+	_control_notify_release(bcmr);
+
 	return 0;
 }
@@ -0,0 +1,151 @@
+/*
+ * Labelled peers benchmark: times the configuration file load and the
+ * label index (the lookup done for every labelled peer) at 1k, 10k and
+ * 100k peers.
+ *
+ * Every configuration file session has its own socket and source port,
+ * so the file is only loaded with up to `BENCH_SESSIONS` peers: the
+ * larger runs time the label index with sessions that have no socket.
+ */
+
+#include <sys/resource.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+struct bfd_global bglobal;
+
+/* Sessions the source ports range can hold (see bp_peer_socket()). */
+#define BENCH_SESSIONS 10000
+
+static const size_t bench_peers[] = {1000, 10000, 100000};
+#define BENCH_CNT (sizeof(bench_peers) / sizeof(bench_peers[0]))
+
+static double bench_ms(uint64_t start)
+{
+	return (get_monotime_ns() - start) / 1e6;
+}
+
+static void config_write(const char *fname, size_t peers)
+{
+	FILE *fp;
+	size_t idx;
+
+	fp = fopen(fname, "w");
+	if (fp == NULL)
+		err(1, "fopen: %s", fname);
+
+	fprintf(fp, "{\n  \"ipv4\": [\n");
+	for (idx = 0; idx < peers; idx++)
+		fprintf(fp,
+			"    {\"peer-address\": \"127.1.%zu.%zu\", "
+			"\"label\": \"peer-%zu\"}%s\n",
+			idx / 250, idx % 250 + 1, idx,
+			idx + 1 < peers ? "," : "");
+	fprintf(fp, "  ]\n}\n");
+
+	if (fclose(fp) != 0)
+		err(1, "fclose: %s", fname);
+}
+
+static void config_bench(size_t peers)
+{
+	char fname[] = "/tmp/bench_config.XXXXXX";
+	bfd_session *bs, *bstmp;
+	uint64_t start;
+	int fd;
+
+	fd = mkstemp(fname);
+	if (fd == -1)
+		err(1, "mkstemp");
+	close(fd);
+	config_write(fname, peers);
+
+	start = get_monotime_ns();
+	if (parse_config(fname) != 0)
+		errx(1, "%zu peers: configuration load failed", peers);
+	printf("%s: %zu labelled peers loaded in %.1f ms\n", __FILE__,
+	       peers, bench_ms(start));
+
+	if (HASH_CNT(sh, session_hash) != peers
+	    || HASH_CNT(pl_hh, bglobal.bg_plhash) != peers)
+		errx(1, "%u sessions and %u labels, expected %zu",
+		     HASH_CNT(sh, session_hash),
+		     HASH_CNT(pl_hh, bglobal.bg_plhash), peers);
+
+	HASH_ITER (sh, session_hash, bs, bstmp)
+		bfd_session_delete(bs);
+	unlink(fname);
+}
+
+static void label_bench(size_t peers)
+{
+	bfd_session *bsv;
+	char label[MAXNAMELEN];
+	uint64_t start;
+	size_t idx;
+
+	bsv = calloc(peers, sizeof(*bsv));
+	if (bsv == NULL)
+		err(1, "calloc");
+
+	/* A new label is looked up first, like the configuration does. */
+	start = get_monotime_ns();
+	for (idx = 0; idx < peers; idx++) {
+		snprintf(label, sizeof(label), "peer-%zu", idx);
+		if (pl_find(label) != NULL || pl_new(label, &bsv[idx]) == NULL)
+			errx(1, "label %s: insertion failed", label);
+	}
+	for (idx = 0; idx < peers; idx++) {
+		snprintf(label, sizeof(label), "peer-%zu", idx);
+		if (pl_find(label) != bsv[idx].pl)
+			errx(1, "label %s: lookup failed", label);
+	}
+	printf("%s: %zu labels indexed and found in %.1f ms\n",
+	       __FILE__, peers, bench_ms(start));
+
+	for (idx = 0; idx < peers; idx++)
+		pl_free(bsv[idx].pl);
+	free(bsv);
+}
+
+int main(void)
+{
+	struct rlimit rl = {};
+	size_t idx;
+
+	log_init(1, BLOG_ERROR);
+
+	/* One socket per session. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	TAILQ_INIT(&bglobal.bg_bcslist);
+	TAILQ_INIT(&bglobal.bg_ranges);
+	TAILQ_INIT(&bglobal.bg_rconns);
+	bglobal.bg_eb = event_base_new();
+	if (bglobal.bg_eb == NULL)
+		errx(1, "initialization failed");
+
+	for (idx = 0; idx < BENCH_CNT; idx++) {
+		if (bench_peers[idx] <= BENCH_SESSIONS) {
+			if (rl.rlim_cur >= bench_peers[idx] + 64)
+				config_bench(bench_peers[idx]);
+			else
+				printf("%s: %zu peers: not enough file "
+				       "descriptors\n",
+				       __FILE__, bench_peers[idx]);
+		}
+
+		label_bench(bench_peers[idx]);
+	}
+
+	return 0;
+}
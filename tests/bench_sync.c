@@ -0,0 +1,167 @@
+/*
+ * Full state sync benchmark: times how long a control client subscribing
+ * to the configuration notifications takes to receive the state of 50k
+ * sessions (one configuration and one status message each).
+ *
+ * The daemon threads run as usual, the sessions have no socket: they
+ * never transmit during the benchmark.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+/* bfd.c internals. */
+bfd_session *bfd_session_new(int sd);
+void bfd_session_install(bfd_session *bfd, struct bfd_peer_cfg *bpc);
+
+struct bfd_global bglobal;
+
+#define BENCH_SESSIONS 50000
+#define BENCH_BUFSIZE (256 * 1024)
+
+static void sessions_add(size_t count)
+{
+	struct bfd_peer_cfg bpc;
+	bfd_session *bs;
+	char addr[INET6_ADDRSTRLEN];
+	size_t idx;
+
+	/* The sessions index is grown by ptm_bfd_sess_new() otherwise. */
+	bglobal.bg_bsindex = calloc(count, sizeof(*bglobal.bg_bsindex));
+	if (bglobal.bg_bsindex == NULL)
+		err(1, "calloc");
+	bglobal.bg_bsindexsize = count;
+
+	for (idx = 0; idx < count; idx++) {
+		bpc_set_defaults(&bpc);
+		bpc.bpc_ipv4 = true;
+		snprintf(addr, sizeof(addr), "10.%zu.%zu.%zu", idx >> 16,
+			 (idx >> 8) & 0xff, idx & 0xff);
+		if (strtosa(addr, &bpc.bpc_peer) != 0)
+			errx(1, "strtosa: %s", addr);
+		if (profile_to_bpc(&bpc) != 0)
+			errx(1, "profile_to_bpc: %s", addr);
+
+		bs = bfd_session_new(-1);
+		if (bs == NULL)
+			err(1, "bfd_session_new");
+		bfd_session_install(bs, &bpc);
+	}
+}
+
+static void *protocol_thread(void *arg __attribute__((unused)))
+{
+	event_base_dispatch(bglobal.bg_eb);
+
+	return NULL;
+}
+
+/* Reads messages until `count` notifications were received. */
+static void sync_read(int sd, size_t count)
+{
+	struct bfd_control_msg bcm;
+	uint8_t *buf;
+	size_t len = 0, pos, msglen, notifications = 0;
+	ssize_t bread;
+
+	buf = malloc(BENCH_BUFSIZE);
+	if (buf == NULL)
+		err(1, "malloc");
+
+	while (notifications < count) {
+		bread = read(sd, &buf[len], BENCH_BUFSIZE - len);
+		if (bread <= 0)
+			errx(1, "connection closed after %zu notifications",
+			     notifications);
+		len += bread;
+
+		for (pos = 0; len - pos >= sizeof(bcm); pos += msglen) {
+			memcpy(&bcm, &buf[pos], sizeof(bcm));
+			msglen = sizeof(bcm) + ntohl(bcm.bcm_length);
+			if (msglen > BENCH_BUFSIZE)
+				errx(1, "message too big: %zu bytes", msglen);
+			if (msglen > len - pos)
+				break;
+
+			if (bcm.bcm_id == htons(BCM_NOTIFY_ID))
+				notifications++;
+		}
+
+		memmove(buf, &buf[pos], len - pos);
+		len -= pos;
+	}
+
+	free(buf);
+}
+
+int main(void)
+{
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+	};
+	struct {
+		struct bfd_control_msg bcm;
+		uint64_t flags;
+	} __attribute__((packed)) req = {
+		.bcm = {
+			.bcm_length = htonl(sizeof(uint64_t)),
+			.bcm_id = htons(1),
+			.bcm_type = BMT_NOTIFY,
+			.bcm_ver = BMV_VERSION_1,
+		},
+		.flags = BCM_NOTIFY_CONFIG,
+	};
+	pthread_t thread;
+	uint64_t start;
+	int sd;
+
+	log_init(1, BLOG_ERROR);
+
+	TAILQ_INIT(&bglobal.bg_bcslist);
+	TAILQ_INIT(&bglobal.bg_ranges);
+	TAILQ_INIT(&bglobal.bg_rconns);
+	bglobal.bg_cqbytes = BFD_CONTROL_QUEUE_BYTES;
+	bglobal.bg_cqmsgs = BFD_CONTROL_QUEUE_MSGS;
+	bglobal.bg_journal_size = BFD_NOTIFY_JOURNAL;
+	bglobal.bg_csock = -1;
+	bglobal.bg_eb = event_base_new();
+	if (bglobal.bg_eb == NULL)
+		errx(1, "initialization failed");
+
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "/tmp/bench_sync.%d",
+		 getpid());
+	if (control_init(sun.sun_path) != 0)
+		errx(1, "control_init failed");
+
+	sessions_add(BENCH_SESSIONS);
+
+	if (pthread_create(&thread, NULL, protocol_thread, NULL) != 0)
+		errx(1, "pthread_create failed");
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sd == -1)
+		err(1, "socket");
+	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		err(1, "connect: %s", sun.sun_path);
+	unlink(sun.sun_path);
+
+	start = get_monotime_ns();
+	if (write(sd, &req, sizeof(req)) != sizeof(req))
+		err(1, "write");
+	sync_read(sd, 2 * BENCH_SESSIONS);
+	printf("%s: %d sessions synced in %.1f ms\n", __FILE__,
+	       BENCH_SESSIONS, (get_monotime_ns() - start) / 1e6);
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Bulk add test: the new sessions only transmit once they have their
+ * socket, and a session that can't get one is deleted even when a
+ * control socket subscribed to it.
+ */
+
+#include <sys/resource.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bfd.h"
+
+/* control.c internals. */
+struct bfd_notify_peer *control_notifypeer_new(struct bfd_control_socket *bcs,
+					       bfd_session *bs);
+
+struct bfd_global bglobal;
+
+static void peer_set(struct bfd_peer_cfg *bpc, const char *peer)
+{
+	bpc_set_defaults(bpc);
+	bpc->bpc_ipv4 = true;
+	if (strtosa(peer, &bpc->bpc_peer) != 0)
+		errx(1, "strtosa: %s", peer);
+}
+
+int main(void)
+{
+	struct bfd_control_socket bcs;
+	struct bfd_peer_cfg bpcv[2];
+	struct rlimit rl;
+	uint8_t results[1];
+	bfd_session *bs, *bsbad;
+	int fd;
+
+	log_init(1, BLOG_ERROR);
+
+	TAILQ_INIT(&bglobal.bg_bcslist);
+	TAILQ_INIT(&bglobal.bg_ranges);
+	TAILQ_INIT(&bglobal.bg_rconns);
+	TAILQ_INIT(&bglobal.bg_sockq);
+	bglobal.bg_eb = event_base_new();
+	if (bglobal.bg_eb == NULL)
+		errx(1, "initialization failed");
+	evtimer_assign(&bglobal.bg_sockev, bglobal.bg_eb, bfd_socket_cb, NULL);
+
+	peer_set(&bpcv[0], "127.0.0.1");
+	if (ptm_bfd_sess_bulk_new(&bpcv[0], 1, results) != 0)
+		errx(1, "bulk add failed: %u", results[0]);
+
+	bs = bs_peer_find(&bpcv[0]);
+	if (bs == NULL)
+		errx(1, "session not created");
+	if (bs->sock != -1 || evtimer_pending(&bs->xmttimer_ev, NULL))
+		errx(1, "session transmitting without its socket");
+
+	event_base_loop(bglobal.bg_eb, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+	if (bs->sock == -1 || bs->sock_pending
+	    || !evtimer_pending(&bs->xmttimer_ev, NULL))
+		errx(1, "session not started with its socket");
+
+	/* The next session can't get a socket: no descriptors left. */
+	peer_set(&bpcv[1], "127.0.0.2");
+	if (ptm_bfd_sess_bulk_new(&bpcv[1], 1, results) != 0)
+		errx(1, "bulk add failed: %u", results[0]);
+
+	bsbad = bs_peer_find(&bpcv[1]);
+	if (bsbad == NULL)
+		errx(1, "session not created");
+
+	/* Subscribed between the batch and the socket setup. */
+	memset(&bcs, 0, sizeof(bcs));
+	if (control_notifypeer_new(&bcs, bsbad) == NULL)
+		errx(1, "subscription failed");
+
+	fd = dup(0);
+	if (fd == -1)
+		err(1, "dup");
+	close(fd);
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		err(1, "getrlimit");
+	rl.rlim_cur = fd;
+	if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+		err(1, "setrlimit");
+
+	event_base_loop(bglobal.bg_eb, EVLOOP_ONCE | EVLOOP_NONBLOCK);
+
+	if (bs_peer_find(&bpcv[1]) != NULL || HASH_CNT(sh, session_hash) != 1)
+		errx(1, "session without a socket was kept");
+	if (bcs.bcs_bnphash != NULL)
+		errx(1, "subscription was kept");
+
+	printf("%s: ok\n", __FILE__);
+
+	return 0;
+}
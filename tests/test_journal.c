@@ -0,0 +1,287 @@
+/*
+ * Notifications journal test: a client resuming from a sequence number
+ * must get the events it missed as they were, not the current session.
+ *
+ * The session goes DOWN -> UP -> DOWN -> UP -> DOWN, is deleted and its
+ * discriminator is reused by another peer before the client replays the
+ * journal in both protocol versions. The messages built by the first
+ * replay are kept in the journal: a second client replays them again.
+ */
+
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+#include "bfd.h"
+
+/* control.c internals. */
+int control_journal_init(void);
+bool control_journal_check(struct bfd_control_socket *bcs, uint64_t seq);
+void control_journal_replay(struct bfd_control_socket *bcs, uint64_t seq);
+int control_mbox_init(struct bfd_mbox *bmb, struct event_base *eb,
+		      event_callback_fn cb);
+struct bfd_mbox_entry *control_mbox_take(struct bfd_mbox *bmb);
+
+struct bfd_global bglobal;
+
+/* Expected journal events. */
+struct journal_event {
+	const char *je_op;
+	const char *je_peer;
+	/* enum bfd_peer_status for status notifications. */
+	int je_state;
+	uint8_t je_diag;
+};
+
+static const struct journal_event events[] = {
+	{"status", "127.0.0.1", BPS_UP, 0},
+	{"status", "127.0.0.1", BPS_DOWN, BFD_DIAGDETECTTIME},
+	{"status", "127.0.0.1", BPS_UP, 0},
+	{"status", "127.0.0.1", BPS_DOWN, BFD_DIAGNEIGHDOWN},
+	{BCM_NOTIFY_CONFIG_DELETE, "127.0.0.1", -1, 0},
+	/* Sessions created with a discriminator notify their state. */
+	{"status", "127.0.0.2", BPS_DOWN, 0},
+	{BCM_NOTIFY_CONFIG_ADD, "127.0.0.2", -1, 0},
+	{"status", "127.0.0.2", BPS_UP, 0},
+};
+#define EVENTS_CNT (sizeof(events) / sizeof(events[0]))
+
+static const char *state_str[] = {
+	[BPS_SHUTDOWN] = "adm-down",
+	[BPS_DOWN] = "down",
+	[BPS_INIT] = "init",
+	[BPS_UP] = "up",
+};
+
+static void noop_cb(evutil_socket_t sd __attribute__((unused)),
+		    short ev __attribute__((unused)),
+		    void *arg __attribute__((unused)))
+{
+}
+
+static bfd_session *session_add(const char *peer, uint32_t discr)
+{
+	struct bfd_peer_cfg bpc;
+	bfd_session *bs;
+
+	bpc_set_defaults(&bpc);
+	bpc.bpc_ipv4 = true;
+	if (strtosa(peer, &bpc.bpc_peer) != 0)
+		errx(1, "strtosa: %s", peer);
+	if (discr != 0) {
+		bpc.bpc_has_discr = true;
+		bpc.bpc_discr = discr;
+	}
+
+	bs = ptm_bfd_sess_new(&bpc);
+	if (bs == NULL)
+		errx(1, "ptm_bfd_sess_new: %s", peer);
+
+	return bs;
+}
+
+static void session_del(const char *peer)
+{
+	struct bfd_peer_cfg bpc;
+
+	bpc_set_defaults(&bpc);
+	bpc.bpc_ipv4 = true;
+	strtosa(peer, &bpc.bpc_peer);
+	if (ptm_bfd_ses_del(&bpc) != 0)
+		errx(1, "ptm_bfd_ses_del: %s", peer);
+}
+
+static void check_json(const struct bfd_control_msg *bcm,
+		       const struct journal_event *je, uint64_t seq)
+{
+	struct json_tokener *jt;
+	struct json_object *jo, *jv;
+
+	jt = json_tokener_new();
+	jo = json_tokener_parse_ex(jt, (const char *)bcm->bcm_data,
+				   ntohl(bcm->bcm_length));
+	json_tokener_free(jt);
+	if (jo == NULL)
+		errx(1, "seq %" PRIu64 ": invalid JSON", seq);
+
+	if (!json_object_object_get_ex(jo, "seq", &jv)
+	    || (uint64_t)json_object_get_int64(jv) != seq)
+		errx(1, "seq %" PRIu64 ": wrong sequence number", seq);
+	if (!json_object_object_get_ex(jo, "op", &jv)
+	    || strcmp(json_object_get_string(jv), je->je_op) != 0)
+		errx(1, "seq %" PRIu64 ": op is not '%s'", seq, je->je_op);
+	if (!json_object_object_get_ex(jo, "peer-address", &jv)
+	    || strcmp(json_object_get_string(jv), je->je_peer) != 0)
+		errx(1, "seq %" PRIu64 ": peer is not '%s'", seq, je->je_peer);
+
+	if (je->je_state != -1) {
+		if (!json_object_object_get_ex(jo, "state", &jv)
+		    || strcmp(json_object_get_string(jv),
+			      state_str[je->je_state])
+			       != 0)
+			errx(1, "seq %" PRIu64 ": state is not '%s'", seq,
+			     state_str[je->je_state]);
+		if (!json_object_object_get_ex(jo, "diagnostics", &jv)
+		    || json_object_get_int(jv) != je->je_diag)
+			errx(1, "seq %" PRIu64 ": diagnostics is not %d", seq,
+			     je->je_diag);
+	}
+
+	json_object_put(jo);
+}
+
+static void check_binary(const struct bfd_control_msg *bcm,
+			 const struct journal_event *je, uint64_t seq)
+{
+	const struct bfd_control_tlv *bct;
+	struct bfd_control_peer bcp;
+	struct bfd_control_peer_state bcps;
+	struct bfd_control_peer_config bcpc;
+	const uint8_t *buf = bcm->bcm_data;
+	size_t left = ntohl(bcm->bcm_length);
+	uint64_t bseq = 0;
+	bool has_peer = false, has_state = false, has_config = false;
+	char peer[INET_ADDRSTRLEN];
+
+	while (left >= sizeof(*bct)) {
+		bct = (const struct bfd_control_tlv *)buf;
+		if (BCT_TOTLEN(ntohs(bct->bct_length)) > left)
+			errx(1, "seq %" PRIu64 ": truncated TLV", seq);
+
+		switch (ntohs(bct->bct_type)) {
+		case BCT_SEQ:
+			memcpy(&bseq, bct->bct_value, sizeof(bseq));
+			break;
+		case BCT_PEER:
+			memcpy(&bcp, bct->bct_value, sizeof(bcp));
+			has_peer = true;
+			break;
+		case BCT_PEER_STATE:
+			memcpy(&bcps, bct->bct_value, sizeof(bcps));
+			has_state = true;
+			break;
+		case BCT_PEER_CONFIG:
+			memcpy(&bcpc, bct->bct_value, sizeof(bcpc));
+			has_config = true;
+			break;
+		}
+
+		left -= BCT_TOTLEN(ntohs(bct->bct_length));
+		buf += BCT_TOTLEN(ntohs(bct->bct_length));
+	}
+
+	if (be64toh(bseq) != seq)
+		errx(1, "seq %" PRIu64 ": wrong sequence number", seq);
+	if (!has_peer)
+		errx(1, "seq %" PRIu64 ": no peer", seq);
+	inet_ntop(AF_INET, bcp.bcp_peer, peer, sizeof(peer));
+	if (strcmp(peer, je->je_peer) != 0)
+		errx(1, "seq %" PRIu64 ": peer is not '%s'", seq, je->je_peer);
+
+	if (je->je_state == -1) {
+		if (!has_config
+		    || bcpc.bcpc_op
+			       != (strcmp(je->je_op, BCM_NOTIFY_CONFIG_ADD) == 0
+					   ? BCO_ADD
+					   : BCO_DELETE))
+			errx(1, "seq %" PRIu64 ": op is not '%s'", seq,
+			     je->je_op);
+		return;
+	}
+
+	if (!has_state || bcps.bcps_state != je->je_state)
+		errx(1, "seq %" PRIu64 ": state is not '%s'", seq,
+		     state_str[je->je_state]);
+	if (bcps.bcps_diag != je->je_diag)
+		errx(1, "seq %" PRIu64 ": diagnostics is not %d", seq,
+		     je->je_diag);
+}
+
+static void replay(enum bc_msg_version bmv, uint64_t seq)
+{
+	struct bfd_control_socket bcs;
+	struct bfd_mbox_entry *bme, *bmenext;
+	struct bfd_control_queue *bcq;
+	size_t cnt = 0;
+
+	memset(&bcs, 0, sizeof(bcs));
+	bcs.bcs_version = bmv;
+	bcs.bcs_notify = BCM_NOTIFY_PEER_STATE | BCM_NOTIFY_CONFIG;
+
+	if (!control_journal_check(&bcs, seq))
+		errx(1, "version %d: journal can't resume", bmv);
+
+	control_journal_replay(&bcs, seq);
+
+	for (bme = control_mbox_take(&bglobal.bg_outq); bme != NULL;
+	     bme = bmenext) {
+		bmenext = bme->bme_next;
+		bcq = (struct bfd_control_queue *)bme;
+		if (cnt >= EVENTS_CNT)
+			errx(1, "version %d: too many messages", bmv);
+
+		if (bmv == BMV_VERSION_2)
+			check_binary(bcq->bcq_bcmr->bcmr_bcm, &events[cnt],
+				     seq + 1 + cnt);
+		else
+			check_json(bcq->bcq_bcmr->bcmr_bcm, &events[cnt],
+				   seq + 1 + cnt);
+
+		control_msgref_unref(bcq->bcq_bcmr);
+		free(bcq);
+		cnt++;
+	}
+
+	if (cnt != EVENTS_CNT)
+		errx(1, "version %d: %zu messages replayed, expected %zu", bmv,
+		     cnt, EVENTS_CNT);
+}
+
+int main(void)
+{
+	bfd_session *bs;
+	uint32_t discr;
+	uint64_t seq;
+
+	log_init(1, BLOG_ERROR);
+
+	TAILQ_INIT(&bglobal.bg_bcslist);
+	bglobal.bg_journal_size = 64;
+	bglobal.bg_eb = event_base_new();
+	if (bglobal.bg_eb == NULL || control_journal_init() != 0
+	    || control_mbox_init(&bglobal.bg_outq, bglobal.bg_eb, noop_cb)
+		       != 0)
+		errx(1, "initialization failed");
+
+	bs = session_add("127.0.0.1", 0);
+	discr = bs->discrs.my_discr;
+	seq = bglobal.bg_nseq;
+
+	ptm_bfd_ses_up(bs);
+	ptm_bfd_ses_dn(bs, BFD_DIAGDETECTTIME);
+	ptm_bfd_ses_up(bs);
+	ptm_bfd_ses_dn(bs, BFD_DIAGNEIGHDOWN);
+	session_del("127.0.0.1");
+
+	/* Another peer gets the same discriminator. */
+	bs = session_add("127.0.0.2", discr);
+	ptm_bfd_ses_up(bs);
+
+	if (bglobal.bg_nseq - seq != EVENTS_CNT)
+		errx(1, "%" PRIu64 " events journaled, expected %zu",
+		     bglobal.bg_nseq - seq, EVENTS_CNT);
+
+	replay(BMV_VERSION_1, seq);
+	replay(BMV_VERSION_2, seq);
+	replay(BMV_VERSION_1, seq);
+	replay(BMV_VERSION_2, seq);
+
+	printf("%s: ok\n", __FILE__);
+
+	return 0;
+}
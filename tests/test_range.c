@@ -0,0 +1,93 @@
+/*
+ * Peer ranges test: a range only creates up to `max-sessions` sessions
+ * and the ones that stay down for `down-timeout` are deleted, making
+ * room for new peers.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bfd.h"
+
+/* bfd_range.c internals. */
+void range_reap_cb(evutil_socket_t sd, short ev, void *arg);
+
+struct bfd_global bglobal;
+
+#define RANGE_MAX 8
+
+static bfd_session *peer_new(int idx)
+{
+	struct sockaddr_any peer;
+	char addr[INET6_ADDRSTRLEN];
+
+	snprintf(addr, sizeof(addr), "127.10.0.%d", idx + 1);
+	if (strtosa(addr, &peer) != 0)
+		errx(1, "strtosa: %s", addr);
+
+	return range_session_new(NULL, &peer, NULL, NULL, false);
+}
+
+int main(void)
+{
+	struct bfd_peer_range *bpr;
+	bfd_session *bs, *up;
+	int idx;
+
+	log_init(1, BLOG_ERROR);
+
+	TAILQ_INIT(&bglobal.bg_bcslist);
+	TAILQ_INIT(&bglobal.bg_ranges);
+	TAILQ_INIT(&bglobal.bg_rconns);
+	bglobal.bg_eb = event_base_new();
+	if (bglobal.bg_eb == NULL)
+		errx(1, "initialization failed");
+
+	bpr = calloc(1, sizeof(*bpr));
+	if (bpr == NULL)
+		err(1, "calloc");
+	TAILQ_INIT(&bpr->bpr_sessions);
+	bpr->bpr_maxsessions = RANGE_MAX;
+	bpr->bpr_downtimeout = 60;
+	bpc_set_defaults(&bpr->bpr_bpc);
+	bpr->bpr_bpc.bpc_ipv4 = true;
+	if (parse_peer_range("127.10.0.0/24", AF_INET, &bpr->bpr_first,
+			     &bpr->bpr_last)
+	    != 0)
+		errx(1, "parse_peer_range");
+	TAILQ_INSERT_TAIL(&bglobal.bg_ranges, bpr, bpr_entry);
+
+	/* A scan of the range: only the first peers get a session. */
+	for (idx = 0; idx < 4 * RANGE_MAX; idx++)
+		peer_new(idx);
+	if (bpr->bpr_sessioncnt != RANGE_MAX)
+		errx(1, "%u range sessions, expected %d", bpr->bpr_sessioncnt,
+		     RANGE_MAX);
+	if (HASH_CNT(sh, session_hash) != RANGE_MAX)
+		errx(1, "%u sessions, expected %d", HASH_CNT(sh, session_hash),
+		     RANGE_MAX);
+
+	/* Down for too long, but one session came up. */
+	up = TAILQ_FIRST(&bpr->bpr_sessions);
+	ptm_bfd_ses_up(up);
+	TAILQ_FOREACH (bs, &bpr->bpr_sessions, range_entry)
+		bs->downtime.tv_sec -= bpr->bpr_downtimeout;
+	range_reap_cb(-1, 0, NULL);
+	if (bpr->bpr_sessioncnt != 1 || TAILQ_FIRST(&bpr->bpr_sessions) != up)
+		errx(1, "%u range sessions left, expected the up one",
+		     bpr->bpr_sessioncnt);
+
+	/* The reaped sessions made room for new peers. */
+	if (peer_new(4 * RANGE_MAX) == NULL)
+		errx(1, "no session for a new peer");
+
+	/* Deleted sessions leave the range. */
+	if (bfd_session_delete(up) != 0 || bpr->bpr_sessioncnt != 1)
+		errx(1, "%u range sessions, expected 1", bpr->bpr_sessioncnt);
+
+	printf("%s: ok\n", __FILE__);
+
+	return 0;
+}
@@ -106,3 +106,14 @@ time_t get_monotime(struct timeval *tv)
 
 	return ts.tv_sec;
 }
+
+/* CLOCK_MONOTONIC in nanoseconds. */
+uint64_t get_monotime_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}